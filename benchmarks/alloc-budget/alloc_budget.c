@@ -0,0 +1,297 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+// Counts the heap allocations and bytes per message on the publish and C2D paths and fails if a path
+// exceeds its budget. The SDK is initialized from a cached identity and MQTT goes through the loopback transport,
+// so the numbers cover the SDK, iotc-c-lib and cJSON, but not the MQTT client itself.
+// Only allocations made by the measuring thread are counted, after a warm-up that lets lazy initialization happen.
+
+#define _DEFAULT_SOURCE // getopt()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "iotcl.h"
+#include "iotconnect.h"
+#include "iotc_device_client.h"
+#include "iotc_telemetry_writer.h"
+#include "iotc_loopback_transport.h"
+#include "bench_alloc.h"
+
+#define WARMUP_MESSAGES 16
+
+typedef enum {
+    PATH_LOOPBACK_SEND = 0,
+    PATH_TELEMETRY,
+    PATH_WRITER,
+    PATH_COMMAND,
+    PATH_COUNT
+} MeasuredPath;
+
+typedef struct {
+    const char *name;
+    const char *description;
+    bool is_checked; // has a budget
+    double max_allocations; // per message
+    double max_bytes; // per message, negative to not check
+} PathBudget;
+
+// The defaults: sending a prepared message and sending from the telemetry writer must not allocate.
+// The cJSON based paths get about twice the allocations that their cJSON trees need, so that a regression that
+// adds a copy of the message or a node per field is caught, while cJSON's own print buffer growth is not.
+// "loopback-send" only covers the SDK dispatch, as the loopback transport does not allocate. Paho and the lite
+// client allocate per publish on their own and are not measured here.
+static PathBudget budgets[PATH_COUNT] = {
+        {"loopback-send", "iotc_device_client_send_message_qos() on the loopback transport", true, 0, 0},
+        {"telemetry", "iotcl_telemetry_create() to iotcl_telemetry_destroy()", true, 64, 8192},
+        {"writer", "iotconnect_sdk_send_telemetry_writer()", true, 0, 0},
+        {"command", "C2D command with acknowledgement", true, 96, 16384},
+};
+
+static unsigned long commands = 0;
+static char telemetry_topic[256];
+
+static void on_command(IotclC2dEventData data) {
+    const char *ack_id = iotcl_c2d_get_ack_id(data);
+    commands++;
+    if (ack_id) {
+        iotcl_mqtt_send_cmd_ack(ack_id, IOTCL_C2D_EVT_CMD_SUCCESS_WITH_ACK, "OK");
+    }
+}
+
+static void send_prepared(unsigned long i) {
+    (void) i;
+    iotc_device_client_send_message_qos(telemetry_topic, "{\"d\":[{\"d\":{\"temperature\":21.5,\"counter\":1}}]}", 1);
+}
+
+static void send_telemetry(unsigned long i) {
+    IotclMessageHandle msg = iotcl_telemetry_create();
+    iotcl_telemetry_set_string(msg, "version", "1.0.0");
+    iotcl_telemetry_set_number(msg, "counter", (double) i);
+    iotcl_telemetry_set_number(msg, "temperature", 20.0 + (double) (i % 100) / 10.0);
+    iotcl_telemetry_set_bool(msg, "active", 0 == i % 2);
+    iotcl_telemetry_set_number(msg, "coordinate.x", (double) (i % 7));
+    iotcl_telemetry_set_number(msg, "coordinate.y", (double) (i % 11));
+    iotcl_mqtt_send_telemetry(msg, false);
+    iotcl_telemetry_destroy(msg);
+}
+
+static char writer_buffer[512];
+static IotConnectTelemetryWriter writer;
+static int writer_slots[6];
+
+static int setup_writer(void) {
+    iotc_telemetry_writer_init(&writer, writer_buffer, sizeof(writer_buffer));
+    writer_slots[0] = iotc_telemetry_writer_add_field(&writer, "version", IOTC_TFT_STRING);
+    writer_slots[1] = iotc_telemetry_writer_add_field(&writer, "counter", IOTC_TFT_NUMBER);
+    writer_slots[2] = iotc_telemetry_writer_add_field(&writer, "temperature", IOTC_TFT_NUMBER);
+    writer_slots[3] = iotc_telemetry_writer_add_field(&writer, "active", IOTC_TFT_BOOLEAN);
+    writer_slots[4] = iotc_telemetry_writer_add_field(&writer, "coordinate.x", IOTC_TFT_NUMBER);
+    writer_slots[5] = iotc_telemetry_writer_add_field(&writer, "coordinate.y", IOTC_TFT_NUMBER);
+    for (size_t i = 0; i < sizeof(writer_slots) / sizeof(writer_slots[0]); i++) {
+        if (writer_slots[i] < 0) {
+            return writer_slots[i];
+        }
+    }
+    return iotc_telemetry_writer_compile(&writer);
+}
+
+static void send_writer(unsigned long i) {
+    iotc_telemetry_writer_set_string(&writer, writer_slots[0], "1.0.0");
+    iotc_telemetry_writer_set_number(&writer, writer_slots[1], (double) i);
+    iotc_telemetry_writer_set_number(&writer, writer_slots[2], 20.0 + (double) (i % 100) / 10.0);
+    iotc_telemetry_writer_set_bool(&writer, writer_slots[3], 0 == i % 2);
+    iotc_telemetry_writer_set_number(&writer, writer_slots[4], (double) (i % 7));
+    iotc_telemetry_writer_set_number(&writer, writer_slots[5], (double) (i % 11));
+    iotconnect_sdk_send_telemetry_writer(&writer);
+}
+
+static void inject_command(unsigned long i) {
+    char command[128];
+    // a new ack ID every time, so that duplicate suppression does not drop it
+    int len = snprintf(command, sizeof(command),
+                       "{\"v\":\"2.1\",\"ct\":0,\"cmd\":\"set-parameter %lu\",\"ack\":\"ack-%lu\"}", i, i);
+    iotc_loopback_inject_c2d((const unsigned char *) command, (size_t) len);
+}
+
+typedef void (*PathFunction)(unsigned long i);
+
+static const PathFunction path_functions[PATH_COUNT] = {send_prepared, send_telemetry, send_writer, inject_command};
+
+static void measure(MeasuredPath path, unsigned long count, BenchAllocStats *a) {
+    static unsigned long sequence = 0; // keeps command ack IDs unique across paths
+    for (unsigned long i = 0; i < WARMUP_MESSAGES; i++) {
+        path_functions[path](sequence++);
+    }
+    bench_alloc_start(true);
+    for (unsigned long i = 0; i < count; i++) {
+        path_functions[path](sequence++);
+    }
+    bench_alloc_stop();
+    bench_alloc_get(a);
+}
+
+// Parses "path=allocations[:bytes]"
+static bool parse_budget(const char *arg) {
+    const char *value = strchr(arg, '=');
+    if (!value) {
+        return false;
+    }
+    size_t name_len = (size_t) (value - arg);
+    for (int i = 0; i < PATH_COUNT; i++) {
+        if (strlen(budgets[i].name) != name_len || 0 != strncmp(arg, budgets[i].name, name_len)) {
+            continue;
+        }
+        char *end;
+        budgets[i].max_allocations = strtod(value + 1, &end);
+        budgets[i].max_bytes = -1;
+        if (':' == *end) {
+            budgets[i].max_bytes = strtod(end + 1, &end);
+        }
+        budgets[i].is_checked = true;
+        return end != value + 1 && 0 == *end;
+    }
+    return false;
+}
+
+static void print_usage(const char *name) {
+    printf("Usage: %s -i identity.json [-n messages] [-b path=allocations[:bytes]]... [-u path]...\n", name);
+    printf("  -i  identity response to use as the cached identity\n");
+    printf("  -n  number of messages measured on each path (default 1000)\n");
+    printf("  -b  budget per message for a path. Can be repeated.\n");
+    printf("  -u  only report a path without checking its budget. Can be repeated.\n");
+    printf("Paths:\n");
+    for (int i = 0; i < PATH_COUNT; i++) {
+        printf("  %-14s %s\n", budgets[i].name, budgets[i].description);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *identity_path = NULL;
+    unsigned long message_count = 1000;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:n:b:u:h")) != -1) {
+        switch (opt) {
+            case 'i':
+                identity_path = optarg;
+                break;
+            case 'n':
+                message_count = strtoul(optarg, NULL, 10);
+                break;
+            case 'b':
+                if (!parse_budget(optarg)) {
+                    printf("Invalid budget: %s\n", optarg);
+                    print_usage(argv[0]);
+                    return 2;
+                }
+                break;
+            case 'u': {
+                bool is_found = false;
+                for (int i = 0; i < PATH_COUNT; i++) {
+                    if (0 == strcmp(optarg, budgets[i].name)) {
+                        budgets[i].is_checked = false;
+                        is_found = true;
+                    }
+                }
+                if (!is_found) {
+                    printf("Unknown path: %s\n", optarg);
+                    return 2;
+                }
+                break;
+            }
+            default:
+                print_usage(argv[0]);
+                return 2;
+        }
+    }
+    if (!identity_path || 0 == message_count) {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    IotConnectClientConfig config;
+    iotconnect_sdk_init_config(&config);
+    config.cpid = "BENCHCPID";
+    config.env = "bench";
+    config.duid = "benchdevice";
+    config.connection_type = IOTC_CT_AWS;
+    config.auth_info.type = IOTC_AT_X509;
+    config.auth_info.trust_store = "unused-ca.pem";
+    config.auth_info.data.cert_info.device_cert = "unused-crt.pem";
+    config.auth_info.data.cert_info.device_key = "unused-key.pem";
+    config.cmd_cb = on_command;
+    config.identity_cache_path = identity_path;
+    config.transport = iotc_loopback_transport();
+
+    int ret = iotconnect_sdk_init(&config);
+    if (ret) {
+        printf("iotconnect_sdk_init() failed with %d\n", ret);
+        return 2;
+    }
+    ret = iotconnect_sdk_connect();
+    if (ret) {
+        printf("iotconnect_sdk_connect() failed with %d\n", ret);
+        return 2;
+    }
+    IotclMqttConfig *mc = iotcl_mqtt_get_config();
+    if (!mc || !mc->pub_rpt || strlen(mc->pub_rpt) >= sizeof(telemetry_topic)) {
+        printf("No telemetry topic in the identity\n");
+        return 2;
+    }
+    strcpy(telemetry_topic, mc->pub_rpt);
+    if (setup_writer()) {
+        printf("Unable to set up the telemetry writer\n");
+        return 2;
+    }
+
+    BenchAllocStats results[PATH_COUNT];
+    IotConnectLoopbackStats before;
+    IotConnectLoopbackStats after;
+    iotc_loopback_get_stats(&before);
+    for (int i = 0; i < PATH_COUNT; i++) {
+        measure((MeasuredPath) i, message_count, &results[i]);
+    }
+    iotc_loopback_get_stats(&after);
+    iotconnect_sdk_disconnect();
+    iotconnect_sdk_deinit();
+
+    if (!bench_alloc_is_supported()) {
+        printf("Allocations cannot be counted on this platform (needs glibc). Nothing was checked.\n");
+        return 0;
+    }
+    // every path publishes once per message: the message itself or the command acknowledgement
+    unsigned long expected = PATH_COUNT * (message_count + WARMUP_MESSAGES);
+    if (after.publishes - before.publishes != expected || commands != message_count + WARMUP_MESSAGES) {
+        printf("Expected %lu publishes and %lu commands, got %llu and %lu\n", expected, message_count + WARMUP_MESSAGES,
+               (unsigned long long) (after.publishes - before.publishes), commands);
+        return 2;
+    }
+
+    bool is_over_budget = false;
+    printf("%-14s %12s %12s %12s %12s\n", "path", "allocs/msg", "bytes/msg", "max allocs", "max bytes");
+    for (int i = 0; i < PATH_COUNT; i++) {
+        const PathBudget *b = &budgets[i];
+        double allocations = (double) results[i].allocations / (double) message_count;
+        double bytes = (double) results[i].bytes / (double) message_count;
+        char max_allocations[32] = "-";
+        char max_bytes[32] = "-";
+        const char *status = "";
+        if (b->is_checked) {
+            snprintf(max_allocations, sizeof(max_allocations), "%.2f", b->max_allocations);
+            if (b->max_bytes >= 0) {
+                snprintf(max_bytes, sizeof(max_bytes), "%.1f", b->max_bytes);
+            }
+            if (allocations > b->max_allocations || (b->max_bytes >= 0 && bytes > b->max_bytes)) {
+                status = "OVER BUDGET";
+                is_over_budget = true;
+            }
+        }
+        printf("%-14s %12.2f %12.1f %12s %12s %s\n", b->name, allocations, bytes, max_allocations, max_bytes, status);
+    }
+    printf("(%lu messages per path after %d warm-up messages)\n", message_count, WARMUP_MESSAGES);
+    return is_over_budget ? 1 : 0;
+}
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+# Copyright (C) 2020-2024 Avnet
+# Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+
+"""Local stand-in for a backfill upload endpoint.
+
+Accepts POSTed batches of newline delimited JSON, optionally gzip compressed, checks that every line is valid JSON
+and prints totals. Use --fail-every to reject some requests and exercise the SDK retry path.
+"""
+
+import argparse
+import gzip
+import json
+import threading
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+totals = {"requests": 0, "batches": 0, "messages": 0, "body_bytes": 0, "raw_bytes": 0, "errors": 0}
+totals_lock = threading.Lock()
+
+
+class BackfillHandler(BaseHTTPRequestHandler):
+    fail_every = 0
+
+    def do_POST(self):
+        body = self.rfile.read(int(self.headers.get("Content-Length", "0")))
+        with totals_lock:
+            totals["requests"] += 1
+            request_number = totals["requests"]
+        if self.fail_every and request_number % self.fail_every == 0:
+            self.send_response(503)
+            self.end_headers()
+            return
+
+        try:
+            raw = gzip.decompress(body) if self.headers.get("Content-Encoding") == "gzip" else body
+            lines = raw.decode("utf-8").splitlines()
+            for line in lines:
+                json.loads(line)
+        except (OSError, UnicodeDecodeError, ValueError) as ex:
+            with totals_lock:
+                totals["errors"] += 1
+            print("Rejected a batch: %s" % ex)
+            self.send_response(400)
+            self.end_headers()
+            return
+
+        with totals_lock:
+            totals["batches"] += 1
+            totals["messages"] += len(lines)
+            totals["body_bytes"] += len(body)
+            totals["raw_bytes"] += len(raw)
+            print("batch %d: %d messages, %d bytes (%d uncompressed). Total %d messages."
+                  % (totals["batches"], len(lines), len(body), len(raw), totals["messages"]))
+        self.send_response(204)
+        self.end_headers()
+
+    def log_message(self, format, *args):
+        pass  # printing every request would slow down the test
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--fail-every", type=int, default=0, help="respond with 503 to every Nth request")
+    args = parser.parse_args()
+    BackfillHandler.fail_every = args.fail_every
+    server = ThreadingHTTPServer(("127.0.0.1", args.port), BackfillHandler)
+    print("Listening on http://127.0.0.1:%d/" % args.port)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    print(totals)
+
+
+if __name__ == "__main__":
+    main()
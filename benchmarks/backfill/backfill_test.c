@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+// Spools a simulated outage worth of telemetry and uploads it with the SDK backfill module.
+// Run backfill_server.py first, or point -u to any endpoint that accepts the batches.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "iotc_clock.h"
+#include "iotc_backfill.h"
+#include "iotc_telemetry_writer.h"
+
+typedef struct {
+    unsigned long count;
+    const char *url;
+    const char *spool_path;
+    size_t batch_bytes;
+    bool compress;
+} BackfillOptions;
+
+static void print_usage(const char *name) {
+    printf("Usage: %s [-n messages] [-u url] [-s spool] [-b batch_bytes] [-r]\n", name);
+    printf("  -n  messages to spool (default 360000, an hour at 100 Hz)\n");
+    printf("  -u  upload URL (default http://127.0.0.1:8080/backfill)\n");
+    printf("  -s  spool file (default /tmp/iotc-backfill-test.ndjson)\n");
+    printf("  -b  uncompressed bytes per upload (default %d)\n", IOTC_BACKFILL_DEFAULT_BATCH_BYTES);
+    printf("  -r  send raw (uncompressed) batches\n");
+}
+
+static int parse_options(int argc, char *argv[], BackfillOptions *o) {
+    int opt;
+    o->count = 360000;
+    o->url = "http://127.0.0.1:8080/backfill";
+    o->spool_path = "/tmp/iotc-backfill-test.ndjson";
+    o->batch_bytes = IOTC_BACKFILL_DEFAULT_BATCH_BYTES;
+    o->compress = true;
+    while ((opt = getopt(argc, argv, "n:u:s:b:rh")) != -1) {
+        switch (opt) {
+            case 'n':
+                o->count = strtoul(optarg, NULL, 10);
+                break;
+            case 'u':
+                o->url = optarg;
+                break;
+            case 's':
+                o->spool_path = optarg;
+                break;
+            case 'b':
+                o->batch_bytes = (size_t) strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                o->compress = false;
+                break;
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+    if (0 == o->count || 0 == o->batch_bytes) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    BackfillOptions o;
+    if (parse_options(argc, argv, &o)) {
+        return 1;
+    }
+
+    IotConnectBackfillConfig config;
+    iotc_backfill_init_config(&config);
+    config.spool_path = o.spool_path;
+    config.upload_url = o.url;
+    config.batch_bytes = o.batch_bytes;
+    config.compress = o.compress;
+    config.max_spool_bytes = (size_t) 1024 * 1024 * 1024;
+    if (iotc_backfill_init(&config)) {
+        return 2;
+    }
+
+    static char buffer[512];
+    static IotConnectTelemetryWriter w;
+    iotc_telemetry_writer_init(&w, buffer, sizeof(buffer));
+    w.include_timestamp = true;
+    int temperature = iotc_telemetry_writer_add_field(&w, "temperature", IOTC_TFT_NUMBER);
+    int current = iotc_telemetry_writer_add_field(&w, "current", IOTC_TFT_NUMBER);
+    int x = iotc_telemetry_writer_add_field(&w, "vibration.x", IOTC_TFT_NUMBER);
+    int y = iotc_telemetry_writer_add_field(&w, "vibration.y", IOTC_TFT_NUMBER);
+    int state = iotc_telemetry_writer_add_field(&w, "state", IOTC_TFT_STRING);
+    iotc_telemetry_writer_set_precision(&w, temperature, 2);
+    iotc_telemetry_writer_set_precision(&w, current, 3);
+    if (iotc_telemetry_writer_compile(&w)) {
+        return 2;
+    }
+
+    srand(1234);
+    uint64_t start_us = iotc_clock_now_us();
+    for (unsigned long i = 0; i < o.count; i++) {
+        iotc_telemetry_writer_set_number(&w, temperature, 20.0 + (double) rand() / RAND_MAX * 5.0);
+        iotc_telemetry_writer_set_number(&w, current, 4.0 + (double) rand() / RAND_MAX);
+        iotc_telemetry_writer_set_number(&w, x, (double) rand() / RAND_MAX - 0.5);
+        iotc_telemetry_writer_set_number(&w, y, (double) rand() / RAND_MAX - 0.5);
+        iotc_telemetry_writer_set_string(&w, state, (i % 100) ? "running" : "idle");
+        const char *json = iotc_telemetry_writer_serialize(&w);
+        if (!json || iotc_backfill_store(json)) {
+            printf("Failed to spool message %lu\n", i);
+            break;
+        }
+    }
+    uint64_t spool_us = iotc_clock_now_us() - start_us;
+
+    IotConnectBackfillStats stats;
+    iotc_backfill_get_stats(&stats);
+    printf("Spooled %lu messages in %.3f s\n", stats.spooled, (double) spool_us / 1e6);
+
+    start_us = iotc_clock_now_us();
+    iotc_backfill_start_upload();
+    while (!iotc_backfill_wait(5000)) {
+        iotc_backfill_get_stats(&stats);
+        printf("  ... %lu messages uploaded, %lu failed attempts\n", stats.uploaded, stats.failures);
+    }
+    uint64_t upload_us = iotc_clock_now_us() - start_us;
+
+    iotc_backfill_get_stats(&stats);
+    double seconds = (double) upload_us / 1e6;
+    printf("Uploaded %lu messages in %lu batches in %.3f s (%.0f messages/s)\n",
+           stats.uploaded, stats.batches, seconds, (double) stats.uploaded / seconds);
+    printf("Sent %llu bytes for %llu bytes of messages (%.1fx)%s\n",
+           stats.sent_bytes, stats.uploaded_bytes,
+           stats.sent_bytes ? (double) stats.uploaded_bytes / (double) stats.sent_bytes : 0.0,
+           o.compress ? "" : " without compression");
+    printf("Failed attempts: %lu, dropped messages: %lu, rejected messages: %lu\n", stats.failures, stats.dropped,
+           stats.rejected);
+
+    iotc_backfill_deinit();
+    return (stats.uploaded == stats.spooled) ? 0 : 4;
+}
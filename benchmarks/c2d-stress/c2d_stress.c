@@ -0,0 +1,366 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+// Pushes generated command, OTA and unknown C2D messages through the SDK receive path
+// and the registered callbacks, optionally while other threads are publishing telemetry.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "iotcl.h"
+#include "iotconnect.h"
+#include "iotc_clock.h"
+#include "iotc_publish_queue.h"
+#include "bench_alloc.h"
+#include "bench_stats.h"
+#include "iotc_loopback_transport.h"
+
+#define MESSAGE_POOL_SIZE 1024
+
+typedef enum {
+    MSG_COMMAND = 0,
+    MSG_OTA,
+    MSG_UNKNOWN,
+    MSG_TYPE_COUNT
+} MessageType;
+
+static const char *message_type_names[MSG_TYPE_COUNT] = {"command", "ota", "unknown"};
+
+typedef struct {
+    MessageType type;
+    unsigned char *data;
+    size_t len;
+} GeneratedMessage;
+
+typedef struct {
+    unsigned long count;
+    unsigned long rate; // messages per second, 0 = as fast as possible
+    size_t size; // approximate message size
+    unsigned int mix[MSG_TYPE_COUNT]; // relative weights
+    unsigned int publishers; // concurrent telemetry publisher threads
+    bool thread_safe_publish; // route all publishes through the SDK publish queue
+    bool dedup; // SDK duplicate suppression. Off by default, as the messages repeat after MESSAGE_POOL_SIZE.
+    unsigned int redeliveries; // percentage of messages injected twice, as after a reconnect
+} StressOptions;
+
+static unsigned long command_callbacks = 0;
+static unsigned long ota_callbacks = 0;
+static volatile int stop_publishers = 0;
+
+static void on_command(IotclC2dEventData data) {
+    const char *ack_id = iotcl_c2d_get_ack_id(data);
+    command_callbacks++;
+    if (ack_id) {
+        iotcl_mqtt_send_cmd_ack(ack_id, IOTCL_C2D_EVT_CMD_SUCCESS_WITH_ACK, "OK");
+    }
+}
+
+static void on_ota(IotclC2dEventData data) {
+    const char *ack_id = iotcl_c2d_get_ack_id(data);
+    ota_callbacks++;
+    if (ack_id) {
+        iotcl_mqtt_send_ota_ack(ack_id, IOTCL_C2D_EVT_OTA_DOWNLOAD_DONE, "OK");
+    }
+}
+
+// Fills the remaining space up to the requested size with command arguments or padding,
+// so that JSON parsing cost scales with the size option.
+static void fill_padding(char *buf, size_t len) {
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = alphabet[(size_t) rand() % (sizeof(alphabet) - 1)];
+    }
+    buf[len] = 0;
+}
+
+static int generate_message(GeneratedMessage *m, MessageType type, size_t size, unsigned long seq) {
+    char ack_id[40];
+    snprintf(ack_id, sizeof(ack_id), "%08lx-1c2d-4e5f-a0b1-%012lx", seq, seq * 2654435761UL);
+
+    size_t padding_len = size > 200 ? size - 200 : 8;
+    char *padding = malloc(padding_len + 1);
+    if (!padding) {
+        return -1;
+    }
+    fill_padding(padding, padding_len);
+
+    const char *format;
+    switch (type) {
+        case MSG_COMMAND:
+            format = "{\"v\":\"2.1\",\"ct\":0,\"cmd\":\"set-parameter %s\",\"ack\":\"%s\"}";
+            break;
+        case MSG_OTA:
+            format = "{\"v\":\"2.1\",\"ct\":1,\"cmd\":\"ota\",\"sw\":\"01.02.03\",\"hw\":\"1\","
+                     "\"urls\":[{\"url\":\"https://ota.iotconnect.local/firmware/%s.bin\",\"fileName\":\"fw.bin\"}],"
+                     "\"ack\":\"%s\"}";
+            break;
+        default:
+            format = "{\"v\":\"2.1\",\"ct\":250,\"unknown\":\"%s\",\"ack\":\"%s\"}";
+            break;
+    }
+
+    int len = snprintf(NULL, 0, format, padding, ack_id);
+    m->data = malloc((size_t) len + 1);
+    if (!m->data) {
+        free(padding);
+        return -1;
+    }
+    snprintf((char *) m->data, (size_t) len + 1, format, padding, ack_id);
+    m->len = (size_t) len;
+    m->type = type;
+    free(padding);
+    return 0;
+}
+
+static MessageType pick_type(const unsigned int *mix) {
+    unsigned int total = mix[MSG_COMMAND] + mix[MSG_OTA] + mix[MSG_UNKNOWN];
+    unsigned int r = (unsigned int) rand() % (total ? total : 1);
+    for (int i = 0; i < MSG_TYPE_COUNT; i++) {
+        if (r < mix[i]) {
+            return (MessageType) i;
+        }
+        r -= mix[i];
+    }
+    return MSG_COMMAND;
+}
+
+static void *publisher_thread(void *arg) {
+    unsigned long *sent = (unsigned long *) arg;
+    while (!__atomic_load_n(&stop_publishers, __ATOMIC_RELAXED)) {
+        IotclMessageHandle msg = iotcl_telemetry_create();
+        iotcl_telemetry_set_number(msg, "temperature", (double) rand() / RAND_MAX * 100.0);
+        iotcl_telemetry_set_number(msg, "coordinate.x", (double) rand() / RAND_MAX);
+        iotcl_telemetry_set_number(msg, "coordinate.y", (double) rand() / RAND_MAX);
+        iotcl_mqtt_send_telemetry(msg, false);
+        iotcl_telemetry_destroy(msg);
+        (*sent)++;
+    }
+    return NULL;
+}
+
+static void sleep_until_us(uint64_t deadline_us) {
+    uint64_t now = iotc_clock_now_us();
+    if (deadline_us > now) {
+        uint64_t delta = deadline_us - now;
+        struct timespec ts;
+        ts.tv_sec = (time_t) (delta / 1000000);
+        ts.tv_nsec = (long) (delta % 1000000) * 1000;
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void print_usage(const char *name) {
+    printf("Usage: %s [-n count] [-r rate] [-s size] [-m cmd:ota:unknown] [-p publishers] [-t] [-d percent]\n", name);
+    printf("  -n  number of C2D messages to process (default 100000)\n");
+    printf("  -r  messages per second, 0 for as fast as possible (default 0)\n");
+    printf("  -s  approximate size of each message in bytes (default 256)\n");
+    printf("  -m  relative weights of command, OTA and unknown messages (default 80:10:10)\n");
+    printf("  -p  number of threads publishing telemetry concurrently (default 0)\n");
+    printf("  -t  enable the SDK thread-safe publish mode (publish queue)\n");
+    printf("  -d  enable duplicate suppression and deliver this percentage of the messages twice (default off)\n");
+}
+
+static int parse_options(int argc, char *argv[], StressOptions *o) {
+    int opt;
+    o->count = 100000;
+    o->rate = 0;
+    o->size = 256;
+    o->mix[MSG_COMMAND] = 80;
+    o->mix[MSG_OTA] = 10;
+    o->mix[MSG_UNKNOWN] = 10;
+    o->publishers = 0;
+    o->thread_safe_publish = false;
+    o->dedup = false;
+    o->redeliveries = 0;
+    while ((opt = getopt(argc, argv, "n:r:s:m:p:td:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                o->count = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                o->rate = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                o->size = (size_t) strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                if (3 != sscanf(optarg, "%u:%u:%u", &o->mix[MSG_COMMAND], &o->mix[MSG_OTA], &o->mix[MSG_UNKNOWN])) {
+                    print_usage(argv[0]);
+                    return -1;
+                }
+                break;
+            case 'p':
+                o->publishers = (unsigned int) strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                o->thread_safe_publish = true;
+                break;
+            case 'd':
+                o->redeliveries = (unsigned int) strtoul(optarg, NULL, 10);
+                o->dedup = true;
+                break;
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+    if (0 == o->count || o->redeliveries > 100) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
+static int init_sdk(const StressOptions *o) {
+    IotConnectClientConfig config;
+    iotconnect_sdk_init_config(&config);
+    config.cpid = "BENCHCPID";
+    config.env = "bench";
+    config.duid = "benchdevice";
+    config.connection_type = IOTC_CT_AWS;
+    config.auth_info.type = IOTC_AT_X509;
+    config.auth_info.trust_store = "unused-ca.pem";
+    config.auth_info.data.cert_info.device_cert = "unused-crt.pem";
+    config.auth_info.data.cert_info.device_key = "unused-key.pem";
+    config.cmd_cb = on_command;
+    config.ota_cb = on_ota;
+    config.thread_safe_publish = o->thread_safe_publish;
+    if (!o->dedup) {
+        config.c2d_dedup.window_secs = 0;
+    }
+    config.transport = iotc_loopback_transport();
+
+    int ret = iotconnect_sdk_init(&config);
+    if (ret) {
+        printf("iotconnect_sdk_init() failed with %d\n", ret);
+        return ret;
+    }
+    ret = iotconnect_sdk_connect();
+    if (ret) {
+        printf("iotconnect_sdk_connect() failed with %d\n", ret);
+        return ret;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    StressOptions o;
+    if (parse_options(argc, argv, &o)) {
+        return 1;
+    }
+    srand(1234);
+
+    if (init_sdk(&o)) {
+        return 2;
+    }
+
+    GeneratedMessage *pool = calloc(MESSAGE_POOL_SIZE, sizeof(GeneratedMessage));
+    uint64_t *latencies = malloc(o.count * sizeof(uint64_t));
+    pthread_t *threads = calloc(o.publishers ? o.publishers : 1, sizeof(pthread_t));
+    unsigned long *published = calloc(o.publishers ? o.publishers : 1, sizeof(unsigned long));
+    if (!pool || !latencies || !threads || !published) {
+        printf("Out of memory\n");
+        return 3;
+    }
+    unsigned long type_counts[MSG_TYPE_COUNT] = {0};
+    for (unsigned long i = 0; i < MESSAGE_POOL_SIZE; i++) {
+        if (generate_message(&pool[i], pick_type(o.mix), o.size, i)) {
+            printf("Out of memory\n");
+            return 3;
+        }
+    }
+
+    for (unsigned int i = 0; i < o.publishers; i++) {
+        pthread_create(&threads[i], NULL, publisher_thread, &published[i]);
+    }
+
+    IotConnectLoopbackStats loopback_before;
+    iotc_loopback_get_stats(&loopback_before);
+    unsigned long redelivered = 0;
+    uint64_t interval_us = o.rate ? 1000000ULL / o.rate : 0;
+    bench_alloc_start(true);
+    uint64_t start_us = iotc_clock_now_us();
+    for (unsigned long i = 0; i < o.count; i++) {
+        GeneratedMessage *m = &pool[i % MESSAGE_POOL_SIZE];
+        if (interval_us) {
+            sleep_until_us(start_us + i * interval_us);
+        }
+        uint64_t t0 = iotc_clock_now_us();
+        if (iotc_loopback_inject_c2d(m->data, m->len)) {
+            printf("The SDK is not connected\n");
+            return 2;
+        }
+        latencies[i] = iotc_clock_now_us() - t0;
+        type_counts[m->type]++;
+        if (o.redeliveries && (unsigned int) rand() % 100 < o.redeliveries) {
+            iotc_loopback_inject_c2d(m->data, m->len);
+            redelivered++;
+        }
+    }
+    uint64_t elapsed_us = iotc_clock_now_us() - start_us;
+    bench_alloc_stop();
+    if (o.thread_safe_publish) {
+        iotc_publish_queue_flush(10000);
+    }
+
+    __atomic_store_n(&stop_publishers, 1, __ATOMIC_RELAXED);
+    unsigned long total_published = 0;
+    for (unsigned int i = 0; i < o.publishers; i++) {
+        pthread_join(threads[i], NULL);
+        total_published += published[i];
+    }
+    IotConnectLoopbackStats loopback_after;
+    iotc_loopback_get_stats(&loopback_after);
+    uint64_t publishes = loopback_after.publishes - loopback_before.publishes;
+
+    BenchAllocStats alloc_stats;
+    bench_alloc_get(&alloc_stats);
+    BenchPercentiles p;
+    bench_percentiles(latencies, o.count, &p);
+
+    double seconds = (double) elapsed_us / 1e6;
+    printf("Processed %lu C2D messages (~%lu bytes each) in %.3f s with %u publisher thread(s)%s\n",
+           o.count, (unsigned long) o.size, seconds, o.publishers,
+           o.thread_safe_publish ? " and the publish queue" : "");
+    for (int i = 0; i < MSG_TYPE_COUNT; i++) {
+        printf("  %-8s %lu\n", message_type_names[i], type_counts[i]);
+    }
+    printf("Callbacks: command=%lu ota=%lu\n", command_callbacks, ota_callbacks);
+    printf("Throughput: %.0f messages/s\n", (double) o.count / seconds);
+    bench_print_percentiles("Per-message latency", "us", &p);
+    if (bench_alloc_is_supported()) {
+        printf("Allocations (receive thread): %.1f per message, %.0f bytes per message, peak %llu bytes\n",
+               (double) alloc_stats.allocations / (double) o.count,
+               (double) alloc_stats.bytes / (double) o.count,
+               (unsigned long long) alloc_stats.peak_bytes);
+    } else {
+        printf("Allocations: not available on this platform\n");
+    }
+    printf("Outbound publishes during the run: %llu (telemetry from publisher threads: %lu)\n",
+           (unsigned long long) publishes, total_published);
+    if (o.dedup) {
+        IotConnectC2dDedupStats dedup;
+        iotc_c2d_dedup_get_stats(&dedup);
+        printf("Duplicate suppression: %lu redelivered, %lu dropped, %lu passed, %lu evicted early\n",
+               redelivered, dedup.hits, dedup.misses, dedup.evictions);
+    }
+
+    iotconnect_sdk_disconnect();
+    iotconnect_sdk_deinit();
+    for (unsigned long i = 0; i < MESSAGE_POOL_SIZE; i++) {
+        free(pool[i].data);
+    }
+    free(pool);
+    free(latencies);
+    free(threads);
+    free(published);
+    return 0;
+}
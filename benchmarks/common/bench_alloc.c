@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <string.h>
+#include "bench_alloc.h"
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static volatile int is_counting = 0;
+static volatile int is_thread_filter = 0;
+static __thread int is_counting_thread = 0;
+static BenchAllocStats counters = {0};
+
+static bool should_count(void) {
+    if (!__atomic_load_n(&is_counting, __ATOMIC_RELAXED)) {
+        return false;
+    }
+    return !__atomic_load_n(&is_thread_filter, __ATOMIC_RELAXED) || is_counting_thread;
+}
+
+static void count_alloc(void *ptr, size_t requested) {
+    if (!ptr || !should_count()) {
+        return;
+    }
+    uint64_t usable = (uint64_t) malloc_usable_size(ptr);
+    __atomic_add_fetch(&counters.allocations, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&counters.bytes, requested, __ATOMIC_RELAXED);
+    uint64_t current = __atomic_add_fetch(&counters.current_bytes, usable, __ATOMIC_RELAXED);
+    uint64_t peak = __atomic_load_n(&counters.peak_bytes, __ATOMIC_RELAXED);
+    while (current > peak && !__atomic_compare_exchange_n(&counters.peak_bytes, &peak, current, true,
+                                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        // peak has been reloaded by the failed exchange
+    }
+}
+
+static void count_free(void *ptr) {
+    if (!ptr || !should_count()) {
+        return;
+    }
+    uint64_t usable = (uint64_t) malloc_usable_size(ptr);
+    __atomic_add_fetch(&counters.frees, 1, __ATOMIC_RELAXED);
+    // blocks allocated before counting started can make this wrap, so clamp at zero
+    uint64_t current = __atomic_load_n(&counters.current_bytes, __ATOMIC_RELAXED);
+    uint64_t next;
+    do {
+        next = current > usable ? current - usable : 0;
+    } while (!__atomic_compare_exchange_n(&counters.current_bytes, &current, next, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void *malloc(size_t size) {
+    void *ptr = __libc_malloc(size);
+    count_alloc(ptr, size);
+    return ptr;
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    void *ptr = __libc_calloc(nmemb, size);
+    count_alloc(ptr, nmemb * size);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size) {
+    count_free(ptr);
+    void *new_ptr = __libc_realloc(ptr, size);
+    count_alloc(new_ptr, size);
+    return new_ptr;
+}
+
+void free(void *ptr) {
+    count_free(ptr);
+    __libc_free(ptr);
+}
+
+bool bench_alloc_is_supported(void) {
+    return true;
+}
+
+void bench_alloc_start(bool current_thread_only) {
+    __atomic_store_n(&is_counting, 0, __ATOMIC_SEQ_CST);
+    is_counting_thread = 1;
+    __atomic_store_n(&is_thread_filter, current_thread_only ? 1 : 0, __ATOMIC_SEQ_CST);
+    uint64_t current = counters.current_bytes;
+    memset(&counters, 0, sizeof(counters));
+    counters.current_bytes = current;
+    counters.peak_bytes = current;
+    __atomic_store_n(&is_counting, 1, __ATOMIC_SEQ_CST);
+}
+
+void bench_alloc_stop(void) {
+    __atomic_store_n(&is_counting, 0, __ATOMIC_SEQ_CST);
+}
+
+void bench_alloc_get(BenchAllocStats *stats) {
+    stats->allocations = __atomic_load_n(&counters.allocations, __ATOMIC_RELAXED);
+    stats->frees = __atomic_load_n(&counters.frees, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&counters.bytes, __ATOMIC_RELAXED);
+    stats->current_bytes = __atomic_load_n(&counters.current_bytes, __ATOMIC_RELAXED);
+    stats->peak_bytes = __atomic_load_n(&counters.peak_bytes, __ATOMIC_RELAXED);
+}
+
+#else
+
+bool bench_alloc_is_supported(void) {
+    return false;
+}
+
+void bench_alloc_start(bool current_thread_only) {
+    (void) current_thread_only;
+}
+
+void bench_alloc_stop(void) {
+}
+
+void bench_alloc_get(BenchAllocStats *stats) {
+    memset(stats, 0, sizeof(BenchAllocStats));
+}
+
+#endif
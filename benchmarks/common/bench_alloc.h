@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef BENCH_ALLOC_H
+#define BENCH_ALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Counts heap allocations made by the whole process (including Paho, cJSON and iotc-c-lib) by interposing
+// malloc and friends. Only available with glibc. bench_alloc_is_supported() returns false elsewhere
+// and all counters stay at zero.
+
+typedef struct {
+    uint64_t allocations; // malloc, calloc and realloc calls that returned a new block
+    uint64_t frees;
+    uint64_t bytes; // total requested bytes
+    uint64_t current_bytes; // bytes currently allocated (by usable size)
+    uint64_t peak_bytes; // high watermark of current_bytes since the last reset
+} BenchAllocStats;
+
+bool bench_alloc_is_supported(void);
+
+// Zero the counters (except current_bytes) and start counting.
+// If current_thread_only is true, only allocations made by the calling thread are counted.
+void bench_alloc_start(bool current_thread_only);
+
+void bench_alloc_stop(void);
+
+void bench_alloc_get(BenchAllocStats *stats);
+
+#endif // BENCH_ALLOC_H
@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench_stats.h"
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static uint64_t percentile(const uint64_t *sorted, size_t count, unsigned int pct) {
+    size_t index = (count * pct + 99) / 100; // nearest rank
+    if (index > 0) {
+        index--;
+    }
+    return sorted[index < count ? index : count - 1];
+}
+
+void bench_percentiles(uint64_t *samples, size_t count, BenchPercentiles *p) {
+    memset(p, 0, sizeof(BenchPercentiles));
+    p->count = count;
+    if (0 == count) {
+        return;
+    }
+    qsort(samples, count, sizeof(uint64_t), compare_u64);
+    double sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        sum += (double) samples[i];
+    }
+    p->mean = sum / (double) count;
+    p->min = samples[0];
+    p->max = samples[count - 1];
+    p->p50 = percentile(samples, count, 50);
+    p->p90 = percentile(samples, count, 90);
+    p->p99 = percentile(samples, count, 99);
+}
+
+void bench_print_percentiles(const char *name, const char *unit, const BenchPercentiles *p) {
+    printf("%-24s n=%-8lu min=%llu%s p50=%llu%s p90=%llu%s p99=%llu%s max=%llu%s mean=%.1f%s\n",
+           name, (unsigned long) p->count,
+           (unsigned long long) p->min, unit,
+           (unsigned long long) p->p50, unit,
+           (unsigned long long) p->p90, unit,
+           (unsigned long long) p->p99, unit,
+           (unsigned long long) p->max, unit,
+           p->mean, unit
+    );
+}
@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef BENCH_STATS_H
+#define BENCH_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    size_t count;
+    uint64_t min;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t max;
+    double mean;
+} BenchPercentiles;
+
+// Sorts the samples in place and computes the percentiles
+void bench_percentiles(uint64_t *samples, size_t count, BenchPercentiles *p);
+
+// Prints one line: name, count and percentiles in the given unit
+void bench_print_percentiles(const char *name, const char *unit, const BenchPercentiles *p);
+
+#endif // BENCH_STATS_H
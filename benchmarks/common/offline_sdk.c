@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "iotc_http_request.h"
+
+// Stand-ins for the HTTP layer, which let the SDK run without the cloud.
+// Linking this file into an executable overrides the curl implementation in the static SDK library.
+// Discovery and identity requests are answered with canned responses.
+// The MQTT side is handled by the loopback transport (iotc_loopback_transport.h).
+
+#define OFFLINE_DISCOVERY_RESPONSE \
+    "{\"d\":{\"ec\":0,\"bu\":\"https://discovery.iotconnect.local/api/2.1/dsdk/cpId/BENCHCPID/env/bench\"," \
+    "\"pf\":\"aws\",\"dip\":1},\"status\":200,\"message\":\"Success\"}"
+
+#define OFFLINE_IDENTITY_RESPONSE \
+    "{\"d\":{\"ec\":0,\"ct\":200,\"meta\":{\"at\":7,\"df\":60,\"cd\":\"XG4E00\",\"gtw\":null,\"edge\":0,\"pf\":0," \
+    "\"hwv\":\"\",\"swv\":\"\",\"v\":2.1},\"has\":{\"d\":0,\"attr\":1,\"set\":0,\"r\":0,\"ota\":0}," \
+    "\"p\":{\"n\":\"mqtt\",\"h\":\"broker.iotconnect.local\",\"p\":8883,\"id\":\"BENCHCPID-benchdevice\",\"un\":null," \
+    "\"topics\":{\"rpt\":\"$aws/rules/msg_d2c_rpt/benchdevice/XG4E00/2.1/0\"," \
+    "\"erpt\":\"$aws/rules/msg_d2c_rpt/benchdevice/XG4E00/2.1/0\"," \
+    "\"erm\":\"$aws/rules/msg_d2c_rpt/benchdevice/XG4E00/2.1/0\"," \
+    "\"flt\":\"$aws/rules/msg_d2c_flt/benchdevice/XG4E00/2.1/3\"," \
+    "\"od\":\"$aws/rules/msg_d2c_od/benchdevice/XG4E00/2.1/4\"," \
+    "\"hb\":\"$aws/rules/msg_d2c_hb/benchdevice/XG4E00/2.1/5\"," \
+    "\"ack\":\"$aws/rules/msg_d2c_ack/benchdevice/XG4E00/2.1/6\"," \
+    "\"dl\":\"$aws/rules/msg_d2c_dl/benchdevice/XG4E00/2.1/7\"," \
+    "\"di\":\"$aws/rules/msg_d2c_di/benchdevice/XG4E00/2.1/1\"," \
+    "\"c2d\":\"iot/benchdevice/cmd\"," \
+    "\"set\":{\"pub\":\"$aws/things/benchdevice/shadow/name/setting_info/update\"," \
+    "\"sub\":\"$aws/things/benchdevice/shadow/name/setting_info/update/delta\"," \
+    "\"pubForAll\":\"$aws/things/benchdevice/shadow/name/setting_info/get\"," \
+    "\"subForAll\":\"$aws/things/benchdevice/shadow/name/setting_info/get/+\"}}}," \
+    "\"dt\":\"2024-01-01T00:00:00.000Z\"},\"status\":200,\"message\":\"Identity Information\"}"
+
+// Everything that iotc_http_request.c defines is replaced here, so that the linker never pulls that object
+// from the SDK library alongside these definitions.
+
+int iotconnect_https_init(void) {
+    return 0;
+}
+
+void iotconnect_https_deinit(void) {
+}
+
+void iotconnect_https_init_options(IotConnectHttpRequestOptions *options) {
+    memset(options, 0, sizeof(IotConnectHttpRequestOptions));
+}
+
+int iotconnect_https_request_with_options(
+        IotConnectHttpResponse *response,
+        const char *url,
+        const IotConnectHttpRequestOptions *options
+) {
+    (void) options;
+    memset(response, 0, sizeof(IotConnectHttpResponse));
+    const char *canned = strstr(url, "/uid/") ? OFFLINE_IDENTITY_RESPONSE : OFFLINE_DISCOVERY_RESPONSE;
+    size_t len = strlen(canned);
+    response->data = malloc(len + 1);
+    if (!response->data) {
+        return -1;
+    }
+    memcpy(response->data, canned, len + 1);
+    response->data_len = len;
+    response->status_code = 200;
+    return 0;
+}
+
+int iotconnect_https_request(IotConnectHttpResponse *response, const char *url, const char *send_str) {
+    (void) send_str;
+    return iotconnect_https_request_with_options(response, url, NULL);
+}
+
+bool iotconnect_https_get_header(const IotConnectHttpResponse *response, const char *name, char *value, size_t value_size) {
+    (void) response;
+    (void) name;
+    (void) value;
+    (void) value_size;
+    return false;
+}
+
+void iotconnect_free_https_response(IotConnectHttpResponse *response) {
+    free(response->data);
+    response->data = NULL;
+    free(response->headers);
+    response->headers = NULL;
+}
@@ -0,0 +1,249 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+// Runs the SDK startup sequence (discovery, identity, MQTT connect and subscribe) repeatedly against IoTConnect
+// and reports percentiles for each phase. Needs a real device and network access.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "iotcl.h"
+#include "iotconnect.h"
+#include "iotc_startup_timing.h"
+#include "bench_stats.h"
+
+typedef struct {
+    IotConnectConnectionType connection_type;
+    char *cpid;
+    char *env;
+    char *duid;
+    char *trust_store;
+    char *device_cert;
+    char *device_key;
+    char *symmetric_key;
+    char *dns_cache_path;
+    unsigned int iterations;
+    unsigned int pause_ms;
+    bool is_mqtt_only;
+    bool is_verbose;
+} ConnectOptions;
+
+typedef struct {
+    uint64_t *phases[IOTC_PHASE_COUNT];
+    size_t phase_counts[IOTC_PHASE_COUNT];
+    uint64_t *init;
+    uint64_t *connect;
+    size_t init_count;
+    size_t connect_count;
+} ConnectSamples;
+
+static void print_usage(const char *name) {
+    printf("Usage: %s -t aws|azure -c cpid -e env -d duid -r trust_store (-C cert -K key | -S symmetric_key)\n"
+           "          [-n iterations] [-p pause_ms] [-D dns_cache_file] [-m] [-v]\n", name);
+    printf("  -n  number of startup sequences (default 10)\n");
+    printf("  -p  pause between sequences in milliseconds (default 1000)\n");
+    printf("  -D  keep the DNS cache in this file, to measure startup with cached addresses\n");
+    printf("  -m  run discovery and identity once and repeat only the MQTT connect\n");
+    printf("  -v  verbose SDK output, including the timing of each sequence\n");
+}
+
+static int parse_options(int argc, char *argv[], ConnectOptions *o) {
+    int opt;
+    memset(o, 0, sizeof(ConnectOptions));
+    o->connection_type = IOTC_CT_AWS;
+    o->iterations = 10;
+    o->pause_ms = 1000;
+    while ((opt = getopt(argc, argv, "t:c:e:d:r:C:K:S:n:p:D:mvh")) != -1) {
+        switch (opt) {
+            case 't':
+                o->connection_type = (0 == strcmp(optarg, "azure")) ? IOTC_CT_AZURE : IOTC_CT_AWS;
+                break;
+            case 'c':
+                o->cpid = optarg;
+                break;
+            case 'e':
+                o->env = optarg;
+                break;
+            case 'd':
+                o->duid = optarg;
+                break;
+            case 'r':
+                o->trust_store = optarg;
+                break;
+            case 'C':
+                o->device_cert = optarg;
+                break;
+            case 'K':
+                o->device_key = optarg;
+                break;
+            case 'S':
+                o->symmetric_key = optarg;
+                break;
+            case 'n':
+                o->iterations = (unsigned int) strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                o->pause_ms = (unsigned int) strtoul(optarg, NULL, 10);
+                break;
+            case 'D':
+                o->dns_cache_path = optarg;
+                break;
+            case 'm':
+                o->is_mqtt_only = true;
+                break;
+            case 'v':
+                o->is_verbose = true;
+                break;
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+    bool has_auth = o->symmetric_key || (o->device_cert && o->device_key);
+    if (!o->cpid || !o->env || !o->duid || !o->trust_store || !has_auth || 0 == o->iterations) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
+static void pause_ms(unsigned int ms) {
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long) (ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
+static void add_samples(ConnectSamples *s, const IotConnectStartupTimings *t, bool has_init) {
+    for (int i = 0; i < IOTC_PHASE_COUNT; i++) {
+        bool is_init_phase = i < IOTC_PHASE_ENDPOINT_RACE;
+        if (t->duration_us[i] && (has_init || !is_init_phase)) {
+            s->phases[i][s->phase_counts[i]++] = t->duration_us[i];
+        }
+    }
+    if (has_init) {
+        s->init[s->init_count++] = t->init_us;
+    }
+    s->connect[s->connect_count++] = t->connect_us;
+}
+
+static void print_samples(ConnectSamples *s) {
+    BenchPercentiles p;
+    for (int i = 0; i < IOTC_PHASE_COUNT; i++) {
+        if (!s->phase_counts[i]) {
+            continue;
+        }
+        // milliseconds with the precision that matters here
+        for (size_t j = 0; j < s->phase_counts[i]; j++) {
+            s->phases[i][j] = (s->phases[i][j] + 500) / 1000;
+        }
+        bench_percentiles(s->phases[i], s->phase_counts[i], &p);
+        bench_print_percentiles(iotc_startup_timing_phase_name((IotConnectStartupPhase) i), "ms", &p);
+    }
+    for (size_t j = 0; j < s->init_count; j++) {
+        s->init[j] = (s->init[j] + 500) / 1000;
+    }
+    for (size_t j = 0; j < s->connect_count; j++) {
+        s->connect[j] = (s->connect[j] + 500) / 1000;
+    }
+    bench_percentiles(s->init, s->init_count, &p);
+    bench_print_percentiles("iotconnect_sdk_init", "ms", &p);
+    bench_percentiles(s->connect, s->connect_count, &p);
+    bench_print_percentiles("iotconnect_sdk_connect", "ms", &p);
+}
+
+int main(int argc, char *argv[]) {
+    ConnectOptions o;
+    if (parse_options(argc, argv, &o)) {
+        return 1;
+    }
+
+    IotConnectClientConfig config;
+    iotconnect_sdk_init_config(&config);
+    config.connection_type = o.connection_type;
+    config.cpid = o.cpid;
+    config.env = o.env;
+    config.duid = o.duid;
+    config.auth_info.trust_store = o.trust_store;
+    if (o.symmetric_key) {
+        config.auth_info.type = IOTC_AT_SYMMETRIC_KEY;
+        config.auth_info.data.symmetric_key = o.symmetric_key;
+    } else {
+        config.auth_info.type = IOTC_AT_X509;
+        config.auth_info.data.cert_info.device_cert = o.device_cert;
+        config.auth_info.data.cert_info.device_key = o.device_key;
+    }
+    config.dns_cache.persist_path = o.dns_cache_path;
+    config.verbose = o.is_verbose;
+
+    ConnectSamples s;
+    memset(&s, 0, sizeof(s));
+    for (int i = 0; i < IOTC_PHASE_COUNT; i++) {
+        s.phases[i] = calloc(o.iterations, sizeof(uint64_t));
+    }
+    s.init = calloc(o.iterations, sizeof(uint64_t));
+    s.connect = calloc(o.iterations, sizeof(uint64_t));
+    bool is_oom = !s.init || !s.connect;
+    for (int i = 0; i < IOTC_PHASE_COUNT; i++) {
+        is_oom = is_oom || !s.phases[i];
+    }
+    if (is_oom) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    unsigned int failures = 0;
+    bool is_initialized = false;
+    for (unsigned int n = 0; n < o.iterations; n++) {
+        bool has_init = !is_initialized;
+        if (!is_initialized) {
+            if (iotconnect_sdk_init(&config)) {
+                fprintf(stderr, "Sequence %u: iotconnect_sdk_init() failed\n", n + 1);
+                failures++;
+                pause_ms(o.pause_ms);
+                continue;
+            }
+            is_initialized = true;
+        }
+        if (iotconnect_sdk_connect()) {
+            fprintf(stderr, "Sequence %u: iotconnect_sdk_connect() failed\n", n + 1);
+            failures++;
+        } else {
+            IotConnectStartupTimings t;
+            iotc_startup_timing_get(&t);
+            add_samples(&s, &t, has_init);
+            if (!o.is_verbose) {
+                printf("Sequence %u: init %lu ms, connect %lu ms\n", n + 1,
+                       (unsigned long) (t.init_us / 1000), (unsigned long) (t.connect_us / 1000));
+            }
+            iotconnect_sdk_disconnect();
+        }
+        if (!o.is_mqtt_only) {
+            iotconnect_sdk_deinit();
+            is_initialized = false;
+        }
+        if (n + 1 < o.iterations) {
+            pause_ms(o.pause_ms);
+        }
+    }
+    if (is_initialized) {
+        iotconnect_sdk_deinit();
+    }
+
+    printf("%u sequences, %u failed\n", o.iterations, failures);
+    print_samples(&s);
+
+    for (int i = 0; i < IOTC_PHASE_COUNT; i++) {
+        free(s.phases[i]);
+    }
+    free(s.init);
+    free(s.connect);
+    return failures ? 2 : 0;
+}
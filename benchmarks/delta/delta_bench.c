@@ -0,0 +1,448 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+// Builds a pair of firmware-like images, makes an ENDSLEY/BSDIFF43 patch between them
+// and measures how long the SDK takes to apply it and how much memory it needs.
+// The patch generator here is a simple greedy matcher. bsdiff makes smaller patches, which apply the same way.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <zlib.h>
+#ifdef BENCH_WITH_BZIP2
+#include <bzlib.h>
+#endif
+
+#include "bench_alloc.h"
+#include "iotc_clock.h"
+#include "iotc_delta.h"
+
+#define HASH_BITS 22
+#define MATCH_KEY 16 // bytes that must match exactly to start a match
+#define MIN_MATCH 32
+#define WORD_TABLE_SIZE 1024
+
+typedef struct {
+    size_t size_mb;
+    double change_pct;
+    const char *dir;
+} DeltaOptions;
+
+typedef enum {
+    OUT_GZIP,
+    OUT_BZIP2
+} OutputCodec;
+
+// Compresses the patch records as they are produced
+typedef struct {
+    OutputCodec codec;
+    FILE *f;
+    unsigned char buffer[64 * 1024];
+    z_stream z;
+#ifdef BENCH_WITH_BZIP2
+    bz_stream bz;
+#endif
+} PatchWriter;
+
+static void print_usage(const char *name) {
+    printf("Usage: %s [-s size_mb] [-p change_percent] [-d dir]\n", name);
+    printf("  -s  image size in MB (default 32)\n");
+    printf("  -p  approximate share of the image that changes between releases (default 3)\n");
+    printf("  -d  directory for the image and patch files (default /tmp)\n");
+}
+
+static int parse_options(int argc, char *argv[], DeltaOptions *o) {
+    int opt;
+    o->size_mb = 32;
+    o->change_pct = 3.0;
+    o->dir = "/tmp";
+    while ((opt = getopt(argc, argv, "s:p:d:h")) != -1) {
+        switch (opt) {
+            case 's':
+                o->size_mb = (size_t) strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                o->change_pct = strtod(optarg, NULL);
+                break;
+            case 'd':
+                o->dir = optarg;
+                break;
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+    if (0 == o->size_mb || o->change_pct < 0 || o->change_pct > 100) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
+static uint32_t rng_state = 12345;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static uint32_t word_table[WORD_TABLE_SIZE];
+
+// Code-like content: words from a small vocabulary with an "address" every 16 words
+static void fill_code(unsigned char *p, size_t len) {
+    for (size_t i = 0; i + 4 <= len; i += 4) {
+        uint32_t w = (i % 64 == 0) ? 0x08000000u + (rng() & 0xFFFFF) : word_table[rng() % WORD_TABLE_SIZE];
+        memcpy(&p[i], &w, 4);
+    }
+}
+
+static unsigned char *make_old_image(size_t size) {
+    unsigned char *image = malloc(size);
+    if (!image) {
+        return NULL;
+    }
+    for (int i = 0; i < WORD_TABLE_SIZE; i++) {
+        word_table[i] = rng();
+    }
+    fill_code(image, size - size / 8);
+    for (size_t i = size - size / 8; i < size; i++) {
+        image[i] = (unsigned char) rng(); // data section, like compressed assets
+    }
+    return image;
+}
+
+// Inserts, removes and patches 4 KB blocks, and shifts the addresses after each insertion or removal,
+// like a linker would
+static unsigned char *make_new_image(const unsigned char *old, size_t old_size, double change_pct, size_t *new_size) {
+    const size_t block = 4096;
+    unsigned char *image = malloc(old_size + old_size / 4 + block);
+    size_t n = 0;
+    uint32_t shift = 0;
+    const uint32_t threshold = (uint32_t) (change_pct / 100.0 / 3.0 * 4294967295.0);
+    if (!image) {
+        return NULL;
+    }
+    for (size_t pos = 0; pos < old_size; pos += block) {
+        size_t len = old_size - pos < block ? old_size - pos : block;
+        const bool is_code = pos + len <= old_size - old_size / 8;
+        if (rng() < threshold && n + block < old_size + old_size / 4) {
+            fill_code(&image[n], block); // new function
+            n += block;
+            shift += block;
+        }
+        if (rng() < threshold) {
+            shift -= (uint32_t) len; // removed function
+            continue;
+        }
+        memcpy(&image[n], &old[pos], len);
+        if (rng() < threshold) {
+            fill_code(&image[n + len / 4], len / 8); // changed code
+        }
+        if (is_code && shift) {
+            for (size_t i = 0; i + 4 <= len; i += 64) {
+                uint32_t w;
+                memcpy(&w, &image[n + i], 4);
+                w += shift;
+                memcpy(&image[n + i], &w, 4);
+            }
+        }
+        n += len;
+    }
+    *new_size = n;
+    return image;
+}
+
+static void offtout(int64_t x, unsigned char *buf) {
+    uint64_t y = (uint64_t) (x < 0 ? -x : x);
+    for (int i = 0; i < 8; i++) {
+        buf[i] = (unsigned char) (y & 0xFF);
+        y >>= 8;
+    }
+    if (x < 0) {
+        buf[7] |= 0x80;
+    }
+}
+
+static int writer_open(PatchWriter *w, OutputCodec codec, const char *path, size_t new_size) {
+    unsigned char header[IOTC_DELTA_HEADER_SIZE];
+    memset(w, 0, sizeof(PatchWriter));
+    w->codec = codec;
+    w->f = fopen(path, "wb");
+    if (!w->f) {
+        return -1;
+    }
+    memcpy(header, IOTC_DELTA_MAGIC, IOTC_DELTA_MAGIC_SIZE);
+    offtout((int64_t) new_size, &header[IOTC_DELTA_MAGIC_SIZE]);
+    fwrite(header, 1, sizeof(header), w->f);
+    if (OUT_GZIP == codec) {
+        return Z_OK == deflateInit2(&w->z, 9, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) ? 0 : -1;
+    }
+#ifdef BENCH_WITH_BZIP2
+    return BZ_OK == BZ2_bzCompressInit(&w->bz, 9, 0, 0) ? 0 : -1;
+#else
+    return -1;
+#endif
+}
+
+static void writer_run(PatchWriter *w, const void *data, size_t len, bool is_finish) {
+    if (OUT_GZIP == w->codec) {
+        w->z.next_in = (unsigned char *) data;
+        w->z.avail_in = (uInt) len;
+        int ret;
+        do {
+            w->z.next_out = w->buffer;
+            w->z.avail_out = sizeof(w->buffer);
+            ret = deflate(&w->z, is_finish ? Z_FINISH : Z_NO_FLUSH);
+            fwrite(w->buffer, 1, sizeof(w->buffer) - w->z.avail_out, w->f);
+        } while (w->z.avail_in > 0 || (is_finish && Z_STREAM_END != ret));
+        return;
+    }
+#ifdef BENCH_WITH_BZIP2
+    w->bz.next_in = (char *) data;
+    w->bz.avail_in = (unsigned int) len;
+    int ret;
+    do {
+        w->bz.next_out = (char *) w->buffer;
+        w->bz.avail_out = sizeof(w->buffer);
+        ret = BZ2_bzCompress(&w->bz, is_finish ? BZ_FINISH : BZ_RUN);
+        fwrite(w->buffer, 1, sizeof(w->buffer) - w->bz.avail_out, w->f);
+    } while (w->bz.avail_in > 0 || (is_finish && BZ_STREAM_END != ret));
+#endif
+}
+
+static void writer_close(PatchWriter *w) {
+    writer_run(w, NULL, 0, true);
+    if (OUT_GZIP == w->codec) {
+        deflateEnd(&w->z);
+    }
+#ifdef BENCH_WITH_BZIP2
+    if (OUT_BZIP2 == w->codec) {
+        BZ2_bzCompressEnd(&w->bz);
+    }
+#endif
+    fclose(w->f);
+}
+
+static uint32_t hash_key(const unsigned char *p) {
+    uint64_t a, b;
+    memcpy(&a, p, 8);
+    memcpy(&b, p + 8, 8);
+    return (uint32_t) (((a ^ (b * 0x9E3779B97F4A7C15ull)) * 0xC2B2AE3D27D4EB4Full) >> (64 - HASH_BITS));
+}
+
+// Extends an approximate match forward. Keeps the length with the best score of matches minus mismatches,
+// so that small edits inside a match become difference bytes instead of breaking it up.
+static size_t extend_match(const unsigned char *old, size_t old_size, size_t old_pos,
+                           const unsigned char *new, size_t new_size, size_t new_pos) {
+    long score = 0;
+    long best_score = 0;
+    size_t best_len = 0;
+    for (size_t i = 0; old_pos + i < old_size && new_pos + i < new_size; i++) {
+        score += (old[old_pos + i] == new[new_pos + i]) ? 1 : -1;
+        if (score > best_score) {
+            best_score = score;
+            best_len = i + 1;
+        } else if (score < best_score - 64) {
+            break;
+        }
+    }
+    return best_len;
+}
+
+static void write_record(PatchWriter *w, const unsigned char *old, const unsigned char *new,
+                         size_t new_pos, size_t old_pos, size_t diff_len, size_t extra_len, int64_t seek) {
+    unsigned char control[24];
+    unsigned char diff[4096];
+    offtout((int64_t) diff_len, control);
+    offtout((int64_t) extra_len, &control[8]);
+    offtout(seek, &control[16]);
+    writer_run(w, control, sizeof(control), false);
+    for (size_t i = 0; i < diff_len; i += sizeof(diff)) {
+        size_t n = diff_len - i < sizeof(diff) ? diff_len - i : sizeof(diff);
+        for (size_t j = 0; j < n; j++) {
+            diff[j] = (unsigned char) (new[new_pos + i + j] - old[old_pos + i + j]);
+        }
+        writer_run(w, diff, n, false);
+    }
+    writer_run(w, &new[new_pos + diff_len], extra_len, false);
+}
+
+static unsigned long make_patch(const unsigned char *old, size_t old_size, const unsigned char *new, size_t new_size,
+                                OutputCodec codec, const char *path) {
+    PatchWriter w;
+    uint32_t *table = malloc(sizeof(uint32_t) << HASH_BITS);
+    if (!table || writer_open(&w, codec, path, new_size)) {
+        free(table);
+        return 0;
+    }
+    memset(table, 0xFF, sizeof(uint32_t) << HASH_BITS);
+    for (size_t i = 0; i + MATCH_KEY <= old_size; i++) {
+        table[hash_key(&old[i])] = (uint32_t) i;
+    }
+
+    // the current match: new bytes from match_new are derived from old bytes from match_old
+    size_t match_new = 0;
+    size_t match_old = 0;
+    size_t match_len = 0;
+    unsigned long records = 0;
+    size_t scan = 0;
+    while (scan + MATCH_KEY <= new_size) {
+        // the old image at the same alignment as the current match often continues to fit
+        size_t old_pos = match_old + (scan - match_new);
+        size_t len = 0;
+        if (match_len && old_pos + MATCH_KEY <= old_size && 0 == memcmp(&old[old_pos], &new[scan], MATCH_KEY)) {
+            len = extend_match(old, old_size, old_pos, new, new_size, scan);
+        }
+        if (len < MIN_MATCH) {
+            uint32_t candidate = table[hash_key(&new[scan])];
+            if (candidate != UINT32_MAX && 0 == memcmp(&old[candidate], &new[scan], MATCH_KEY)) {
+                old_pos = candidate;
+                len = extend_match(old, old_size, old_pos, new, new_size, scan);
+            }
+        }
+        if (len < MIN_MATCH) {
+            scan++;
+            continue;
+        }
+        const size_t extra_len = scan - (match_new + match_len);
+        write_record(&w, old, new, match_new, match_old, match_len, extra_len,
+                     (int64_t) old_pos - (int64_t) (match_old + match_len));
+        records++;
+        match_new = scan;
+        match_old = old_pos;
+        match_len = len;
+        scan += len;
+    }
+    write_record(&w, old, new, match_new, match_old, match_len, new_size - (match_new + match_len), 0);
+    records++;
+    writer_close(&w);
+    free(table);
+    return records;
+}
+
+static int write_file(const char *path, const unsigned char *data, size_t len) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        return -1;
+    }
+    size_t written = fwrite(data, 1, len, f);
+    return (0 == fclose(f) && written == len) ? 0 : -1;
+}
+
+static long file_size(const char *path) {
+    FILE *f = fopen(path, "rb");
+    long size = -1;
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        size = ftell(f);
+        fclose(f);
+    }
+    return size;
+}
+
+static size_t gzip_size(const unsigned char *data, size_t len) {
+    uLongf out_len = compressBound((uLong) len);
+    unsigned char *out = malloc(out_len);
+    if (!out || Z_OK != compress2(out, &out_len, data, (uLong) len, 6)) {
+        out_len = 0;
+    }
+    free(out);
+    return out_len;
+}
+
+static void sha256_hex(const unsigned char *data, size_t len, char *hex) {
+    unsigned char hash[32];
+    unsigned int hash_len = 0;
+    EVP_Digest(data, len, hash, &hash_len, EVP_sha256(), NULL);
+    for (unsigned int i = 0; i < hash_len; i++) {
+        sprintf(&hex[i * 2], "%02x", hash[i]);
+    }
+}
+
+static int run_apply(const char *label, const char *old_path, const char *patch_path, const char *new_path,
+                     const char *sha, size_t new_size, size_t full_size) {
+    IotConnectDeltaStats stats;
+    BenchAllocStats alloc;
+    long patch_size = file_size(patch_path);
+
+    bench_alloc_start(true);
+    uint64_t start_us = iotc_clock_now_us();
+    int status = iotc_delta_apply_file(old_path, patch_path, new_path, sha, &stats);
+    uint64_t elapsed_us = iotc_clock_now_us() - start_us;
+    bench_alloc_stop();
+    bench_alloc_get(&alloc);
+
+    if (status) {
+        printf("%-6s patch failed to apply\n", label);
+        return status;
+    }
+    printf("%-6s patch %9ld bytes (%5.2f%% of the image, %5.2f%% of gzip), %lu records, %.0f%% diff bytes\n",
+           label, patch_size, 100.0 * (double) patch_size / (double) new_size,
+           100.0 * (double) patch_size / (double) full_size, stats.records,
+           100.0 * (double) stats.diff_bytes / (double) stats.new_size);
+    printf("       applied and verified in %.0f ms (%.1f MB/s)", (double) elapsed_us / 1000.0,
+           (double) new_size / (double) elapsed_us);
+    if (bench_alloc_is_supported()) {
+        printf(", peak heap %.1f KB in %llu allocations", (double) alloc.peak_bytes / 1024.0,
+               (unsigned long long) alloc.allocations);
+    }
+    printf("\n");
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    DeltaOptions o;
+    char old_path[256], new_path[256], out_path[256], gz_path[256], bz_path[256];
+    char sha[65];
+    size_t new_size = 0;
+
+    if (parse_options(argc, argv, &o)) {
+        return 1;
+    }
+    snprintf(old_path, sizeof(old_path), "%s/iotc-delta-old.bin", o.dir);
+    snprintf(new_path, sizeof(new_path), "%s/iotc-delta-new.bin", o.dir);
+    snprintf(out_path, sizeof(out_path), "%s/iotc-delta-out.bin", o.dir);
+    snprintf(gz_path, sizeof(gz_path), "%s/iotc-delta.patch.gz", o.dir);
+    snprintf(bz_path, sizeof(bz_path), "%s/iotc-delta.patch.bz2", o.dir);
+
+    const size_t old_size = o.size_mb * 1024 * 1024;
+    unsigned char *old = make_old_image(old_size);
+    unsigned char *new = old ? make_new_image(old, old_size, o.change_pct, &new_size) : NULL;
+    if (!new || write_file(old_path, old, old_size) || write_file(new_path, new, new_size)) {
+        printf("Failed to create the images\n");
+        return 2;
+    }
+    sha256_hex(new, new_size, sha);
+    const size_t full_size = gzip_size(new, new_size);
+    printf("Old image %lu bytes, new image %lu bytes, full update %lu bytes gzipped\n",
+           (unsigned long) old_size, (unsigned long) new_size, (unsigned long) full_size);
+
+    uint64_t start_us = iotc_clock_now_us();
+    unsigned long records = make_patch(old, old_size, new, new_size, OUT_GZIP, gz_path);
+    printf("Made a patch with %lu records in %.0f ms\n", records, (double) (iotc_clock_now_us() - start_us) / 1000.0);
+#ifdef BENCH_WITH_BZIP2
+    make_patch(old, old_size, new, new_size, OUT_BZIP2, bz_path);
+#endif
+    free(old);
+    free(new);
+
+    int status = run_apply("gzip", old_path, gz_path, out_path, sha, new_size, full_size);
+#ifdef BENCH_WITH_BZIP2
+    status |= run_apply("bzip2", old_path, bz_path, out_path, sha, new_size, full_size);
+#endif
+
+    remove(old_path);
+    remove(new_path);
+    remove(out_path);
+    remove(gz_path);
+    remove(bz_path);
+    return status ? 3 : 0;
+}
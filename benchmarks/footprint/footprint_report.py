@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+# Copyright (C) 2020-2024 Avnet
+# Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+
+"""Footprint report of an SDK build.
+
+Measures the flash (text + data) and static RAM (data + bss) of the footprint-workload executable with size(1),
+then runs it to measure the peak heap. Shared libraries such as libc and OpenSSL are not included.
+Each --max-* budget that is given is checked, and the exit code is 1 if one is exceeded.
+"""
+
+import argparse
+import subprocess
+import sys
+
+
+def measure_sections(size_tool, executable):
+    # Berkeley format: text data bss dec hex filename
+    output = subprocess.run([size_tool, "-B", executable], check=True, capture_output=True, text=True).stdout
+    text, data, bss = (int(v) for v in output.splitlines()[1].split()[:3])
+    return text, data, bss
+
+
+def run_workload(executable, identity, messages, commands):
+    result = subprocess.run([executable, "-i", identity, "-n", str(messages), "-c", str(commands)],
+                            capture_output=True, text=True)
+    values = {}
+    for line in result.stdout.splitlines():
+        key, sep, value = line.partition("=")
+        if sep:
+            values[key] = value
+    if result.returncode != 0 or "peak_heap_bytes" not in values:
+        sys.stderr.write(result.stdout + result.stderr)
+        raise RuntimeError("The workload failed with exit code %d" % result.returncode)
+    return values
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("executable", help="path to footprint-workload")
+    parser.add_argument("identity", help="identity response used as the cached identity")
+    parser.add_argument("--size-tool", default="size", help="size(1) of the target toolchain")
+    parser.add_argument("--messages", type=int, default=1000, help="telemetry messages in the workload")
+    parser.add_argument("--commands", type=int, default=100, help="commands in the workload")
+    parser.add_argument("--max-flash", type=int, default=0, help="flash budget in bytes, 0 to not check")
+    parser.add_argument("--max-ram", type=int, default=0, help="static RAM budget in bytes, 0 to not check")
+    parser.add_argument("--max-heap", type=int, default=0, help="peak heap budget in bytes, 0 to not check")
+    args = parser.parse_args()
+
+    text, data, bss = measure_sections(args.size_tool, args.executable)
+    values = run_workload(args.executable, args.identity, args.messages, args.commands)
+    heap = int(values["peak_heap_bytes"])
+    is_heap_measured = values.get("heap_supported") == "1"
+
+    results = [
+        ("flash", text + data, args.max_flash, True),
+        ("static RAM", data + bss, args.max_ram, True),
+        ("peak heap", heap, args.max_heap, is_heap_measured),
+    ]
+    print("%-12s %10s %10s" % ("", "bytes", "budget"))
+    is_over_budget = False
+    for name, value, budget, is_measured in results:
+        status = ""
+        if not is_measured:
+            status = "not measured (needs glibc)"
+        elif budget and value > budget:
+            status = "OVER BUDGET"
+            is_over_budget = True
+        print("%-12s %10d %10s %s" % (name, value, budget if budget else "-", status))
+    print("(text %d, data %d, bss %d; %s publishes, %s commands, %s allocations)"
+          % (text, data, bss, values.get("publishes"), values.get("commands"), values.get("allocations")))
+    return 1 if is_over_budget else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+// The reference workload of the footprint report: init from a cached identity, connect, publish telemetry,
+// handle commands, disconnect and deinit. MQTT goes through the loopback transport, so the heap numbers cover
+// the SDK, iotc-c-lib and cJSON, but not TLS. Prints key=value lines for footprint_report.py.
+
+#define _DEFAULT_SOURCE // getopt()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "iotcl.h"
+#include "iotconnect.h"
+#include "iotc_loopback_transport.h"
+#include "bench_alloc.h"
+
+static unsigned long commands = 0;
+
+static void on_command(IotclC2dEventData data) {
+    const char *ack_id = iotcl_c2d_get_ack_id(data);
+    commands++;
+    if (ack_id) {
+        iotcl_mqtt_send_cmd_ack(ack_id, IOTCL_C2D_EVT_CMD_SUCCESS_WITH_ACK, "OK");
+    }
+}
+
+static void publish_telemetry(unsigned long i) {
+    IotclMessageHandle msg = iotcl_telemetry_create();
+    iotcl_telemetry_set_string(msg, "version", "1.0.0");
+    iotcl_telemetry_set_number(msg, "counter", (double) i);
+    iotcl_telemetry_set_number(msg, "temperature", 20.0 + (double) (i % 100) / 10.0);
+    iotcl_telemetry_set_bool(msg, "active", 0 == i % 2);
+    iotcl_telemetry_set_number(msg, "coordinate.x", (double) (i % 7));
+    iotcl_telemetry_set_number(msg, "coordinate.y", (double) (i % 11));
+    iotcl_mqtt_send_telemetry(msg, false);
+    iotcl_telemetry_destroy(msg);
+}
+
+static void print_usage(const char *name) {
+    printf("Usage: %s -i identity.json [-n messages] [-c commands]\n", name);
+    printf("  -i  identity response to use as the cached identity\n");
+    printf("  -n  number of telemetry messages (default 1000)\n");
+    printf("  -c  number of commands (default 100)\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *identity_path = NULL;
+    unsigned long message_count = 1000;
+    unsigned long command_count = 100;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:n:c:h")) != -1) {
+        switch (opt) {
+            case 'i':
+                identity_path = optarg;
+                break;
+            case 'n':
+                message_count = strtoul(optarg, NULL, 10);
+                break;
+            case 'c':
+                command_count = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    if (!identity_path) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    bench_alloc_start(false);
+
+    IotConnectClientConfig config;
+    iotconnect_sdk_init_config(&config);
+    config.cpid = "BENCHCPID";
+    config.env = "bench";
+    config.duid = "benchdevice";
+    config.connection_type = IOTC_CT_AWS;
+    config.auth_info.type = IOTC_AT_X509;
+    config.auth_info.trust_store = "unused-ca.pem";
+    config.auth_info.data.cert_info.device_cert = "unused-crt.pem";
+    config.auth_info.data.cert_info.device_key = "unused-key.pem";
+    config.cmd_cb = on_command;
+    config.identity_cache_path = identity_path;
+    config.transport = iotc_loopback_transport();
+
+    int ret = iotconnect_sdk_init(&config);
+    if (ret) {
+        printf("iotconnect_sdk_init() failed with %d\n", ret);
+        return 2;
+    }
+    ret = iotconnect_sdk_connect();
+    if (ret) {
+        printf("iotconnect_sdk_connect() failed with %d\n", ret);
+        return 2;
+    }
+
+    char command[128];
+    for (unsigned long i = 0; i < message_count || i < command_count; i++) {
+        if (i < message_count) {
+            publish_telemetry(i);
+        }
+        if (i < command_count) {
+            int len = snprintf(command, sizeof(command),
+                               "{\"v\":\"2.1\",\"ct\":0,\"cmd\":\"set-parameter %lu\",\"ack\":\"ack-%lu\"}", i, i);
+            iotc_loopback_inject_c2d((const unsigned char *) command, (size_t) len);
+        }
+        iotconnect_sdk_receive();
+    }
+
+    iotconnect_sdk_disconnect();
+    iotconnect_sdk_deinit();
+    bench_alloc_stop();
+
+    BenchAllocStats alloc;
+    bench_alloc_get(&alloc);
+    IotConnectLoopbackStats loopback;
+    iotc_loopback_get_stats(&loopback);
+    printf("heap_supported=%d\n", bench_alloc_is_supported() ? 1 : 0);
+    printf("peak_heap_bytes=%llu\n", (unsigned long long) alloc.peak_bytes);
+    printf("allocations=%llu\n", (unsigned long long) alloc.allocations);
+    printf("publishes=%llu\n", (unsigned long long) loopback.publishes);
+    printf("commands=%lu\n", commands);
+    if (commands != command_count) {
+        printf("Expected %lu commands\n", command_count);
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,266 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+// Compares the memory use and publish throughput of the Paho and the lite MQTT transports against a local
+// TLS broker. Each transport runs in a process of its own, so that the resident memory of one does not
+// show up in the numbers of the other.
+
+#define _DEFAULT_SOURCE // nanosleep() and fork()
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "iotcl.h"
+#include "iotconnect.h"
+#include "iotc_clock.h"
+#include "iotc_device_client.h"
+#include "iotc_lite_mqtt.h"
+#include "bench_alloc.h"
+
+#define MAX_MESSAGE_SIZE (1024 * 1024)
+#define DRAIN_TIMEOUT_MS 30000
+
+typedef struct {
+    const char *transport; // paho, lite or all
+    const char *endpoint;
+    char *trust_store;
+    char *device_cert;
+    char *device_key;
+    unsigned long count;
+    size_t size;
+    int qos;
+} TransportOptions;
+
+static volatile unsigned long delivered = 0;
+static volatile unsigned long failed = 0;
+
+static void on_status(IotConnectMqttStatus status) {
+    if (status == IOTC_CS_MQTT_DELIVERED) {
+        __atomic_add_fetch(&delivered, 1, __ATOMIC_RELAXED);
+    } else if (status == IOTC_CS_MQTT_SEND_FAILED) {
+        __atomic_add_fetch(&failed, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void print_usage(const char *name) {
+    printf("Usage: %s -r trust_store -C cert -K key [-e host:port] [-b paho|lite|all] [-n count] [-s size] [-q qos]\n",
+           name);
+    printf("  -e  the broker (default localhost:8883). Its certificate must be valid for the host name.\n");
+    printf("  -b  transport to measure (default all, one after the other)\n");
+    printf("  -n  number of messages (default 20000)\n");
+    printf("  -s  message size in bytes (default 256)\n");
+    printf("  -q  QoS of the messages, 0 or 1 (default 1)\n");
+}
+
+static int parse_options(int argc, char *argv[], TransportOptions *o) {
+    int opt;
+    memset(o, 0, sizeof(TransportOptions));
+    o->transport = "all";
+    o->endpoint = "localhost:8883";
+    o->count = 20000;
+    o->size = 256;
+    o->qos = 1;
+    while ((opt = getopt(argc, argv, "r:C:K:e:b:n:s:q:h")) != -1) {
+        switch (opt) {
+            case 'r':
+                o->trust_store = optarg;
+                break;
+            case 'C':
+                o->device_cert = optarg;
+                break;
+            case 'K':
+                o->device_key = optarg;
+                break;
+            case 'e':
+                o->endpoint = optarg;
+                break;
+            case 'b':
+                o->transport = optarg;
+                break;
+            case 'n':
+                o->count = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                o->size = (size_t) strtoul(optarg, NULL, 10);
+                break;
+            case 'q':
+                o->qos = atoi(optarg) > 0 ? 1 : 0;
+                break;
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+    bool is_known = 0 == strcmp(o->transport, "paho") || 0 == strcmp(o->transport, "lite") ||
+                    0 == strcmp(o->transport, "all");
+    if (!o->trust_store || !o->device_cert || !o->device_key || !is_known || 0 == o->count ||
+        o->size < 2 || o->size > MAX_MESSAGE_SIZE) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
+// Reads a value like VmRSS or Threads from /proc/self/status
+static unsigned long read_proc_status(const char *name) {
+    char line[128];
+    unsigned long value = 0;
+    size_t name_len = strlen(name);
+    FILE *f = fopen("/proc/self/status", "r");
+    if (!f) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (0 == strncmp(line, name, name_len) && ':' == line[name_len]) {
+            value = strtoul(&line[name_len + 1], NULL, 10);
+            break;
+        }
+    }
+    fclose(f);
+    return value;
+}
+
+static void sleep_ms(unsigned int ms) {
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long) (ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
+static int run_transport(const TransportOptions *o, bool is_lite) {
+    static const char *endpoints[2];
+    endpoints[0] = o->endpoint;
+    endpoints[1] = NULL;
+
+    // Discovery and identity are answered by offline_sdk.c. The broker that the identity names does not exist,
+    // so the endpoint race picks the local one.
+    IotConnectClientConfig config;
+    iotconnect_sdk_init_config(&config);
+    config.cpid = "BENCHCPID";
+    config.env = "bench";
+    config.duid = "benchdevice";
+    config.connection_type = IOTC_CT_AWS;
+    config.auth_info.type = IOTC_AT_X509;
+    config.auth_info.trust_store = o->trust_store;
+    config.auth_info.data.cert_info.device_cert = o->device_cert;
+    config.auth_info.data.cert_info.device_key = o->device_key;
+    config.mqtt_endpoints.endpoints = endpoints;
+    config.status_cb = on_status;
+    config.transport = is_lite ? iotc_lite_mqtt_transport() : iotc_paho_transport();
+
+    char *message = malloc(o->size + 1);
+    if (!message) {
+        printf("Out of memory\n");
+        return 3;
+    }
+    message[0] = '"';
+    memset(&message[1], 'x', o->size - 2);
+    message[o->size - 1] = '"';
+    message[o->size] = 0;
+
+    int ret = iotconnect_sdk_init(&config);
+    if (ret) {
+        printf("iotconnect_sdk_init() failed with %d\n", ret);
+        return 2;
+    }
+    const char *topic = iotcl_mqtt_get_config()->pub_rpt;
+
+    unsigned long rss_before_kb = read_proc_status("VmRSS");
+    bench_alloc_start(false);
+    uint64_t start_us = iotc_clock_now_us();
+    ret = iotconnect_sdk_connect();
+    uint64_t connect_us = iotc_clock_now_us() - start_us;
+    if (ret) {
+        printf("iotconnect_sdk_connect() failed with %d\n", ret);
+        return 2;
+    }
+    BenchAllocStats connect_alloc;
+    bench_alloc_get(&connect_alloc);
+    unsigned long threads = read_proc_status("Threads");
+
+    __atomic_store_n(&delivered, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&failed, 0, __ATOMIC_RELAXED);
+    start_us = iotc_clock_now_us();
+    unsigned long errors = 0;
+    for (unsigned long i = 0; i < o->count; i++) {
+        if (iotc_device_client_send_message_qos(topic, message, o->qos)) {
+            errors++;
+        }
+        iotconnect_sdk_receive(); // picks up the PUBACKs with the lite transport
+    }
+    uint64_t drain_deadline_us = iotc_clock_now_us() + DRAIN_TIMEOUT_MS * 1000ULL;
+    while (__atomic_load_n(&delivered, __ATOMIC_RELAXED) + __atomic_load_n(&failed, __ATOMIC_RELAXED) + errors
+           < o->count && iotconnect_sdk_is_connected() && iotc_clock_now_us() < drain_deadline_us) {
+        iotconnect_sdk_receive();
+        sleep_ms(1);
+    }
+    uint64_t elapsed_us = iotc_clock_now_us() - start_us;
+    bench_alloc_stop();
+    BenchAllocStats alloc;
+    bench_alloc_get(&alloc);
+    unsigned long rss_after_kb = read_proc_status("VmRSS");
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    double seconds = (double) elapsed_us / 1e6;
+    unsigned long publish_allocations = (unsigned long) (alloc.allocations - connect_alloc.allocations);
+    printf("%-10s %9.1f %10.0f %8.2f %7lu %11lu %12lu %9ld %8lu\n",
+           is_lite ? "lite" : "paho",
+           (double) connect_us / 1000.0,
+           seconds > 0 ? (double) __atomic_load_n(&delivered, __ATOMIC_RELAXED) / seconds : 0.0,
+           (double) publish_allocations / (double) o->count,
+           __atomic_load_n(&failed, __ATOMIC_RELAXED) + errors,
+           (unsigned long) (alloc.peak_bytes / 1024),
+           rss_after_kb > rss_before_kb ? rss_after_kb - rss_before_kb : 0,
+           usage.ru_maxrss,
+           threads);
+
+    iotconnect_sdk_disconnect();
+    iotconnect_sdk_deinit();
+    free(message);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    TransportOptions o;
+    if (parse_options(argc, argv, &o)) {
+        return 1;
+    }
+    printf("%lu messages of %lu bytes at QoS %d%s\n", o.count, (unsigned long) o.size, o.qos,
+           bench_alloc_is_supported() ? "" : " (allocation counts need glibc)");
+    printf("%-10s %9s %10s %8s %7s %11s %12s %9s %8s\n",
+           "transport", "conn ms", "msg/s", "alloc/m", "failed", "heap KB", "RSS+ KB", "RSS KB", "threads");
+    fflush(stdout);
+
+    const char *transports[] = {"paho", "lite"};
+    int status = 0;
+    for (int i = 0; i < 2; i++) {
+        if (0 != strcmp(o.transport, "all") && 0 != strcmp(o.transport, transports[i])) {
+            continue;
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (0 == pid) {
+            int ret = run_transport(&o, 1 == i);
+            fflush(stdout);
+            _exit(ret);
+        }
+        int child_status = 0;
+        waitpid(pid, &child_status, 0);
+        if (!WIFEXITED(child_status) || WEXITSTATUS(child_status) != 0) {
+            status = 2;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+// Downloads an image with the SDK OTA downloader and reports throughput, retries and peak memory.
+// Run ota_server.py first, or point -u to any HTTP(S) URL.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "iotc_ota_download.h"
+
+typedef struct {
+    const char *url;
+    const char *path;
+    const char *sha256;
+    unsigned int connections;
+    size_t chunk_size;
+    bool is_fresh;
+    bool is_quiet;
+} OtaOptions;
+
+static void print_usage(const char *name) {
+    printf("Usage: %s [-u url] [-o file] [-s sha256] [-c connections] [-k chunk_size] [-f] [-q]\n", name);
+    printf("  -u  image URL (default http://127.0.0.1:8080/firmware.bin)\n");
+    printf("  -o  output file (default /tmp/iotc-ota-test.bin)\n");
+    printf("  -s  expected SHA-256 in hex\n");
+    printf("  -c  parallel connections (default 1, at most %d)\n", IOTC_OTA_MAX_CONNECTIONS);
+    printf("  -k  chunk size (default %d)\n", IOTC_OTA_DEFAULT_CHUNK_SIZE);
+    printf("  -f  delete the output file first instead of resuming\n");
+    printf("  -q  no progress output\n");
+}
+
+static int parse_options(int argc, char *argv[], OtaOptions *o) {
+    int opt;
+    o->url = "http://127.0.0.1:8080/firmware.bin";
+    o->path = "/tmp/iotc-ota-test.bin";
+    o->sha256 = NULL;
+    o->connections = 1;
+    o->chunk_size = IOTC_OTA_DEFAULT_CHUNK_SIZE;
+    o->is_fresh = false;
+    o->is_quiet = false;
+    while ((opt = getopt(argc, argv, "u:o:s:c:k:fqh")) != -1) {
+        switch (opt) {
+            case 'u':
+                o->url = optarg;
+                break;
+            case 'o':
+                o->path = optarg;
+                break;
+            case 's':
+                o->sha256 = optarg;
+                break;
+            case 'c':
+                o->connections = (unsigned int) strtoul(optarg, NULL, 10);
+                break;
+            case 'k':
+                o->chunk_size = (size_t) strtoul(optarg, NULL, 10);
+                break;
+            case 'f':
+                o->is_fresh = true;
+                break;
+            case 'q':
+                o->is_quiet = true;
+                break;
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+    if (0 == o->connections || 0 == o->chunk_size) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
+static void on_progress(const IotConnectOtaProgress *p, void *context) {
+    (void) context;
+    if (p->total) {
+        printf("  %llu / %llu bytes (%.1f%%), %.2f MB/s, %u retries\n",
+               (unsigned long long) p->received, (unsigned long long) p->total,
+               100.0 * (double) p->received / (double) p->total, p->bytes_per_second / 1e6, p->retries);
+    } else {
+        printf("  %llu bytes, %.2f MB/s, %u retries\n",
+               (unsigned long long) p->received, p->bytes_per_second / 1e6, p->retries);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    OtaOptions o;
+    if (parse_options(argc, argv, &o)) {
+        return 1;
+    }
+    if (o.is_fresh) {
+        remove(o.path);
+    }
+
+    IotConnectOtaDownloadConfig config;
+    iotc_ota_download_init_config(&config);
+    config.url = o.url;
+    config.path = o.path;
+    config.sha256 = o.sha256;
+    config.connections = o.connections;
+    config.chunk_size = o.chunk_size;
+    if (!o.is_quiet) {
+        config.progress_cb = on_progress;
+    }
+
+    IotConnectOtaProgress p;
+    int status = iotc_ota_download(&config, &p);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("%s: %llu bytes (%llu resumed) over %u connection(s) at %.2f MB/s, %u retries%s\n",
+           status ? "Failed" : "Done",
+           (unsigned long long) p.received, (unsigned long long) p.resumed_from, p.connections,
+           p.bytes_per_second / 1e6, p.retries, o.sha256 ? (status ? "" : ", SHA-256 verified") : "");
+    printf("Peak resident memory: %ld KB\n", usage.ru_maxrss);
+    return status ? 2 : 0;
+}
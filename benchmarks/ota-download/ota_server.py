@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+# Copyright (C) 2020-2024 Avnet
+# Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+
+"""Local stand-in for a firmware download server.
+
+Serves a generated image of the given size at any path, with support for single range requests.
+Use --drop-every to cut some responses short and exercise resume, and --no-ranges to emulate a server
+that always sends the whole image. The SHA-256 of the image is printed at startup.
+"""
+
+import argparse
+import hashlib
+import random
+import re
+import threading
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+counters = {"requests": 0, "dropped": 0, "bytes": 0}
+counters_lock = threading.Lock()
+
+
+class ImageHandler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    image = b""
+    drop_every = 0
+    support_ranges = True
+
+    def do_GET(self):
+        size = len(self.image)
+        begin, end = 0, size
+        partial = False
+        match = re.fullmatch(r"bytes=(\d+)-(\d*)", self.headers.get("Range", ""))
+        if self.support_ranges and match:
+            begin = int(match.group(1))
+            end = min(int(match.group(2)) + 1, size) if match.group(2) else size
+            if begin >= size or begin >= end:
+                self.send_response(416)
+                self.send_header("Content-Range", "bytes */%d" % size)
+                self.send_header("Content-Length", "0")
+                self.end_headers()
+                return
+            partial = True
+
+        with counters_lock:
+            counters["requests"] += 1
+            drop = self.drop_every and counters["requests"] % self.drop_every == 0
+            if drop:
+                counters["dropped"] += 1
+
+        self.send_response(206 if partial else 200)
+        self.send_header("Content-Type", "application/octet-stream")
+        self.send_header("Content-Length", str(end - begin))
+        if self.support_ranges:
+            self.send_header("Accept-Ranges", "bytes")
+        if partial:
+            self.send_header("Content-Range", "bytes %d-%d/%d" % (begin, end - 1, size))
+        self.end_headers()
+
+        if drop:
+            end = begin + (end - begin) // 2  # send half and hang up
+            self.close_connection = True
+        view = memoryview(self.image)
+        position = begin
+        try:
+            while position < end:
+                n = min(64 * 1024, end - position)
+                self.wfile.write(view[position:position + n])
+                position += n
+        except (BrokenPipeError, ConnectionResetError):
+            self.close_connection = True
+        with counters_lock:
+            counters["bytes"] += position - begin
+
+    def log_message(self, format, *args):
+        pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--size", type=int, default=32 * 1024 * 1024, help="image size in bytes")
+    parser.add_argument("--seed", type=int, default=1, help="seed for the image contents")
+    parser.add_argument("--drop-every", type=int, default=0, help="cut every Nth response in half")
+    parser.add_argument("--no-ranges", action="store_true", help="ignore Range headers")
+    parser.add_argument("--save", help="also write the image to this file")
+    args = parser.parse_args()
+
+    ImageHandler.image = random.Random(args.seed).randbytes(args.size)
+    ImageHandler.drop_every = args.drop_every
+    ImageHandler.support_ranges = not args.no_ranges
+    if args.save:
+        with open(args.save, "wb") as f:
+            f.write(ImageHandler.image)
+    print("Image: %d bytes, sha256 %s" % (args.size, hashlib.sha256(ImageHandler.image).hexdigest()), flush=True)
+
+    server = ThreadingHTTPServer(("127.0.0.1", args.port), ImageHandler)
+    print("Listening on http://127.0.0.1:%d/" % args.port, flush=True)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    print(counters)
+
+
+if __name__ == "__main__":
+    main()
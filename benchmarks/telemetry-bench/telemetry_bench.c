@@ -0,0 +1,397 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+// Compares number formatting and whole telemetry message serialization between the cJSON based
+// iotcl_telemetry_* path and the SDK telemetry writer.
+// Also checks over the whole double range that iotc_dtoa() output round-trips and that it is the shortest form
+// for all but CHECK_MAX_LONGER_PERCENT of the values, and exits with 4 if not.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "iotcl.h"
+#include "iotconnect.h"
+#include "iotc_clock.h"
+#include "iotc_dtoa.h"
+#include "iotc_telemetry_writer.h"
+#include "bench_alloc.h"
+#include "iotc_loopback_transport.h"
+
+#define MAX_CHANNELS IOTC_TELEMETRY_WRITER_MAX_FIELDS
+
+// random doubles over the whole range in the shortest and round-trip check, on top of the edge cases
+#define CHECK_RANDOM_VALUES 200000
+// Grisu2 is shortest for about 99.9% of doubles. A broken digit generation or rounding step shows up well above this.
+#define CHECK_MAX_LONGER_PERCENT 1.0
+
+typedef struct {
+    unsigned long values; // numbers to format in the formatting test
+    unsigned long messages; // messages to send in the message test
+    unsigned int channels; // numeric fields per message
+    int precision; // -1 for shortest round-trip
+} BenchOptions;
+
+typedef size_t (*FormatFunction)(double value, char *buffer);
+
+static int fixed_precision = 3;
+
+// What cJSON's print_number() does for every number in the tree
+static size_t format_cjson(double value, char *buffer) {
+    double test;
+    if (value != value || value - value != 0) {
+        memcpy(buffer, "null", 4);
+        return 4;
+    }
+    if (value == (double) (int) value) {
+        return (size_t) sprintf(buffer, "%d", (int) value);
+    }
+    int len = sprintf(buffer, "%1.15g", value);
+    if (1 != sscanf(buffer, "%lg", &test) || test != value) {
+        len = sprintf(buffer, "%1.17g", value);
+    }
+    return (size_t) len;
+}
+
+static size_t format_dtoa_fixed(double value, char *buffer) {
+    return iotc_dtoa_fixed(value, fixed_precision, buffer);
+}
+
+// A mix of what sensors typically report: noisy readings, ADC counts and small fractions
+static double generate_value(unsigned long i) {
+    switch (i % 4) {
+        case 0:
+            return 20.0 + (double) rand() / RAND_MAX * 10.0;
+        case 1:
+            return (double) (rand() % 4096);
+        case 2:
+            return (double) rand() / RAND_MAX;
+        default:
+            return -1000.0 + (double) (rand() % 200000) / 100.0;
+    }
+}
+
+// Returns the number of values that did not round-trip, if checked
+static unsigned long run_format_test(const char *name, FormatFunction format, const double *values,
+                                     unsigned long count, bool check_round_trip) {
+    char buffer[64];
+    size_t total_len = 0;
+    unsigned long mismatches = 0;
+    uint64_t start_us = iotc_clock_now_us();
+    for (unsigned long i = 0; i < count; i++) {
+        total_len += format(values[i], buffer);
+    }
+    uint64_t elapsed_us = iotc_clock_now_us() - start_us;
+
+    if (check_round_trip) {
+        for (unsigned long i = 0; i < count; i++) {
+            size_t len = format(values[i], buffer);
+            buffer[len] = 0;
+            if (strtod(buffer, NULL) != values[i]) {
+                mismatches++;
+            }
+        }
+    }
+    printf("  %-22s %8.1f ns/value  %5.2f chars/value", name, (double) elapsed_us * 1000.0 / (double) count,
+           (double) total_len / (double) count);
+    if (check_round_trip) {
+        printf("  round-trip mismatches: %lu", mismatches);
+    }
+    printf("\n");
+    return mismatches;
+}
+
+// xorshift64, so that the checked values do not depend on the C library
+static uint64_t next_random(void) {
+    static uint64_t state = 0x9E3779B97F4A7C15u;
+    state ^= state << 13u;
+    state ^= state >> 7u;
+    state ^= state << 17u;
+    return state;
+}
+
+// Significant digits of a formatted number, without leading and trailing zeros
+static int count_digits(const char *s) {
+    int digits = 0;
+    int trailing_zeros = 0;
+    for (; *s && 'e' != *s; s++) {
+        if (*s < '0' || *s > '9' || (0 == digits && '0' == *s)) {
+            continue;
+        }
+        digits++;
+        trailing_zeros = ('0' == *s) ? trailing_zeros + 1 : 0;
+    }
+    return digits - trailing_zeros;
+}
+
+// The fewest significant digits that parse back to the value, found by trying every precision
+static int count_shortest_digits(double value) {
+    char buffer[64];
+    for (int precision = 0; precision < 17; precision++) {
+        sprintf(buffer, "%.*e", precision, value);
+        if (strtod(buffer, NULL) == value) {
+            return precision + 1;
+        }
+    }
+    return 17;
+}
+
+typedef struct {
+    unsigned long values;
+    unsigned long mismatches; // did not parse back to the same double
+    unsigned long longer; // round-trip, but with more digits than the shortest form
+    int max_extra_digits;
+} CheckResult;
+
+static void check_value(double value, CheckResult *r) {
+    char buffer[IOTC_DTOA_BUFFER_SIZE + 1];
+    size_t len = iotc_dtoa(value, buffer);
+    buffer[len] = 0;
+    r->values++;
+    if (strtod(buffer, NULL) != value) {
+        if (r->mismatches++ < 10) {
+            printf("  %.17g was formatted as %s\n", value, buffer);
+        }
+        return;
+    }
+    if (0 == value) {
+        return;
+    }
+    int extra_digits = count_digits(buffer) - count_shortest_digits(value);
+    if (extra_digits > 0) {
+        r->longer++;
+        if (extra_digits > r->max_extra_digits) {
+            r->max_extra_digits = extra_digits;
+        }
+    }
+}
+
+// Edge cases (powers of two and ten, subnormals, the limits) and random bit patterns
+static bool run_dtoa_check(void) {
+    static const double edge_values[] = {
+            0.0, -0.0, 0.1, 0.2, 0.3, 1.0 / 3.0, 2.0 / 3.0, 1e-7, 1e21, 1e22, 1e23, 5e-324, 5e-310,
+            2.2250738585072009e-308, DBL_MIN, DBL_MAX, DBL_EPSILON, 9007199254740992.0, 9007199254740994.0,
+            123456789012345680.0, 1.7976931348623155e308, 4.35, 0.3 - 0.1, 29.99999999999999
+    };
+    CheckResult r = {0};
+    for (size_t i = 0; i < sizeof(edge_values) / sizeof(edge_values[0]); i++) {
+        check_value(edge_values[i], &r);
+        check_value(-edge_values[i], &r);
+    }
+    for (int e = -1074; e <= 1023; e++) {
+        // 2^e: subnormal below 2^-1022, where the rounding interval is not symmetric above
+        uint64_t bits = e < -1022 ? (uint64_t) 1u << (unsigned) (e + 1074) : (uint64_t) (e + 1023) << 52u;
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        check_value(value, &r);
+    }
+    for (int e = -323; e <= 308; e++) {
+        char buffer[16];
+        sprintf(buffer, "1e%d", e);
+        check_value(strtod(buffer, NULL), &r);
+    }
+    for (unsigned long i = 0; i < CHECK_RANDOM_VALUES; i++) {
+        uint64_t bits = next_random();
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        if (value != value || value - value != 0) {
+            continue; // NaN and infinity are written as null
+        }
+        check_value(value, &r);
+        // short decimals, like sensors report, are where a longer than needed output would show
+        check_value((double) (int64_t) (bits % 2000001u) / 1000.0 - 1000.0, &r);
+    }
+    double longer_percent = 100.0 * (double) r.longer / (double) r.values;
+    printf("  iotc_dtoa checked over %lu values: %lu round-trip mismatches, %lu (%.3f%%) longer than shortest"
+           " by up to %d digits\n", r.values, r.mismatches, r.longer, longer_percent, r.max_extra_digits);
+    return 0 == r.mismatches && longer_percent <= CHECK_MAX_LONGER_PERCENT;
+}
+
+static void print_message_result(const char *name, uint64_t elapsed_us, const BenchOptions *o,
+                                 uint64_t bytes, const BenchAllocStats *a) {
+    printf("  %-22s %8.2f us/message  %6.0f bytes/message", name, (double) elapsed_us / (double) o->messages,
+           (double) bytes / (double) o->messages);
+    if (bench_alloc_is_supported()) {
+        printf("  %6.1f allocations/message", (double) a->allocations / (double) o->messages);
+    }
+    printf("\n");
+}
+
+static uint64_t get_publish_bytes(void) {
+    IotConnectLoopbackStats stats;
+    iotc_loopback_get_stats(&stats);
+    return stats.publish_bytes;
+}
+
+static void run_message_test(const BenchOptions *o, const double *values, unsigned long value_count) {
+    char names[MAX_CHANNELS][24];
+    BenchAllocStats a;
+    for (unsigned int c = 0; c < o->channels; c++) {
+        // half of the channels are nested, like "coordinate.x"
+        if (c % 2) {
+            sprintf(names[c], "group%u.ch%u", c / 4, c);
+        } else {
+            sprintf(names[c], "ch%u", c);
+        }
+    }
+
+    uint64_t bytes_before = get_publish_bytes();
+    bench_alloc_start(true);
+    uint64_t start_us = iotc_clock_now_us();
+    for (unsigned long m = 0; m < o->messages; m++) {
+        IotclMessageHandle msg = iotcl_telemetry_create();
+        for (unsigned int c = 0; c < o->channels; c++) {
+            iotcl_telemetry_set_number(msg, names[c], values[(m * o->channels + c) % value_count]);
+        }
+        iotcl_mqtt_send_telemetry(msg, false);
+        iotcl_telemetry_destroy(msg);
+    }
+    uint64_t elapsed_us = iotc_clock_now_us() - start_us;
+    bench_alloc_stop();
+    bench_alloc_get(&a);
+    print_message_result("iotcl_telemetry (cJSON)", elapsed_us, o, get_publish_bytes() - bytes_before, &a);
+
+    static char buffer[4096];
+    static IotConnectTelemetryWriter w;
+    int slots[MAX_CHANNELS];
+    iotc_telemetry_writer_init(&w, buffer, sizeof(buffer));
+    w.include_timestamp = true; // iotcl adds it as well
+    for (unsigned int c = 0; c < o->channels; c++) {
+        slots[c] = iotc_telemetry_writer_add_field(&w, names[c], IOTC_TFT_NUMBER);
+        iotc_telemetry_writer_set_precision(&w, slots[c], o->precision);
+    }
+    if (iotc_telemetry_writer_compile(&w)) {
+        printf("Failed to compile the telemetry writer\n");
+        return;
+    }
+
+    bytes_before = get_publish_bytes();
+    bench_alloc_start(true);
+    start_us = iotc_clock_now_us();
+    for (unsigned long m = 0; m < o->messages; m++) {
+        for (unsigned int c = 0; c < o->channels; c++) {
+            iotc_telemetry_writer_set_number(&w, slots[c], values[(m * o->channels + c) % value_count]);
+        }
+        iotconnect_sdk_send_telemetry_writer(&w);
+    }
+    elapsed_us = iotc_clock_now_us() - start_us;
+    bench_alloc_stop();
+    bench_alloc_get(&a);
+    print_message_result(o->precision < 0 ? "telemetry writer" : "telemetry writer fixed", elapsed_us, o,
+                         get_publish_bytes() - bytes_before, &a);
+}
+
+static int init_sdk(void) {
+    IotConnectClientConfig config;
+    iotconnect_sdk_init_config(&config);
+    config.cpid = "BENCHCPID";
+    config.env = "bench";
+    config.duid = "benchdevice";
+    config.connection_type = IOTC_CT_AWS;
+    config.auth_info.type = IOTC_AT_X509;
+    config.auth_info.trust_store = "unused-ca.pem";
+    config.auth_info.data.cert_info.device_cert = "unused-crt.pem";
+    config.auth_info.data.cert_info.device_key = "unused-key.pem";
+    config.transport = iotc_loopback_transport();
+
+    int ret = iotconnect_sdk_init(&config);
+    if (ret) {
+        printf("iotconnect_sdk_init() failed with %d\n", ret);
+        return ret;
+    }
+    ret = iotconnect_sdk_connect();
+    if (ret) {
+        printf("iotconnect_sdk_connect() failed with %d\n", ret);
+        return ret;
+    }
+    return 0;
+}
+
+static void print_usage(const char *name) {
+    printf("Usage: %s [-v values] [-n messages] [-c channels] [-f decimals]\n", name);
+    printf("  -v  number of values in the formatting test (default 1000000)\n");
+    printf("  -n  number of messages in the message test (default 100000)\n");
+    printf("  -c  numeric fields per message, at most %d (default 16)\n", MAX_CHANNELS);
+    printf("  -f  send with a fixed number of decimals instead of the shortest round-trip format\n");
+}
+
+static int parse_options(int argc, char *argv[], BenchOptions *o) {
+    int opt;
+    o->values = 1000000;
+    o->messages = 100000;
+    o->channels = 16;
+    o->precision = -1;
+    while ((opt = getopt(argc, argv, "v:n:c:f:h")) != -1) {
+        switch (opt) {
+            case 'v':
+                o->values = strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                o->messages = strtoul(optarg, NULL, 10);
+                break;
+            case 'c':
+                o->channels = (unsigned int) strtoul(optarg, NULL, 10);
+                break;
+            case 'f':
+                o->precision = atoi(optarg);
+                break;
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+    if (0 == o->values || 0 == o->messages || 0 == o->channels || o->channels > MAX_CHANNELS
+        || o->precision > IOTC_DTOA_MAX_PRECISION) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions o;
+    if (parse_options(argc, argv, &o)) {
+        return 1;
+    }
+    srand(1234);
+
+    double *values = malloc(o.values * sizeof(double));
+    if (!values) {
+        printf("Out of memory\n");
+        return 3;
+    }
+    for (unsigned long i = 0; i < o.values; i++) {
+        values[i] = generate_value(i);
+    }
+
+    if (o.precision >= 0) {
+        fixed_precision = o.precision;
+    }
+    printf("Number formatting, %lu values:\n", o.values);
+    run_format_test("cJSON print_number", format_cjson, values, o.values, true);
+    bool is_correct = (0 == run_format_test("iotc_dtoa", iotc_dtoa, values, o.values, true));
+    char fixed_name[32];
+    sprintf(fixed_name, "iotc_dtoa_fixed (%d)", fixed_precision);
+    run_format_test(fixed_name, format_dtoa_fixed, values, o.values, false);
+    is_correct = run_dtoa_check() && is_correct;
+
+    if (init_sdk()) {
+        free(values);
+        return 2;
+    }
+    printf("Telemetry messages, %lu messages with %u numeric fields:\n", o.messages, o.channels);
+    run_message_test(&o, values, o.values);
+
+    iotconnect_sdk_disconnect();
+    iotconnect_sdk_deinit();
+    free(values);
+    return is_correct ? 0 : 4;
+}
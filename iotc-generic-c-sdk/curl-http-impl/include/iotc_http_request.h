@@ -5,14 +5,88 @@
 
 #ifndef IOTC_HTTP_REQUEST_H
 #define IOTC_HTTP_REQUEST_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern   "C" {
 #endif
+
+#ifndef IOTC_HTTP_DEFAULT_CONNECT_TIMEOUT_MS
+#define IOTC_HTTP_DEFAULT_CONNECT_TIMEOUT_MS 10000
+#endif
+
+#ifndef IOTC_HTTP_DEFAULT_TIMEOUT_MS
+#define IOTC_HTTP_DEFAULT_TIMEOUT_MS 30000
+#endif
+
+#ifndef IOTC_HTTP_DEFAULT_MAX_RESPONSE_SIZE
+#define IOTC_HTTP_DEFAULT_MAX_RESPONSE_SIZE (1024 * 1024)
+#endif
+
+typedef enum {
+    IOTC_HTTP_AUTO = 0, // GET, or POST if there is a body
+    IOTC_HTTP_GET,
+    IOTC_HTTP_POST,
+    IOTC_HTTP_PUT,
+    IOTC_HTTP_PATCH,
+    IOTC_HTTP_DELETE,
+    IOTC_HTTP_HEAD
+} IotConnectHttpMethod;
+
+typedef struct {
+    IotConnectHttpMethod method;
+    const char *content_type; // of the body. Default "application/json".
+    const char *content_encoding; // of the body, like "gzip". Optional.
+    const char *const *headers; // additional "Name: value" headers, terminated by NULL. Optional.
+    const void *body;
+    size_t body_len;
+    unsigned long connect_timeout_ms; // 0 for no limit
+    unsigned long timeout_ms; // for the whole request. 0 for no limit.
+    // Abort if fewer than low_speed_limit bytes per second are transferred for low_speed_time_ms. 0 disables.
+    unsigned long low_speed_limit;
+    unsigned long low_speed_time_ms;
+    size_t max_response_size; // larger responses fail the request. 0 for no limit.
+    bool allow_empty_response; // otherwise an empty response body is an error
+} IotConnectHttpRequestOptions;
+
+// Durations of the request phases, from curl
+typedef struct {
+    uint64_t dns_us;
+    uint64_t connect_us; // TCP
+    uint64_t tls_us; // 0 for plain HTTP or a reused connection
+    uint64_t first_byte_us; // from the request being sent to the first response byte
+    uint64_t total_us; // whole request, including redirects
+} IotConnectHttpTimings;
+
 typedef struct IotConnectHttpResponse {
-    char *data; // add flexibility for future, but at this point we only have response data
+    char *data; // response body, NUL terminated
+    size_t data_len;
+    long status_code; // 0 if there was no response
+    char *headers; // header lines of the final response, separated with CRLF
+    IotConnectHttpTimings timings;
 } IotConnectHttpResponse;
 
+// Optional. Lets requests share DNS lookups and TLS sessions until iotconnect_https_deinit().
+// Must not be called while requests are running.
+int iotconnect_https_init(void);
+
+void iotconnect_https_deinit(void);
+
+void iotconnect_https_init_options(IotConnectHttpRequestOptions *options);
+
+// Returns 0 on success, or a curl error code. A response with status 400 or more is an error,
+// but its body is still returned for diagnostics.
+// The response must always be freed with iotconnect_free_https_response()
+int iotconnect_https_request_with_options(
+        IotConnectHttpResponse *response,
+        const char *url,
+        const IotConnectHttpRequestOptions *options
+);
+
 // Helper to deal with http chunked transfers which are always returned by iotconnect services.
+// GET, or a POST of send_str as JSON, with the default timeouts.
 // Free data with iotconnect_free_https_response
 int iotconnect_https_request(
         IotConnectHttpResponse* response,
@@ -20,6 +94,10 @@ int iotconnect_https_request(
         const char *send_str
 );
 
+// Copies the value of the first response header with this name (case insensitive) into value.
+// Returns false if there is no such header or it does not fit.
+bool iotconnect_https_get_header(const IotConnectHttpResponse *response, const char *name, char *value, size_t value_size);
+
 void iotconnect_free_https_response(IotConnectHttpResponse* response);
 
 int curl_test(void);
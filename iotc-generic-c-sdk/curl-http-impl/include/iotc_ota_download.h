@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_OTA_DOWNLOAD_H
+#define IOTC_OTA_DOWNLOAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+/*
+ * Streaming firmware download.
+ *
+ * The image is written to a file, or handed to a custom sink like a flash partition writer, in fixed size chunks.
+ * Memory use depends on the chunk size and the number of connections, not on the size of the image.
+ * Interrupted transfers are resumed with HTTP Range requests. A file download also resumes across restarts
+ * from what is already in the file. If an expected SHA-256 is given, the digest is computed as the chunks arrive
+ * and the download fails if it does not match.
+ */
+
+#ifndef IOTC_OTA_DEFAULT_CHUNK_SIZE
+#define IOTC_OTA_DEFAULT_CHUNK_SIZE (16 * 1024)
+#endif
+
+#ifndef IOTC_OTA_MAX_CONNECTIONS
+#define IOTC_OTA_MAX_CONNECTIONS 8
+#endif
+
+#ifndef IOTC_OTA_DEFAULT_MAX_RETRIES
+#define IOTC_OTA_DEFAULT_MAX_RETRIES 5
+#endif
+
+#ifndef IOTC_OTA_DEFAULT_TIMEOUT_MS
+#define IOTC_OTA_DEFAULT_TIMEOUT_MS 30000
+#endif
+
+typedef struct {
+    uint64_t received; // bytes stored, including resumed_from
+    uint64_t total; // image size, 0 while unknown
+    uint64_t resumed_from; // bytes that were already stored when the download started
+    double bytes_per_second; // average over this download, excluding resumed_from
+    unsigned int retries;
+    unsigned int connections;
+} IotConnectOtaProgress;
+
+typedef void (*IotConnectOtaProgressCallback)(const IotConnectOtaProgress *progress, void *context);
+
+// Stores len bytes at offset and returns 0 on success. Each connection writes its range in order,
+// but with parallel connections the writes of different ranges are interleaved.
+typedef int (*IotConnectOtaWriteCallback)(uint64_t offset, const void *data, size_t len, void *context);
+
+// Reads back stored bytes and returns 0 on success.
+typedef int (*IotConnectOtaReadCallback)(uint64_t offset, void *data, size_t len, void *context);
+
+typedef struct {
+    const char *url;
+    const char *path; // file to download to. Ignored if write_cb is set.
+    IotConnectOtaWriteCallback write_cb; // custom sink
+    // Optional for a custom sink. Without it, the hash of a resumed download cannot be verified
+    // and parallel connections are not used when verifying.
+    IotConnectOtaReadCallback read_cb;
+    void *sink_context;
+    uint64_t resume_offset; // custom sink only: bytes stored by an earlier attempt
+    const char *sha256; // expected digest in hex. NULL skips verification.
+    size_t chunk_size; // bytes per write. The last write of a range can be shorter.
+    unsigned int connections; // fetch this many ranges in parallel, if the server supports ranges
+    unsigned int max_retries; // per connection
+    unsigned long timeout_ms; // a connection that receives nothing for this long is retried
+    unsigned long progress_interval_ms;
+    IotConnectOtaProgressCallback progress_cb;
+    void *cb_context;
+} IotConnectOtaDownloadConfig;
+
+void iotc_ota_download_init_config(IotConnectOtaDownloadConfig *c);
+
+// Blocks until the download completes or fails. progress is optional and receives the final state.
+int iotc_ota_download(const IotConnectOtaDownloadConfig *c, IotConnectOtaProgress *progress);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_OTA_DOWNLOAD_H
@@ -3,50 +3,255 @@
  * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
  */
 
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <curl/curl.h>
 #include "iotc_log.h"
+#include "iotc_thread.h"
+#include "iotc_dns_cache.h"
 #include "iotconnect.h"
 #include "iotc_http_request.h"
 
+#define MAX_HEADER_LENGTH 256
+// "+host:port:" followed by the bracketed addresses
+#define MAX_RESOLVE_LENGTH (IOTC_DNS_CACHE_MAX_HOST_LENGTH + 16 + IOTC_DNS_CACHE_MAX_ADDRESSES * (IOTC_DNS_CACHE_MAX_ADDRESS_LENGTH + 3))
+
+// Lookups and TLS sessions are shared between requests, so that identity can reuse what discovery found
+static CURLSH *share = NULL;
+static IotcMutex share_locks[CURL_LOCK_DATA_LAST];
+
 struct MemoryStruct {
     char *memory;
     size_t size;
+    size_t max_size;
+    bool is_too_large;
 };
 
-static size_t write_memory_cb(void *contents, size_t size, size_t nmemb, void *userp) {
-    size_t realsize = size * nmemb;
-    struct MemoryStruct *mem = (struct MemoryStruct *) userp;
+static bool memory_append(struct MemoryStruct *mem, const void *contents, size_t realsize) {
+    if (mem->max_size && mem->size + realsize > mem->max_size) {
+        mem->is_too_large = true;
+        return false;
+    }
 
     char *ptr = realloc(mem->memory, mem->size + realsize + 1);
     if (!ptr) {
         /* out of memory! */
         IOTC_ERROR("not enough memory (realloc returned NULL)");
-        return 0;
+        return false;
     }
 
     mem->memory = ptr;
     memcpy(&(mem->memory[mem->size]), contents, realsize);
     mem->size += realsize;
     mem->memory[mem->size] = 0;
+    return true;
+}
 
+static size_t write_memory_cb(void *contents, size_t size, size_t nmemb, void *userp) {
+    size_t realsize = size * nmemb;
+    if (!memory_append((struct MemoryStruct *) userp, contents, realsize)) {
+        return 0; // makes curl fail the transfer with CURLE_WRITE_ERROR
+    }
     return realsize;
 }
 
-int iotconnect_https_request(
+static size_t header_cb(char *buffer, size_t size, size_t nitems, void *userp) {
+    size_t realsize = size * nitems;
+    struct MemoryStruct *mem = (struct MemoryStruct *) userp;
+
+    // A status line starts the headers of the next response after a redirect or a 100 Continue.
+    // Keep only the last set of headers.
+    if (realsize >= 5 && 0 == strncmp(buffer, "HTTP/", 5)) {
+        mem->size = 0;
+        if (mem->memory) {
+            mem->memory[0] = 0;
+        }
+        return realsize;
+    }
+    if (!memory_append(mem, buffer, realsize)) {
+        return 0;
+    }
+    return realsize;
+}
+
+static void free_memory(struct MemoryStruct *mem) {
+    free(mem->memory);
+    mem->memory = NULL;
+    mem->size = 0;
+}
+
+static uint64_t get_time_us(CURL *curl, CURLINFO info) {
+    curl_off_t t = 0;
+    if (CURLE_OK != curl_easy_getinfo(curl, info, &t) || t < 0) {
+        return 0;
+    }
+    return (uint64_t) t;
+}
+
+// curl reports times from the start of the request. Convert them to phase durations.
+static void get_timings(CURL *curl, IotConnectHttpTimings *t) {
+    uint64_t dns = get_time_us(curl, CURLINFO_NAMELOOKUP_TIME_T);
+    uint64_t connect = get_time_us(curl, CURLINFO_CONNECT_TIME_T);
+    uint64_t tls = get_time_us(curl, CURLINFO_APPCONNECT_TIME_T);
+    uint64_t first_byte = get_time_us(curl, CURLINFO_STARTTRANSFER_TIME_T);
+    uint64_t ready = tls > connect ? tls : connect;
+    t->dns_us = dns;
+    t->connect_us = connect > dns ? connect - dns : 0;
+    t->tls_us = tls > connect ? tls - connect : 0;
+    t->first_byte_us = first_byte > ready ? first_byte - ready : 0;
+    t->total_us = get_time_us(curl, CURLINFO_TOTAL_TIME_T);
+}
+
+static const char *method_name(IotConnectHttpMethod method) {
+    switch (method) {
+        case IOTC_HTTP_PUT:
+            return "PUT";
+        case IOTC_HTTP_PATCH:
+            return "PATCH";
+        case IOTC_HTTP_DELETE:
+            return "DELETE";
+        default:
+            return NULL;
+    }
+}
+
+static struct curl_slist *append_header(struct curl_slist *list, const char *name, const char *value) {
+    char header[MAX_HEADER_LENGTH];
+    int len = snprintf(header, sizeof(header), "%s: %s", name, value);
+    if (len < 0 || (size_t) len >= sizeof(header)) {
+        IOTC_WARN("HTTP header %s is too long and was not sent", name);
+        return list;
+    }
+    struct curl_slist *new_list = curl_slist_append(list, header);
+    return new_list ? new_list : list;
+}
+
+static void share_lock_cb(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+    (void) handle;
+    (void) access;
+    (void) userptr;
+    iotc_mutex_lock(&share_locks[data]);
+}
+
+static void share_unlock_cb(CURL *handle, curl_lock_data data, void *userptr) {
+    (void) handle;
+    (void) userptr;
+    iotc_mutex_unlock(&share_locks[data]);
+}
+
+static bool get_host_and_port(const char *url, char *host, size_t host_size, long *port) {
+    bool is_found = false;
+    char *h = NULL;
+    char *p = NULL;
+    CURLU *u = curl_url();
+    if (u
+        && CURLUE_OK == curl_url_set(u, CURLUPART_URL, url, 0)
+        && CURLUE_OK == curl_url_get(u, CURLUPART_HOST, &h, 0)
+        && CURLUE_OK == curl_url_get(u, CURLUPART_PORT, &p, CURLU_DEFAULT_PORT)
+        && '[' != h[0] // no point in caching IPv6 literals
+        && strlen(h) < host_size) {
+        strcpy(host, h);
+        *port = strtol(p, NULL, 10);
+        is_found = true;
+    }
+    curl_free(h);
+    curl_free(p);
+    curl_url_cleanup(u);
+    return is_found;
+}
+
+// An entry with the "+" prefix expires from curl's (shared) cache like a normal lookup would
+static struct curl_slist *make_resolve_list(const char *host, long port, const IotConnectDnsAddress *addresses, size_t count) {
+    char entry[MAX_RESOLVE_LENGTH];
+    int len = snprintf(entry, sizeof(entry), "+%s:%ld:", host, port);
+    for (size_t i = 0; i < count && len > 0 && (size_t) len < sizeof(entry); i++) {
+        const char *format = strchr(addresses[i], ':') ? "%s[%s]" : "%s%s"; // IPv6 needs brackets
+        len += snprintf(&entry[len], sizeof(entry) - (size_t) len, format, i ? "," : "", addresses[i]);
+    }
+    if (len < 0 || (size_t) len >= sizeof(entry)) {
+        return NULL;
+    }
+    return curl_slist_append(NULL, entry);
+}
+
+static struct curl_slist *make_remove_list(const char *host, long port) {
+    char entry[IOTC_DNS_CACHE_MAX_HOST_LENGTH + 16];
+    snprintf(entry, sizeof(entry), "-%s:%ld", host, port);
+    return curl_slist_append(NULL, entry);
+}
+
+static bool is_connect_failure(CURL *curl, CURLcode res) {
+    curl_off_t connect_time = 0;
+    if (res == CURLE_COULDNT_CONNECT) {
+        return true;
+    }
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect_time);
+    return res == CURLE_OPERATION_TIMEDOUT && 0 == connect_time;
+}
+
+int iotconnect_https_init(void) {
+    if (share) {
+        return IOTCL_SUCCESS;
+    }
+    curl_global_init(CURL_GLOBAL_ALL); // held until iotconnect_https_deinit()
+    share = curl_share_init();
+    if (!share) {
+        IOTC_ERROR("iotconnect_https_init: Unable to create the curl share handle");
+        curl_global_cleanup();
+        return IOTCL_ERR_FAILED;
+    }
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        iotc_mutex_init(&share_locks[i]);
+    }
+    curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock_cb);
+    curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock_cb);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    // Connections are not shared, as curl does not support sharing them between threads
+    return IOTCL_SUCCESS;
+}
+
+void iotconnect_https_deinit(void) {
+    if (!share) {
+        return;
+    }
+    curl_share_cleanup(share);
+    share = NULL;
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        iotc_mutex_destroy(&share_locks[i]);
+    }
+    curl_global_cleanup();
+}
+
+void iotconnect_https_init_options(IotConnectHttpRequestOptions *options) {
+    memset(options, 0, sizeof(IotConnectHttpRequestOptions));
+    options->method = IOTC_HTTP_AUTO;
+    options->content_type = "application/json";
+    options->connect_timeout_ms = IOTC_HTTP_DEFAULT_CONNECT_TIMEOUT_MS;
+    options->timeout_ms = IOTC_HTTP_DEFAULT_TIMEOUT_MS;
+    options->max_response_size = IOTC_HTTP_DEFAULT_MAX_RESPONSE_SIZE;
+}
+
+int iotconnect_https_request_with_options(
         IotConnectHttpResponse *response,
         const char *url,
-        const char *send_str
+        const IotConnectHttpRequestOptions *options
 ) {
     CURL *curl;
-    CURLcode res = (!CURLE_OK); /* FIXME there's probably a better value to initialize this too */
+    CURLcode res = CURLE_FAILED_INIT;
 
     if (NULL == response) {
         IOTC_ERROR("iotconnect_https_request() requires a valid IotConnectHttpResponse pointer.");
         return res;
     }
-    response->data = NULL;
+    memset(response, 0, sizeof(IotConnectHttpResponse));
+    if (NULL == url || NULL == options) {
+        IOTC_ERROR("iotconnect_https_request() requires a URL and options.");
+        return res;
+    }
 
     /* In windows, this will init the winsock stuff */
     curl_global_init(CURL_GLOBAL_ALL);
@@ -54,44 +259,222 @@ int iotconnect_https_request(
     /* get a curl handle */
     curl = curl_easy_init();
     if (curl) {
-        struct MemoryStruct chunk;
+        struct MemoryStruct chunk = {0};
+        struct MemoryStruct headers = {0};
         chunk.memory = malloc(1);  /* will be grown as needed by the realloc above */
-        chunk.size = 0;    /* no data at this point */
+        if (chunk.memory) {
+            chunk.memory[0] = 0;
+        }
+        chunk.max_size = options->max_response_size;
+        headers.max_size = IOTC_HTTP_DEFAULT_MAX_RESPONSE_SIZE;
 
         struct curl_slist *header_slist = NULL;
-        header_slist = curl_slist_append(header_slist, "Content-Type: application/json");
-        curl_easy_setopt(curl, CURLOPT_FAILONERROR, 400);
+        if (options->body) {
+            header_slist = append_header(header_slist, "Content-Type",
+                                         options->content_type ? options->content_type : "application/json");
+            if (options->content_encoding) {
+                header_slist = append_header(header_slist, "Content-Encoding", options->content_encoding);
+            }
+        }
+        for (const char *const *h = options->headers; h && *h; h++) {
+            struct curl_slist *new_list = curl_slist_append(header_slist, *h);
+            if (new_list) {
+                header_slist = new_list;
+            }
+        }
+
         curl_easy_setopt(curl, CURLOPT_HTTPHEADER, header_slist);
         curl_easy_setopt(curl, CURLOPT_URL, url);
-        if (send_str) {
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, send_str);
+        if (options->body) {
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) options->body_len);
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, options->body);
+        }
+        switch (options->method) {
+            case IOTC_HTTP_GET:
+                curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+                break;
+            case IOTC_HTTP_POST:
+                curl_easy_setopt(curl, CURLOPT_POST, 1L);
+                if (!options->body) {
+                    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, 0L);
+                }
+                break;
+            case IOTC_HTTP_HEAD:
+                curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+                break;
+            case IOTC_HTTP_PUT:
+            case IOTC_HTTP_PATCH:
+            case IOTC_HTTP_DELETE:
+                curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method_name(options->method));
+                break;
+            default:
+                break;
         }
-        response->data = malloc(1); // start with 1 byte and regrow into write_memory_cb
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, (long) options->connect_timeout_ms);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long) options->timeout_ms);
+        if (options->low_speed_limit && options->low_speed_time_ms) {
+            // curl counts the low speed time in whole seconds
+            curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, (long) options->low_speed_limit);
+            curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long) ((options->low_speed_time_ms + 999) / 1000));
+        }
+        if (options->max_response_size) {
+            // fails early if the server announces a larger body
+            curl_easy_setopt(curl, CURLOPT_MAXFILESIZE_LARGE, (curl_off_t) options->max_response_size);
+        }
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L); // timeouts must not use signals in threaded programs
         curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_memory_cb);
         curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *) &chunk);
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_cb);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *) &headers);
+
+        if (share) {
+            curl_easy_setopt(curl, CURLOPT_SHARE, share);
+        }
+
+        char host[IOTC_DNS_CACHE_MAX_HOST_LENGTH];
+        long port = 0;
+        IotConnectDnsAddress addresses[IOTC_DNS_CACHE_MAX_ADDRESSES];
+        size_t address_count = 0;
+        bool is_cacheable = iotc_dns_cache_is_enabled() && get_host_and_port(url, host, sizeof(host), &port);
+        if (is_cacheable) {
+            address_count = iotc_dns_cache_get(host, addresses, IOTC_DNS_CACHE_MAX_ADDRESSES, false);
+        }
+
+        // A second attempt is made with a fresh lookup if the cached address did not work,
+        // or with expired cached addresses if the lookup failed
+        for (int attempt = 0; attempt < 2; attempt++) {
+            struct curl_slist *resolve_slist = NULL;
+            if (address_count) {
+                resolve_slist = make_resolve_list(host, port, (const IotConnectDnsAddress *) addresses, address_count);
+            } else if (attempt > 0) {
+                resolve_slist = make_remove_list(host, port); // drop what the first attempt put in the shared cache
+            }
+            curl_easy_setopt(curl, CURLOPT_RESOLVE, resolve_slist);
+            chunk.size = 0;
+            chunk.is_too_large = false;
+            if (chunk.memory) {
+                chunk.memory[0] = 0;
+            }
+            headers.size = 0;
+            if (headers.memory) {
+                headers.memory[0] = 0;
+            }
+
+            /* Perform the request, res will get the return code */
+            res = curl_easy_perform(curl);
+            curl_easy_setopt(curl, CURLOPT_RESOLVE, NULL);
+            curl_slist_free_all(resolve_slist);
+
+            if (!is_cacheable || attempt > 0) {
+                break;
+            }
+            if (address_count && is_connect_failure(curl, res)) {
+                IOTC_WARN("Unable to connect to the cached address of %s. Retrying with a new lookup.", host);
+                iotc_dns_cache_invalidate(host);
+                address_count = 0;
+            } else if (!address_count && res == CURLE_COULDNT_RESOLVE_HOST) {
+                address_count = iotc_dns_cache_get(host, addresses, IOTC_DNS_CACHE_MAX_ADDRESSES, true);
+                if (!address_count) {
+                    break;
+                }
+                IOTC_WARN("Unable to resolve %s. Retrying with its expired cached address.", host);
+            } else {
+                break;
+            }
+        }
+        if (is_cacheable && res == CURLE_OK && !address_count) {
+            // remember where curl's own lookup took us
+            char *ip = NULL;
+            if (CURLE_OK == curl_easy_getinfo(curl, CURLINFO_PRIMARY_IP, &ip) && ip && ip[0]
+                && strlen(ip) < IOTC_DNS_CACHE_MAX_ADDRESS_LENGTH) {
+                strcpy(addresses[0], ip);
+                iotc_dns_cache_put(host, (const IotConnectDnsAddress *) addresses, 1);
+            }
+        }
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response->status_code);
+        get_timings(curl, &response->timings);
 
-        /* Perform the request, res will get the return code */
-        res = curl_easy_perform(curl);
         /* Check for errors */
-        if (res != CURLE_OK) {
-            IOTC_ERROR("iotconnect_https_request() failed with error: \"%s\"", curl_easy_strerror(res));
-            free(chunk.memory);
-            chunk.memory = NULL;
-        } else if (chunk.size == 0) {
+        if (res == CURLE_OK && response->status_code >= 400) {
+            IOTC_ERROR("iotconnect_https_request() failed with HTTP status %ld", response->status_code);
+            res = CURLE_HTTP_RETURNED_ERROR; // keep the body, it usually says what went wrong
+        } else if (res != CURLE_OK) {
+            if (chunk.is_too_large || res == CURLE_FILESIZE_EXCEEDED) {
+                IOTC_ERROR("iotconnect_https_request(): Response is larger than %lu bytes",
+                           (unsigned long) options->max_response_size);
+            } else {
+                IOTC_ERROR("iotconnect_https_request() failed with error: \"%s\"", curl_easy_strerror(res));
+            }
+            free_memory(&chunk);
+        } else if (chunk.size == 0 && !options->allow_empty_response && options->method != IOTC_HTTP_HEAD) {
             IOTC_ERROR("iotconnect_https_request(): No data returned");
-            free(chunk.memory);
-            chunk.memory = NULL;
+            res = CURLE_GOT_NOTHING;
+            free_memory(&chunk);
         }
         response->data = chunk.memory;
+        response->data_len = chunk.size;
+        response->headers = headers.memory;
         /* always cleanup */
         curl_easy_cleanup(curl);
+        curl_slist_free_all(header_slist);
     }
     curl_global_cleanup();
     return (int) res;
 }
 
+int iotconnect_https_request(
+        IotConnectHttpResponse *response,
+        const char *url,
+        const char *send_str
+) {
+    IotConnectHttpRequestOptions options;
+    iotconnect_https_init_options(&options);
+    options.body = send_str;
+    options.body_len = send_str ? strlen(send_str) : 0;
+    return iotconnect_https_request_with_options(response, url, &options);
+}
+
+bool iotconnect_https_get_header(const IotConnectHttpResponse *response, const char *name, char *value, size_t value_size) {
+    if (!response || !response->headers || !name || !value || 0 == value_size) {
+        return false;
+    }
+    size_t name_len = strlen(name);
+    const char *line = response->headers;
+    while (*line) {
+        const char *end = strstr(line, "\r\n");
+        if (!end) {
+            end = line + strlen(line);
+        }
+        if ((size_t) (end - line) > name_len && ':' == line[name_len]) {
+            size_t i;
+            for (i = 0; i < name_len; i++) {
+                if (tolower((unsigned char) line[i]) != tolower((unsigned char) name[i])) {
+                    break;
+                }
+            }
+            if (i == name_len) {
+                const char *v = line + name_len + 1;
+                while (v < end && (' ' == *v || '\t' == *v)) {
+                    v++;
+                }
+                size_t len = (size_t) (end - v);
+                if (len >= value_size) {
+                    return false;
+                }
+                memcpy(value, v, len);
+                value[len] = 0;
+                return true;
+            }
+        }
+        line = *end ? end + 2 : end;
+    }
+    return false;
+}
 
 void iotconnect_free_https_response(IotConnectHttpResponse *response) {
     free(response->data);
     response->data = NULL;
+    response->data_len = 0;
+    free(response->headers);
+    response->headers = NULL;
 }
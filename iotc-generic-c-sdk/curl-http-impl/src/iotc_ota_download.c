@@ -0,0 +1,702 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#if !defined(_POSIX_C_SOURCE)
+// for fseeko() with -std=c99
+#define _POSIX_C_SOURCE 200809L
+#endif
+// images over 2 GB on 32-bit systems
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curl/curl.h>
+#include <openssl/evp.h>
+#include "iotcl.h"
+#include "iotc_log.h"
+#include "iotc_clock.h"
+#include "iotc_ota_download.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#define file_seek(f, offset) _fseeki64((f), (__int64) (offset), SEEK_SET)
+#else
+#define file_seek(f, offset) fseeko((f), (off_t) (offset), SEEK_SET)
+#endif
+
+// Exists while a parallel download to a file is in progress. Such a file can have holes, so it is not resumed.
+#define PARALLEL_SUFFIX ".parallel"
+
+#define SHA256_SIZE 32
+#define INITIAL_RETRY_MS 1000
+#define MAX_RETRY_MS 30000
+
+typedef struct Download Download;
+
+// One connection and the range assigned to it
+typedef struct {
+    Download *d;
+    CURL *curl;
+    uint64_t begin;
+    uint64_t end; // exclusive. 0 while the size is unknown.
+    uint64_t flushed; // bytes from begin up to here are stored
+    uint64_t flushed_at_request; // to tell whether a failed request made progress
+    unsigned char *buffer; // one chunk
+    size_t filled;
+    unsigned int retries;
+    uint64_t retry_at_ms;
+    bool is_active; // added to the multi handle
+    bool is_done;
+    bool is_response_checked;
+} Segment;
+
+struct Download {
+    const IotConnectOtaDownloadConfig *c;
+    IotConnectOtaWriteCallback write_cb;
+    IotConnectOtaReadCallback read_cb;
+    void *sink_context;
+    FILE *file;
+    char *marker_path;
+    size_t chunk_size;
+    EVP_MD_CTX *md;
+    unsigned char expected_hash[SHA256_SIZE];
+    uint64_t hashed; // bytes from the start of the image up to here went into the digest
+    unsigned char *scratch; // for hashing stored data
+    CURLM *multi;
+    Segment segments[IOTC_OTA_MAX_CONNECTIONS];
+    unsigned int segment_count;
+    IotConnectOtaProgress progress;
+    uint64_t start_ms;
+    int error;
+};
+
+static int file_write(uint64_t offset, const void *data, size_t len, void *context) {
+    Download *d = (Download *) context;
+    if (0 != file_seek(d->file, offset) || len != fwrite(data, 1, len, d->file)) {
+        return IOTCL_ERR_FAILED;
+    }
+    return IOTCL_SUCCESS;
+}
+
+static int file_read(uint64_t offset, void *data, size_t len, void *context) {
+    Download *d = (Download *) context;
+    if (0 != file_seek(d->file, offset) || len != fread(data, 1, len, d->file)) {
+        return IOTCL_ERR_FAILED;
+    }
+    return IOTCL_SUCCESS;
+}
+
+static uint64_t file_size(FILE *f) {
+    if (0 != fseek(f, 0, SEEK_END)) {
+        return 0;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    __int64 size = _ftelli64(f);
+#else
+    off_t size = ftello(f);
+#endif
+    return size > 0 ? (uint64_t) size : 0;
+}
+
+static int parse_hash(const char *hex, unsigned char *hash) {
+    if (strlen(hex) != SHA256_SIZE * 2) {
+        return IOTCL_ERR_BAD_VALUE;
+    }
+    for (int i = 0; i < SHA256_SIZE * 2; i++) {
+        int c = tolower((unsigned char) hex[i]);
+        int v;
+        if (c >= '0' && c <= '9') {
+            v = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            v = c - 'a' + 10;
+        } else {
+            return IOTCL_ERR_BAD_VALUE;
+        }
+        if (i % 2) {
+            hash[i / 2] = (unsigned char) (hash[i / 2] | v);
+        } else {
+            hash[i / 2] = (unsigned char) (v << 4);
+        }
+    }
+    return IOTCL_SUCCESS;
+}
+
+// Hashes stored data up to the given offset by reading it back from the sink
+static int hash_stored(Download *d, uint64_t to) {
+    while (d->hashed < to) {
+        size_t len = (to - d->hashed < d->chunk_size) ? (size_t) (to - d->hashed) : d->chunk_size;
+        if (d->read_cb(d->hashed, d->scratch, len, d->sink_context)) {
+            IOTC_ERROR("OTA: Failed to read back stored data at offset %llu", (unsigned long long) d->hashed);
+            return IOTCL_ERR_FAILED;
+        }
+        EVP_DigestUpdate(d->md, d->scratch, len);
+        d->hashed += len;
+    }
+    return IOTCL_SUCCESS;
+}
+
+// The range that continues the digest is hashed straight from its chunks.
+// Other ranges are stored first and read back once everything before them is hashed.
+static int hash_catch_up(Download *d) {
+    for (unsigned int i = 0; i < d->segment_count; i++) {
+        Segment *s = &d->segments[i];
+        if (s->begin <= d->hashed && d->hashed < s->flushed) {
+            int status = hash_stored(d, s->flushed);
+            if (status) {
+                return status;
+            }
+        }
+    }
+    return IOTCL_SUCCESS;
+}
+
+static int flush_chunk(Segment *s) {
+    Download *d = s->d;
+    if (0 == s->filled) {
+        return IOTCL_SUCCESS;
+    }
+    if (d->write_cb(s->flushed, s->buffer, s->filled, d->sink_context)) {
+        IOTC_ERROR("OTA: Failed to store %lu bytes at offset %llu", (unsigned long) s->filled,
+                   (unsigned long long) s->flushed);
+        return IOTCL_ERR_FAILED;
+    }
+    if (d->md && d->hashed == s->flushed) {
+        EVP_DigestUpdate(d->md, s->buffer, s->filled);
+        d->hashed += s->filled;
+    }
+    s->flushed += s->filled;
+    d->progress.received += s->filled;
+    s->filled = 0;
+    return d->md ? hash_catch_up(d) : IOTCL_SUCCESS;
+}
+
+// The server sent the whole image in response to a range request
+static int restart_from_zero(Segment *s) {
+    Download *d = s->d;
+    IOTC_WARN("OTA: The server does not support ranges. Downloading from the start.");
+    s->begin = 0;
+    s->flushed = 0;
+    s->flushed_at_request = 0;
+    d->progress.received = 0;
+    d->progress.resumed_from = 0;
+    if (d->md) {
+        EVP_DigestInit_ex(d->md, EVP_sha256(), NULL);
+        d->hashed = 0;
+    }
+    if (d->file) {
+        // drop the old contents in case the new image is shorter
+        d->file = freopen(d->c->path, "w+b", d->file);
+        if (!d->file) {
+            IOTC_ERROR("OTA: Unable to truncate %s", d->c->path);
+            return IOTCL_ERR_FAILED;
+        }
+    }
+    return IOTCL_SUCCESS;
+}
+
+static bool check_response(Segment *s) {
+    Download *d = s->d;
+    long code = 0;
+    curl_off_t content_length = -1;
+    curl_easy_getinfo(s->curl, CURLINFO_RESPONSE_CODE, &code);
+    curl_easy_getinfo(s->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length);
+    s->is_response_checked = true;
+
+    if (200 == code && (s->flushed > 0 || d->segment_count > 1)) {
+        if (d->segment_count > 1) {
+            IOTC_ERROR("OTA: The server stopped honoring range requests.");
+            return false;
+        }
+        if (restart_from_zero(s)) {
+            return false;
+        }
+    }
+    if (0 == s->end && content_length > 0) {
+        s->end = s->flushed + (uint64_t) content_length;
+        d->progress.total = s->end;
+    }
+    return true;
+}
+
+static size_t on_data(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    Segment *s = (Segment *) userdata;
+    Download *d = s->d;
+    const size_t len = size * nmemb;
+
+    if (!s->is_response_checked && !check_response(s)) {
+        d->error = IOTCL_ERR_FAILED;
+        return 0;
+    }
+    if (s->end && s->flushed + s->filled + len > s->end) {
+        IOTC_ERROR("OTA: Received more data than requested.");
+        d->error = IOTCL_ERR_FAILED;
+        return 0;
+    }
+
+    const char *p = ptr;
+    size_t left = len;
+    while (left) {
+        size_t n = d->chunk_size - s->filled;
+        n = n < left ? n : left;
+        memcpy(&s->buffer[s->filled], p, n);
+        s->filled += n;
+        p += n;
+        left -= n;
+        if (s->filled == d->chunk_size && flush_chunk(s)) {
+            d->error = IOTCL_ERR_FAILED;
+            return 0;
+        }
+    }
+    return len;
+}
+
+static size_t on_probe_header(char *buffer, size_t size, size_t nitems, void *userdata) {
+    static const char name[] = "content-range:";
+    const size_t len = size * nitems;
+    uint64_t *total = (uint64_t *) userdata;
+    if (len < sizeof(name)) {
+        return len;
+    }
+    for (size_t i = 0; i < sizeof(name) - 1; i++) {
+        if (tolower((unsigned char) buffer[i]) != name[i]) {
+            return len;
+        }
+    }
+    // Content-Range: bytes 0-0/12345. The size can also be "*".
+    const char *slash = memchr(buffer, '/', len);
+    if (slash && isdigit((unsigned char) slash[1])) {
+        *total = strtoull(slash + 1, NULL, 10);
+    }
+    return len;
+}
+
+static size_t on_probe_data(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    (void) ptr;
+    size_t *received = (size_t *) userdata;
+    *received += size * nmemb;
+    return (*received > 1) ? 0 : size * nmemb; // abort if the server is sending the whole image
+}
+
+// Requests the first byte to learn the image size and whether the server supports ranges
+static uint64_t probe(CURL *curl, bool *supports_ranges) {
+    uint64_t range_total = 0;
+    size_t received = 0;
+    long code = 0;
+    curl_off_t content_length = -1;
+
+    curl_easy_setopt(curl, CURLOPT_RANGE, "0-0");
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, on_probe_header);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &range_total);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, on_probe_data);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &received);
+    CURLcode res = curl_easy_perform(curl);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, NULL);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, NULL);
+
+    *supports_ranges = false;
+    if (206 == code) {
+        *supports_ranges = true;
+        return range_total;
+    }
+    if (200 == code) {
+        return content_length > 0 ? (uint64_t) content_length : 0;
+    }
+    IOTC_WARN("OTA: Unable to determine the image size (%s, HTTP %ld).", curl_easy_strerror(res), code);
+    return 0;
+}
+
+static void setup_handle(Segment *s) {
+    const IotConnectOtaDownloadConfig *c = s->d->c;
+    long timeout_s = (long) ((c->timeout_ms + 999) / 1000);
+    curl_easy_setopt(s->curl, CURLOPT_URL, c->url);
+    curl_easy_setopt(s->curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(s->curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(s->curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(s->curl, CURLOPT_CONNECTTIMEOUT_MS, (long) c->timeout_ms);
+    // less than a byte per second for timeout_ms
+    curl_easy_setopt(s->curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(s->curl, CURLOPT_LOW_SPEED_TIME, timeout_s > 0 ? timeout_s : 1L);
+    curl_easy_setopt(s->curl, CURLOPT_PRIVATE, s);
+    curl_easy_setopt(s->curl, CURLOPT_WRITEFUNCTION, on_data);
+    curl_easy_setopt(s->curl, CURLOPT_WRITEDATA, s);
+}
+
+static void start_request(Segment *s) {
+    char range[48];
+    const uint64_t from = s->flushed;
+    if (s->end) {
+        snprintf(range, sizeof(range), "%llu-%llu", (unsigned long long) from, (unsigned long long) (s->end - 1));
+    } else {
+        snprintf(range, sizeof(range), "%llu-", (unsigned long long) from);
+    }
+    curl_easy_setopt(s->curl, CURLOPT_RANGE, (s->end || from) ? range : NULL);
+    s->is_response_checked = false;
+    s->flushed_at_request = from;
+    curl_multi_add_handle(s->d->multi, s->curl);
+    s->is_active = true;
+}
+
+static void finish_request(Segment *s, CURLcode result) {
+    Download *d = s->d;
+    curl_multi_remove_handle(d->multi, s->curl);
+    s->is_active = false;
+    if (d->error) {
+        return;
+    }
+    // keep what arrived so that the retry continues from there
+    if (flush_chunk(s)) {
+        d->error = IOTCL_ERR_FAILED;
+        return;
+    }
+    if (CURLE_OK == result && (0 == s->end || s->flushed == s->end)) {
+        s->is_done = true;
+        if (0 == s->end) {
+            d->progress.total = s->flushed; // size was not known up front
+        }
+        return;
+    }
+
+    if (CURLE_OK == result) {
+        IOTC_WARN("OTA: Connection closed at offset %llu of %llu.", (unsigned long long) s->flushed,
+                  (unsigned long long) s->end);
+    } else {
+        IOTC_WARN("OTA: Transfer failed at offset %llu: %s", (unsigned long long) s->flushed,
+                  curl_easy_strerror(result));
+    }
+    if (s->flushed > s->flushed_at_request) {
+        s->retries = 0; // only count retries that make no progress
+    }
+    if (s->retries >= d->c->max_retries) {
+        IOTC_ERROR("OTA: Giving up after %u retries.", s->retries);
+        d->error = IOTCL_ERR_FAILED;
+        return;
+    }
+    unsigned long delay_ms = INITIAL_RETRY_MS << (s->retries < 5 ? s->retries : 5);
+    delay_ms = delay_ms < MAX_RETRY_MS ? delay_ms : MAX_RETRY_MS;
+    s->retries++;
+    s->retry_at_ms = iotc_clock_now_ms() + delay_ms;
+    d->progress.retries++;
+}
+
+static void update_rate(Download *d) {
+    uint64_t elapsed_ms = iotc_clock_now_ms() - d->start_ms;
+    if (elapsed_ms > 0) {
+        d->progress.bytes_per_second =
+                (double) (d->progress.received - d->progress.resumed_from) * 1000.0 / (double) elapsed_ms;
+    }
+}
+
+static void report_progress(Download *d) {
+    if (d->c->progress_cb) {
+        update_rate(d);
+        d->c->progress_cb(&d->progress, d->c->cb_context);
+    }
+}
+
+static int run_transfers(Download *d) {
+    uint64_t next_report_ms = d->start_ms + d->c->progress_interval_ms;
+    while (!d->error) {
+        const uint64_t now_ms = iotc_clock_now_ms();
+        bool is_finished = true;
+        for (unsigned int i = 0; i < d->segment_count; i++) {
+            Segment *s = &d->segments[i];
+            if (s->is_done) {
+                continue;
+            }
+            is_finished = false;
+            if (!s->is_active && now_ms >= s->retry_at_ms) {
+                start_request(s);
+            }
+        }
+        if (is_finished) {
+            break;
+        }
+
+        int running = 0;
+        int left = 0;
+        CURLMsg *msg;
+        curl_multi_perform(d->multi, &running);
+        while ((msg = curl_multi_info_read(d->multi, &left))) {
+            if (CURLMSG_DONE == msg->msg) {
+                Segment *s = NULL;
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &s);
+                finish_request(s, msg->data.result);
+            }
+        }
+        if (d->c->progress_cb && now_ms >= next_report_ms) {
+            report_progress(d);
+            next_report_ms = now_ms + d->c->progress_interval_ms;
+        }
+        // unlike curl_multi_wait(), this also sleeps while only retries are pending
+        curl_multi_poll(d->multi, NULL, 0, running ? 100 : 50, NULL);
+    }
+    return d->error;
+}
+
+// Splits what is left to download into chunk aligned ranges, one per connection
+static void plan_segments(Download *d, uint64_t from, uint64_t total, unsigned int connections) {
+    if (0 == total) {
+        d->segment_count = 1;
+        d->segments[0].begin = from;
+        d->segments[0].end = 0;
+        d->segments[0].flushed = from;
+        return;
+    }
+    const uint64_t remaining = total - from;
+    const uint64_t chunks = (remaining + d->chunk_size - 1) / d->chunk_size;
+    if (connections > chunks) {
+        connections = chunks > 0 ? (unsigned int) chunks : 1;
+    }
+    const uint64_t chunks_per_segment = (chunks + connections - 1) / connections;
+    uint64_t begin = from;
+    d->segment_count = 0;
+    while (begin < total || 0 == d->segment_count) {
+        Segment *s = &d->segments[d->segment_count++];
+        uint64_t end = begin + chunks_per_segment * d->chunk_size;
+        s->begin = begin;
+        s->end = end < total ? end : total;
+        s->flushed = begin;
+        s->is_done = (s->begin == s->end);
+        begin = s->end;
+    }
+}
+
+static int verify_hash(Download *d) {
+    unsigned char hash[SHA256_SIZE];
+    unsigned int hash_len = 0;
+    if (d->hashed != d->progress.received) {
+        IOTC_ERROR("OTA: Only %llu of %llu bytes were hashed.", (unsigned long long) d->hashed,
+                   (unsigned long long) d->progress.received);
+        return IOTCL_ERR_FAILED;
+    }
+    EVP_DigestFinal_ex(d->md, hash, &hash_len);
+    if (hash_len != SHA256_SIZE || 0 != memcmp(hash, d->expected_hash, SHA256_SIZE)) {
+        IOTC_ERROR("OTA: SHA-256 of the downloaded image does not match.");
+        return IOTCL_ERR_BAD_VALUE;
+    }
+    return IOTCL_SUCCESS;
+}
+
+static int open_file(Download *d) {
+    const char *path = d->c->path;
+    size_t len = strlen(path);
+    d->marker_path = malloc(len + sizeof(PARALLEL_SUFFIX));
+    if (!d->marker_path) {
+        IOTC_ERROR("OTA: Out of memory!");
+        return IOTCL_ERR_OUT_OF_MEMORY;
+    }
+    memcpy(d->marker_path, path, len);
+    memcpy(&d->marker_path[len], PARALLEL_SUFFIX, sizeof(PARALLEL_SUFFIX));
+
+    FILE *marker = fopen(d->marker_path, "rb");
+    if (marker) {
+        fclose(marker);
+        IOTC_INFO("OTA: %s is left over from a parallel download. Starting over.", path);
+    } else {
+        d->file = fopen(path, "r+b");
+    }
+    if (d->file) {
+        d->progress.resumed_from = file_size(d->file);
+    } else {
+        d->file = fopen(path, "w+b");
+    }
+    if (!d->file) {
+        IOTC_ERROR("OTA: Unable to open %s", path);
+        return IOTCL_ERR_FAILED;
+    }
+    d->write_cb = file_write;
+    d->read_cb = file_read;
+    d->sink_context = d;
+    return IOTCL_SUCCESS;
+}
+
+void iotc_ota_download_init_config(IotConnectOtaDownloadConfig *c) {
+    memset(c, 0, sizeof(IotConnectOtaDownloadConfig));
+    c->chunk_size = IOTC_OTA_DEFAULT_CHUNK_SIZE;
+    c->connections = 1;
+    c->max_retries = IOTC_OTA_DEFAULT_MAX_RETRIES;
+    c->timeout_ms = IOTC_OTA_DEFAULT_TIMEOUT_MS;
+    c->progress_interval_ms = 1000;
+}
+
+int iotc_ota_download(const IotConnectOtaDownloadConfig *c, IotConnectOtaProgress *progress) {
+    int status = IOTCL_SUCCESS;
+    bool supports_ranges = false;
+    bool is_curl_initialized = false;
+    Download *d;
+
+    if (!c->url || (!c->path && !c->write_cb)) {
+        IOTC_ERROR("iotc_ota_download: URL and a path or a write callback are required.");
+        return IOTCL_ERR_MISSING_VALUE;
+    }
+
+    // calloc, because the segments make this a bit large for the stack of a callback
+    d = calloc(1, sizeof(Download));
+    if (!d) {
+        IOTC_ERROR("iotc_ota_download: Out of memory!");
+        return IOTCL_ERR_OUT_OF_MEMORY;
+    }
+    d->c = c;
+    d->chunk_size = c->chunk_size ? c->chunk_size : IOTC_OTA_DEFAULT_CHUNK_SIZE;
+    d->start_ms = iotc_clock_now_ms();
+
+    if (c->write_cb) {
+        d->write_cb = c->write_cb;
+        d->read_cb = c->read_cb;
+        d->sink_context = c->sink_context;
+        d->progress.resumed_from = c->resume_offset;
+    } else {
+        status = open_file(d);
+        if (status) goto cleanup; // called function will print the error
+    }
+
+    if (c->sha256) {
+        if (parse_hash(c->sha256, d->expected_hash)) {
+            IOTC_ERROR("iotc_ota_download: The SHA-256 must be 64 hex characters.");
+            status = IOTCL_ERR_BAD_VALUE;
+            goto cleanup;
+        }
+        d->md = EVP_MD_CTX_new();
+        d->scratch = malloc(d->chunk_size);
+        if (!d->md || !d->scratch || !EVP_DigestInit_ex(d->md, EVP_sha256(), NULL)) {
+            IOTC_ERROR("iotc_ota_download: Unable to set up hashing.");
+            status = IOTCL_ERR_OUT_OF_MEMORY;
+            goto cleanup;
+        }
+    }
+
+    unsigned int connections = c->connections ? c->connections : 1;
+    if (connections > IOTC_OTA_MAX_CONNECTIONS) {
+        connections = IOTC_OTA_MAX_CONNECTIONS;
+    }
+    if (d->md && !d->read_cb) {
+        connections = 1; // out of order data could not be hashed
+        if (d->progress.resumed_from > 0) {
+            IOTC_ERROR("iotc_ota_download: Verifying a resumed download requires a read callback.");
+            status = IOTCL_ERR_CONFIG_MISSING;
+            goto cleanup;
+        }
+    }
+
+    curl_global_init(CURL_GLOBAL_ALL);
+    is_curl_initialized = true;
+    d->multi = curl_multi_init();
+    for (unsigned int i = 0; i < connections; i++) {
+        Segment *s = &d->segments[i];
+        s->d = d;
+        s->curl = curl_easy_init();
+        s->buffer = malloc(d->chunk_size);
+        if (!s->curl || !s->buffer) {
+            IOTC_ERROR("iotc_ota_download: Out of memory!");
+            status = IOTCL_ERR_OUT_OF_MEMORY;
+            goto cleanup;
+        }
+        setup_handle(s);
+    }
+    if (!d->multi) {
+        IOTC_ERROR("iotc_ota_download: Out of memory!");
+        status = IOTCL_ERR_OUT_OF_MEMORY;
+        goto cleanup;
+    }
+
+    d->progress.total = probe(d->segments[0].curl, &supports_ranges);
+    setup_handle(&d->segments[0]); // restore the callbacks
+    uint64_t from = d->progress.resumed_from;
+    if (d->progress.total > 0 && (!supports_ranges || from > d->progress.total)) {
+        if (from > 0) {
+            IOTC_WARN("OTA: Unable to resume. Downloading from the start.");
+        }
+        from = 0;
+    }
+    if (d->file && 0 == from && d->progress.resumed_from > 0) {
+        d->file = freopen(c->path, "w+b", d->file);
+        if (!d->file) {
+            IOTC_ERROR("OTA: Unable to truncate %s", c->path);
+            status = IOTCL_ERR_FAILED;
+            goto cleanup;
+        }
+    }
+    d->progress.resumed_from = from;
+    d->progress.received = from;
+    if (!supports_ranges || 0 == d->progress.total) {
+        connections = 1;
+    }
+
+    if (d->md && from > 0) {
+        status = hash_stored(d, from);
+        if (status) goto cleanup; // called function will print the error
+    }
+
+    plan_segments(d, from, d->progress.total, connections);
+    d->progress.connections = d->segment_count;
+    if (d->marker_path && d->segment_count > 1) {
+        FILE *marker = fopen(d->marker_path, "wb");
+        if (marker) {
+            fclose(marker);
+        }
+    }
+    if (from > 0) {
+        IOTC_INFO("OTA: Resuming at %llu bytes.", (unsigned long long) from);
+    }
+
+    status = run_transfers(d);
+    if (status) goto cleanup; // called function will print the error
+
+    if (d->file && 0 != fflush(d->file)) {
+        IOTC_ERROR("OTA: Unable to write %s", c->path);
+        status = IOTCL_ERR_FAILED;
+        goto cleanup;
+    }
+    if (d->md) {
+        status = verify_hash(d);
+        if (status && d->file) {
+            // don't resume from bad data next time
+            d->file = freopen(c->path, "w+b", d->file);
+        }
+    }
+    if (d->marker_path) {
+        remove(d->marker_path);
+    }
+
+    cleanup:
+    update_rate(d);
+    if (progress) {
+        *progress = d->progress;
+    }
+    if (!status) {
+        report_progress(d);
+    }
+    for (unsigned int i = 0; i < IOTC_OTA_MAX_CONNECTIONS; i++) {
+        Segment *s = &d->segments[i];
+        if (s->curl) {
+            if (s->is_active) {
+                curl_multi_remove_handle(d->multi, s->curl);
+            }
+            curl_easy_cleanup(s->curl);
+        }
+        free(s->buffer);
+    }
+    if (d->multi) {
+        curl_multi_cleanup(d->multi);
+    }
+    if (is_curl_initialized) {
+        curl_global_cleanup();
+    }
+    if (d->md) {
+        EVP_MD_CTX_free(d->md);
+    }
+    if (d->file) {
+        fclose(d->file);
+    }
+    free(d->scratch);
+    free(d->marker_path);
+    free(d);
+    return status;
+}
@@ -0,0 +1,88 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_BACKFILL_H
+#define IOTC_BACKFILL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+/*
+ * Backfill of telemetry that could not be sent while the device was offline.
+ *
+ * While MQTT is down, telemetry messages are appended to a spool file, one JSON message per line.
+ * Once the connection is back, a background thread uploads the spool over HTTPS in large batches
+ * while live telemetry keeps flowing over MQTT. Each batch is a POST of newline delimited JSON
+ * (Content-Type: application/x-ndjson), gzip compressed (Content-Encoding: gzip) if the SDK is built with zlib.
+ * The receiving endpoint is application specific and is set with upload_url.
+ *
+ * Upload progress is saved after every batch, so a restart resumes where it left off.
+ * Failed uploads are retried with a backoff, except when the endpoint rejects a batch with a 4xx status other than
+ * 408 or 429. Such a batch would never be accepted, so it is dropped and the upload goes on with the next one.
+ */
+
+#ifndef IOTC_BACKFILL_DEFAULT_MAX_SPOOL_BYTES
+#define IOTC_BACKFILL_DEFAULT_MAX_SPOOL_BYTES (16 * 1024 * 1024)
+#endif
+
+#ifndef IOTC_BACKFILL_DEFAULT_BATCH_BYTES
+#define IOTC_BACKFILL_DEFAULT_BATCH_BYTES (256 * 1024)
+#endif
+
+// Upload retries back off up to this interval
+#ifndef IOTC_BACKFILL_MAX_RETRY_MS
+#define IOTC_BACKFILL_MAX_RETRY_MS 60000
+#endif
+
+typedef struct {
+    const char *spool_path; // file that keeps messages while offline. NULL disables backfill.
+    const char *upload_url; // HTTP(S) endpoint that accepts the batches
+    size_t max_spool_bytes; // messages are dropped once the spool and the file being uploaded reach this size
+    size_t batch_bytes; // uncompressed size of each upload
+    bool compress; // gzip the batches. Ignored if the SDK was built without zlib.
+} IotConnectBackfillConfig;
+
+typedef struct {
+    unsigned long spooled; // messages written to the spool
+    unsigned long dropped; // messages lost because the spool was full or could not be written
+    unsigned long uploaded; // messages uploaded
+    unsigned long long uploaded_bytes; // uncompressed
+    unsigned long long sent_bytes; // actual body bytes, after compression
+    unsigned long batches;
+    unsigned long failures; // failed upload attempts
+    unsigned long rejected; // messages dropped because the endpoint rejected their batch
+    bool is_uploading;
+} IotConnectBackfillStats;
+
+void iotc_backfill_init_config(IotConnectBackfillConfig *c);
+
+// Copies the configuration. Does nothing and returns success if spool_path is NULL.
+int iotc_backfill_init(const IotConnectBackfillConfig *c);
+
+// Stops the upload thread. The spool and the upload progress are kept for the next run.
+void iotc_backfill_deinit(void);
+
+bool iotc_backfill_is_enabled(void);
+
+// Appends a message to the spool. Safe to call from any thread.
+int iotc_backfill_store(const char *message);
+
+// Starts the upload thread if there is anything to upload and it is not already running.
+int iotc_backfill_start_upload(void);
+
+// Waits until the current upload finishes. Returns false on timeout.
+bool iotc_backfill_wait(unsigned long timeout_ms);
+
+void iotc_backfill_get_stats(IotConnectBackfillStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_BACKFILL_H
@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_C2D_DEDUP_H
+#define IOTC_C2D_DEDUP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+/*
+ * Drops C2D messages that were already received, like the QoS 1 messages that the broker delivers again
+ * after a reconnect, so that commands and OTA updates do not run twice.
+ *
+ * Messages are recognized by their ack ID, which the cloud assigns to every command it sends, so a command that
+ * is sent again from the cloud has a new ack ID and always runs. Messages without an ack ID are passed on,
+ * unless fingerprint_messages is set. Then they are recognized by a hash of the whole message, which also drops
+ * a command without an ack ID that is repeated on purpose within the window.
+ *
+ * The window starts when a message is first passed on and is not extended by its duplicates, so a message that
+ * keeps being redelivered is processed again once the window ends. The most recently passed messages are kept in
+ * a fixed-size table indexed by a hash of the key, and the oldest one is replaced when the table is full.
+ */
+
+// Messages that are remembered. Each one takes a few tens of bytes.
+#ifndef IOTC_C2D_DEDUP_MAX_ENTRIES
+#define IOTC_C2D_DEDUP_MAX_ENTRIES 64
+#endif
+
+#ifndef IOTC_C2D_DEDUP_DEFAULT_WINDOW_SECS
+#define IOTC_C2D_DEDUP_DEFAULT_WINDOW_SECS 600
+#endif
+
+typedef struct {
+    unsigned long window_secs; // how long a message is remembered. 0 disables the suppression.
+    bool fingerprint_messages; // also check messages without an ack ID, by their content. Off by default.
+} IotConnectC2dDedupConfig;
+
+typedef struct {
+    unsigned long hits; // duplicates that were dropped
+    unsigned long misses; // messages that were checked and passed on
+    unsigned long evictions; // remembered messages replaced by newer ones before their window ended
+} IotConnectC2dDedupStats;
+
+void iotc_c2d_dedup_init_config(IotConnectC2dDedupConfig *c);
+
+// Forgets all messages and resets the statistics
+int iotc_c2d_dedup_init(const IotConnectC2dDedupConfig *c);
+
+void iotc_c2d_dedup_deinit(void);
+
+// Returns true if the message was passed on within the window. Otherwise remembers it and returns false.
+// Always false if disabled, and for messages without an ack ID unless fingerprint_messages is set.
+bool iotc_c2d_dedup_is_duplicate(const unsigned char *message, size_t message_len);
+
+void iotc_c2d_dedup_get_stats(IotConnectC2dDedupStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_C2D_DEDUP_H
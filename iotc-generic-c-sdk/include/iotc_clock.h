@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_CLOCK_H
+#define IOTC_CLOCK_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+// Monotonic clock readings, unaffected by wall clock adjustments. Only differences are meaningful.
+uint64_t iotc_clock_now_us(void);
+
+uint64_t iotc_clock_now_ms(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_CLOCK_H
@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_COMMAND_EXECUTOR_H
+#define IOTC_COMMAND_EXECUTOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+/*
+ * Runs cloud commands on a pool of worker threads instead of the MQTT thread.
+ *
+ * Each command is copied out of the C2D message and queued. Commands with the same ordering key
+ * (by default the command name, which is the first word of the command) run one after another in the order
+ * in which they arrived, while commands with different keys run in parallel. A command that has not finished
+ * within the timeout is acknowledged as failed. Its late result is dropped, as the thread cannot be stopped.
+ * Acknowledgements are pushed into the publish queue, so workers never wait on the MQTT client and
+ * the acknowledgements of a burst of commands go out back to back from the publisher thread.
+ */
+
+#ifndef IOTC_COMMAND_EXECUTOR_MAX_WORKERS
+#define IOTC_COMMAND_EXECUTOR_MAX_WORKERS 16
+#endif
+
+#ifndef IOTC_COMMAND_EXECUTOR_DEFAULT_MAX_PENDING
+#define IOTC_COMMAND_EXECUTOR_DEFAULT_MAX_PENDING 32
+#endif
+
+#ifndef IOTC_COMMAND_EXECUTOR_DEFAULT_TIMEOUT_MS
+#define IOTC_COMMAND_EXECUTOR_DEFAULT_TIMEOUT_MS 30000
+#endif
+
+#define IOTC_COMMAND_ACK_MESSAGE_SIZE 128
+
+// Runs on a worker thread. Returns the acknowledgement status, like IOTCL_C2D_EVT_CMD_SUCCESS_WITH_ACK or
+// IOTCL_C2D_EVT_CMD_FAILED, and can write a message of up to ack_message_size bytes into ack_message.
+typedef int (*IotConnectCommandHandler)(const char *command, char *ack_message, size_t ack_message_size);
+
+// Returns the length of the ordering key of the command and points key to its start within the command.
+typedef size_t (*IotConnectCommandKeyCallback)(const char *command, const char **key);
+
+typedef struct {
+    unsigned int workers; // 0 disables the executor and commands are passed to cmd_cb on the MQTT thread
+    IotConnectCommandHandler handler; // required if workers is not 0. Used instead of cmd_cb.
+    IotConnectCommandKeyCallback key_cb; // optional. Orders by the command name if not set.
+    unsigned int max_pending; // commands beyond this are acknowledged as failed without running
+    unsigned long timeout_ms; // from arrival to completion. 0 for no timeout.
+} IotConnectCommandExecutorConfig;
+
+typedef struct {
+    unsigned long submitted;
+    unsigned long completed; // handler returned in time
+    unsigned long timed_out;
+    unsigned long rejected; // the queue was full or the command could not be copied
+    unsigned long pending; // waiting or running
+} IotConnectCommandExecutorStats;
+
+void iotc_command_executor_init_config(IotConnectCommandExecutorConfig *c);
+
+// Starts the workers. The publish queue must be running, so that the acknowledgements can be sent.
+int iotc_command_executor_start(const IotConnectCommandExecutorConfig *c);
+
+// Drops the commands that have not started, acknowledging them as failed, and waits for the running ones
+void iotc_command_executor_stop(void);
+
+bool iotc_command_executor_is_running(void);
+
+// Copies the command and queues it. ack_id can be NULL if no acknowledgement was requested.
+int iotc_command_executor_submit(const char *command, const char *ack_id);
+
+// True on the executor's own threads, so that messages sent from handlers can be queued instead of sent inline
+bool iotc_command_executor_is_executor_thread(void);
+
+void iotc_command_executor_get_stats(IotConnectCommandExecutorStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_COMMAND_EXECUTOR_H
@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_CREDENTIALS_H
+#define IOTC_CREDENTIALS_H
+
+#include <stdbool.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+/*
+ * Lifetime of the SAS tokens used with symmetric key authentication.
+ *
+ * Azure closes a connection when the SAS token that it was made with expires. The credential manager
+ * signs each token on its own thread before it is needed, so a connect only picks up a ready token.
+ * renew_margin_secs before the token of the current connection expires, it asks the SDK to reconnect
+ * with the next token, so the connection is renewed at a planned time instead of being dropped by the hub.
+ */
+
+#ifndef IOTC_CREDENTIALS_DEFAULT_SAS_LIFETIME_SECS
+#define IOTC_CREDENTIALS_DEFAULT_SAS_LIFETIME_SECS 3600
+#endif
+
+#ifndef IOTC_CREDENTIALS_DEFAULT_RENEW_MARGIN_SECS
+#define IOTC_CREDENTIALS_DEFAULT_RENEW_MARGIN_SECS 300
+#endif
+
+// The next token is signed this long before the renewal
+#ifndef IOTC_CREDENTIALS_PREPARE_LEAD_SECS
+#define IOTC_CREDENTIALS_PREPARE_LEAD_SECS 30
+#endif
+
+// First retry of a failed renewal. Doubles with each failure, up to a minute.
+#ifndef IOTC_CREDENTIALS_RENEW_RETRY_SECS
+#define IOTC_CREDENTIALS_RENEW_RETRY_SECS 5
+#endif
+
+typedef struct {
+    unsigned long sas_lifetime_secs;
+    unsigned long renew_margin_secs; // must be less than sas_lifetime_secs
+} IotConnectCredentialsConfig;
+
+// Called from the credential manager thread when the connection should be renewed with a new token.
+// Returns 0 on success. A failed renewal is tried again after a backoff, until a new token is taken.
+typedef int (*IotConnectCredentialsRenewCallback)(void);
+
+void iotc_credentials_init_config(IotConnectCredentialsConfig *c);
+
+// Starts the manager thread, which signs the first token right away. All strings are copied.
+int iotc_credentials_init(
+        const IotConnectCredentialsConfig *c,
+        const char *host,
+        const char *client_id,
+        const char *symmetric_key,
+        IotConnectCredentialsRenewCallback renew_cb
+);
+
+void iotc_credentials_deinit(void);
+
+bool iotc_credentials_is_enabled(void);
+
+// Returns a token for a new connection, to be freed with free(), and schedules the renewal of that connection.
+// Returns NULL if the manager is not running.
+char *iotc_credentials_take_sas_token(void);
+
+// Expiry of the token that was taken last, or 0
+time_t iotc_credentials_get_expiry(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_CREDENTIALS_H
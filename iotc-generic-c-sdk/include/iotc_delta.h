@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_DELTA_H
+#define IOTC_DELTA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+/*
+ * Streaming application of binary delta updates.
+ *
+ * Patches are in the ENDSLEY/BSDIFF43 format produced by bsdiff (https://github.com/mendsley/bsdiff):
+ * a 16 byte magic and the size of the new image, followed by a compressed stream of records.
+ * Each record adds a run of difference bytes to the old image, appends a run of new bytes
+ * and moves the read position in the old image.
+ * bsdiff compresses the records with bzip2, which needs the SDK to be built with libbz2.
+ * Records compressed with gzip are accepted as well. Their decompressor takes under 64 KB instead of about 3.5 MB,
+ * at the cost of larger patches.
+ *
+ * The patch is read once from front to back and the new image is written once from front to back.
+ * The old image is read at the positions that the patch asks for. Memory use is a few buffers, whatever the image size.
+ */
+
+#define IOTC_DELTA_MAGIC "ENDSLEY/BSDIFF43"
+#define IOTC_DELTA_MAGIC_SIZE 16
+#define IOTC_DELTA_HEADER_SIZE 24
+
+#ifndef IOTC_DELTA_BUFFER_SIZE
+#define IOTC_DELTA_BUFFER_SIZE (16 * 1024)
+#endif
+
+// bzip2 can decompress with about half the memory at about half the speed
+#ifndef IOTC_DELTA_BZIP2_SMALL
+#define IOTC_DELTA_BZIP2_SMALL 0
+#endif
+
+// Reads up to len bytes of the patch. Returns the number of bytes read, 0 at the end or a negative value on error.
+typedef long (*IotConnectDeltaPatchReader)(void *data, size_t len, void *context);
+
+// Reads len bytes of the old image at offset. Returns 0 on success.
+typedef int (*IotConnectDeltaOldReader)(uint64_t offset, void *data, size_t len, void *context);
+
+// Appends len bytes to the new image. Returns 0 on success.
+typedef int (*IotConnectDeltaNewWriter)(const void *data, size_t len, void *context);
+
+typedef struct {
+    IotConnectDeltaPatchReader patch_cb;
+    IotConnectDeltaOldReader old_cb;
+    IotConnectDeltaNewWriter new_cb;
+    void *context; // passed to all callbacks
+    uint64_t old_size;
+    // Expected SHA-256 of the new image in hex. NULL skips verification. bsdiff patches do not record which
+    // image they were made from, so this is the only way to tell that the patch was applied to the right one.
+    const char *new_sha256;
+} IotConnectDeltaConfig;
+
+typedef struct {
+    uint64_t new_size;
+    unsigned long records;
+    uint64_t diff_bytes; // new bytes derived from the old image
+    uint64_t extra_bytes; // new bytes carried in the patch
+} IotConnectDeltaStats;
+
+// Returns true if the data starts with the patch magic
+bool iotc_delta_is_patch(const void *data, size_t len);
+
+bool iotc_delta_is_patch_file(const char *path);
+
+// stats is optional
+int iotc_delta_apply(const IotConnectDeltaConfig *c, IotConnectDeltaStats *stats);
+
+// Applies the patch in patch_path to the image in old_path and writes the result to new_path.
+// new_path is removed if the patch cannot be applied or if the result does not match new_sha256.
+int iotc_delta_apply_file(
+        const char *old_path,
+        const char *patch_path,
+        const char *new_path,
+        const char *new_sha256,
+        IotConnectDeltaStats *stats
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_DELTA_H
@@ -7,6 +7,8 @@
 #define IOTC_DEVICE_CLIENT_H
 
 #include "iotconnect.h"
+#include "iotc_link_health.h"
+#include "iotc_endpoint_race.h"
 
 #ifdef __cplusplus
 extern   "C" {
@@ -20,12 +22,54 @@ typedef struct {
     IotConnectAuthInfo *auth; // Pointer to IoTConnect auth configuration
     IotConnectC2dCallback c2d_msg_cb; // callback for inbound messages
     IotConnectMqttStatusCallback status_cb; // callback for connection and message status
+    // If true, connect with cleansession=0 and keep QoS1 messages that are in flight in an in-memory store,
+    // so that they are re-sent after a reconnect and the broker keeps our subscription.
+    bool persistent_session;
+    IotConnectLinkHealthConfig link_health; // keepalive and dead link detection settings
+    IotConnectEndpointConfig endpoints; // additional endpoints to race against the broker and fall back to
 } IotConnectDeviceClientConfig;
 
+/*
+ * The MQTT transport that the device client functions below are dispatched to.
+ * Paho is the default. iotc_loopback_transport.h provides one that runs in-process without a network.
+ * Only connect is called while the transport is disconnected.
+ */
+typedef struct IotConnectTransport {
+    const char *name;
+    int (*connect)(IotConnectDeviceClientConfig *c);
+    int (*disconnect)(void);
+    int (*renew_credentials)(void);
+    bool (*is_connected)(void);
+    int (*send_message_qos)(const char *topic, const char *message, int qos);
+    void (*receive)(void); // optional, for transports that need to be polled
+} IotConnectTransport;
+
+// The Paho MQTT transport. Not available if the SDK is built with IOTC_WITH_PAHO=OFF.
+const IotConnectTransport *iotc_paho_transport(void);
+
+// Selects the transport for the next connect. NULL selects the default one, which is Paho
+// or the lite MQTT client (iotc_lite_mqtt.h) if Paho is not built. Must not be called while connected.
+void iotc_device_client_set_transport(const IotConnectTransport *transport);
+
+const IotConnectTransport *iotc_device_client_get_transport(void);
+
 int iotc_device_client_connect(IotConnectDeviceClientConfig *c);
 
 int iotc_device_client_disconnect(void);
 
+// Reconnects with fresh credentials, like the next SAS token or rotated certificate files, without reporting
+// a disconnect. Fails if the client is not connected.
+// The broker allows one MQTT connection per client ID, so the old session always ends before the new one is
+// usable, and publishes or C2D messages can fail or be missed in the short gap between the two:
+// - Paho connects a second client with the same client ID, which makes the broker drop the old connection.
+//   Publishes that fail on the old connection are sent again on the new one once it is subscribed.
+// - Paho with persistent_session disconnects and reconnects the same client (break-before-make), so the session
+//   and its in-flight messages are kept, but publishes fail while it is disconnected.
+// - The lite client opens the TCP and TLS connection first, waits for the acknowledgements on the old connection,
+//   then closes it before sending CONNECT on the new one.
+// If the new connection cannot be made and the old one is still up, that one is kept.
+int iotc_device_client_renew_credentials(void);
+
 bool iotc_device_client_is_connected(void);
 
 // Sends the message with the underlying MQTT client (Paho) with configured default QOS and returns the error if
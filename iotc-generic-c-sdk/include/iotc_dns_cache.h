@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_DNS_CACHE_H
+#define IOTC_DNS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+/*
+ * Resolver cache shared by the HTTP and MQTT connections of the SDK.
+ *
+ * The HTTP layer records the address that each host was reached on and hands it to curl on the next request,
+ * so discovery and identity skip their lookups. If a cached address cannot be connected to, it is dropped
+ * and the request is retried with a fresh lookup. If a lookup fails, expired addresses are still tried.
+ * The MQTT broker host is resolved in the background as soon as the identity response names it.
+ *
+ * The cache can be kept in a file, so that the addresses survive restarts.
+ */
+
+#ifndef IOTC_DNS_CACHE_DEFAULT_TTL_SECS
+#define IOTC_DNS_CACHE_DEFAULT_TTL_SECS 3600
+#endif
+
+#ifndef IOTC_DNS_CACHE_MAX_ENTRIES
+#define IOTC_DNS_CACHE_MAX_ENTRIES 8
+#endif
+
+#ifndef IOTC_DNS_CACHE_MAX_ADDRESSES
+#define IOTC_DNS_CACHE_MAX_ADDRESSES 4
+#endif
+
+#define IOTC_DNS_CACHE_MAX_HOST_LENGTH 128
+#define IOTC_DNS_CACHE_MAX_ADDRESS_LENGTH 46 // INET6_ADDRSTRLEN
+
+// How long iotconnect_sdk_connect() waits for a broker lookup that is still running
+#ifndef IOTC_DNS_CACHE_PREFETCH_WAIT_MS
+#define IOTC_DNS_CACHE_PREFETCH_WAIT_MS 10000
+#endif
+
+typedef struct {
+    unsigned long ttl_secs; // how long addresses are used without a new lookup. 0 disables the cache.
+    const char *persist_path; // file that keeps the cache across restarts. Optional.
+} IotConnectDnsCacheConfig;
+
+typedef char IotConnectDnsAddress[IOTC_DNS_CACHE_MAX_ADDRESS_LENGTH];
+
+void iotc_dns_cache_init_config(IotConnectDnsCacheConfig *c);
+
+// Loads the persisted entries, if any
+int iotc_dns_cache_init(const IotConnectDnsCacheConfig *c);
+
+// Waits for a running lookup and clears the cache
+void iotc_dns_cache_deinit(void);
+
+bool iotc_dns_cache_is_enabled(void);
+
+// Copies up to max addresses of the host. Expired entries are returned only if allow_expired is true.
+// Returns the number of addresses copied.
+size_t iotc_dns_cache_get(const char *host, IotConnectDnsAddress *addresses, size_t max, bool allow_expired);
+
+void iotc_dns_cache_put(const char *host, const IotConnectDnsAddress *addresses, size_t count);
+
+// Drops the host, for example after its cached address could not be connected to
+void iotc_dns_cache_invalidate(const char *host);
+
+// Resolves the host on a background thread and caches the result. Does nothing if the host is cached.
+int iotc_dns_cache_prefetch(const char *host);
+
+// Waits for a background lookup of the host to finish. Returns false on timeout.
+bool iotc_dns_cache_wait(const char *host, unsigned long timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_DNS_CACHE_H
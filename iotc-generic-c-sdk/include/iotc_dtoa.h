@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_DTOA_H
+#define IOTC_DTOA_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+// Number formatting for telemetry serialization. Output is a valid JSON number and is not NUL terminated.
+// NaN and infinity are not valid JSON and are written as "null".
+// Only the telemetry writer (iotc_telemetry_writer.h) formats numbers with these. Messages built with
+// iotcl_telemetry_set_number() are printed by cJSON inside iotc-c-lib, with "%1.15g" or "%1.17g".
+
+// Large enough for any output of the functions below
+#define IOTC_DTOA_BUFFER_SIZE 32
+
+// Maximum number of decimals accepted by iotc_dtoa_fixed()
+#define IOTC_DTOA_MAX_PRECISION 9
+
+// Writes a decimal representation that parses back to exactly the same double (Grisu2).
+// Grisu2 is not always shortest: about 0.05% of values get more digits than needed, up to 17 significant
+// digits in total, like 1e23 written as 9.999999999999999e+22. Do not rely on the shortest form.
+// Integral values below 2^53 take an integer-only fast path.
+// benchmarks/telemetry-bench checks the round trip and how often the output is longer than shortest.
+// Returns the number of characters written.
+size_t iotc_dtoa(double value, char *buffer);
+
+// Writes the value rounded to the given number of decimals, like "%.<precision>f" would, except that ties are
+// rounded away from zero after scaling, so values within an ulp of a tie can differ in the last decimal.
+// Falls back to iotc_dtoa() if the value is too large to be scaled exactly or if precision is out of range.
+// Returns the number of characters written.
+size_t iotc_dtoa_fixed(double value, int precision, char *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_DTOA_H
@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_ENDPOINT_RACE_H
+#define IOTC_ENDPOINT_RACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "iotc_dns_cache.h"
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+/*
+ * Choosing between several MQTT endpoints, like the broker on an alternate port or a fallback broker.
+ *
+ * Before the MQTT connect, TCP connects are raced to every address of every endpoint, in the style of
+ * Happy Eyeballs (RFC 8305): IPv6 and IPv4 addresses are interleaved and each attempt gets a head start
+ * over the next one instead of a full timeout. The endpoint that answers first is connected to first,
+ * and the rest stay in the list that the MQTT client falls back to, in their configured order.
+ * With a single endpoint there is nothing to choose from, so no race is run.
+ */
+
+#ifndef IOTC_ENDPOINT_RACE_DEFAULT_ATTEMPT_DELAY_MS
+#define IOTC_ENDPOINT_RACE_DEFAULT_ATTEMPT_DELAY_MS 250 // the "Connection Attempt Delay" of RFC 8305
+#endif
+
+#ifndef IOTC_ENDPOINT_RACE_DEFAULT_TIMEOUT_MS
+#define IOTC_ENDPOINT_RACE_DEFAULT_TIMEOUT_MS 5000
+#endif
+
+// Including the broker from the identity response
+#ifndef IOTC_ENDPOINT_RACE_MAX_ENDPOINTS
+#define IOTC_ENDPOINT_RACE_MAX_ENDPOINTS 8
+#endif
+
+#define IOTC_ENDPOINT_DEFAULT_PORT 8883
+
+typedef struct {
+    // Additional endpoints as "host", "host:port" or "[IPv6 address]:port", after the broker from the identity
+    // response. The port defaults to 8883. NULL terminated. Optional.
+    const char **endpoints;
+    unsigned long attempt_delay_ms; // head start of each TCP attempt over the next one
+    unsigned long timeout_ms; // how long to wait for any endpoint to answer. 0 disables the race.
+} IotConnectEndpointConfig;
+
+typedef struct {
+    char host[IOTC_DNS_CACHE_MAX_HOST_LENGTH]; // without the brackets of an IPv6 address
+    unsigned int port;
+    unsigned long connect_us; // TCP connect time in the race. 0 if it did not win or the race did not run.
+} IotConnectEndpoint;
+
+void iotc_endpoint_race_init_config(IotConnectEndpointConfig *c);
+
+// Parses "host", "host:port" or "[IPv6 address]:port"
+int iotc_endpoint_parse(const char *str, unsigned int default_port, IotConnectEndpoint *endpoint);
+
+// Races TCP connects to the endpoints and moves the one that answered first to the front.
+// Returns false if none answered within the timeout, in which case the order is unchanged.
+// The endpoints are resolved through the DNS cache when it is enabled.
+bool iotc_endpoint_race(IotConnectEndpoint *endpoints, size_t count, const IotConnectEndpointConfig *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_ENDPOINT_RACE_H
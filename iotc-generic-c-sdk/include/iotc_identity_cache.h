@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_IDENTITY_CACHE_H
+#define IOTC_IDENTITY_CACHE_H
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+/*
+ * Keeps the identity response in a file, so that iotconnect_sdk_init() can configure MQTT without
+ * the discovery and identity requests. The file holds the response as it was received.
+ * Builds without the HTTP layer (IOTC_WITH_HTTP=OFF) depend on it, so it must be provisioned
+ * with the device, for example by running a full build once.
+ * Delete the file to make a full build look the identity up again, for example after the device was moved.
+ */
+
+// Returns the cached identity response, or NULL if there is none. Free it with free().
+char *iotc_identity_cache_load(const char *path);
+
+// Replaces the file atomically, so that an interrupted write leaves the previous response in place
+int iotc_identity_cache_save(const char *path, const char *identity_response);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_IDENTITY_CACHE_H
@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_LINK_HEALTH_H
+#define IOTC_LINK_HEALTH_H
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+/*
+ * Tracks the broker round trip time from acknowledgement timing (PUBACK and SUBACK) and derives
+ * an adaptive acknowledgement deadline from it, TCP style: deadline = srtt + 4 * rttvar.
+ * Dead link detection is off by default. When dead_rtt_multiple is set, the acknowledgement deadline becomes
+ * dead_rtt_multiple RTT deadlines, and if dead_after_misses acknowledgements in a row miss it, the link is declared
+ * dead and the device client drops the connection instead of waiting for the keepalive to expire.
+ * A single late acknowledgement only fails that publish.
+ * All functions can be called from any thread.
+ */
+
+typedef struct {
+    int keepalive_secs; // MQTT keepalive interval. Shorter values detect a dead idle link sooner. 0 = client default
+    unsigned int dead_rtt_multiple; // How many RTT deadlines an ack can be late before it is missed. 0 = never dead
+    unsigned int dead_after_misses; // Missed acks in a row that declare the link dead. Treated as 1 if 0
+    unsigned long min_ack_timeout_ms; // Lower bound for the ack deadline, so that jitter-free links do not flap
+    unsigned long max_ack_timeout_ms; // Upper bound for the ack deadline and the deadline before the first sample
+} IotConnectLinkHealthConfig;
+
+typedef struct {
+    unsigned long srtt_us; // smoothed round trip time
+    unsigned long rttvar_us; // round trip time variation (jitter)
+    unsigned long last_rtt_us;
+    unsigned long min_rtt_us;
+    unsigned long max_rtt_us;
+    unsigned long ack_timeout_ms; // the deadline that will be used for the next acknowledgement
+    unsigned long samples;
+    unsigned long timeouts;
+    unsigned long consecutive_timeouts; // since the last acknowledgement
+    bool is_dead;
+} IotConnectLinkHealthStats;
+
+void iotc_link_health_init_config(IotConnectLinkHealthConfig *c);
+
+// Resets all statistics. Called by the device client on each connect.
+void iotc_link_health_reset(const IotConnectLinkHealthConfig *c);
+
+void iotc_link_health_on_rtt_sample(unsigned long rtt_us);
+
+// How long to wait for the next acknowledgement before the link should be considered dead
+unsigned long iotc_link_health_get_ack_timeout_ms(void);
+
+// Records a missed acknowledgement deadline. Returns true if the link should now be declared dead:
+// dead link detection is on and this was the dead_after_misses-th miss in a row.
+bool iotc_link_health_on_ack_timeout(void);
+
+void iotc_link_health_get_stats(IotConnectLinkHealthStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_LINK_HEALTH_H
@@ -29,8 +29,13 @@
 #define IOTC_INFO_LEVEL 2
 #endif
 
+// A negative level removes the error messages as well, along with their strings
 #ifndef IOTC_ERROR
+#if IOTC_INFO_LEVEL >= 0
 #define IOTC_ERROR(...) fprintf(stderr, __VA_ARGS__);fprintf(stderr, IOTC_ENDLN)
+#else
+#define IOTC_ERROR(...)
+#endif // IOTC_INFO_LEVEL
 #endif
 
 #ifndef IOTC_WARN
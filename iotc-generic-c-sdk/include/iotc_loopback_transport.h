@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_LOOPBACK_TRANSPORT_H
+#define IOTC_LOOPBACK_TRANSPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "iotc_device_client.h"
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+/*
+ * An MQTT transport that never leaves the process, for benchmarks and for testing applications without a broker.
+ *
+ * Connects succeed immediately and publishes are counted and passed to the publish callback, if one is set,
+ * on the calling thread. C2D messages are injected with iotc_loopback_inject_c2d() and reach the SDK
+ * on the calling thread, like they would on the Paho thread. Publishes are serialized on a mutex,
+ * like they are in Paho, so that contention between publishing threads stays realistic.
+ * Connect and publish failures and connection drops can be injected to exercise the error paths.
+ */
+
+// Called for every successful publish, with the publish lock held
+typedef void (*IotConnectLoopbackPublishCallback)(const char *topic, const char *message, int qos);
+
+typedef struct {
+    uint64_t connects;
+    uint64_t disconnects; // including the dropped connections
+    uint64_t publishes;
+    uint64_t publish_bytes;
+    uint64_t publish_failures;
+    uint64_t c2d_messages;
+} IotConnectLoopbackStats;
+
+const IotConnectTransport *iotc_loopback_transport(void);
+
+void iotc_loopback_set_publish_cb(IotConnectLoopbackPublishCallback cb);
+
+// Passes the message to the C2D callback of the SDK. Fails if not connected.
+int iotc_loopback_inject_c2d(const unsigned char *message, size_t message_len);
+
+// The next count connects fail
+void iotc_loopback_fail_next_connects(unsigned int count);
+
+// The next count publishes fail and are reported as IOTC_CS_MQTT_SEND_FAILED
+void iotc_loopback_fail_next_publishes(unsigned int count);
+
+// Closes the connection as if the broker went away and reports IOTC_CS_MQTT_DISCONNECTED
+void iotc_loopback_drop_connection(void);
+
+void iotc_loopback_get_stats(IotConnectLoopbackStats *stats);
+
+void iotc_loopback_reset_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_LOOPBACK_TRANSPORT_H
@@ -0,0 +1,80 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_PUBLISH_QUEUE_H
+#define IOTC_PUBLISH_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+/*
+ * Thread-safe publishing. Any thread can push messages into a lock-free multi-producer single-consumer
+ * queue and a single publisher thread owned by the SDK sends them with the device client, in the order
+ * in which they were pushed. Producers never take a lock while the publisher is busy, so there is no lock
+ * convoy in front of the MQTT client. The publisher thread is only woken when the queue becomes non-empty.
+ *
+ * Producers that can adapt to a slow link, for example by sampling less often, can use the watermarks.
+ * Once the queued topics and messages take high_watermark bytes, iotc_publish_queue_try_push() refuses
+ * new messages with IOTC_ERR_WOULD_BLOCK and iotc_publish_queue_is_writable() returns false.
+ * After that, writable_cb is called once the queue has drained to low_watermark bytes.
+ * iotc_publish_queue_push() ignores the watermarks, so acknowledgements are never refused.
+ */
+
+// Outside of the range of the IOTCL_ERR_* codes
+#define IOTC_ERR_WOULD_BLOCK 100
+
+// Called on the publisher thread. It must not block, but it can push messages.
+typedef void (*IotConnectPublishWritableCallback)(void);
+
+typedef struct {
+    size_t high_watermark; // in bytes. 0 for no limit.
+    size_t low_watermark; // in bytes. Must be lower than high_watermark.
+    IotConnectPublishWritableCallback writable_cb; // optional
+} IotConnectPublishQueueConfig;
+
+typedef struct {
+    unsigned long pushed;
+    unsigned long published; // sent and acknowledged (for qos>0)
+    unsigned long failed;
+    unsigned long pending; // pushed, but not yet handed to the device client
+    unsigned long pending_bytes; // topics and messages of the pending messages
+    unsigned long would_block; // pushes refused at the high watermark
+} IotConnectPublishQueueStats;
+
+void iotc_publish_queue_init_config(IotConnectPublishQueueConfig *c);
+
+int iotc_publish_queue_start(const IotConnectPublishQueueConfig *c);
+
+// Stops the publisher thread after sending all messages that were pushed before this call.
+// Pushes that race with it are counted as failed. Waits for producers that are still inside a queue call.
+void iotc_publish_queue_stop(void);
+
+bool iotc_publish_queue_is_running(void);
+
+// Copies the message and queues it. Returns immediately.
+int iotc_publish_queue_push(const char *topic, const char *message, int qos);
+
+// Like iotc_publish_queue_push(), but returns IOTC_ERR_WOULD_BLOCK without queuing the message
+// if the queue is at its high watermark
+int iotc_publish_queue_try_push(const char *topic, const char *message, int qos);
+
+// False while the queue is at its high watermark. writable_cb is called once it drains after this returned false.
+bool iotc_publish_queue_is_writable(void);
+
+// Blocks until all messages pushed before this call have been handed to the device client,
+// or until the timeout expires. Returns false on timeout.
+bool iotc_publish_queue_flush(unsigned long timeout_ms);
+
+void iotc_publish_queue_get_stats(IotConnectPublishQueueStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_PUBLISH_QUEUE_H
@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_STARTUP_TIMING_H
+#define IOTC_STARTUP_TIMING_H
+
+#include <stdint.h>
+#include "iotc_http_request.h"
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+/*
+ * Where the time goes in iotconnect_sdk_init() and iotconnect_sdk_connect().
+ * Each phase is timed with the monotonic clock. iotconnect_sdk_init() clears all phases
+ * and iotconnect_sdk_connect() clears the MQTT ones, so a reconnect reports its own numbers.
+ */
+
+typedef enum {
+    IOTC_PHASE_IOTCL_INIT = 0,
+    IOTC_PHASE_DISCOVERY, // discovery HTTP request
+    IOTC_PHASE_IDENTITY, // identity HTTP request
+    IOTC_PHASE_ENDPOINT_RACE, // racing TCP connects to the MQTT endpoints. Runs only if there are several.
+    IOTC_PHASE_MQTT_CREATE, // creating the MQTT client
+    IOTC_PHASE_MQTT_CONNECT, // TCP, TLS handshake and MQTT CONNECT
+    IOTC_PHASE_MQTT_SUBSCRIBE, // C2D subscription. Does not run if a persistent session was resumed.
+    IOTC_PHASE_COUNT
+} IotConnectStartupPhase;
+
+typedef struct {
+    uint64_t duration_us[IOTC_PHASE_COUNT]; // 0 if the phase did not run
+    // Start of each phase relative to the start of iotconnect_sdk_init().
+    // Gaps show time spent in the application or in the SDK outside of the listed phases.
+    uint64_t offset_us[IOTC_PHASE_COUNT];
+    uint64_t init_us; // whole iotconnect_sdk_init()
+    uint64_t connect_us; // whole iotconnect_sdk_connect()
+    IotConnectHttpTimings discovery; // curl's breakdown of the discovery request
+    IotConnectHttpTimings identity;
+} IotConnectStartupTimings;
+
+// Returns the timings of the last iotconnect_sdk_init() and iotconnect_sdk_connect()
+void iotc_startup_timing_get(IotConnectStartupTimings *timings);
+
+// Prints the phases that ran. iotconnect_sdk_connect() calls this in verbose mode.
+void iotc_startup_timing_print(void);
+
+const char *iotc_startup_timing_phase_name(IotConnectStartupPhase phase);
+
+// The functions below are called by the SDK and the MQTT client implementations
+
+void iotc_startup_timing_begin_init(void);
+
+void iotc_startup_timing_end_init(void);
+
+void iotc_startup_timing_begin_connect(void);
+
+void iotc_startup_timing_end_connect(void);
+
+// Records a phase that started at start_us (iotc_clock_now_us()) and ends now
+void iotc_startup_timing_record(IotConnectStartupPhase phase, uint64_t start_us);
+
+// Stores curl's breakdown of the discovery or identity request
+void iotc_startup_timing_record_http(IotConnectStartupPhase phase, const IotConnectHttpTimings *http);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_STARTUP_TIMING_H
@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_TELEMETRY_AGGREGATOR_H
+#define IOTC_TELEMETRY_AGGREGATOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+/*
+ * Windowed aggregation for channels that are sampled faster than they can be reported, like vibration or current.
+ *
+ * Samples are added one row at a time (one value per channel) into a ring buffer that keeps each channel
+ * in its own contiguous array. Every time a window completes, the window is reduced to min, max, mean,
+ * standard deviation and count per channel and one telemetry record is sent with iotcl_mqtt_send_telemetry()
+ * with fields named "<channel>.min", "<channel>.max" and so on. Instead of sending, results can be passed
+ * to a callback.
+ *
+ * Windows are counted in samples:
+ *   - tumbling: hop == window_size (or 0). Every sample belongs to exactly one window.
+ *   - sliding: hop < window_size. A record for the last window_size samples is produced every hop samples.
+ *
+ * An aggregator must be used by one thread at a time.
+ */
+
+// Values for IotConnectAggregatorConfig.stats
+#define IOTC_AGG_MIN     0x01
+#define IOTC_AGG_MAX     0x02
+#define IOTC_AGG_MEAN    0x04
+#define IOTC_AGG_STDDEV  0x08
+#define IOTC_AGG_COUNT   0x10
+#define IOTC_AGG_ALL     0x1F
+
+typedef struct {
+    float min;
+    float max;
+    double mean;
+    double stddev; // population standard deviation
+    size_t count;
+} IotConnectAggregate;
+
+// Called with one result per channel, in the order of channel_names
+typedef void (*IotConnectAggregatorCallback)(const IotConnectAggregate *results, size_t channel_count, void *context);
+
+typedef struct {
+    const char **channel_names; // used as telemetry field prefixes. Copied.
+    size_t channel_count;
+    size_t window_size; // samples per window
+    size_t hop; // samples between records. 0 or window_size for tumbling windows.
+    unsigned int stats; // IOTC_AGG_* bits to include in telemetry. Defaults to IOTC_AGG_ALL.
+    IotConnectAggregatorCallback window_cb; // if set, called instead of sending telemetry
+    void *cb_context;
+} IotConnectAggregatorConfig;
+
+typedef struct IotConnectAggregator IotConnectAggregator;
+
+void iotc_aggregator_init_config(IotConnectAggregatorConfig *c);
+
+// Returns NULL on error or if out of memory
+IotConnectAggregator *iotc_aggregator_create(const IotConnectAggregatorConfig *c);
+
+void iotc_aggregator_destroy(IotConnectAggregator *a);
+
+// Adds one sample for every channel. values must have channel_count entries.
+// Returns true if the sample completed a window and a record was produced, even if sending it failed.
+bool iotc_aggregator_add_sample(IotConnectAggregator *a, const float *values);
+
+// Produces a record from the samples added since the last record, if any, and starts a new window.
+// Useful before disconnecting, so that a partial window is not lost.
+bool iotc_aggregator_flush(IotConnectAggregator *a);
+
+// Returns the number of records that could not be sent, for example while disconnected.
+// Failed records are dropped, not retried. Always 0 when window_cb is set.
+unsigned long iotc_aggregator_get_send_failures(const IotConnectAggregator *a);
+
+// Reduces an array of samples. Exposed for applications that keep their own buffers.
+void iotc_aggregator_reduce(const float *samples, size_t count, IotConnectAggregate *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_TELEMETRY_AGGREGATOR_H
@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_TELEMETRY_FILTER_H
+#define IOTC_TELEMETRY_FILTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+/*
+ * Deadband (report by exception) filter for numeric telemetry.
+ *
+ * A value is reported only if it moved away from the last reported value by more than the field's deadband,
+ * or if the field has not been reported for max_silence_ms. The deadband is the larger of the absolute deadband
+ * and the percentage of the last reported value. With both set to zero, only changed values are reported.
+ * Fields that are not configured are always reported.
+ *
+ * Fields are identified by slot numbers chosen by the application. They can be the slots returned by
+ * iotc_telemetry_writer_add_field(), in which case iotc_telemetry_writer_apply_filter() can be used.
+ * With the iotcl_telemetry_* API:
+ *   if (iotc_telemetry_filter_update(&filter, TEMPERATURE_SLOT, temperature)) {
+ *       iotcl_telemetry_set_number(msg, "temperature", temperature);
+ *   }
+ */
+
+#ifndef IOTC_TELEMETRY_FILTER_MAX_FIELDS
+#define IOTC_TELEMETRY_FILTER_MAX_FIELDS 32
+#endif
+
+typedef struct {
+    double last_value; // last reported value
+    float abs_deadband;
+    float pct_deadband; // percent of the last reported value
+    uint32_t max_silence_ms; // 0 = no forced reports
+    uint32_t last_report_ms; // relative to the filter start time, wraps after ~49 days
+    uint8_t flags;
+} IotConnectTelemetryFilterEntry;
+
+typedef struct {
+    IotConnectTelemetryFilterEntry entries[IOTC_TELEMETRY_FILTER_MAX_FIELDS];
+    uint64_t start_ms;
+    unsigned long reported;
+    unsigned long suppressed;
+} IotConnectTelemetryFilter;
+
+void iotc_telemetry_filter_init(IotConnectTelemetryFilter *f);
+
+// Enables filtering for the slot. abs_deadband is in the unit of the value, pct_deadband is in percent.
+// max_silence_ms forces a report even if the value did not change, so that the cloud can tell
+// a steady value from a dead device.
+int iotc_telemetry_filter_configure(IotConnectTelemetryFilter *f, int slot, double abs_deadband,
+                                    double pct_deadband, unsigned long max_silence_ms);
+
+// Returns true if the value should be reported, in which case it is recorded as the last reported value.
+bool iotc_telemetry_filter_update(IotConnectTelemetryFilter *f, int slot, double value);
+
+// Forces the next value of the slot to be reported, like after a reconnect
+void iotc_telemetry_filter_reset(IotConnectTelemetryFilter *f, int slot);
+
+void iotc_telemetry_filter_reset_all(IotConnectTelemetryFilter *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_TELEMETRY_FILTER_H
@@ -0,0 +1,141 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_TELEMETRY_WRITER_H
+#define IOTC_TELEMETRY_WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "iotc_telemetry_filter.h"
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+/*
+ * Pre-compiled telemetry writer. An alternative to building a cJSON tree with iotcl_telemetry_set_*()
+ * for every message when the same set of fields is sent over and over.
+ *
+ * Fields are declared once, including nested fields with dotted paths like "coordinate.x", and compiled into
+ * pre-formatted key fragments. Values are then written into fixed slots and serialized in a single pass into
+ * a caller supplied buffer, producing the same JSON as iotcl_mqtt_send_telemetry(). Nothing is allocated.
+ * Numbers are formatted with iotc_dtoa() rather than cJSON, so their digits can differ from cJSON output,
+ * but they parse back to the same value.
+ *
+ * Example:
+ *   static char buffer[512];
+ *   static IotConnectTelemetryWriter w;
+ *   iotc_telemetry_writer_init(&w, buffer, sizeof(buffer));
+ *   int temperature = iotc_telemetry_writer_add_field(&w, "temperature", IOTC_TFT_NUMBER);
+ *   int x = iotc_telemetry_writer_add_field(&w, "coordinate.x", IOTC_TFT_NUMBER);
+ *   iotc_telemetry_writer_compile(&w);
+ *   ...
+ *   iotc_telemetry_writer_set_number(&w, temperature, 23.5);
+ *   iotc_telemetry_writer_set_number(&w, x, 1.25);
+ *   iotconnect_sdk_send_telemetry_writer(&w);
+ */
+
+#ifndef IOTC_TELEMETRY_WRITER_MAX_FIELDS
+#define IOTC_TELEMETRY_WRITER_MAX_FIELDS 32
+#endif
+
+// Maximum number of distinct nested objects ("coordinate" in "coordinate.x")
+#ifndef IOTC_TELEMETRY_WRITER_MAX_OBJECTS
+#define IOTC_TELEMETRY_WRITER_MAX_OBJECTS 16
+#endif
+
+// Maximum nesting depth of a field path. "a.b.c" has depth 2.
+#ifndef IOTC_TELEMETRY_WRITER_MAX_DEPTH
+#define IOTC_TELEMETRY_WRITER_MAX_DEPTH 4
+#endif
+
+// Storage for field paths and pre-formatted keys
+#ifndef IOTC_TELEMETRY_WRITER_KEY_POOL_SIZE
+#define IOTC_TELEMETRY_WRITER_KEY_POOL_SIZE 1024
+#endif
+
+typedef enum {
+    IOTC_TFT_NUMBER = 1, // INTEGER or DECIMAL template attributes
+    IOTC_TFT_BOOLEAN,
+    IOTC_TFT_STRING
+} IotConnectTelemetryFieldType;
+
+typedef struct {
+    IotConnectTelemetryFieldType type;
+    bool is_set;
+    uint16_t path_offset; // the dotted path, in the key pool
+    uint16_t key_offset; // pre-formatted "name": in the key pool
+    uint16_t key_len;
+    int8_t precision; // number of decimals, or -1 for the shortest representation that round-trips
+    uint8_t depth;
+    uint8_t parents[IOTC_TELEMETRY_WRITER_MAX_DEPTH]; // object indexes from the outermost one
+    union {
+        double number;
+        bool boolean;
+        const char *string; // not copied. Must stay valid until the message is serialized.
+    } value;
+} IotConnectTelemetryField;
+
+typedef struct {
+    uint16_t prefix_offset; // dotted path of the object itself, in the key pool
+    uint16_t prefix_len;
+    uint16_t key_offset; // pre-formatted "name":{ in the key pool
+    uint16_t key_len;
+} IotConnectTelemetryObject;
+
+typedef struct {
+    IotConnectTelemetryField fields[IOTC_TELEMETRY_WRITER_MAX_FIELDS];
+    uint8_t order[IOTC_TELEMETRY_WRITER_MAX_FIELDS]; // serialization order, grouped by object
+    IotConnectTelemetryObject objects[IOTC_TELEMETRY_WRITER_MAX_OBJECTS];
+    char key_pool[IOTC_TELEMETRY_WRITER_KEY_POOL_SIZE];
+    size_t field_count;
+    size_t object_count;
+    size_t key_pool_used;
+    char *buffer;
+    size_t buffer_size;
+    size_t length; // length of the last serialized message
+    bool is_compiled;
+    bool include_timestamp; // if true, add "dt" with the current UTC time to each message
+} IotConnectTelemetryWriter;
+
+// The buffer receives the serialized JSON and must outlive the writer
+void iotc_telemetry_writer_init(IotConnectTelemetryWriter *w, char *buffer, size_t buffer_size);
+
+// Declares a field. Returns the slot index used to set the value, or a negative value on error.
+// The path is copied. It cannot contain quotes, backslashes or control characters, since it is not escaped.
+int iotc_telemetry_writer_add_field(IotConnectTelemetryWriter *w, const char *path, IotConnectTelemetryFieldType type);
+
+// Groups the fields by their nested objects and pre-formats all keys. No fields can be added afterwards.
+int iotc_telemetry_writer_compile(IotConnectTelemetryWriter *w);
+
+int iotc_telemetry_writer_set_number(IotConnectTelemetryWriter *w, int slot, double value);
+
+// Prints the number field with a fixed number of decimals (0 to 9) instead of the shortest round-trip
+// representation, which is shorter on the wire for noisy sensor values. Pass -1 to restore the default.
+int iotc_telemetry_writer_set_precision(IotConnectTelemetryWriter *w, int slot, int decimals);
+
+int iotc_telemetry_writer_set_bool(IotConnectTelemetryWriter *w, int slot, bool value);
+
+int iotc_telemetry_writer_set_string(IotConnectTelemetryWriter *w, int slot, const char *value);
+
+// Fields that are not set are left out of the message, same as with iotcl_telemetry_set_*()
+void iotc_telemetry_writer_clear(IotConnectTelemetryWriter *w, int slot);
+
+void iotc_telemetry_writer_clear_all(IotConnectTelemetryWriter *w);
+
+// Runs the set number fields through the deadband filter, using the writer slots as filter slots,
+// and clears the ones that the filter suppresses. Returns the number of fields (of any type) that are still set.
+// If it returns zero, there is nothing worth sending.
+size_t iotc_telemetry_writer_apply_filter(IotConnectTelemetryWriter *w, IotConnectTelemetryFilter *filter);
+
+// Serializes all set fields into the buffer. Returns the NUL terminated JSON or NULL if the buffer is too small.
+const char *iotc_telemetry_writer_serialize(IotConnectTelemetryWriter *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_TELEMETRY_WRITER_H
@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_THREAD_H
+#define IOTC_THREAD_H
+
+// Minimal portability layer for the few places where the SDK runs its own threads.
+// Uses Win32 primitives on Windows and pthreads everywhere else.
+
+#include <stdbool.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <Windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+#if defined(_WIN32) || defined(_WIN64)
+typedef HANDLE IotcThread;
+typedef CRITICAL_SECTION IotcMutex;
+typedef CONDITION_VARIABLE IotcCond;
+typedef INIT_ONCE IotcOnce;
+#define IOTC_ONCE_INIT INIT_ONCE_STATIC_INIT
+#else
+typedef pthread_t IotcThread;
+typedef pthread_mutex_t IotcMutex;
+typedef pthread_cond_t IotcCond;
+typedef pthread_once_t IotcOnce;
+#define IOTC_ONCE_INIT PTHREAD_ONCE_INIT
+#endif
+
+#if defined(_MSC_VER)
+#define IOTC_THREAD_LOCAL __declspec(thread)
+#define IOTC_ATOMIC_EXCHANGE_PTR(ptr, value) InterlockedExchangePointer((PVOID volatile *) (ptr), (value))
+#define IOTC_ATOMIC_LOAD_PTR(ptr) InterlockedCompareExchangePointer((PVOID volatile *) (ptr), NULL, NULL)
+#define IOTC_ATOMIC_STORE_PTR(ptr, value) ((void) InterlockedExchangePointer((PVOID volatile *) (ptr), (value)))
+#define IOTC_ATOMIC_ADD(ptr, value) InterlockedAdd((LONG volatile *) (ptr), (value))
+#define IOTC_ATOMIC_LOAD(ptr) InterlockedCompareExchange((LONG volatile *) (ptr), 0, 0)
+#else
+#define IOTC_THREAD_LOCAL __thread
+#define IOTC_ATOMIC_EXCHANGE_PTR(ptr, value) __atomic_exchange_n((ptr), (value), __ATOMIC_ACQ_REL)
+#define IOTC_ATOMIC_LOAD_PTR(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define IOTC_ATOMIC_STORE_PTR(ptr, value) __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+#define IOTC_ATOMIC_ADD(ptr, value) __atomic_add_fetch((ptr), (value), __ATOMIC_ACQ_REL)
+#define IOTC_ATOMIC_LOAD(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#endif
+
+typedef void (*IotcThreadFunction)(void *arg);
+
+typedef void (*IotcOnceFunction)(void);
+
+int iotc_thread_create(IotcThread *thread, IotcThreadFunction fn, void *arg);
+
+void iotc_thread_join(IotcThread *thread);
+
+// Gives up the rest of the time slice, for short waits on another thread that cannot be woken with a condition
+void iotc_thread_yield(void);
+
+void iotc_mutex_init(IotcMutex *mutex);
+
+void iotc_mutex_lock(IotcMutex *mutex);
+
+void iotc_mutex_unlock(IotcMutex *mutex);
+
+void iotc_mutex_destroy(IotcMutex *mutex);
+
+void iotc_cond_init(IotcCond *cond);
+
+void iotc_cond_wait(IotcCond *cond, IotcMutex *mutex);
+
+// Returns false if the timeout expired
+bool iotc_cond_timed_wait(IotcCond *cond, IotcMutex *mutex, unsigned long timeout_ms);
+
+void iotc_cond_signal(IotcCond *cond);
+
+void iotc_cond_broadcast(IotcCond *cond);
+
+void iotc_cond_destroy(IotcCond *cond);
+
+// Runs fn exactly once for an IotcOnce initialized with IOTC_ONCE_INIT, even if called from several threads at once.
+// For module locks that must be usable before the module is initialized.
+void iotc_once(IotcOnce *once, IotcOnceFunction fn);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_THREAD_H
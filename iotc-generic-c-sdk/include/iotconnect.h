@@ -10,6 +10,16 @@
 #include <stddef.h>
 #include <time.h>
 #include "iotcl.h"
+#include "iotc_link_health.h"
+#include "iotc_telemetry_writer.h"
+#include "iotc_backfill.h"
+#include "iotc_dns_cache.h"
+#include "iotc_startup_timing.h"
+#include "iotc_credentials.h"
+#include "iotc_endpoint_race.h"
+#include "iotc_command_executor.h"
+#include "iotc_publish_queue.h"
+#include "iotc_c2d_dedup.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -58,6 +68,8 @@ typedef struct {
     } data;
 } IotConnectAuthInfo;
 
+struct IotConnectTransport; // defined in iotc_device_client.h
+
 typedef struct {
     IotConnectConnectionType connection_type;
     char *env;    // Settings -> Key Vault -> CPID.
@@ -68,24 +80,102 @@ typedef struct {
     IotclOtaCallback ota_cb; // callback for OTA events.
     IotclCommandCallback cmd_cb; // callback for command events.
     IotConnectMqttStatusCallback status_cb; // callback for connection status
-    bool verbose; // If true, we will output extra info and sent and received MQTT json data to standard out
+    // If true, we will output extra info and sent and received MQTT json data to standard out.
+    // The startup phase timings are printed after each connect. See iotc_startup_timing.h.
+    bool verbose;
+    // If true, the MQTT session and the QoS1 messages that are in flight will survive reconnects.
+    // A failed QoS1 send will be retried by the SDK on the next connect in this case, so it should not be re-sent.
+    bool persistent_session;
+    // Keepalive and dead link detection. See iotc_link_health.h. Defaults are set by iotconnect_sdk_init_config().
+    // Link statistics (smoothed RTT, jitter etc.) can be obtained with iotc_link_health_get_stats().
+    IotConnectLinkHealthConfig link_health;
+    // If true, outbound messages (telemetry, acks etc.) can be sent from any thread. They are queued and published
+    // in order by a single SDK thread, so iotcl_mqtt_send_* calls return without waiting for the acknowledgement.
+    // Delivery results are still reported through status_cb, but from the SDK publisher thread.
+    // iotconnect_sdk_disconnect() waits for the queued messages to be sent before disconnecting.
+    bool thread_safe_publish;
+    // Watermarks of the queue used with thread_safe_publish. See iotc_publish_queue.h.
+    // At the high watermark, iotconnect_sdk_send_telemetry_writer() returns IOTC_ERR_WOULD_BLOCK instead of
+    // queuing and iotconnect_sdk_is_writable() returns false, until publish_queue.writable_cb reports that
+    // the queue has drained to the low watermark. Messages sent with iotcl_mqtt_send_* are always queued.
+    IotConnectPublishQueueConfig publish_queue;
+    // Telemetry that cannot be sent while MQTT is disconnected is kept in a spool file and uploaded over HTTPS
+    // in the background after the next successful iotconnect_sdk_connect(). See iotc_backfill.h.
+    // Disabled unless backfill.spool_path and backfill.upload_url are set.
+    IotConnectBackfillConfig backfill;
+    // Addresses of the discovery, identity and broker hosts are cached, so that they are not looked up
+    // on every request. See iotc_dns_cache.h. Set dns_cache.persist_path to keep them across restarts.
+    IotConnectDnsCacheConfig dns_cache;
+    // SAS token lifetime and renewal for symmetric key authentication. See iotc_credentials.h.
+    // The connection is renewed with a new token shortly before the hub would close it.
+    IotConnectCredentialsConfig credentials;
+    // Additional MQTT endpoints, like the broker on another port or a fallback broker. See iotc_endpoint_race.h.
+    // The one that answers first is connected to, and the others are tried if that fails.
+    // The list is not copied and must stay valid until iotconnect_sdk_deinit().
+    IotConnectEndpointConfig mqtt_endpoints;
+    // Set command_executor.workers and command_executor.handler to run commands on a pool of worker threads
+    // instead of passing them to cmd_cb on the MQTT thread. See iotc_command_executor.h.
+    // The publish queue is started for the acknowledgements even if thread_safe_publish is not set.
+    IotConnectCommandExecutorConfig command_executor;
+    // The MQTT transport. NULL for the default one, which is Paho unless the SDK is built without it.
+    // Set to iotc_lite_mqtt_transport() for the small-footprint client or iotc_loopback_transport() to run
+    // without a network.
+    // See IotConnectTransport in iotc_device_client.h.
+    const struct IotConnectTransport *transport;
+
+    // If set, the identity response is kept in this file and iotconnect_sdk_init() skips the discovery and
+    // identity requests while the file is valid. Required by builds without HTTP. Not copied.
+    // See iotc_identity_cache.h.
+    const char *identity_cache_path;
+
+    // C2D messages with an ack ID that arrive again within c2d_dedup.window_secs, like QoS 1 messages redelivered
+    // after a reconnect, are dropped before they reach cmd_cb or ota_cb. See iotc_c2d_dedup.h.
+    // Set c2d_dedup.fingerprint_messages to also check messages without an ack ID by their content.
+    // Set c2d_dedup.window_secs to 0 to pass all messages on.
+    IotConnectC2dDedupConfig c2d_dedup;
 } IotConnectClientConfig;
 
 
 void iotconnect_sdk_init_config(IotConnectClientConfig * c);
 
 // call iotconnect_sdk_init_config first and configure the SDK before calling iotconnect_sdk_init()
-// NOTE: the client does not need to keep references to the struct or any values inside it
+// NOTE: the struct itself and its strings (env, cpid, duid, auth_info, backfill and dns_cache paths) are copied,
+// but these pointers are kept as they are and must stay valid until iotconnect_sdk_deinit():
+//   - mqtt_endpoints.endpoints, the array and the strings in it
+//   - identity_cache_path
+//   - transport
 int iotconnect_sdk_init(IotConnectClientConfig * c);
 
 int iotconnect_sdk_connect(void);
 
 bool iotconnect_sdk_is_connected(void);
 
+// Processes incoming messages, acknowledgements and keepalive for transports that do not have a thread of their own,
+// like the lite MQTT client. Call it regularly, well within the keepalive interval. Does nothing with Paho.
+void iotconnect_sdk_receive(void);
+
+// Moves the connection to one made with the current credentials, like after the device certificate and key files
+// were replaced on disk. The switch relies on sending publishes that were in flight again on the new connection,
+// and there is a short gap in which publishes can fail and C2D messages can be missed, as the broker allows
+// only one connection per client ID. See iotc_device_client_renew_credentials() for how each transport does it.
+// SAS tokens are renewed this way automatically. Fails if not connected.
+int iotconnect_sdk_renew_credentials(void);
+
 void iotconnect_sdk_disconnect(void);
 
 void iotconnect_sdk_deinit(void);
 
+// Serializes the writer's current values and sends them as a telemetry message.
+// Intended to be used instead of iotcl_telemetry_create() and iotcl_mqtt_send_telemetry() when sending
+// the same fields repeatedly. See iotc_telemetry_writer.h.
+// Returns IOTC_ERR_WOULD_BLOCK without sending if thread_safe_publish is set and the publish queue is
+// at its high watermark. The writer keeps its values, so they can be sent again later.
+int iotconnect_sdk_send_telemetry_writer(IotConnectTelemetryWriter *w);
+
+// False while the publish queue is at its high watermark. Producers that use iotcl_mqtt_send_telemetry()
+// can check this first. publish_queue.writable_cb is called once the queue drains after this returned false.
+bool iotconnect_sdk_is_writable(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_LITE_MQTT_H
+#define IOTC_LITE_MQTT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "iotc_device_client.h"
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+/*
+ * A small MQTT 3.1.1 client over OpenSSL, for devices where Paho does not fit.
+ *
+ * It supports only what IoTConnect needs: QoS 0 and 1 publishes, the single C2D subscription and keepalive,
+ * with a clean session. It starts no threads and does not allocate per message. Packets are built in
+ * and parsed from two fixed buffers, which can be provided by the application.
+ *
+ * The socket is non-blocking. Publishes return once the packet is written and their QoS 1 acknowledgements
+ * are reported through the status callback as they arrive. Incoming messages, acknowledgements and
+ * keepalive are processed by iotconnect_sdk_receive(), which the application must call regularly,
+ * at least a few times per keepalive interval. The calls can be made from any thread and are serialized.
+ */
+
+// Used when no buffers are configured. The transmit buffer limits the size of a publish (topic and message),
+// and the receive buffer the size of a C2D message. Larger C2D messages are acknowledged and dropped.
+#ifndef IOTC_LITE_MQTT_DEFAULT_BUFFER_SIZE
+#define IOTC_LITE_MQTT_DEFAULT_BUFFER_SIZE 4096
+#endif
+
+// QoS 1 publishes that can wait for their PUBACK at the same time
+#ifndef IOTC_LITE_MQTT_MAX_INFLIGHT
+#define IOTC_LITE_MQTT_MAX_INFLIGHT 8
+#endif
+
+// For each of TCP connect, TLS handshake, CONNACK and SUBACK
+#ifndef IOTC_LITE_MQTT_CONNECT_TIMEOUT_MS
+#define IOTC_LITE_MQTT_CONNECT_TIMEOUT_MS 10000
+#endif
+
+#ifndef IOTC_LITE_MQTT_DEFAULT_KEEPALIVE_SECS
+#define IOTC_LITE_MQTT_DEFAULT_KEEPALIVE_SECS 60
+#endif
+
+typedef struct {
+    unsigned char *tx_buffer; // must stay valid while connected
+    size_t tx_buffer_size;
+    unsigned char *rx_buffer; // must stay valid while connected
+    size_t rx_buffer_size;
+} IotConnectLiteMqttConfig;
+
+typedef struct {
+    uint64_t tx_bytes; // MQTT bytes, before TLS
+    uint64_t rx_bytes;
+    uint64_t publishes;
+    uint64_t pubacks;
+    uint64_t c2d_messages;
+    uint64_t c2d_dropped; // did not fit into the receive buffer
+    uint64_t pings;
+} IotConnectLiteMqttStats;
+
+// Points the config to the built-in buffers of IOTC_LITE_MQTT_DEFAULT_BUFFER_SIZE
+void iotc_lite_mqtt_init_config(IotConnectLiteMqttConfig *c);
+
+// Takes effect on the next connect
+int iotc_lite_mqtt_configure(const IotConnectLiteMqttConfig *c);
+
+const IotConnectTransport *iotc_lite_mqtt_transport(void);
+
+void iotc_lite_mqtt_get_stats(IotConnectLiteMqttStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_LITE_MQTT_H
@@ -0,0 +1,1100 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#if !defined(_WIN32) && !defined(_WIN64) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L // getaddrinfo()
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32) || defined(_WIN64)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET LiteSocket;
+#define INVALID_LITE_SOCKET INVALID_SOCKET
+#define close_socket closesocket
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+typedef int LiteSocket;
+#define INVALID_LITE_SOCKET (-1)
+#define close_socket close
+#endif
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+#include "iotcl.h"
+#include "iotc_log.h"
+#include "iotc_algorithms.h"
+#include "iotc_clock.h"
+#include "iotc_thread.h"
+#include "iotc_link_health.h"
+#include "iotc_dns_cache.h"
+#include "iotc_startup_timing.h"
+#include "iotc_credentials.h"
+#include "iotc_endpoint_race.h"
+#include "iotc_lite_mqtt.h"
+
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_PUBACK 0x40
+#define MQTT_SUBSCRIBE 0x82 // with the reserved flags that MQTT 3.1.1 requires
+#define MQTT_SUBACK 0x90
+#define MQTT_PINGREQ 0xC0
+#define MQTT_PINGRESP 0xD0
+#define MQTT_DISCONNECT 0xE0
+
+#define MQTT_PROTOCOL_LEVEL 4 // 3.1.1
+#define MQTT_MAX_REMAINING_LENGTH 268435455UL
+#define MQTT_MAX_FIXED_HEADER_SIZE 5
+#define MQTT_SUBACK_FAILURE 0x80
+
+typedef struct {
+    uint16_t packet_id;
+    uint64_t sent_us;
+} InflightPublish;
+
+// A TCP connection and its TLS session, before it is used for MQTT
+typedef struct {
+    LiteSocket sock;
+    SSL_CTX *ssl_ctx;
+    SSL *ssl;
+} LiteLink;
+
+static unsigned char default_tx_buffer[IOTC_LITE_MQTT_DEFAULT_BUFFER_SIZE];
+static unsigned char default_rx_buffer[IOTC_LITE_MQTT_DEFAULT_BUFFER_SIZE];
+static IotConnectLiteMqttConfig lite_config = {
+        default_tx_buffer, sizeof(default_tx_buffer), default_rx_buffer, sizeof(default_rx_buffer)
+};
+static IotConnectLiteMqttConfig buffers; // the ones that the current connection uses
+
+static LiteSocket sock = INVALID_LITE_SOCKET;
+static SSL_CTX *ssl_ctx = NULL;
+static SSL *ssl = NULL; // NULL when there is no connection to the broker
+static volatile bool is_connected = false; // CONNACK received and not lost since
+static IotConnectC2dCallback c2d_msg_cb = NULL;
+static IotConnectMqttStatusCallback status_cb = NULL;
+// What the last successful connect used, for reconnecting with new credentials.
+// The auth info and the endpoints that it points to belong to the SDK configuration and outlive the connection.
+static IotConnectDeviceClientConfig saved_config;
+static IotConnectEndpoint connected_endpoint; // the one that the connection was made to
+
+static uint16_t next_packet_id = 1;
+static InflightPublish inflight[IOTC_LITE_MQTT_MAX_INFLIGHT];
+static size_t inflight_count = 0;
+static size_t rx_len = 0;
+static size_t rx_skip = 0; // the rest of a message that did not fit into the receive buffer
+static uint64_t keepalive_us = 0;
+static uint64_t last_tx_us = 0;
+static uint64_t ping_sent_us = 0; // 0 when no PINGRESP is outstanding
+
+static bool is_connack_received = false;
+static int connack_code = 0;
+static uint16_t subscribe_packet_id = 0;
+static bool is_suback_received = false;
+static int suback_code = 0;
+
+static IotConnectLiteMqttStats stats;
+
+// Serializes the application, the SDK publisher thread and the command workers.
+// Callbacks run with the lock held, so calls made from within them skip it.
+static IotcMutex lock;
+static bool is_lock_initialized = false;
+static IOTC_THREAD_LOCAL bool is_in_callback = false;
+
+static void lock_init(void) {
+    if (!is_lock_initialized) {
+        iotc_mutex_init(&lock);
+        is_lock_initialized = true;
+    }
+}
+
+static void enter(void) {
+    lock_init();
+    if (!is_in_callback) {
+        iotc_mutex_lock(&lock);
+    }
+}
+
+static void leave(void) {
+    if (!is_in_callback) {
+        iotc_mutex_unlock(&lock);
+    }
+}
+
+static void notify_status(IotConnectMqttStatus status) {
+    if (status_cb) {
+        bool was_in_callback = is_in_callback;
+        is_in_callback = true;
+        status_cb(status);
+        is_in_callback = was_in_callback;
+    }
+}
+
+static void close_link(LiteLink *l) {
+    if (l->ssl) {
+        SSL_free(l->ssl);
+        l->ssl = NULL;
+    }
+    if (l->ssl_ctx) {
+        SSL_CTX_free(l->ssl_ctx);
+        l->ssl_ctx = NULL;
+    }
+    if (INVALID_LITE_SOCKET != l->sock) {
+        close_socket(l->sock);
+        l->sock = INVALID_LITE_SOCKET;
+    }
+}
+
+// Makes the link the connection that MQTT goes through
+static void use_link(const LiteLink *l) {
+    sock = l->sock;
+    ssl_ctx = l->ssl_ctx;
+    ssl = l->ssl;
+}
+
+static void close_connection(void) {
+    LiteLink current = {sock, ssl_ctx, ssl};
+    close_link(&current);
+    use_link(&current);
+    is_connected = false;
+    inflight_count = 0;
+    rx_len = 0;
+    rx_skip = 0;
+    ping_sent_us = 0;
+}
+
+static void lose_connection(const char *cause) {
+    bool was_connected = is_connected;
+    size_t lost_publishes = inflight_count;
+    close_connection();
+    if (!was_connected) {
+        return; // a connect in progress reports its own error
+    }
+    IOTC_INFO("MQTT Connection lost. Cause: %s", cause);
+    for (size_t i = 0; i < lost_publishes; i++) {
+        notify_status(IOTC_CS_MQTT_SEND_FAILED);
+    }
+    notify_status(IOTC_CS_MQTT_DISCONNECTED);
+}
+
+static void print_ssl_errors(const char *what) {
+    unsigned long e = ERR_get_error();
+    if (0 == e) {
+        IOTC_ERROR("%s failed", what);
+    }
+    for (; e != 0; e = ERR_get_error()) {
+        char buf[256];
+        ERR_error_string_n(e, buf, sizeof(buf));
+        IOTC_ERROR("%s failed: %s", what, buf);
+    }
+}
+
+// Returns 1 if the socket is ready, 0 on timeout and -1 on error
+static int wait_socket(LiteSocket s, bool for_write, unsigned long timeout_ms) {
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(s, &fds);
+    struct timeval tv;
+    tv.tv_sec = (long) (timeout_ms / 1000);
+    tv.tv_usec = (long) (timeout_ms % 1000) * 1000;
+    int rc = select((int) s + 1, for_write ? NULL : &fds, for_write ? &fds : NULL, NULL, &tv);
+    return rc > 0 ? 1 : rc;
+}
+
+static unsigned long remaining_ms(uint64_t deadline_ms) {
+    uint64_t now_ms = iotc_clock_now_ms();
+    return now_ms >= deadline_ms ? 0 : (unsigned long) (deadline_ms - now_ms);
+}
+
+static bool set_non_blocking(LiteSocket s) {
+#if defined(_WIN32) || defined(_WIN64)
+    u_long non_blocking = 1;
+    return 0 == ioctlsocket(s, FIONBIO, &non_blocking);
+#else
+    int flags = fcntl(s, F_GETFL, 0);
+    return flags >= 0 && 0 == fcntl(s, F_SETFL, flags | O_NONBLOCK) && s < FD_SETSIZE;
+#endif
+}
+
+static bool connect_address(LiteLink *l, const struct addrinfo *ai, uint64_t deadline_ms) {
+    l->sock = socket(ai->ai_family, SOCK_STREAM, 0);
+    if (INVALID_LITE_SOCKET == l->sock) {
+        return false;
+    }
+    if (!set_non_blocking(l->sock)) {
+        goto cleanup;
+    }
+    if (0 == connect(l->sock, ai->ai_addr, (socklen_t) ai->ai_addrlen)) {
+        return true;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    if (WSAGetLastError() != WSAEWOULDBLOCK) {
+        goto cleanup;
+    }
+#else
+    if (errno != EINPROGRESS) {
+        goto cleanup;
+    }
+#endif
+    if (wait_socket(l->sock, true, remaining_ms(deadline_ms)) > 0) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (0 == getsockopt(l->sock, SOL_SOCKET, SO_ERROR, (char *) &error, &len) && 0 == error) {
+            return true;
+        }
+    }
+
+    cleanup:
+    close_socket(l->sock);
+    l->sock = INVALID_LITE_SOCKET;
+    return false;
+}
+
+// Tries the cached addresses of the host first and then a fresh lookup
+static bool tcp_connect(LiteLink *l, const IotConnectEndpoint *e, uint64_t deadline_ms) {
+    char port[8];
+    struct addrinfo hints;
+    struct addrinfo *list = NULL;
+    sprintf(port, "%u", e->port);
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    IotConnectDnsAddress addresses[IOTC_DNS_CACHE_MAX_ADDRESSES];
+    size_t address_count = iotc_dns_cache_get(e->host, addresses, IOTC_DNS_CACHE_MAX_ADDRESSES, false);
+    hints.ai_flags = AI_NUMERICHOST;
+    for (size_t i = 0; i < address_count; i++) {
+        if (0 == getaddrinfo(addresses[i], port, &hints, &list)) {
+            bool is_done = connect_address(l, list, deadline_ms);
+            freeaddrinfo(list);
+            if (is_done) {
+                return true;
+            }
+        }
+    }
+
+    hints.ai_flags = 0;
+    int status = getaddrinfo(e->host, port, &hints, &list);
+    if (0 != status) {
+        IOTC_ERROR("Unable to resolve %s: %s", e->host, gai_strerror(status));
+        return false;
+    }
+    bool is_done = false;
+    for (struct addrinfo *ai = list; ai && !is_done && remaining_ms(deadline_ms) > 0; ai = ai->ai_next) {
+        is_done = connect_address(l, ai, deadline_ms);
+    }
+    freeaddrinfo(list);
+    if (!is_done) {
+        IOTC_ERROR("Unable to connect to %s:%u", e->host, e->port);
+    }
+    return is_done;
+}
+
+static bool tls_connect(LiteLink *l, const char *host, const IotConnectAuthInfo *auth, uint64_t deadline_ms) {
+    l->ssl_ctx = SSL_CTX_new(TLS_client_method());
+    if (!l->ssl_ctx) {
+        print_ssl_errors("SSL_CTX_new");
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(l->ssl_ctx, TLS1_2_VERSION);
+    SSL_CTX_set_verify(l->ssl_ctx, SSL_VERIFY_PEER, NULL);
+    if (1 != SSL_CTX_load_verify_locations(l->ssl_ctx, auth->trust_store, NULL)) {
+        print_ssl_errors("Loading the trust store");
+        return false;
+    }
+    if (auth->type == IOTC_AT_X509) {
+        if (1 != SSL_CTX_use_certificate_chain_file(l->ssl_ctx, auth->data.cert_info.device_cert)) {
+            print_ssl_errors("Loading the device certificate");
+            return false;
+        }
+        if (1 != SSL_CTX_use_PrivateKey_file(l->ssl_ctx, auth->data.cert_info.device_key, SSL_FILETYPE_PEM)) {
+            print_ssl_errors("Loading the device key");
+            return false;
+        }
+    }
+    l->ssl = SSL_new(l->ssl_ctx);
+    if (!l->ssl || 1 != SSL_set_fd(l->ssl, (int) l->sock)) {
+        print_ssl_errors("SSL_new");
+        return false;
+    }
+    SSL_set_tlsext_host_name(l->ssl, host);
+    SSL_set1_host(l->ssl, host); // check the certificate against the host name, like Paho does
+
+    while (true) {
+        int rc = SSL_connect(l->ssl);
+        if (1 == rc) {
+            return true;
+        }
+        int error = SSL_get_error(l->ssl, rc);
+        if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) {
+            long verify_result = SSL_get_verify_result(l->ssl);
+            if (verify_result != X509_V_OK) {
+                IOTC_ERROR("TLS handshake with %s failed: %s", host, X509_verify_cert_error_string(verify_result));
+            } else {
+                print_ssl_errors("TLS handshake");
+            }
+            return false;
+        }
+        if (wait_socket(l->sock, error == SSL_ERROR_WANT_WRITE, remaining_ms(deadline_ms)) <= 0) {
+            IOTC_ERROR("TLS handshake with %s timed out", host);
+            return false;
+        }
+    }
+}
+
+static bool write_all(const unsigned char *data, size_t len, unsigned long timeout_ms) {
+    uint64_t deadline_ms = iotc_clock_now_ms() + timeout_ms;
+    while (true) {
+        // partial writes are not enabled, so this writes all or nothing
+        int rc = SSL_write(ssl, data, (int) len);
+        if (rc > 0) {
+            stats.tx_bytes += len;
+            last_tx_us = iotc_clock_now_us();
+            return true;
+        }
+        int error = SSL_get_error(ssl, rc);
+        if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) {
+            return false;
+        }
+        // retried with the same arguments, as OpenSSL requires
+        if (wait_socket(sock, error == SSL_ERROR_WANT_WRITE, remaining_ms(deadline_ms)) <= 0) {
+            return false;
+        }
+    }
+}
+
+static bool send_packet(const unsigned char *data, size_t len) {
+    if (!ssl) {
+        return false;
+    }
+    if (!write_all(data, len, iotc_link_health_get_ack_timeout_ms())) {
+        lose_connection("write failed");
+        return false;
+    }
+    return true;
+}
+
+static size_t put_remaining_length(unsigned char *p, size_t value) {
+    size_t i = 0;
+    do {
+        unsigned char b = (unsigned char) (value % 128);
+        value /= 128;
+        p[i++] = value > 0 ? (unsigned char) (b | 0x80) : b;
+    } while (value > 0);
+    return i;
+}
+
+static size_t put_u16(unsigned char *p, uint16_t value) {
+    p[0] = (unsigned char) (value >> 8);
+    p[1] = (unsigned char) (value & 0xFF);
+    return 2;
+}
+
+static size_t put_string(unsigned char *p, const char *str, size_t len) {
+    put_u16(p, (uint16_t) len);
+    memcpy(p + 2, str, len);
+    return 2 + len;
+}
+
+static uint16_t get_u16(const unsigned char *p) {
+    return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+// Returns the header length if the fixed header is complete, 0 if more data is needed, or -1 if it is malformed
+static int parse_fixed_header(const unsigned char *p, size_t len, size_t *remaining_length) {
+    size_t value = 0;
+    size_t multiplier = 1;
+    for (size_t i = 1; i < MQTT_MAX_FIXED_HEADER_SIZE; i++) {
+        if (i >= len) {
+            return 0;
+        }
+        value += (p[i] & 0x7F) * multiplier;
+        if (0 == (p[i] & 0x80)) {
+            *remaining_length = value;
+            return (int) i + 1;
+        }
+        multiplier *= 128;
+    }
+    return -1;
+}
+
+static uint16_t get_packet_id(void) {
+    while (true) {
+        uint16_t id = next_packet_id++;
+        if (0 == next_packet_id) {
+            next_packet_id = 1;
+        }
+        bool is_in_use = (id == subscribe_packet_id && !is_suback_received);
+        for (size_t i = 0; i < inflight_count; i++) {
+            if (inflight[i].packet_id == id) {
+                is_in_use = true;
+            }
+        }
+        if (!is_in_use) {
+            return id;
+        }
+    }
+}
+
+static void on_link_dead(void) {
+    IOTC_WARN("MQTT link declared dead. No acknowledgement within %lu ms.", iotc_link_health_get_ack_timeout_ms());
+    lose_connection("link dead");
+}
+
+static void handle_publish(unsigned char flags, const unsigned char *body, size_t available, size_t len) {
+    int qos = (flags >> 1) & 0x03;
+    size_t header_len = 2 + (qos > 0 ? 2 : 0);
+    if (available < 2 || available < header_len + get_u16(body)) {
+        lose_connection("malformed PUBLISH");
+        return;
+    }
+    size_t topic_len = get_u16(body);
+    header_len += topic_len;
+    uint16_t packet_id = qos > 0 ? get_u16(body + 2 + topic_len) : 0;
+
+    if (available < len) {
+        stats.c2d_dropped++;
+        IOTC_WARN("Dropped a C2D message of %lu bytes. The receive buffer holds %lu bytes.",
+                  (unsigned long) (len - header_len), (unsigned long) buffers.rx_buffer_size);
+    } else {
+        stats.c2d_messages++;
+        if (c2d_msg_cb) {
+            bool was_in_callback = is_in_callback;
+            is_in_callback = true;
+            c2d_msg_cb(body + header_len, len - header_len);
+            is_in_callback = was_in_callback;
+        }
+    }
+    if (qos > 0 && ssl) {
+        unsigned char puback[4] = {MQTT_PUBACK, 2};
+        put_u16(&puback[2], packet_id);
+        send_packet(puback, sizeof(puback));
+    }
+}
+
+static void handle_puback(uint16_t packet_id) {
+    for (size_t i = 0; i < inflight_count; i++) {
+        if (inflight[i].packet_id == packet_id) {
+            iotc_link_health_on_rtt_sample((unsigned long) (iotc_clock_now_us() - inflight[i].sent_us));
+            inflight[i] = inflight[--inflight_count];
+            stats.pubacks++;
+            notify_status(IOTC_CS_MQTT_DELIVERED);
+            return;
+        }
+    }
+}
+
+// available is less than len if the packet did not fit into the receive buffer
+static void handle_packet(unsigned char type, const unsigned char *body, size_t available, size_t len) {
+    switch (type & 0xF0) {
+        case MQTT_CONNACK:
+            if (len >= 2) {
+                connack_code = body[1];
+                is_connack_received = true;
+            }
+            break;
+        case MQTT_PUBLISH:
+            handle_publish(type & 0x0F, body, available, len);
+            break;
+        case MQTT_PUBACK:
+            if (len >= 2) {
+                handle_puback(get_u16(body));
+            }
+            break;
+        case MQTT_SUBACK:
+            if (len >= 3 && get_u16(body) == subscribe_packet_id) {
+                suback_code = body[2];
+                is_suback_received = true;
+            }
+            break;
+        case MQTT_PINGRESP:
+            if (ping_sent_us) {
+                iotc_link_health_on_rtt_sample((unsigned long) (iotc_clock_now_us() - ping_sent_us));
+            }
+            ping_sent_us = 0;
+            break;
+        default:
+            break; // nothing else is expected from the broker with QoS 1 and a single subscription
+    }
+}
+
+static void consume(size_t len) {
+    memmove(buffers.rx_buffer, buffers.rx_buffer + len, rx_len - len);
+    rx_len -= len;
+}
+
+static void process_packets(void) {
+    while (ssl && rx_len > 0) {
+        if (rx_skip > 0) {
+            size_t len = rx_skip < rx_len ? rx_skip : rx_len;
+            rx_skip -= len;
+            consume(len);
+            continue;
+        }
+        size_t remaining_length = 0;
+        int header_len = parse_fixed_header(buffers.rx_buffer, rx_len, &remaining_length);
+        if (header_len < 0) {
+            lose_connection("malformed packet");
+            return;
+        }
+        if (0 == header_len) {
+            return; // need more data
+        }
+        size_t total = (size_t) header_len + remaining_length;
+        if (total > buffers.rx_buffer_size) {
+            if (rx_len < buffers.rx_buffer_size) {
+                return; // handled once the buffer is full, so that the topic and packet ID are in it
+            }
+            size_t available = rx_len - (size_t) header_len;
+            unsigned char type = buffers.rx_buffer[0];
+            rx_skip = total - rx_len;
+            rx_len = 0;
+            handle_packet(type, buffers.rx_buffer + header_len, available, remaining_length);
+            continue;
+        }
+        if (rx_len < total) {
+            return;
+        }
+        handle_packet(buffers.rx_buffer[0], buffers.rx_buffer + header_len, remaining_length, remaining_length);
+        if (!ssl) {
+            return; // the connection was closed while handling the packet
+        }
+        consume(total);
+    }
+}
+
+// Reads and processes everything that has arrived. Returns false if the connection was lost.
+static bool read_available(void) {
+    while (ssl) {
+        if (rx_len == buffers.rx_buffer_size) {
+            process_packets(); // an oversized message
+            continue;
+        }
+        int rc = SSL_read(ssl, buffers.rx_buffer + rx_len, (int) (buffers.rx_buffer_size - rx_len));
+        if (rc > 0) {
+            rx_len += (size_t) rc;
+            stats.rx_bytes += (uint64_t) rc;
+            process_packets();
+            continue;
+        }
+        int error = SSL_get_error(ssl, rc);
+        if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+            return true;
+        }
+        lose_connection(error == SSL_ERROR_ZERO_RETURN ? "closed by the broker" : "read failed");
+        return false;
+    }
+    return false;
+}
+
+static void check_timers(void) {
+    uint64_t now_us = iotc_clock_now_us();
+    uint64_t ack_timeout_us = (uint64_t) iotc_link_health_get_ack_timeout_ms() * 1000;
+    for (size_t i = 0; i < inflight_count && is_connected;) {
+        if (now_us - inflight[i].sent_us < ack_timeout_us) {
+            i++;
+            continue;
+        }
+        inflight[i] = inflight[--inflight_count];
+        notify_status(IOTC_CS_MQTT_SEND_FAILED);
+        if (iotc_link_health_on_ack_timeout()) {
+            on_link_dead();
+            return;
+        }
+    }
+    if (!is_connected) {
+        return;
+    }
+    if (ping_sent_us) {
+        if (now_us - ping_sent_us >= keepalive_us) {
+            lose_connection("no PINGRESP within the keepalive interval");
+        }
+    } else if (now_us - last_tx_us >= keepalive_us) {
+        unsigned char pingreq[2] = {MQTT_PINGREQ, 0};
+        if (send_packet(pingreq, sizeof(pingreq))) {
+            ping_sent_us = iotc_clock_now_us();
+            stats.pings++;
+        }
+    }
+}
+
+// Waits up to timeout_ms for data and processes it
+static void poll_connection(unsigned long timeout_ms) {
+    if (!ssl) {
+        return;
+    }
+    if (0 == SSL_pending(ssl) && timeout_ms > 0 && wait_socket(sock, false, timeout_ms) < 0) {
+        lose_connection("select failed");
+        return;
+    }
+    if (read_available()) {
+        check_timers();
+    }
+}
+
+static bool wait_for(const bool *flag, uint64_t deadline_ms) {
+    while (ssl && !*flag) {
+        unsigned long timeout_ms = remaining_ms(deadline_ms);
+        if (0 == timeout_ms) {
+            return false;
+        }
+        poll_connection(timeout_ms);
+    }
+    return *flag;
+}
+
+static bool send_connect(const IotclMqttConfig *mc, const char *password, int keepalive_secs) {
+    const char *username = mc->username;
+    size_t client_id_len = strlen(mc->client_id);
+    size_t username_len = username ? strlen(username) : 0;
+    size_t password_len = password ? strlen(password) : 0;
+    size_t remaining_length = 10 + 2 + client_id_len;
+    unsigned char flags = 0x02; // clean session
+    if (username) {
+        flags |= 0x80;
+        remaining_length += 2 + username_len;
+    }
+    if (password) {
+        flags |= 0x40;
+        remaining_length += 2 + password_len;
+    }
+    if (MQTT_MAX_FIXED_HEADER_SIZE + remaining_length > buffers.tx_buffer_size) {
+        IOTC_ERROR("The MQTT CONNECT packet does not fit into the transmit buffer of %lu bytes",
+                   (unsigned long) buffers.tx_buffer_size);
+        return false;
+    }
+    unsigned char *p = buffers.tx_buffer;
+    *p++ = MQTT_CONNECT;
+    p += put_remaining_length(p, remaining_length);
+    p += put_string(p, "MQTT", 4);
+    *p++ = MQTT_PROTOCOL_LEVEL;
+    *p++ = flags;
+    p += put_u16(p, (uint16_t) keepalive_secs);
+    p += put_string(p, mc->client_id, client_id_len);
+    if (username) {
+        p += put_string(p, username, username_len);
+    }
+    if (password) {
+        p += put_string(p, password, password_len);
+    }
+    return write_all(buffers.tx_buffer, (size_t) (p - buffers.tx_buffer), IOTC_LITE_MQTT_CONNECT_TIMEOUT_MS);
+}
+
+// Opens the TCP connection and makes the TLS handshake. Touches nothing that the current connection uses.
+static bool open_link(LiteLink *l, const IotConnectEndpoint *e, const IotConnectAuthInfo *auth) {
+    uint64_t deadline_ms = iotc_clock_now_ms() + IOTC_LITE_MQTT_CONNECT_TIMEOUT_MS;
+    if (!tcp_connect(l, e, deadline_ms)) {
+        return false; // called function will print the error
+    }
+    deadline_ms = iotc_clock_now_ms() + IOTC_LITE_MQTT_CONNECT_TIMEOUT_MS;
+    if (!tls_connect(l, e->host, auth, deadline_ms)) {
+        close_link(l);
+        return false; // called function will print the error
+    }
+    return true;
+}
+
+// Sends CONNECT over the link in use and waits for the CONNACK
+static int start_session(const IotConnectEndpoint *e, const IotclMqttConfig *mc, const char *password,
+                         int keepalive_secs) {
+    is_connack_received = false;
+    if (!send_connect(mc, password, keepalive_secs)) {
+        close_connection();
+        return IOTCL_ERR_FAILED;
+    }
+    uint64_t deadline_ms = iotc_clock_now_ms() + IOTC_LITE_MQTT_CONNECT_TIMEOUT_MS;
+    if (!wait_for(&is_connack_received, deadline_ms)) {
+        IOTC_ERROR("No CONNACK from %s:%u", e->host, e->port);
+        close_connection();
+        return IOTCL_ERR_FAILED;
+    }
+    if (0 != connack_code) {
+        IOTC_ERROR("%s:%u refused the connection with code %d", e->host, e->port, connack_code);
+        close_connection();
+        return IOTCL_ERR_FAILED;
+    }
+    return IOTCL_SUCCESS;
+}
+
+static int open_connection(const IotConnectEndpoint *e, const IotclMqttConfig *mc, const IotConnectAuthInfo *auth,
+                           const char *password, int keepalive_secs) {
+    LiteLink l = {INVALID_LITE_SOCKET, NULL, NULL};
+    if (!open_link(&l, e, auth)) {
+        return IOTCL_ERR_FAILED; // called function will print the error
+    }
+    use_link(&l);
+    return start_session(e, mc, password, keepalive_secs);
+}
+
+static void subscribe_c2d(const IotclMqttConfig *mc) {
+    size_t topic_len = strlen(mc->sub_c2d);
+    size_t remaining_length = 2 + 2 + topic_len + 1;
+    if (MQTT_MAX_FIXED_HEADER_SIZE + remaining_length > buffers.tx_buffer_size) {
+        IOTC_ERROR("The C2D topic does not fit into the transmit buffer");
+        return;
+    }
+    unsigned char *p = buffers.tx_buffer;
+    *p++ = MQTT_SUBSCRIBE;
+    p += put_remaining_length(p, remaining_length);
+    is_suback_received = false;
+    subscribe_packet_id = get_packet_id();
+    p += put_u16(p, subscribe_packet_id);
+    p += put_string(p, mc->sub_c2d, topic_len);
+    *p++ = 1; // QoS
+
+    // SUBACK gives us the first RTT sample before any telemetry is sent
+    uint64_t start_us = iotc_clock_now_us();
+    if (!send_packet(buffers.tx_buffer, (size_t) (p - buffers.tx_buffer))) {
+        IOTC_ERROR("Failed to subscribe to c2d topic");
+        return;
+    }
+    if (!wait_for(&is_suback_received, iotc_clock_now_ms() + IOTC_LITE_MQTT_CONNECT_TIMEOUT_MS)) {
+        IOTC_ERROR("Failed to subscribe to c2d topic. No SUBACK received.");
+        return;
+    }
+    if (MQTT_SUBACK_FAILURE == suback_code) {
+        IOTC_ERROR("The broker rejected the subscription to the c2d topic");
+        return;
+    }
+    iotc_link_health_on_rtt_sample((unsigned long) (iotc_clock_now_us() - start_us));
+}
+
+// Takes the token that the credential manager has ready, if it is running
+static char *get_sas_token(IotclMqttConfig *mc, const IotConnectAuthInfo *auth) {
+    char *sas_token = iotc_credentials_take_sas_token();
+    if (!sas_token) {
+        sas_token = gen_sas_token(mc->host, mc->client_id, auth->data.symmetric_key, 60);
+    }
+    if (!sas_token) {
+        IOTC_ERROR("Unable to generate SAS token!"); // could be OOM or a different reason
+    }
+    return sas_token;
+}
+
+// The broker and the configured fallback endpoints, the one that answers first in front
+static size_t get_endpoints(IotclMqttConfig *mc, const IotConnectEndpointConfig *ec, IotConnectEndpoint *endpoints) {
+    size_t count = 0;
+    if (iotc_endpoint_parse(mc->host, IOTC_ENDPOINT_DEFAULT_PORT, &endpoints[count]) == IOTCL_SUCCESS) {
+        count++;
+    }
+    for (size_t i = 0; ec->endpoints && ec->endpoints[i] && count < IOTC_ENDPOINT_RACE_MAX_ENDPOINTS; i++) {
+        if (iotc_endpoint_parse(ec->endpoints[i], IOTC_ENDPOINT_DEFAULT_PORT, &endpoints[count]) == IOTCL_SUCCESS) {
+            count++; // otherwise the called function prints the error and the endpoint is skipped
+        }
+    }
+    if (count > 1) {
+        uint64_t start_us = iotc_clock_now_us();
+        iotc_endpoint_race(endpoints, count, ec);
+        iotc_startup_timing_record(IOTC_PHASE_ENDPOINT_RACE, start_us);
+    }
+    return count;
+}
+
+static int connect_locked(IotConnectDeviceClientConfig *c) {
+    IotclMqttConfig *mc = iotcl_mqtt_get_config();
+    if (!mc) {
+        return IOTCL_ERR_CONFIG_MISSING; // called function will print the error
+    }
+    if (!lite_config.tx_buffer || !lite_config.rx_buffer) {
+        IOTC_ERROR("The lite MQTT client has no buffers configured");
+        return IOTCL_ERR_CONFIG_MISSING;
+    }
+    buffers = lite_config;
+
+    char *password = NULL;
+    if (c->auth->type == IOTC_AT_SYMMETRIC_KEY) {
+        if (!c->auth->data.symmetric_key || 0 == strlen(c->auth->data.symmetric_key)) {
+            IOTC_ERROR("Error: Configuration symmetric key is missing.");
+            return IOTCL_ERR_CONFIG_MISSING;
+        }
+        password = get_sas_token(mc, c->auth);
+        if (!password) {
+            return IOTCL_ERR_FAILED; // called function will print the error
+        }
+    }
+
+    if (!iotc_dns_cache_wait(mc->host, IOTC_DNS_CACHE_PREFETCH_WAIT_MS)) {
+        IOTC_WARN("Lookup of %s is taking long. Connecting anyway.", mc->host);
+    }
+    IotConnectEndpoint endpoints[IOTC_ENDPOINT_RACE_MAX_ENDPOINTS];
+    size_t endpoint_count = get_endpoints(mc, &c->endpoints, endpoints);
+
+    int keepalive_secs = c->link_health.keepalive_secs > 0 ?
+            c->link_health.keepalive_secs : IOTC_LITE_MQTT_DEFAULT_KEEPALIVE_SECS;
+    keepalive_us = (uint64_t) keepalive_secs * 1000000;
+    iotc_link_health_reset(&c->link_health);
+
+    int status = IOTCL_ERR_CONFIG_ERROR;
+    uint64_t start_us = iotc_clock_now_us();
+    for (size_t i = 0; i < endpoint_count; i++) {
+        status = open_connection(&endpoints[i], mc, c->auth, password, keepalive_secs);
+        if (IOTCL_SUCCESS == status) {
+            connected_endpoint = endpoints[i];
+            break;
+        }
+    }
+    iotc_startup_timing_record(IOTC_PHASE_MQTT_CONNECT, start_us);
+    free(password);
+    if (status != IOTCL_SUCCESS) {
+        IOTC_ERROR("Failed to connect, return code %d", status);
+        return status;
+    }
+
+    c2d_msg_cb = c->c2d_msg_cb;
+    status_cb = c->status_cb;
+    start_us = iotc_clock_now_us();
+    subscribe_c2d(mc); // the connection is still usable for sending if this fails
+    iotc_startup_timing_record(IOTC_PHASE_MQTT_SUBSCRIBE, start_us);
+    if (!ssl) {
+        return IOTCL_ERR_FAILED; // lost while subscribing
+    }
+    saved_config = *c;
+    is_connected = true;
+    return IOTCL_SUCCESS;
+}
+
+static void send_disconnect(void) {
+    if (ssl) {
+        unsigned char packet[2] = {MQTT_DISCONNECT, 0};
+        write_all(packet, sizeof(packet), 1000);
+    }
+}
+
+static int lite_connect(IotConnectDeviceClientConfig *c) {
+    enter();
+    send_disconnect();
+    close_connection();
+    c2d_msg_cb = NULL;
+    status_cb = NULL;
+#if !defined(_WIN32) && !defined(_WIN64)
+    // Writing to a connection that the broker has closed must fail instead of ending the process, as with Paho
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    if (c->persistent_session) {
+        IOTC_WARN("The lite MQTT client does not support persistent sessions. Using a clean session.");
+    }
+    int status = connect_locked(c);
+    if (status != IOTCL_SUCCESS) {
+        close_connection();
+        c2d_msg_cb = NULL;
+        status_cb = NULL;
+    } else {
+        notify_status(IOTC_CS_MQTT_CONNECTED);
+    }
+    leave();
+    return status;
+}
+
+static int lite_disconnect(void) {
+    enter();
+    send_disconnect();
+    close_connection();
+    c2d_msg_cb = NULL;
+    status_cb = NULL;
+    leave();
+    return IOTCL_SUCCESS;
+}
+
+// The TCP connection and the TLS handshake with the new credentials are made with the lock released, so that
+// the current connection keeps serving meanwhile. The broker allows one connection per client ID, so the old
+// connection is closed before CONNECT is sent on the new one, after the publishes in flight are acknowledged.
+static int lite_renew_credentials(void) {
+    enter();
+    if (!is_connected) {
+        leave();
+        return IOTCL_ERR_FAILED; // not connected
+    }
+    IotclMqttConfig *mc = iotcl_mqtt_get_config();
+    IotConnectEndpoint endpoint = connected_endpoint;
+    const IotConnectAuthInfo *auth = saved_config.auth;
+    int keepalive_secs = (int) (keepalive_us / 1000000);
+    leave();
+    if (!mc) {
+        return IOTCL_ERR_CONFIG_MISSING; // called function will print the error
+    }
+    char *password = NULL;
+    if (auth->type == IOTC_AT_SYMMETRIC_KEY) {
+        password = get_sas_token(mc, auth);
+        if (!password) {
+            return IOTCL_ERR_FAILED; // called function will print the error
+        }
+    }
+
+    uint64_t start_us = iotc_clock_now_us();
+    LiteLink l = {INVALID_LITE_SOCKET, NULL, NULL};
+    if (!open_link(&l, &endpoint, auth)) {
+        IOTC_ERROR("Failed to connect with new credentials. Keeping the current connection.");
+        free(password);
+        return IOTCL_ERR_FAILED;
+    }
+
+    enter();
+    if (!is_connected) {
+        leave();
+        close_link(&l);
+        free(password);
+        IOTC_ERROR("The connection was closed while renewing it.");
+        return IOTCL_ERR_FAILED;
+    }
+    uint64_t deadline_ms = iotc_clock_now_ms() + iotc_link_health_get_ack_timeout_ms();
+    while (ssl && inflight_count > 0 && remaining_ms(deadline_ms) > 0) {
+        poll_connection(remaining_ms(deadline_ms));
+    }
+    bool was_connected = is_connected; // unless lost while waiting for the acknowledgements
+    size_t lost_publishes = inflight_count;
+    send_disconnect();
+    close_connection();
+    // With a clean session the broker forgets what was in flight, so report it as failed, as Paho would
+    for (size_t i = 0; i < lost_publishes; i++) {
+        notify_status(IOTC_CS_MQTT_SEND_FAILED);
+    }
+
+    use_link(&l);
+    int status = start_session(&endpoint, mc, password, keepalive_secs);
+    free(password);
+    if (IOTCL_SUCCESS == status) {
+        subscribe_c2d(mc); // the connection is still usable for sending if this fails
+        if (!ssl) {
+            status = IOTCL_ERR_FAILED; // lost while subscribing
+        }
+    }
+    if (status != IOTCL_SUCCESS) {
+        IOTC_ERROR("Failed to reconnect with new credentials, return code %d", status);
+        close_connection();
+        if (was_connected) {
+            notify_status(IOTC_CS_MQTT_DISCONNECTED);
+        }
+        c2d_msg_cb = NULL;
+        status_cb = NULL;
+    } else {
+        is_connected = true;
+        if (!was_connected) {
+            notify_status(IOTC_CS_MQTT_CONNECTED);
+        }
+        IOTC_INFO("MQTT connection renewed in %lu ms.", (unsigned long) ((iotc_clock_now_us() - start_us) / 1000));
+    }
+    leave();
+    return status;
+}
+
+static bool lite_is_connected(void) {
+    return is_connected;
+}
+
+static int lite_send_message_qos(const char *topic, const char *message, int qos) {
+    enter();
+    if (qos > 0 && inflight_count >= IOTC_LITE_MQTT_MAX_INFLIGHT) {
+        if (is_in_callback) {
+            qos = 0; // acknowledgements cannot be processed from within the receive path
+        } else {
+            while (is_connected && inflight_count >= IOTC_LITE_MQTT_MAX_INFLIGHT) {
+                poll_connection(iotc_link_health_get_ack_timeout_ms()); // times out the oldest eventually
+            }
+        }
+    }
+    if (!is_connected) {
+        leave();
+        IOTC_ERROR("Failed to publish message. Not connected.");
+        return IOTCL_ERR_FAILED;
+    }
+    qos = qos > 0 ? 1 : 0;
+    size_t topic_len = strlen(topic);
+    size_t message_len = strlen(message);
+    size_t remaining_length = 2 + topic_len + (qos ? 2 : 0) + message_len;
+    if (remaining_length > MQTT_MAX_REMAINING_LENGTH ||
+        MQTT_MAX_FIXED_HEADER_SIZE + remaining_length > buffers.tx_buffer_size) {
+        leave();
+        IOTC_ERROR("Failed to publish message. %lu bytes do not fit into the transmit buffer of %lu bytes.",
+                   (unsigned long) message_len, (unsigned long) buffers.tx_buffer_size);
+        return IOTCL_ERR_BAD_VALUE;
+    }
+
+    unsigned char *p = buffers.tx_buffer;
+    *p++ = (unsigned char) (MQTT_PUBLISH | (qos << 1));
+    p += put_remaining_length(p, remaining_length);
+    p += put_string(p, topic, topic_len);
+    uint16_t packet_id = 0;
+    if (qos) {
+        packet_id = get_packet_id();
+        p += put_u16(p, packet_id);
+    }
+    memcpy(p, message, message_len);
+    p += message_len;
+
+    uint64_t sent_us = iotc_clock_now_us();
+    if (!send_packet(buffers.tx_buffer, (size_t) (p - buffers.tx_buffer))) {
+        leave();
+        IOTC_ERROR("Failed to publish message");
+        return IOTCL_ERR_FAILED;
+    }
+    stats.publishes++;
+    if (qos) {
+        inflight[inflight_count].packet_id = packet_id;
+        inflight[inflight_count].sent_us = sent_us;
+        inflight_count++;
+    } else {
+        notify_status(IOTC_CS_MQTT_DELIVERED);
+    }
+    leave();
+    return IOTCL_SUCCESS;
+}
+
+static void lite_receive(void) {
+    enter();
+    if (is_in_callback) {
+        leave();
+        return; // already receiving further up the stack
+    }
+    poll_connection(0);
+    leave();
+}
+
+static const IotConnectTransport lite_mqtt_transport = {
+        "lite-mqtt",
+        lite_connect,
+        lite_disconnect,
+        lite_renew_credentials,
+        lite_is_connected,
+        lite_send_message_qos,
+        lite_receive
+};
+
+const IotConnectTransport *iotc_lite_mqtt_transport(void) {
+    return &lite_mqtt_transport;
+}
+
+void iotc_lite_mqtt_init_config(IotConnectLiteMqttConfig *c) {
+    c->tx_buffer = default_tx_buffer;
+    c->tx_buffer_size = sizeof(default_tx_buffer);
+    c->rx_buffer = default_rx_buffer;
+    c->rx_buffer_size = sizeof(default_rx_buffer);
+}
+
+int iotc_lite_mqtt_configure(const IotConnectLiteMqttConfig *c) {
+    // the CONNECT packet with a SAS token needs a few hundred bytes, and so do the IoTConnect topics
+    if (!c->tx_buffer || !c->rx_buffer || c->tx_buffer_size < 512 || c->rx_buffer_size < 512) {
+        IOTC_ERROR("The lite MQTT client needs buffers of at least 512 bytes");
+        return IOTCL_ERR_BAD_VALUE;
+    }
+    enter();
+    lite_config = *c;
+    leave();
+    return IOTCL_SUCCESS;
+}
+
+void iotc_lite_mqtt_get_stats(IotConnectLiteMqttStats *s) {
+    enter();
+    *s = stats;
+    leave();
+}
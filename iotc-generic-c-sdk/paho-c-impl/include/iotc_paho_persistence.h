@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#ifndef IOTC_PAHO_PERSISTENCE_H
+#define IOTC_PAHO_PERSISTENCE_H
+
+#include <stddef.h>
+#include "MQTTClientPersistence.h"
+
+#ifdef __cplusplus
+extern   "C" {
+#endif
+
+// In-memory implementation of the Paho user persistence interface (MQTTCLIENT_PERSISTENCE_USER).
+// Unlike the Paho file persistence, the store outlives the MQTTClient handle, so QoS1 messages which were
+// in flight when the connection was lost are re-sent by Paho when the next client with the same client ID
+// connects with cleansession=0. Records belonging to a different client ID are discarded on open.
+MQTTClient_persistence *iotc_paho_persistence_get(void);
+
+// Number of records (in-flight messages and related Paho state) currently held by the store.
+size_t iotc_paho_persistence_count(void);
+
+// Drops all records and frees the memory held by the store.
+void iotc_paho_persistence_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IOTC_PAHO_PERSISTENCE_H
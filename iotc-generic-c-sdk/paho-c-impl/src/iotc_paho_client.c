@@ -10,24 +10,109 @@
 #include "iotc_algorithms.h"
 #include "iotconnect.h"
 #include "iotc_device_client.h"
+#include "iotc_paho_persistence.h"
+#include "iotc_clock.h"
+#include "iotc_link_health.h"
+#include "iotc_thread.h"
+#include "iotc_dns_cache.h"
+#include "iotc_startup_timing.h"
+#include "iotc_credentials.h"
+#include "iotc_endpoint_race.h"
 
-#define HOST_URL_FORMAT "ssl://%s:8883"
-
-#ifndef MQTT_PUBLISH_TIMEOUT_MS
-#define MQTT_PUBLISH_TIMEOUT_MS     10000L
-#endif
+#define HOST_URL_FORMAT "ssl://%s:%u"
+#define IPV6_HOST_URL_FORMAT "ssl://[%s]:%u"
 
 static bool is_initialized = false;
 static MQTTClient client = NULL;
 static IotConnectC2dCallback c2d_msg_cb = NULL; // callback for inbound messages
 static IotConnectMqttStatusCallback status_cb = NULL; // callback for connection status
-static bool is_in_async_callback = false;
+// Per thread, so that only publishes made from within the C2D callback itself are affected.
+// Publishes from other threads (like the SDK publisher thread) can use QOS1 at the same time.
+static IOTC_THREAD_LOCAL bool is_in_async_callback = false;
+// What the last successful connect used, for reconnecting with new credentials.
+// The strings that these point to belong to the SDK configuration and outlive the connection.
+static MQTTClient_connectOptions saved_conn_opts;
+static MQTTClient_SSLOptions saved_ssl_opts;
+static IotConnectAuthInfo *saved_auth = NULL;
+// The broker and the configured fallback endpoints, in the order that Paho tries them
+static char *server_uris[IOTC_ENDPOINT_RACE_MAX_ENDPOINTS];
+static int server_uri_count = 0;
 
-static void paho_deinit(void) {
-    if (client) {
-        MQTTClient_destroy(&client);
-        client = NULL;
+// Publishes take the client under this lock and count themselves as its users, so that a credential handover
+// can swap in the new client while they are running, and nothing destroys a client until they are done with it.
+// Created once, as publishes can come from any thread before the first connect.
+static IotcOnce handover_lock_once = IOTC_ONCE_INIT;
+static IotcMutex handover_lock;
+static IotcCond handover_cond; // signaled when a handover ends and when the last user of a retiring client is done
+static bool is_handing_over = false;
+static int client_users = 0;
+static MQTTClient retiring_client = NULL; // taken out of use, destroyed once retiring_users is 0
+static int retiring_users = 0;
+
+static void create_handover_lock(void) {
+    iotc_mutex_init(&handover_lock);
+    iotc_cond_init(&handover_cond);
+}
+
+static void handover_lock_init(void) {
+    iotc_once(&handover_lock_once, create_handover_lock);
+}
+
+static void free_server_uris(void) {
+    for (int i = 0; i < server_uri_count; i++) {
+        free(server_uris[i]);
+    }
+    server_uri_count = 0;
+}
+
+// Waits for the publishes that still use the retiring client and destroys it. Called with handover_lock held.
+static void destroy_retiring_client_locked(void) {
+    while (retiring_users > 0) {
+        // bounded by the acknowledgement timeout of the publishes, or sooner once the connection is closed
+        iotc_cond_wait(&handover_cond, &handover_lock);
+    }
+    MQTTClient c = retiring_client;
+    retiring_client = NULL;
+    iotc_mutex_unlock(&handover_lock);
+    MQTTClient_destroy(&c);
+    iotc_mutex_lock(&handover_lock);
+    iotc_cond_broadcast(&handover_cond);
+}
+
+// Takes the client out of use so that new publishes fail, disconnects it unless disconnect_timeout_ms is negative,
+// and destroys it once the publishes in progress are done with it. Disconnecting first fails the ones that are
+// waiting for an acknowledgement, so they finish right away. Waits for a credential handover to finish first.
+// Returns MQTTCLIENT_DISCONNECTED if there was no client, otherwise the result of the disconnect.
+static int close_client(int disconnect_timeout_ms) {
+    int rc = MQTTCLIENT_SUCCESS;
+    handover_lock_init();
+    iotc_mutex_lock(&handover_lock);
+    while (is_handing_over || retiring_client) {
+        iotc_cond_wait(&handover_cond, &handover_lock);
+    }
+    if (!client) {
+        iotc_mutex_unlock(&handover_lock);
+        return MQTTCLIENT_DISCONNECTED;
+    }
+    MQTTClient c = client;
+    retiring_client = client;
+    retiring_users = client_users;
+    client = NULL;
+    client_users = 0;
+    iotc_mutex_unlock(&handover_lock);
+
+    if (disconnect_timeout_ms >= 0) {
+        rc = MQTTClient_disconnect(c, disconnect_timeout_ms);
     }
+    iotc_mutex_lock(&handover_lock);
+    destroy_retiring_client_locked();
+    iotc_mutex_unlock(&handover_lock);
+    return rc;
+}
+
+static void paho_deinit(void) {
+    close_client(-1);
+    free_server_uris();
     c2d_msg_cb = NULL;
     status_cb = NULL;
 }
@@ -47,7 +132,13 @@ static int on_c2d_message(void *context, char *topicName, int topicLen, MQTTClie
 }
 
 static void on_connection_lost(void *context, char *cause) {
-    (void) context;
+    iotc_mutex_lock(&handover_lock);
+    // The broker closes the old connection when the new one with the same client ID connects
+    bool is_retiring = (context != client || is_handing_over);
+    iotc_mutex_unlock(&handover_lock);
+    if (is_retiring) {
+        return;
+    }
 
     IOTC_INFO("MQTT Connection lost. Cause: %s", cause);
 
@@ -57,24 +148,87 @@ static void on_connection_lost(void *context, char *cause) {
     paho_deinit();
 }
 
-int iotc_device_client_disconnect(void) {
+// The broker stopped acknowledging within the deadline derived from the RTT.
+// Drop the connection now rather than waiting for Paho to notice it when the keepalive expires.
+// Publishes from other threads may still be using the client, so it is closed once they are done with it.
+// A credential handover in progress is replacing the connection anyway, so it is left to finish.
+static void on_link_dead(void) {
+    iotc_mutex_lock(&handover_lock);
+    bool is_replacing = (!client || is_handing_over || retiring_client);
+    iotc_mutex_unlock(&handover_lock);
+    if (is_replacing) {
+        return;
+    }
+    IOTC_WARN("MQTT link declared dead. No acknowledgement within %lu ms.", iotc_link_health_get_ack_timeout_ms());
+    is_initialized = false;
+    if (MQTTCLIENT_DISCONNECTED == close_client(0)) {
+        return; // another thread closed it first and reported it
+    }
+    if (status_cb) {
+        status_cb(IOTC_CS_MQTT_DISCONNECTED);
+    }
+    paho_deinit();
+}
+
+static int paho_disconnect(void) {
     int rc;
     is_initialized = false;
-    if ((rc = MQTTClient_disconnect(client, 10000)) != MQTTCLIENT_SUCCESS) {
+    if ((rc = close_client(10000)) != MQTTCLIENT_SUCCESS) {
         IOTC_ERROR("Failed to disconnect, return code %d", rc);
     }
     paho_deinit();
     return rc;
 }
 
-bool iotc_device_client_is_connected(void) {
+// Takes the current client for a publish
+static MQTTClient acquire_client(void) {
+    handover_lock_init();
+    iotc_mutex_lock(&handover_lock);
+    MQTTClient c = client;
+    if (c) {
+        client_users++;
+    }
+    iotc_mutex_unlock(&handover_lock);
+    return c;
+}
+
+static void release_client(MQTTClient c) {
+    iotc_mutex_lock(&handover_lock);
+    if (c == client) {
+        client_users--;
+    } else if (c == retiring_client) {
+        retiring_users--;
+        iotc_cond_broadcast(&handover_cond);
+    }
+    iotc_mutex_unlock(&handover_lock);
+}
+
+// Holds the client like a publish, as it can be called from any thread while the client is closed or replaced
+static bool paho_is_connected(void) {
     if (!is_initialized) {
         return false;
     }
-    return MQTTClient_isConnected(client);
+    MQTTClient c = acquire_client();
+    if (!c) {
+        return false;
+    }
+    bool is_connected = MQTTClient_isConnected(c);
+    release_client(c);
+    return is_connected;
+}
+
+// Returns true if a credential handover replaced the client, after waiting for one that is in progress
+static bool is_replaced(MQTTClient c) {
+    iotc_mutex_lock(&handover_lock);
+    while (is_handing_over) {
+        iotc_cond_wait(&handover_cond, &handover_lock);
+    }
+    bool is_replaced = (client && client != c);
+    iotc_mutex_unlock(&handover_lock);
+    return is_replaced;
 }
 
-int iotc_device_client_send_message_qos(const char* topic, const char *message, int qos) {
+static int paho_send_message_qos(const char *topic, const char *message, int qos) {
     MQTTClient_message pubmsg = MQTTClient_message_initializer;
     MQTTClient_deliveryToken token;
     int rc;
@@ -89,12 +243,36 @@ int iotc_device_client_send_message_qos(const char* topic, const char *message,
         pubmsg.qos = qos;
     }
     pubmsg.retained = 0;
-    if ((rc = MQTTClient_publishMessage(client, topic, &pubmsg, &token)) != MQTTCLIENT_SUCCESS) {
+    MQTTClient c = acquire_client();
+    if (!c) {
+        IOTC_ERROR("Failed to publish message. Not connected.");
+        return MQTTCLIENT_DISCONNECTED;
+    }
+    uint64_t start_us = iotc_clock_now_us();
+    unsigned long ack_timeout_ms = iotc_link_health_get_ack_timeout_ms();
+    bool is_published = ((rc = MQTTClient_publishMessage(c, topic, &pubmsg, &token)) == MQTTCLIENT_SUCCESS);
+    if (is_published) {
+        rc = MQTTClient_waitForCompletion(c, token, ack_timeout_ms);
+    }
+    release_client(c);
+    if (rc != MQTTCLIENT_SUCCESS && is_replaced(c)) {
+        // The old connection was closed by the handover before this was acknowledged. Send it on the new one.
+        return paho_send_message_qos(topic, message, qos);
+    }
+    if (!is_published) {
         IOTC_ERROR("Failed to publish message, return code %d", rc);
         return rc;
     }
 
-    rc = MQTTClient_waitForCompletion(client, token, MQTT_PUBLISH_TIMEOUT_MS);
+    bool is_link_dead = false;
+    if (pubmsg.qos > 0) {
+        uint64_t elapsed_us = iotc_clock_now_us() - start_us;
+        if (0 == rc) {
+            iotc_link_health_on_rtt_sample((unsigned long) elapsed_us);
+        } else if (elapsed_us >= (uint64_t) ack_timeout_ms * 1000) {
+            is_link_dead = iotc_link_health_on_ack_timeout();
+        }
+    }
     if (status_cb) {
         if (0 == rc) {
             status_cb(IOTC_CS_MQTT_DELIVERED);
@@ -102,15 +280,80 @@ int iotc_device_client_send_message_qos(const char* topic, const char *message,
             status_cb(IOTC_CS_MQTT_SEND_FAILED);
         }
     }
+    if (is_link_dead) {
+        on_link_dead();
+    }
     //IOTC_INFO("Message with delivery token %d delivered", token);
     return rc;
 }
 
-int iotc_device_client_send_message(const char* topic, const char *message) {
-    return iotc_device_client_send_message_qos(topic, message, 1);
+// Takes the token that the credential manager has ready, if it is running
+static char *get_sas_token(IotclMqttConfig *mc, IotConnectAuthInfo *auth) {
+    char *sas_token = iotc_credentials_take_sas_token();
+    if (!sas_token) {
+        sas_token = gen_sas_token(mc->host, mc->client_id, auth->data.symmetric_key, 60);
+    }
+    if (!sas_token) {
+        IOTC_ERROR("Unable to generate SAS token!"); // could be OOM or a different reason
+    }
+    return sas_token;
+}
+
+static int subscribe_c2d(MQTTClient c, IotclMqttConfig *mc) {
+    // SUBACK gives us the first RTT sample before any telemetry is sent
+    uint64_t start_us = iotc_clock_now_us();
+    int rc = MQTTClient_subscribe(c, mc->sub_c2d, 1);
+    if (rc != MQTTCLIENT_SUCCESS) {
+        IOTC_ERROR("Failed to subscribe to c2d topic, return code %d", rc);
+        return IOTCL_ERR_FAILED;
+    }
+    iotc_link_health_on_rtt_sample((unsigned long) (iotc_clock_now_us() - start_us));
+    return IOTCL_SUCCESS;
+}
+
+// Fills server_uris with the broker and the additional endpoints, the one that answers first in front
+static int build_server_uris(IotclMqttConfig *mc, const IotConnectEndpointConfig *ec) {
+    IotConnectEndpoint endpoints[IOTC_ENDPOINT_RACE_MAX_ENDPOINTS];
+    size_t count = 0;
+    if (iotc_endpoint_parse(mc->host, IOTC_ENDPOINT_DEFAULT_PORT, &endpoints[count]) == IOTCL_SUCCESS) {
+        count++;
+    }
+    for (size_t i = 0; ec->endpoints && ec->endpoints[i]; i++) {
+        if (count >= IOTC_ENDPOINT_RACE_MAX_ENDPOINTS) {
+            IOTC_WARN("Only %d MQTT endpoints are supported. Ignoring %s and the ones after it.",
+                      IOTC_ENDPOINT_RACE_MAX_ENDPOINTS, ec->endpoints[i]);
+            break;
+        }
+        if (iotc_endpoint_parse(ec->endpoints[i], IOTC_ENDPOINT_DEFAULT_PORT, &endpoints[count]) == IOTCL_SUCCESS) {
+            count++; // otherwise the called function prints the error and the endpoint is skipped
+        }
+    }
+    if (0 == count) {
+        return IOTCL_ERR_CONFIG_ERROR;
+    }
+    if (count > 1) {
+        uint64_t start_us = iotc_clock_now_us();
+        iotc_endpoint_race(endpoints, count, ec);
+        iotc_startup_timing_record(IOTC_PHASE_ENDPOINT_RACE, start_us);
+    }
+
+    free_server_uris();
+    for (size_t i = 0; i < count; i++) {
+        const char *format = strchr(endpoints[i].host, ':') ? IPV6_HOST_URL_FORMAT : HOST_URL_FORMAT;
+        size_t len = (size_t) snprintf(NULL, 0, format, endpoints[i].host, endpoints[i].port);
+        char *uri = malloc(len + 1);
+        if (NULL == uri) {
+            IOTC_ERROR("ERROR: Unable to allocate memory for paho host URL!");
+            free_server_uris();
+            return IOTCL_ERR_OUT_OF_MEMORY;
+        }
+        sprintf(uri, format, endpoints[i].host, endpoints[i].port);
+        server_uris[server_uri_count++] = uri;
+    }
+    return IOTCL_SUCCESS;
 }
 
-int iotc_device_client_connect(IotConnectDeviceClientConfig *c) {
+static int paho_connect(IotConnectDeviceClientConfig *c) {
     MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
     MQTTClient_SSLOptions ssl_opts = MQTTClient_SSLOptions_initializer;
     char * password = NULL;
@@ -124,22 +367,33 @@ int iotc_device_client_connect(IotConnectDeviceClientConfig *c) {
 
     paho_deinit(); // reset all locals
 
-    char *paho_host_url = malloc((size_t) snprintf(NULL, 0, HOST_URL_FORMAT, mc->host) + 1);
-    if (NULL == paho_host_url) {
-        IOTC_ERROR("ERROR: Unable to allocate memory for paho host URL!");
-        return -1;
+    // Paho does its own lookup and checks the certificate against the host name, so it cannot be given the address.
+    // Waiting for the lookup that started with identity lets a caching system resolver answer Paho's lookup locally.
+    if (!iotc_dns_cache_wait(mc->host, IOTC_DNS_CACHE_PREFETCH_WAIT_MS)) {
+        IOTC_WARN("Lookup of %s is taking long. Connecting anyway.", mc->host);
     }
-    sprintf(paho_host_url, HOST_URL_FORMAT, mc->host);
 
-    if ((rc = MQTTClient_create(&client, paho_host_url, mc->client_id,
-                                MQTTCLIENT_PERSISTENCE_NONE, NULL)) != MQTTCLIENT_SUCCESS) {
+    if ((rc = build_server_uris(mc, &c->endpoints)) != IOTCL_SUCCESS) {
+        return rc; // called function will print the error
+    }
+
+    uint64_t start_us = iotc_clock_now_us();
+    if (c->persistent_session) {
+        rc = MQTTClient_create(&client, server_uris[0], mc->client_id,
+                               MQTTCLIENT_PERSISTENCE_USER, iotc_paho_persistence_get());
+    } else {
+        rc = MQTTClient_create(&client, server_uris[0], mc->client_id,
+                               MQTTCLIENT_PERSISTENCE_NONE, NULL);
+    }
+    iotc_startup_timing_record(IOTC_PHASE_MQTT_CREATE, start_us);
+    if (rc != MQTTCLIENT_SUCCESS) {
         IOTC_ERROR("Failed to create client, return code %d", rc);
-        free(paho_host_url);
+        paho_deinit();
         return rc;
     }
-    free(paho_host_url);
 
-    if ((rc = MQTTClient_setCallbacks(client, NULL, on_connection_lost, on_c2d_message, NULL)) != MQTTCLIENT_SUCCESS) {
+    // the client is the context, so that a connection lost callback from a client that was replaced is ignored
+    if ((rc = MQTTClient_setCallbacks(client, client, on_connection_lost, on_c2d_message, NULL)) != MQTTCLIENT_SUCCESS) {
         IOTC_ERROR("Failed to set callbacks, return code %d", rc);
         paho_deinit();
         return rc;
@@ -152,42 +406,57 @@ int iotc_device_client_connect(IotConnectDeviceClientConfig *c) {
         ssl_opts.privateKey = c->auth->data.cert_info.device_key;
     } else if (c->auth->type  == IOTC_AT_SYMMETRIC_KEY) {
         if (c->auth->data.symmetric_key && strlen(c->auth->data.symmetric_key) > 0) {
-            // for paho we need to pass the generated sas token
-            char *sas_token = gen_sas_token(mc->host,
-                                            mc->client_id,
-                                            c->auth->data.symmetric_key,
-                                            60
-            );
-            if (!sas_token) {
-                IOTC_ERROR("Unable to generate SAS token!");
-                return IOTCL_ERR_FAILED; // could be OOM or a different reason
-            }
-            // a bit of a hack - the token will be freed when freeing the sync response
             // paho will use the SAS token as the broker password
-            password = sas_token;
+            password = get_sas_token(mc, c->auth);
+            if (!password) {
+                return IOTCL_ERR_FAILED; // called function will print the error
+            }
         } else {
             IOTC_ERROR("Error: Configuration symmetric key is missing.");
             return -1;
         }
     }
     conn_opts.ssl = &ssl_opts;
+    if (server_uri_count > 1) {
+        // Paho falls back to the next endpoint if connecting to one fails
+        conn_opts.serverURIs = server_uris;
+        conn_opts.serverURIcount = server_uri_count;
+    }
+    conn_opts.cleansession = c->persistent_session ? 0 : 1;
+    if (c->link_health.keepalive_secs > 0) {
+        conn_opts.keepAliveInterval = c->link_health.keepalive_secs;
+    }
+    iotc_link_health_reset(&c->link_health);
 
     status_cb = c->status_cb;
     conn_opts.username = iotcl_mqtt_get_config()->username;
     conn_opts.password = password;
-    if ((rc = MQTTClient_connect(client, &conn_opts)) != MQTTCLIENT_SUCCESS) {
+    start_us = iotc_clock_now_us();
+    rc = MQTTClient_connect(client, &conn_opts);
+    iotc_startup_timing_record(IOTC_PHASE_MQTT_CONNECT, start_us);
+    if (rc != MQTTCLIENT_SUCCESS) {
         IOTC_ERROR("Failed to connect, return code %d", rc);
         paho_deinit();
         free(password);
         return rc;
     }
     free(password);
+    saved_conn_opts = conn_opts;
+    saved_conn_opts.password = NULL;
+    saved_conn_opts.ssl = NULL;
+    saved_ssl_opts = ssl_opts;
+    saved_auth = c->auth;
 
     is_initialized = true; // even if we fail below, we are ok
 
-    if ((rc = MQTTClient_subscribe(client, mc->sub_c2d, 1)) != MQTTCLIENT_SUCCESS) {
-        IOTC_ERROR("Failed to subscribe to c2d topic, return code %d", rc);
-        rc = IOTCL_ERR_FAILED;
+    if (c->persistent_session && conn_opts.returned.sessionPresent) {
+        // the broker still has our subscription and Paho has re-sent whatever was in flight
+        IOTC_INFO("Resumed persistent MQTT session with %lu stored records.",
+                  (unsigned long) iotc_paho_persistence_count());
+    } else {
+        start_us = iotc_clock_now_us();
+        subscribe_c2d(client, mc); // the connection is still usable for sending if this fails
+        iotc_startup_timing_record(IOTC_PHASE_MQTT_SUBSCRIBE, start_us);
     }
     c2d_msg_cb = c->c2d_msg_cb;
 
@@ -200,3 +469,149 @@ int iotc_device_client_connect(IotConnectDeviceClientConfig *c) {
 
 
 
+
+// Reconnects the same Paho client, so that the persisted in-flight messages of a persistent session are kept.
+// Publishes fail while it is disconnected.
+static int reconnect_client(IotclMqttConfig *mc, char *password) {
+    MQTTClient_disconnect(client, (int) iotc_link_health_get_ack_timeout_ms());
+    MQTTClient_connectOptions conn_opts = saved_conn_opts;
+    MQTTClient_SSLOptions ssl_opts = saved_ssl_opts;
+    conn_opts.ssl = &ssl_opts;
+    conn_opts.password = password;
+    int rc = MQTTClient_connect(client, &conn_opts);
+    if (rc != MQTTCLIENT_SUCCESS) {
+        IOTC_ERROR("Failed to reconnect with new credentials, return code %d", rc);
+        is_initialized = false;
+        if (status_cb) {
+            status_cb(IOTC_CS_MQTT_DISCONNECTED);
+        }
+        paho_deinit();
+        return rc;
+    }
+    if (!conn_opts.returned.sessionPresent) {
+        subscribe_c2d(client, mc);
+    }
+    return IOTCL_SUCCESS;
+}
+
+static void end_handover(void) {
+    iotc_mutex_lock(&handover_lock);
+    is_handing_over = false;
+    iotc_cond_broadcast(&handover_cond);
+    iotc_mutex_unlock(&handover_lock);
+}
+
+// A second client connects and subscribes, then it replaces the current one. The broker allows one connection per
+// client ID, so it drops the old connection as soon as the new one connects, and there can be a short gap until
+// the new one is subscribed. Publishes that fail on the old client wait for the handover to finish and are sent
+// again on the new one. The old client is destroyed once all of them are done with it.
+static int hand_over_client(IotclMqttConfig *mc, char *password) {
+    MQTTClient new_client = NULL;
+    iotc_mutex_lock(&handover_lock);
+    if (is_handing_over || retiring_client || !client) {
+        iotc_mutex_unlock(&handover_lock);
+        return IOTCL_ERR_FAILED; // closing, or another renewal is in progress
+    }
+    is_handing_over = true;
+    iotc_mutex_unlock(&handover_lock);
+
+    int rc = MQTTClient_create(&new_client, server_uris[0], mc->client_id, MQTTCLIENT_PERSISTENCE_NONE, NULL);
+    if (rc != MQTTCLIENT_SUCCESS) {
+        IOTC_ERROR("Failed to create client, return code %d", rc);
+        goto cleanup;
+    }
+    if ((rc = MQTTClient_setCallbacks(new_client, new_client, on_connection_lost, on_c2d_message, NULL))
+        != MQTTCLIENT_SUCCESS) {
+        IOTC_ERROR("Failed to set callbacks, return code %d", rc);
+        goto cleanup;
+    }
+    MQTTClient_connectOptions conn_opts = saved_conn_opts;
+    MQTTClient_SSLOptions ssl_opts = saved_ssl_opts;
+    conn_opts.ssl = &ssl_opts;
+    conn_opts.password = password;
+    if ((rc = MQTTClient_connect(new_client, &conn_opts)) != MQTTCLIENT_SUCCESS) {
+        IOTC_ERROR("Failed to connect with new credentials, return code %d", rc);
+        goto cleanup;
+    }
+    subscribe_c2d(new_client, mc); // the connection is still usable for sending if this fails
+
+    iotc_mutex_lock(&handover_lock);
+    MQTTClient old_client = client;
+    retiring_client = client;
+    retiring_users = client_users;
+    client = new_client;
+    client_users = 0;
+    new_client = NULL;
+    is_handing_over = false;
+    iotc_cond_broadcast(&handover_cond);
+    iotc_mutex_unlock(&handover_lock);
+
+    // The broker normally dropped it already. Closing it fails its remaining publishes, which are sent again.
+    MQTTClient_disconnect(old_client, 0);
+    iotc_mutex_lock(&handover_lock);
+    destroy_retiring_client_locked();
+    iotc_mutex_unlock(&handover_lock);
+    return IOTCL_SUCCESS;
+
+    cleanup:
+    if (new_client) {
+        MQTTClient_destroy(&new_client);
+    }
+    // Checked before the handover ends, as nothing can close the current client until then
+    bool is_connected = client && MQTTClient_isConnected(client);
+    end_handover();
+    if (is_connected) {
+        IOTC_WARN("Keeping the current MQTT connection.");
+    } else {
+        is_initialized = false;
+        if (status_cb) {
+            status_cb(IOTC_CS_MQTT_DISCONNECTED);
+        }
+        paho_deinit();
+    }
+    return rc;
+}
+
+static int paho_renew_credentials(void) {
+    IotclMqttConfig *mc = iotcl_mqtt_get_config();
+    if (!is_initialized || !client || !mc || !saved_auth) {
+        return IOTCL_ERR_FAILED; // not connected
+    }
+    char *password = NULL;
+    if (saved_auth->type == IOTC_AT_SYMMETRIC_KEY) {
+        password = get_sas_token(mc, saved_auth);
+        if (!password) {
+            return IOTCL_ERR_FAILED; // called function will print the error
+        }
+    }
+
+    // Certificates and keys are read again, so that rotated files on disk are picked up as well.
+    // A persistent session lives in the store of the current client, so that one is reconnected instead.
+    uint64_t start_us = iotc_clock_now_us();
+    int rc;
+    if (saved_conn_opts.cleansession) {
+        rc = hand_over_client(mc, password);
+    } else {
+        rc = reconnect_client(mc, password);
+    }
+    free(password);
+    if (rc != IOTCL_SUCCESS) {
+        return rc; // called function will print the error
+    }
+    IOTC_INFO("MQTT connection renewed in %lu ms.", (unsigned long) ((iotc_clock_now_us() - start_us) / 1000));
+    return IOTCL_SUCCESS;
+}
+
+static const IotConnectTransport paho_transport = {
+        "paho",
+        paho_connect,
+        paho_disconnect,
+        paho_renew_credentials,
+        paho_is_connected,
+        paho_send_message_qos,
+        NULL
+};
+
+const IotConnectTransport *iotc_paho_transport(void) {
+    return &paho_transport;
+}
@@ -0,0 +1,235 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "MQTTClient.h"
+#include "iotc_log.h"
+#include "iotc_paho_persistence.h"
+
+// Paho keeps at most maxInflight (default 10) messages in each direction, so the store stays small
+// and a flat array with linear lookup is faster than anything fancier.
+#ifndef IOTC_PAHO_PERSISTENCE_INITIAL_CAPACITY
+#define IOTC_PAHO_PERSISTENCE_INITIAL_CAPACITY 16
+#endif
+
+typedef struct {
+    char *key;
+    char *data;
+    int data_len;
+} PersistenceRecord;
+
+static PersistenceRecord *records = NULL;
+static size_t records_count = 0;
+static size_t records_capacity = 0;
+static char *store_client_id = NULL;
+
+static void free_record(PersistenceRecord *r) {
+    free(r->key);
+    free(r->data);
+    r->key = NULL;
+    r->data = NULL;
+    r->data_len = 0;
+}
+
+static PersistenceRecord *find_record(const char *key) {
+    for (size_t i = 0; i < records_count; i++) {
+        if (0 == strcmp(records[i].key, key)) {
+            return &records[i];
+        }
+    }
+    return NULL;
+}
+
+static void clear_records(void) {
+    for (size_t i = 0; i < records_count; i++) {
+        free_record(&records[i]);
+    }
+    records_count = 0;
+}
+
+static int persistence_open(void **handle, const char *client_id, const char *server_uri, void *context) {
+    (void) server_uri;
+    (void) context;
+
+    // in-flight messages of a different identity must never be replayed to this one
+    if (store_client_id && 0 != strcmp(store_client_id, client_id)) {
+        clear_records();
+        free(store_client_id);
+        store_client_id = NULL;
+    }
+    if (!store_client_id) {
+        size_t len = strlen(client_id);
+        store_client_id = malloc(len + 1);
+        if (!store_client_id) {
+            IOTC_ERROR("ERROR: Unable to allocate memory for persistence client ID!");
+            return MQTTCLIENT_PERSISTENCE_ERROR;
+        }
+        memcpy(store_client_id, client_id, len + 1);
+    }
+    *handle = &records; // any non-NULL value
+    return 0;
+}
+
+static int persistence_close(void *handle) {
+    (void) handle;
+    // Intentionally keep the records. This is what allows the next client to pick them up.
+    return 0;
+}
+
+static int persistence_put(void *handle, char *key, int bufcount, char *buffers[], int buflens[]) {
+    (void) handle;
+    int total_len = 0;
+    for (int i = 0; i < bufcount; i++) {
+        total_len += buflens[i];
+    }
+
+    char *data = malloc((size_t) total_len);
+    if (!data && total_len > 0) {
+        IOTC_ERROR("ERROR: Unable to allocate memory for persistence record!");
+        return MQTTCLIENT_PERSISTENCE_ERROR;
+    }
+    char *p = data;
+    for (int i = 0; i < bufcount; i++) {
+        memcpy(p, buffers[i], (size_t) buflens[i]);
+        p += buflens[i];
+    }
+
+    PersistenceRecord *r = find_record(key);
+    if (r) {
+        free(r->data);
+        r->data = data;
+        r->data_len = total_len;
+        return 0;
+    }
+
+    if (records_count == records_capacity) {
+        size_t new_capacity = records_capacity ? records_capacity * 2 : IOTC_PAHO_PERSISTENCE_INITIAL_CAPACITY;
+        PersistenceRecord *new_records = realloc(records, new_capacity * sizeof(PersistenceRecord));
+        if (!new_records) {
+            IOTC_ERROR("ERROR: Unable to grow the persistence store!");
+            free(data);
+            return MQTTCLIENT_PERSISTENCE_ERROR;
+        }
+        records = new_records;
+        records_capacity = new_capacity;
+    }
+
+    size_t key_len = strlen(key);
+    r = &records[records_count];
+    r->key = malloc(key_len + 1);
+    if (!r->key) {
+        IOTC_ERROR("ERROR: Unable to allocate memory for persistence key!");
+        free(data);
+        return MQTTCLIENT_PERSISTENCE_ERROR;
+    }
+    memcpy(r->key, key, key_len + 1);
+    r->data = data;
+    r->data_len = total_len;
+    records_count++;
+    return 0;
+}
+
+static int persistence_get(void *handle, char *key, char **buffer, int *buflen) {
+    (void) handle;
+    PersistenceRecord *r = find_record(key);
+    if (!r) {
+        return MQTTCLIENT_PERSISTENCE_ERROR;
+    }
+    // Paho will free the buffer, so it has to come from the Paho allocator
+    char *data = MQTTClient_malloc(r->data_len > 0 ? (size_t) r->data_len : 1);
+    if (!data) {
+        return MQTTCLIENT_PERSISTENCE_ERROR;
+    }
+    memcpy(data, r->data, (size_t) r->data_len);
+    *buffer = data;
+    *buflen = r->data_len;
+    return 0;
+}
+
+static int persistence_remove(void *handle, char *key) {
+    (void) handle;
+    PersistenceRecord *r = find_record(key);
+    if (!r) {
+        return MQTTCLIENT_PERSISTENCE_ERROR;
+    }
+    free_record(r);
+    // order of records does not matter, so move the last one into the hole
+    records_count--;
+    if (r != &records[records_count]) {
+        *r = records[records_count];
+    }
+    return 0;
+}
+
+static int persistence_keys(void *handle, char ***keys, int *nkeys) {
+    (void) handle;
+    *keys = NULL;
+    *nkeys = 0;
+    if (0 == records_count) {
+        return 0;
+    }
+
+    char **key_array = MQTTClient_malloc(records_count * sizeof(char *));
+    if (!key_array) {
+        return MQTTCLIENT_PERSISTENCE_ERROR;
+    }
+    for (size_t i = 0; i < records_count; i++) {
+        size_t key_len = strlen(records[i].key);
+        key_array[i] = MQTTClient_malloc(key_len + 1);
+        if (!key_array[i]) {
+            for (size_t j = 0; j < i; j++) {
+                MQTTClient_free(key_array[j]);
+            }
+            MQTTClient_free(key_array);
+            return MQTTCLIENT_PERSISTENCE_ERROR;
+        }
+        memcpy(key_array[i], records[i].key, key_len + 1);
+    }
+    *keys = key_array;
+    *nkeys = (int) records_count;
+    return 0;
+}
+
+static int persistence_clear(void *handle) {
+    (void) handle;
+    clear_records();
+    return 0;
+}
+
+static int persistence_containskey(void *handle, char *key) {
+    (void) handle;
+    return find_record(key) ? 0 : MQTTCLIENT_PERSISTENCE_ERROR;
+}
+
+static MQTTClient_persistence persistence = {
+        NULL,
+        persistence_open,
+        persistence_close,
+        persistence_put,
+        persistence_get,
+        persistence_remove,
+        persistence_keys,
+        persistence_clear,
+        persistence_containskey
+};
+
+MQTTClient_persistence *iotc_paho_persistence_get(void) {
+    return &persistence;
+}
+
+size_t iotc_paho_persistence_count(void) {
+    return records_count;
+}
+
+void iotc_paho_persistence_clear(void) {
+    clear_records();
+    free(records);
+    records = NULL;
+    records_capacity = 0;
+    free(store_client_id);
+    store_client_id = NULL;
+}
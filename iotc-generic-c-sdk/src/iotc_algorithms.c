@@ -11,6 +11,9 @@
 #include <openssl/hmac.h>
 #include <openssl/buffer.h>
 
+// iotc_algorithms_alternative.c provides gen_sas_token() instead
+#if !IOTCONNECT_USE_CUSTOM_ALGORITHMS
+
 #ifndef IOTHUB_RESOURCE_URI_FORMAT
 #define IOTHUB_RESOURCE_URI_FORMAT "%s/devices/%s"
 #endif
@@ -170,3 +173,4 @@ char *gen_sas_token(const char *host, const char *client_id, const char *b64key,
     return sas_token;
 }
 
+#endif // !IOTCONNECT_USE_CUSTOM_ALGORITHMS
@@ -0,0 +1,515 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "iotcl.h"
+#include "iotc_log.h"
+#include "iotc_thread.h"
+#include "iotc_clock.h"
+#include "iotc_http_request.h"
+#include "iotc_backfill.h"
+
+#ifdef IOTC_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+// The spool is renamed to this while it is being uploaded, so that new messages can be spooled at the same time
+#define UPLOAD_SUFFIX ".upload"
+// Byte offset in the upload file up to which everything has been uploaded
+#define POSITION_SUFFIX ".upload.pos"
+
+#define INITIAL_RETRY_MS 1000
+
+static bool is_enabled = false;
+static char *spool_path = NULL;
+static char *upload_path = NULL;
+static char *position_path = NULL;
+static char *upload_url = NULL;
+static size_t max_spool_bytes;
+static size_t batch_bytes;
+static bool is_compressed;
+
+// The lock protects everything below
+static IotcMutex lock;
+static IotcCond state_cond; // signaled when an upload finishes and on stop
+static FILE *spool_file = NULL;
+static size_t spool_bytes = 0;
+static size_t upload_file_bytes = 0; // on disk until the whole file is uploaded, so it counts toward the limit
+static IotcThread upload_thread;
+static bool is_thread_started = false; // needs a join
+static bool is_stop_requested = false;
+static IotConnectBackfillStats stats;
+
+static char *concat(const char *a, const char *b) {
+    size_t a_len = strlen(a);
+    size_t b_len = strlen(b);
+    char *s = malloc(a_len + b_len + 1);
+    if (s) {
+        memcpy(s, a, a_len);
+        memcpy(s + a_len, b, b_len + 1);
+    }
+    return s;
+}
+
+static bool file_exists(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f) {
+        fclose(f);
+        return true;
+    }
+    return false;
+}
+
+static size_t get_file_size(const char *path) {
+    FILE *f = fopen(path, "rb");
+    long size = 0;
+    if (f) {
+        if (0 == fseek(f, 0, SEEK_END)) {
+            size = ftell(f);
+        }
+        fclose(f);
+    }
+    return size > 0 ? (size_t) size : 0;
+}
+
+static long read_position(void) {
+    long position = 0;
+    FILE *f = fopen(position_path, "r");
+    if (f) {
+        if (1 != fscanf(f, "%ld", &position) || position < 0) {
+            position = 0;
+        }
+        fclose(f);
+    }
+    return position;
+}
+
+static void write_position(long position) {
+    FILE *f = fopen(position_path, "w");
+    if (!f) {
+        IOTC_WARN("Backfill: Unable to save the upload position to %s", position_path);
+        return;
+    }
+    fprintf(f, "%ld\n", position);
+    fclose(f);
+}
+
+static bool should_stop(void) {
+    iotc_mutex_lock(&lock);
+    bool ret = is_stop_requested;
+    iotc_mutex_unlock(&lock);
+    return ret;
+}
+
+#ifdef IOTC_WITH_ZLIB
+static unsigned char *gzip(const char *data, size_t len, size_t *out_len) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // 15 + 16 selects the gzip wrapper instead of zlib
+    if (Z_OK != deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY)) {
+        IOTC_ERROR("Backfill: deflateInit2 failed");
+        return NULL;
+    }
+    uLong bound = deflateBound(&zs, (uLong) len);
+    unsigned char *out = malloc(bound);
+    if (!out) {
+        IOTC_ERROR("Backfill: Out of memory!");
+        deflateEnd(&zs);
+        return NULL;
+    }
+    zs.next_in = (Bytef *) data;
+    zs.avail_in = (uInt) len;
+    zs.next_out = out;
+    zs.avail_out = (uInt) bound;
+    if (Z_STREAM_END != deflate(&zs, Z_FINISH)) {
+        IOTC_ERROR("Backfill: Compression failed");
+        free(out);
+        deflateEnd(&zs);
+        return NULL;
+    }
+    *out_len = (size_t) zs.total_out;
+    deflateEnd(&zs);
+    return out;
+}
+#endif
+
+// A client error other than a timeout or rate limiting means that the batch itself, or the URL, is not accepted
+static bool is_permanent_failure(long status_code) {
+    return status_code >= 400 && status_code < 500 && 408 != status_code && 429 != status_code;
+}
+
+static int post_batch(const char *data, size_t len, long *status_code) {
+    const void *body = data;
+    size_t body_len = len;
+    const char *content_encoding = NULL;
+    unsigned char *compressed = NULL;
+
+#ifdef IOTC_WITH_ZLIB
+    if (is_compressed) {
+        compressed = gzip(data, len, &body_len);
+        if (!compressed) {
+            return IOTCL_ERR_FAILED; // called function will print the error
+        }
+        body = compressed;
+        content_encoding = "gzip";
+    }
+#endif
+
+    IotConnectHttpRequestOptions options;
+    iotconnect_https_init_options(&options);
+    options.method = IOTC_HTTP_POST;
+    options.content_type = "application/x-ndjson";
+    options.content_encoding = content_encoding;
+    options.body = body;
+    options.body_len = body_len;
+    // a large batch can take a while on a slow link, so give up on a stalled upload rather than a slow one
+    options.timeout_ms = 0;
+    options.low_speed_limit = 64;
+    options.low_speed_time_ms = 30000;
+    options.allow_empty_response = true;
+
+    IotConnectHttpResponse response;
+    int ret = iotconnect_https_request_with_options(&response, upload_url, &options);
+    *status_code = response.status_code;
+    iotconnect_free_https_response(&response);
+    free(compressed);
+    if (0 == ret) {
+        iotc_mutex_lock(&lock);
+        stats.sent_bytes += body_len;
+        iotc_mutex_unlock(&lock);
+    }
+    return ret;
+}
+
+// Retries until the batch is uploaded or a stop is requested.
+// Returns IOTCL_ERR_BAD_VALUE if the endpoint rejected the batch for good.
+static int upload_batch(const char *data, size_t len) {
+    unsigned long retry_ms = INITIAL_RETRY_MS;
+    for (;;) {
+        if (should_stop()) {
+            return IOTCL_ERR_FAILED;
+        }
+        long status_code = 0;
+        if (0 == post_batch(data, len, &status_code)) {
+            return IOTCL_SUCCESS;
+        }
+        iotc_mutex_lock(&lock);
+        stats.failures++;
+        if (is_permanent_failure(status_code)) {
+            iotc_mutex_unlock(&lock);
+            return IOTCL_ERR_BAD_VALUE;
+        }
+        if (!is_stop_requested) {
+            IOTC_WARN("Backfill: Upload failed. Retrying in %lu ms.", retry_ms);
+            iotc_cond_timed_wait(&state_cond, &lock, retry_ms);
+        }
+        iotc_mutex_unlock(&lock);
+        retry_ms = (retry_ms * 2 > IOTC_BACKFILL_MAX_RETRY_MS) ? IOTC_BACKFILL_MAX_RETRY_MS : retry_ms * 2;
+    }
+}
+
+// Uploads the upload file from the saved position, in batches that end on message boundaries
+static int upload_file(void) {
+    FILE *f = fopen(upload_path, "rb");
+    if (!f) {
+        IOTC_ERROR("Backfill: Unable to open %s", upload_path);
+        return IOTCL_ERR_FAILED;
+    }
+    size_t capacity = batch_bytes;
+    char *buffer = malloc(capacity);
+    if (!buffer) {
+        IOTC_ERROR("Backfill: Out of memory!");
+        fclose(f);
+        return IOTCL_ERR_OUT_OF_MEMORY;
+    }
+
+    int ret = IOTCL_SUCCESS;
+    long position = read_position();
+    for (;;) {
+        if (0 != fseek(f, position, SEEK_SET)) {
+            IOTC_ERROR("Backfill: Unable to seek in %s", upload_path);
+            ret = IOTCL_ERR_FAILED;
+            break;
+        }
+        size_t n = fread(buffer, 1, capacity, f);
+        if (0 == n) {
+            break; // all done
+        }
+        size_t batch_len = n;
+        while (batch_len > 0 && buffer[batch_len - 1] != '\n') {
+            batch_len--;
+        }
+        if (0 == batch_len) {
+            if (n < capacity) {
+                IOTC_WARN("Backfill: Skipping a truncated message at the end of the spool.");
+                break;
+            }
+            // a single message larger than the batch size
+            char *larger = realloc(buffer, capacity * 2);
+            if (!larger) {
+                IOTC_ERROR("Backfill: Out of memory!");
+                ret = IOTCL_ERR_OUT_OF_MEMORY;
+                break;
+            }
+            buffer = larger;
+            capacity *= 2;
+            continue;
+        }
+
+        unsigned long messages = 0;
+        for (size_t i = 0; i < batch_len; i++) {
+            messages += ('\n' == buffer[i]);
+        }
+        ret = upload_batch(buffer, batch_len);
+        if (IOTCL_ERR_BAD_VALUE == ret) {
+            IOTC_ERROR("Backfill: The endpoint rejected a batch. Dropping its %lu messages.", messages);
+        } else if (ret) {
+            break; // stopped
+        }
+        position += (long) batch_len;
+        write_position(position);
+
+        iotc_mutex_lock(&lock);
+        if (ret) {
+            stats.rejected += messages;
+        } else {
+            stats.uploaded += messages;
+            stats.uploaded_bytes += batch_len;
+            stats.batches++;
+        }
+        iotc_mutex_unlock(&lock);
+        ret = IOTCL_SUCCESS;
+    }
+    free(buffer);
+    fclose(f);
+    return ret;
+}
+
+static void upload_loop(void *arg) {
+    (void) arg;
+    for (;;) {
+        iotc_mutex_lock(&lock);
+        if (is_stop_requested) {
+            iotc_mutex_unlock(&lock);
+            break;
+        }
+        if (!file_exists(upload_path)) {
+            if (0 == spool_bytes) {
+                iotc_mutex_unlock(&lock);
+                break; // nothing left
+            }
+            // take over what has been spooled so far. New messages will go into a new spool file.
+            if (spool_file) {
+                fclose(spool_file);
+                spool_file = NULL;
+            }
+            remove(position_path);
+            if (0 != rename(spool_path, upload_path)) {
+                IOTC_ERROR("Backfill: Unable to rename %s to %s", spool_path, upload_path);
+                iotc_mutex_unlock(&lock);
+                break;
+            }
+            upload_file_bytes = spool_bytes;
+            spool_bytes = 0;
+        }
+        iotc_mutex_unlock(&lock);
+
+        if (upload_file()) {
+            break; // stopped or failed. The upload file is kept for the next attempt.
+        }
+        iotc_mutex_lock(&lock);
+        remove(upload_path);
+        remove(position_path);
+        upload_file_bytes = 0;
+        iotc_mutex_unlock(&lock);
+    }
+
+    iotc_mutex_lock(&lock);
+    stats.is_uploading = false;
+    iotc_cond_broadcast(&state_cond);
+    iotc_mutex_unlock(&lock);
+}
+
+void iotc_backfill_init_config(IotConnectBackfillConfig *c) {
+    memset(c, 0, sizeof(IotConnectBackfillConfig));
+    c->max_spool_bytes = IOTC_BACKFILL_DEFAULT_MAX_SPOOL_BYTES;
+    c->batch_bytes = IOTC_BACKFILL_DEFAULT_BATCH_BYTES;
+    c->compress = true;
+}
+
+int iotc_backfill_init(const IotConnectBackfillConfig *c) {
+    if (is_enabled) {
+        iotc_backfill_deinit();
+    }
+    if (!c->spool_path) {
+        return IOTCL_SUCCESS;
+    }
+    if (!c->upload_url) {
+        IOTC_ERROR("iotc_backfill_init: upload_url is required.");
+        return IOTCL_ERR_MISSING_VALUE;
+    }
+    spool_path = concat(c->spool_path, "");
+    upload_path = concat(c->spool_path, UPLOAD_SUFFIX);
+    position_path = concat(c->spool_path, POSITION_SUFFIX);
+    upload_url = concat(c->upload_url, "");
+    if (!spool_path || !upload_path || !position_path || !upload_url) {
+        IOTC_ERROR("iotc_backfill_init: Out of memory!");
+        free(spool_path);
+        free(upload_path);
+        free(position_path);
+        free(upload_url);
+        spool_path = upload_path = position_path = upload_url = NULL;
+        return IOTCL_ERR_OUT_OF_MEMORY;
+    }
+    max_spool_bytes = c->max_spool_bytes ? c->max_spool_bytes : IOTC_BACKFILL_DEFAULT_MAX_SPOOL_BYTES;
+    batch_bytes = c->batch_bytes ? c->batch_bytes : IOTC_BACKFILL_DEFAULT_BATCH_BYTES;
+    is_compressed = c->compress;
+#ifndef IOTC_WITH_ZLIB
+    if (is_compressed) {
+        IOTC_INFO("Backfill: The SDK was built without zlib. Batches will not be compressed.");
+    }
+#endif
+
+    iotc_mutex_init(&lock);
+    iotc_cond_init(&state_cond);
+    memset(&stats, 0, sizeof(stats));
+    spool_file = NULL;
+    spool_bytes = get_file_size(spool_path); // left over from a previous run
+    upload_file_bytes = get_file_size(upload_path);
+    is_stop_requested = false;
+    is_thread_started = false;
+    is_enabled = true;
+    return IOTCL_SUCCESS;
+}
+
+void iotc_backfill_deinit(void) {
+    if (!is_enabled) {
+        return;
+    }
+    iotc_mutex_lock(&lock);
+    is_stop_requested = true;
+    iotc_cond_broadcast(&state_cond);
+    iotc_mutex_unlock(&lock);
+    if (is_thread_started) {
+        iotc_thread_join(&upload_thread);
+        is_thread_started = false;
+    }
+    if (spool_file) {
+        fclose(spool_file);
+        spool_file = NULL;
+    }
+    iotc_cond_destroy(&state_cond);
+    iotc_mutex_destroy(&lock);
+    free(spool_path);
+    free(upload_path);
+    free(position_path);
+    free(upload_url);
+    spool_path = upload_path = position_path = upload_url = NULL;
+    is_enabled = false;
+}
+
+bool iotc_backfill_is_enabled(void) {
+    return is_enabled;
+}
+
+int iotc_backfill_store(const char *message) {
+    if (!is_enabled) {
+        return IOTCL_ERR_FAILED;
+    }
+    size_t len = strlen(message);
+    int ret = IOTCL_SUCCESS;
+    iotc_mutex_lock(&lock);
+    if (spool_bytes + upload_file_bytes + len + 1 > max_spool_bytes) {
+        stats.dropped++;
+        ret = IOTCL_ERR_OUT_OF_MEMORY;
+    } else {
+        if (!spool_file) {
+            spool_file = fopen(spool_path, "ab");
+        }
+        if (!spool_file) {
+            IOTC_ERROR("Backfill: Unable to open %s", spool_path);
+            stats.dropped++;
+            ret = IOTCL_ERR_FAILED;
+        } else {
+            // One message per line. Unescaped newlines in JSON can only be whitespace, so they become spaces.
+            const char *p = message;
+            const char *nl;
+            while (NULL != (nl = strchr(p, '\n'))) {
+                fwrite(p, 1, (size_t) (nl - p), spool_file);
+                fputc(' ', spool_file);
+                p = nl + 1;
+            }
+            fputs(p, spool_file);
+            fputc('\n', spool_file);
+            if (0 != fflush(spool_file)) {
+                IOTC_ERROR("Backfill: Unable to write to %s", spool_path);
+                stats.dropped++;
+                ret = IOTCL_ERR_FAILED;
+            } else {
+                spool_bytes += len + 1;
+                stats.spooled++;
+            }
+        }
+    }
+    iotc_mutex_unlock(&lock);
+    return ret;
+}
+
+int iotc_backfill_start_upload(void) {
+    if (!is_enabled) {
+        return IOTCL_SUCCESS;
+    }
+    int ret = IOTCL_SUCCESS;
+    iotc_mutex_lock(&lock);
+    if (!stats.is_uploading) {
+        if (is_thread_started) {
+            iotc_thread_join(&upload_thread); // already finished
+            is_thread_started = false;
+        }
+        if (spool_bytes > 0 || file_exists(upload_path)) {
+            stats.is_uploading = true;
+            if (iotc_thread_create(&upload_thread, upload_loop, NULL)) {
+                IOTC_ERROR("Backfill: Failed to start the upload thread!");
+                stats.is_uploading = false;
+                ret = IOTCL_ERR_FAILED;
+            } else {
+                is_thread_started = true;
+            }
+        }
+    }
+    iotc_mutex_unlock(&lock);
+    return ret;
+}
+
+bool iotc_backfill_wait(unsigned long timeout_ms) {
+    if (!is_enabled) {
+        return true;
+    }
+    uint64_t deadline_ms = iotc_clock_now_ms() + timeout_ms;
+    bool ret = true;
+    iotc_mutex_lock(&lock);
+    while (stats.is_uploading) {
+        uint64_t now_ms = iotc_clock_now_ms();
+        if (now_ms >= deadline_ms) {
+            ret = false;
+            break;
+        }
+        iotc_cond_timed_wait(&state_cond, &lock, (unsigned long) (deadline_ms - now_ms));
+    }
+    iotc_mutex_unlock(&lock);
+    return ret;
+}
+
+void iotc_backfill_get_stats(IotConnectBackfillStats *s) {
+    if (!is_enabled) {
+        memset(s, 0, sizeof(IotConnectBackfillStats));
+        return;
+    }
+    iotc_mutex_lock(&lock);
+    *s = stats;
+    iotc_mutex_unlock(&lock);
+}
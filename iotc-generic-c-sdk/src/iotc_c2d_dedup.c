@@ -0,0 +1,215 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "iotcl.h"
+#include "iotc_log.h"
+#include "iotc_thread.h"
+#include "iotc_clock.h"
+#include "iotc_c2d_dedup.h"
+
+#define BUCKET_COUNT (IOTC_C2D_DEDUP_MAX_ENTRIES * 2)
+#define NO_ENTRY (-1)
+#define MAX_ACK_ID_LENGTH 128
+
+// Distinct FNV-1a offsets, so that an ack ID and a whole message never share a key
+#define ACK_ID_SEED 0xcbf29ce484222325ULL
+#define MESSAGE_SEED 0x84222325cbf29ce4ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+typedef struct {
+    uint64_t key;
+    uint64_t seen_ms; // when the message was last passed on. Duplicates do not update it.
+    int bucket_next; // next entry with the same bucket
+    int newer; // towards the most recently passed entry
+    int older;
+} DedupEntry;
+
+static bool is_enabled = false;
+static bool is_fingerprinting = false;
+static uint64_t window_ms;
+
+// The lock protects everything below
+static IotcMutex lock;
+static DedupEntry entries[IOTC_C2D_DEDUP_MAX_ENTRIES];
+static int buckets[BUCKET_COUNT];
+static int used_count = 0;
+static int newest = NO_ENTRY;
+static int oldest = NO_ENTRY;
+static IotConnectC2dDedupStats stats;
+
+static uint64_t hash_bytes(uint64_t hash, const unsigned char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+// Finds the value of "ack" without parsing the whole message. Returns NULL if there is none.
+static const unsigned char *find_ack_id(const unsigned char *message, size_t message_len, size_t *id_len) {
+    static const char name[] = "\"ack\"";
+    const size_t name_len = sizeof(name) - 1;
+    for (size_t i = 0; i + name_len < message_len; i++) {
+        if (0 != memcmp(&message[i], name, name_len)) {
+            continue;
+        }
+        size_t pos = i + name_len;
+        while (pos < message_len && (' ' == message[pos] || ':' == message[pos])) {
+            pos++;
+        }
+        if (pos >= message_len || '"' != message[pos]) {
+            return NULL; // null or not a string
+        }
+        size_t start = pos + 1;
+        size_t end = start;
+        while (end < message_len && '"' != message[end] && end - start < MAX_ACK_ID_LENGTH) {
+            end++;
+        }
+        if (end >= message_len || '"' != message[end] || end == start) {
+            return NULL;
+        }
+        *id_len = end - start;
+        return &message[start];
+    }
+    return NULL;
+}
+
+static void unlink_lru(int i) {
+    DedupEntry *e = &entries[i];
+    if (NO_ENTRY != e->newer) {
+        entries[e->newer].older = e->older;
+    } else {
+        newest = e->older;
+    }
+    if (NO_ENTRY != e->older) {
+        entries[e->older].newer = e->newer;
+    } else {
+        oldest = e->newer;
+    }
+}
+
+static void link_newest(int i) {
+    entries[i].newer = NO_ENTRY;
+    entries[i].older = newest;
+    if (NO_ENTRY != newest) {
+        entries[newest].newer = i;
+    }
+    newest = i;
+    if (NO_ENTRY == oldest) {
+        oldest = i;
+    }
+}
+
+static void unlink_bucket(int i) {
+    int *link = &buckets[entries[i].key % BUCKET_COUNT];
+    while (*link != i) {
+        link = &entries[*link].bucket_next;
+    }
+    *link = entries[i].bucket_next;
+}
+
+static int find_entry(uint64_t key) {
+    for (int i = buckets[key % BUCKET_COUNT]; NO_ENTRY != i; i = entries[i].bucket_next) {
+        if (entries[i].key == key) {
+            return i;
+        }
+    }
+    return NO_ENTRY;
+}
+
+// Takes a free entry, or the least recently passed one when the table is full
+static int take_entry(uint64_t now_ms) {
+    if (used_count < IOTC_C2D_DEDUP_MAX_ENTRIES) {
+        return used_count++;
+    }
+    int i = oldest;
+    if (now_ms - entries[i].seen_ms < window_ms) {
+        stats.evictions++;
+    }
+    unlink_lru(i);
+    unlink_bucket(i);
+    return i;
+}
+
+void iotc_c2d_dedup_init_config(IotConnectC2dDedupConfig *c) {
+    memset(c, 0, sizeof(IotConnectC2dDedupConfig));
+    c->window_secs = IOTC_C2D_DEDUP_DEFAULT_WINDOW_SECS;
+}
+
+int iotc_c2d_dedup_init(const IotConnectC2dDedupConfig *c) {
+    if (is_enabled) {
+        iotc_c2d_dedup_deinit();
+    }
+    memset(&stats, 0, sizeof(stats));
+    if (0 == c->window_secs) {
+        return IOTCL_SUCCESS;
+    }
+    window_ms = (uint64_t) c->window_secs * 1000;
+    is_fingerprinting = c->fingerprint_messages;
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        buckets[i] = NO_ENTRY;
+    }
+    used_count = 0;
+    newest = NO_ENTRY;
+    oldest = NO_ENTRY;
+    iotc_mutex_init(&lock);
+    is_enabled = true;
+    return IOTCL_SUCCESS;
+}
+
+void iotc_c2d_dedup_deinit(void) {
+    if (!is_enabled) {
+        return;
+    }
+    is_enabled = false;
+    iotc_mutex_destroy(&lock);
+}
+
+bool iotc_c2d_dedup_is_duplicate(const unsigned char *message, size_t message_len) {
+    if (!is_enabled) {
+        return false;
+    }
+    size_t id_len = 0;
+    const unsigned char *ack_id = find_ack_id(message, message_len, &id_len);
+    if (!ack_id && !is_fingerprinting) {
+        return false;
+    }
+    uint64_t key = ack_id ? hash_bytes(ACK_ID_SEED, ack_id, id_len) : hash_bytes(MESSAGE_SEED, message, message_len);
+    uint64_t now_ms = iotc_clock_now_ms();
+
+    iotc_mutex_lock(&lock);
+    int i = find_entry(key);
+    if (NO_ENTRY != i && now_ms - entries[i].seen_ms < window_ms) {
+        // leave the entry as it is, so that redeliveries cannot keep a message suppressed forever
+        stats.hits++;
+        iotc_mutex_unlock(&lock);
+        return true;
+    }
+    if (NO_ENTRY != i) {
+        unlink_lru(i); // the window ended, so this counts as a new message
+    } else {
+        i = take_entry(now_ms);
+        entries[i].key = key;
+        entries[i].bucket_next = buckets[key % BUCKET_COUNT];
+        buckets[key % BUCKET_COUNT] = i;
+    }
+    entries[i].seen_ms = now_ms;
+    link_newest(i);
+    stats.misses++;
+    iotc_mutex_unlock(&lock);
+    return false;
+}
+
+void iotc_c2d_dedup_get_stats(IotConnectC2dDedupStats *s) {
+    if (!is_enabled) {
+        memcpy(s, &stats, sizeof(IotConnectC2dDedupStats));
+        return;
+    }
+    iotc_mutex_lock(&lock);
+    memcpy(s, &stats, sizeof(IotConnectC2dDedupStats));
+    iotc_mutex_unlock(&lock);
+}
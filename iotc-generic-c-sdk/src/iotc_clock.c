@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <Windows.h>
+#else
+// for clock_gettime() and CLOCK_MONOTONIC with -std=c99
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <time.h>
+#endif
+
+#include "iotc_clock.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+uint64_t iotc_clock_now_us(void) {
+    static LARGE_INTEGER frequency = {0};
+    LARGE_INTEGER counter;
+    if (0 == frequency.QuadPart) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+    // split the division to avoid overflow with high frequency counters
+    return (uint64_t) (counter.QuadPart / frequency.QuadPart) * 1000000ULL
+           + (uint64_t) (counter.QuadPart % frequency.QuadPart) * 1000000ULL / (uint64_t) frequency.QuadPart;
+}
+#else
+uint64_t iotc_clock_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000ULL + (uint64_t) ts.tv_nsec / 1000ULL;
+}
+#endif
+
+uint64_t iotc_clock_now_ms(void) {
+    return iotc_clock_now_us() / 1000ULL;
+}
@@ -0,0 +1,427 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "iotcl.h"
+#include "iotc_log.h"
+#include "iotc_thread.h"
+#include "iotc_clock.h"
+#include "iotc_command_executor.h"
+
+#define TIMEOUT_ACK_MESSAGE "Timed out"
+#define REJECTED_ACK_MESSAGE "Too many commands in progress"
+#define STOPPED_ACK_MESSAGE "Stopped before it could start"
+
+// The command and the ack ID are stored in the same allocation, right after the job
+typedef struct CommandJob {
+    struct CommandJob *next;
+    uint32_t key_hash;
+    uint64_t deadline_ms; // 0 if there is no timeout
+    bool is_acked; // the timeout ack was sent, so the result of the handler is dropped
+    bool is_ack_in_progress; // the supervisor is sending the timeout ack without the lock, so the job must stay
+    char *command;
+    char *ack_id; // NULL if no acknowledgement was requested
+} CommandJob;
+
+static IOTC_THREAD_LOCAL bool is_executor_thread = false;
+
+static bool is_running = false;
+static IotConnectCommandExecutorConfig config;
+static IotcThread workers[IOTC_COMMAND_EXECUTOR_MAX_WORKERS];
+static IotcThread supervisor_thread;
+
+// The lock protects everything below
+static IotcMutex lock;
+static IotcCond work_cond; // signaled when a job is queued, when a key becomes free and on stop
+static IotcCond supervisor_cond; // signaled when a job with an earlier deadline may exist and on stop
+static bool is_stop_requested = false;
+static CommandJob *pending_head = NULL; // FIFO of jobs that have not started
+static CommandJob *pending_tail = NULL;
+static unsigned int pending_count = 0;
+static CommandJob *running[IOTC_COMMAND_EXECUTOR_MAX_WORKERS]; // indexed by worker, NULL if idle
+static unsigned long submitted = 0;
+static unsigned long completed = 0;
+static unsigned long timed_out = 0;
+static unsigned long rejected = 0;
+
+static size_t command_name_key(const char *command, const char **key) {
+    *key = command;
+    size_t len = 0;
+    while (command[len] && command[len] != ' ') {
+        len++;
+    }
+    return len;
+}
+
+// FNV-1a. A collision only makes two keys wait for each other.
+static uint32_t hash_key(const char *key, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) key[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void send_ack(const char *ack_id, int status, const char *message) {
+    if (ack_id && 0 != iotcl_mqtt_send_cmd_ack(ack_id, status, message)) {
+        IOTC_WARN("Command executor: Unable to send the acknowledgement for %s", ack_id);
+    }
+}
+
+static bool is_key_running(uint32_t key_hash) {
+    for (unsigned int i = 0; i < config.workers; i++) {
+        if (running[i] && running[i]->key_hash == key_hash) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Removes and returns the oldest job whose key is not running and not held by an older pending job
+static CommandJob *take_runnable_job(void) {
+    CommandJob *prev = NULL;
+    for (CommandJob *job = pending_head; job; prev = job, job = job->next) {
+        bool is_blocked = is_key_running(job->key_hash);
+        for (CommandJob *older = pending_head; older != job && !is_blocked; older = older->next) {
+            is_blocked = (older->key_hash == job->key_hash);
+        }
+        if (is_blocked) {
+            continue;
+        }
+        if (prev) {
+            prev->next = job->next;
+        } else {
+            pending_head = job->next;
+        }
+        if (pending_tail == job) {
+            pending_tail = prev;
+        }
+        job->next = NULL;
+        pending_count--;
+        return job;
+    }
+    return NULL;
+}
+
+static void worker_fn(void *arg) {
+    unsigned int index = (unsigned int) (size_t) arg;
+    char ack_message[IOTC_COMMAND_ACK_MESSAGE_SIZE];
+    is_executor_thread = true;
+
+    iotc_mutex_lock(&lock);
+    while (!is_stop_requested) {
+        CommandJob *job = take_runnable_job();
+        if (!job) {
+            iotc_cond_wait(&work_cond, &lock);
+            continue;
+        }
+        running[index] = job;
+        iotc_mutex_unlock(&lock);
+
+        ack_message[0] = 0;
+        int status = config.handler(job->command, ack_message, sizeof(ack_message));
+        ack_message[sizeof(ack_message) - 1] = 0;
+
+        iotc_mutex_lock(&lock);
+        running[index] = NULL;
+        while (job->is_ack_in_progress) {
+            iotc_cond_wait(&work_cond, &lock);
+        }
+        bool is_acked = job->is_acked;
+        if (!is_acked) {
+            completed++;
+        }
+        iotc_cond_broadcast(&work_cond); // jobs with the same key may be runnable now
+        iotc_mutex_unlock(&lock);
+
+        if (is_acked) {
+            IOTC_WARN("Command executor: \"%s\" finished after its timeout. The result is dropped.", job->command);
+        } else {
+            send_ack(job->ack_id, status, ack_message);
+        }
+        free(job);
+        iotc_mutex_lock(&lock);
+    }
+    iotc_mutex_unlock(&lock);
+}
+
+// Acknowledges jobs that ran out of time, whether they are still waiting or already running
+static void supervisor_fn(void *arg) {
+    (void) arg;
+    is_executor_thread = true;
+
+    iotc_mutex_lock(&lock);
+    while (!is_stop_requested) {
+        uint64_t now_ms = iotc_clock_now_ms();
+        uint64_t next_deadline_ms = 0;
+        CommandJob *expired = NULL; // pending jobs that are removed and freed here
+
+        CommandJob *prev = NULL;
+        CommandJob *job = pending_head;
+        while (job) {
+            CommandJob *next = job->next;
+            if (job->deadline_ms && job->deadline_ms <= now_ms) {
+                if (prev) {
+                    prev->next = next;
+                } else {
+                    pending_head = next;
+                }
+                if (pending_tail == job) {
+                    pending_tail = prev;
+                }
+                pending_count--;
+                job->next = expired;
+                expired = job;
+            } else {
+                if (job->deadline_ms && (!next_deadline_ms || job->deadline_ms < next_deadline_ms)) {
+                    next_deadline_ms = job->deadline_ms;
+                }
+                prev = job;
+            }
+            job = next;
+        }
+
+        // Running jobs are acknowledged here, but they are freed by their worker
+        CommandJob *expired_running[IOTC_COMMAND_EXECUTOR_MAX_WORKERS];
+        unsigned int expired_running_count = 0;
+        for (unsigned int i = 0; i < config.workers; i++) {
+            CommandJob *r = running[i];
+            if (!r || r->is_acked || !r->deadline_ms) {
+                continue;
+            }
+            if (r->deadline_ms <= now_ms) {
+                r->is_acked = true;
+                r->is_ack_in_progress = true; // keeps the worker from freeing it while we send without the lock
+                expired_running[expired_running_count++] = r;
+            } else if (!next_deadline_ms || r->deadline_ms < next_deadline_ms) {
+                next_deadline_ms = r->deadline_ms;
+            }
+        }
+        timed_out += expired_running_count;
+        for (CommandJob *e = expired; e; e = e->next) {
+            timed_out++;
+        }
+
+        if (expired || expired_running_count) {
+            // Acks are sent without the lock, so that a slow publish does not hold up submits and workers
+            iotc_mutex_unlock(&lock);
+            for (unsigned int i = 0; i < expired_running_count; i++) {
+                IOTC_WARN("Command executor: \"%s\" timed out.", expired_running[i]->command);
+                send_ack(expired_running[i]->ack_id, IOTCL_C2D_EVT_CMD_FAILED, TIMEOUT_ACK_MESSAGE);
+            }
+            while (expired) {
+                CommandJob *next = expired->next;
+                IOTC_WARN("Command executor: \"%s\" timed out before it could start.", expired->command);
+                send_ack(expired->ack_id, IOTCL_C2D_EVT_CMD_FAILED, TIMEOUT_ACK_MESSAGE);
+                free(expired);
+                expired = next;
+            }
+            iotc_mutex_lock(&lock);
+            if (expired_running_count) {
+                for (unsigned int i = 0; i < expired_running_count; i++) {
+                    expired_running[i]->is_ack_in_progress = false;
+                }
+                iotc_cond_broadcast(&work_cond); // their workers may be waiting to free them
+            }
+            continue;
+        }
+
+        if (next_deadline_ms) {
+            iotc_cond_timed_wait(&supervisor_cond, &lock, (unsigned long) (next_deadline_ms - now_ms));
+        } else {
+            iotc_cond_wait(&supervisor_cond, &lock);
+        }
+    }
+    iotc_mutex_unlock(&lock);
+}
+
+void iotc_command_executor_init_config(IotConnectCommandExecutorConfig *c) {
+    memset(c, 0, sizeof(IotConnectCommandExecutorConfig));
+    c->max_pending = IOTC_COMMAND_EXECUTOR_DEFAULT_MAX_PENDING;
+    c->timeout_ms = IOTC_COMMAND_EXECUTOR_DEFAULT_TIMEOUT_MS;
+}
+
+int iotc_command_executor_start(const IotConnectCommandExecutorConfig *c) {
+    if (is_running) {
+        iotc_command_executor_stop();
+    }
+    if (0 == c->workers || c->workers > IOTC_COMMAND_EXECUTOR_MAX_WORKERS) {
+        IOTC_ERROR("Command executor: The number of workers must be between 1 and %d.",
+                   IOTC_COMMAND_EXECUTOR_MAX_WORKERS);
+        return IOTCL_ERR_CONFIG_ERROR;
+    }
+    if (!c->handler) {
+        IOTC_ERROR("Command executor: A command handler is required.");
+        return IOTCL_ERR_CONFIG_MISSING;
+    }
+    memcpy(&config, c, sizeof(IotConnectCommandExecutorConfig));
+    if (!config.key_cb) {
+        config.key_cb = command_name_key;
+    }
+    if (!config.max_pending) {
+        config.max_pending = IOTC_COMMAND_EXECUTOR_DEFAULT_MAX_PENDING;
+    }
+
+    is_stop_requested = false;
+    pending_head = pending_tail = NULL;
+    pending_count = 0;
+    memset(running, 0, sizeof(running));
+    submitted = completed = timed_out = rejected = 0;
+    iotc_mutex_init(&lock);
+    iotc_cond_init(&work_cond);
+    iotc_cond_init(&supervisor_cond);
+
+    if (0 != iotc_thread_create(&supervisor_thread, supervisor_fn, NULL)) {
+        IOTC_ERROR("Command executor: Unable to start the supervisor thread!");
+        iotc_cond_destroy(&supervisor_cond);
+        iotc_cond_destroy(&work_cond);
+        iotc_mutex_destroy(&lock);
+        return IOTCL_ERR_FAILED;
+    }
+    unsigned int started = 0;
+    bool is_failed = false;
+    while (!is_failed && started < config.workers) {
+        is_failed = (0 != iotc_thread_create(&workers[started], worker_fn, (void *) (size_t) started));
+        if (!is_failed) {
+            started++;
+        }
+    }
+    is_running = true; // so that stop can clean up after a partial start
+    if (is_failed) {
+        IOTC_ERROR("Command executor: Unable to start the worker threads!");
+        config.workers = started;
+        iotc_command_executor_stop();
+        return IOTCL_ERR_FAILED;
+    }
+    return IOTCL_SUCCESS;
+}
+
+void iotc_command_executor_stop(void) {
+    if (!is_running) {
+        return;
+    }
+    iotc_mutex_lock(&lock);
+    is_stop_requested = true;
+    CommandJob *dropped = pending_head;
+    pending_head = pending_tail = NULL;
+    pending_count = 0;
+    iotc_cond_broadcast(&work_cond);
+    iotc_cond_broadcast(&supervisor_cond);
+    iotc_mutex_unlock(&lock);
+
+    unsigned int dropped_count = 0;
+    while (dropped) {
+        CommandJob *next = dropped->next;
+        // The publish queue is stopped after the executor, so these still go out
+        send_ack(dropped->ack_id, IOTCL_C2D_EVT_CMD_FAILED, STOPPED_ACK_MESSAGE);
+        free(dropped);
+        dropped = next;
+        dropped_count++;
+    }
+    if (dropped_count) {
+        IOTC_WARN("Command executor: Dropped %u command(s) that did not start.", dropped_count);
+    }
+
+    // A worker that is stuck in its handler holds up the stop until the handler returns
+    for (unsigned int i = 0; i < config.workers; i++) {
+        iotc_thread_join(&workers[i]);
+    }
+    iotc_thread_join(&supervisor_thread);
+
+    iotc_cond_destroy(&supervisor_cond);
+    iotc_cond_destroy(&work_cond);
+    iotc_mutex_destroy(&lock);
+    is_running = false;
+}
+
+bool iotc_command_executor_is_running(void) {
+    return is_running;
+}
+
+int iotc_command_executor_submit(const char *command, const char *ack_id) {
+    if (!is_running) {
+        IOTC_ERROR("iotc_command_executor_submit: The command executor is not running!");
+        return IOTCL_ERR_FAILED;
+    }
+    if (!command) {
+        return IOTCL_ERR_MISSING_VALUE;
+    }
+    size_t command_size = strlen(command) + 1;
+    size_t ack_id_size = ack_id ? strlen(ack_id) + 1 : 0;
+    CommandJob *job = malloc(sizeof(CommandJob) + command_size + ack_id_size);
+    if (!job) {
+        iotc_mutex_lock(&lock);
+        submitted++;
+        rejected++;
+        iotc_mutex_unlock(&lock);
+        IOTC_ERROR("Command executor: Out of memory while queuing \"%s\"!", command);
+        send_ack(ack_id, IOTCL_C2D_EVT_CMD_FAILED, REJECTED_ACK_MESSAGE);
+        return IOTCL_ERR_OUT_OF_MEMORY;
+    }
+    memset(job, 0, sizeof(CommandJob));
+    job->command = (char *) (job + 1);
+    memcpy(job->command, command, command_size);
+    if (ack_id) {
+        job->ack_id = job->command + command_size;
+        memcpy(job->ack_id, ack_id, ack_id_size);
+    }
+    const char *key = NULL;
+    size_t key_len = config.key_cb(job->command, &key);
+    job->key_hash = hash_key(key ? key : "", key ? key_len : 0);
+    if (config.timeout_ms) {
+        job->deadline_ms = iotc_clock_now_ms() + config.timeout_ms;
+    }
+
+    iotc_mutex_lock(&lock);
+    submitted++;
+    if (pending_count >= config.max_pending) {
+        rejected++;
+        iotc_mutex_unlock(&lock);
+        IOTC_WARN("Command executor: Rejecting \"%s\". %s.", command, REJECTED_ACK_MESSAGE);
+        send_ack(ack_id, IOTCL_C2D_EVT_CMD_FAILED, REJECTED_ACK_MESSAGE);
+        free(job);
+        return IOTCL_ERR_FAILED;
+    }
+    if (pending_tail) {
+        pending_tail->next = job;
+    } else {
+        pending_head = job;
+    }
+    pending_tail = job;
+    pending_count++;
+    iotc_cond_broadcast(&work_cond);
+    if (job->deadline_ms) {
+        iotc_cond_signal(&supervisor_cond);
+    }
+    iotc_mutex_unlock(&lock);
+    return IOTCL_SUCCESS;
+}
+
+bool iotc_command_executor_is_executor_thread(void) {
+    return is_executor_thread;
+}
+
+void iotc_command_executor_get_stats(IotConnectCommandExecutorStats *stats) {
+    memset(stats, 0, sizeof(IotConnectCommandExecutorStats));
+    if (!is_running) {
+        return;
+    }
+    iotc_mutex_lock(&lock);
+    stats->submitted = submitted;
+    stats->completed = completed;
+    stats->timed_out = timed_out;
+    stats->rejected = rejected;
+    stats->pending = pending_count;
+    for (unsigned int i = 0; i < config.workers; i++) {
+        if (running[i]) {
+            stats->pending++;
+        }
+    }
+    iotc_mutex_unlock(&lock);
+}
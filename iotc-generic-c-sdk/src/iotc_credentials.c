@@ -0,0 +1,247 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "iotcl.h"
+#include "iotc_log.h"
+#include "iotc_thread.h"
+#include "iotc_algorithms.h"
+#include "iotc_credentials.h"
+
+// Upper bound for a single wait, so that wall clock adjustments are picked up
+#define MAX_WAIT_MS 60000UL
+#define SIGN_RETRY_MS 5000UL
+#define MAX_RENEW_RETRY_SECS 60
+
+static bool is_enabled = false;
+static char *host = NULL;
+static char *client_id = NULL;
+static char *symmetric_key = NULL;
+static unsigned long lifetime_secs;
+static unsigned long margin_secs;
+static IotConnectCredentialsRenewCallback renew_cb = NULL;
+
+// The lock protects everything below
+static IotcMutex lock;
+static IotcCond cond; // signaled when a token is taken and on stop
+static IotcThread manager_thread;
+static bool is_stop_requested = false;
+static char *next_token = NULL;
+static time_t next_expiry = 0;
+static time_t current_expiry = 0; // of the token that the current connection was made with. 0 if none.
+static bool is_renew_requested = false;
+static time_t renew_retry_at = 0; // after a failed renewal. 0 if none failed since the last token was taken.
+static time_t renew_retry_secs = IOTC_CREDENTIALS_RENEW_RETRY_SECS;
+
+static char *copy_string(const char *s) {
+    size_t len = strlen(s);
+    char *copy = malloc(len + 1);
+    if (copy) {
+        memcpy(copy, s, len + 1);
+    }
+    return copy;
+}
+
+static char *sign_token(time_t *expiry) {
+    // taken before signing, so that the recorded expiry is never later than the real one
+    *expiry = time(NULL) + (time_t) lifetime_secs;
+    char *token = gen_sas_token(host, client_id, symmetric_key, (time_t) lifetime_secs);
+    if (!token) {
+        IOTC_ERROR("Credentials: Unable to generate a SAS token!");
+    }
+    return token;
+}
+
+static unsigned long ms_until(time_t t, time_t now) {
+    if (t <= now) {
+        return 0;
+    }
+    unsigned long long ms = (unsigned long long) (t - now) * 1000ULL;
+    return ms > MAX_WAIT_MS ? MAX_WAIT_MS : (unsigned long) ms;
+}
+
+static void manager_thread_fn(void *arg) {
+    (void) arg;
+    iotc_mutex_lock(&lock);
+    while (!is_stop_requested) {
+        time_t now = time(NULL);
+        time_t renew_at = current_expiry - (time_t) margin_secs;
+        time_t prepare_at = renew_at - IOTC_CREDENTIALS_PREPARE_LEAD_SECS;
+
+        if (!next_token && (0 == current_expiry || now >= prepare_at)) {
+            time_t expiry;
+            iotc_mutex_unlock(&lock);
+            char *token = sign_token(&expiry);
+            iotc_mutex_lock(&lock);
+            if (token) {
+                next_token = token;
+                next_expiry = expiry;
+            } else if (!is_stop_requested) {
+                iotc_cond_timed_wait(&cond, &lock, SIGN_RETRY_MS);
+            }
+            continue;
+        }
+
+        if (renew_retry_at > renew_at) {
+            renew_at = renew_retry_at;
+        }
+        if (current_expiry && !is_renew_requested && now >= renew_at) {
+            is_renew_requested = true; // until the next token is taken
+            iotc_mutex_unlock(&lock);
+            IOTC_INFO("Credentials: SAS token expires in %ld s. Renewing the connection.",
+                      (long) (current_expiry - now));
+            int status = renew_cb();
+            iotc_mutex_lock(&lock);
+            if (status && is_renew_requested) {
+                // no new token was taken, so nothing else would start another attempt
+                is_renew_requested = false;
+                renew_retry_at = time(NULL) + renew_retry_secs;
+                IOTC_WARN("Credentials: Renewing the connection failed. Retrying in %ld s.", (long) renew_retry_secs);
+                renew_retry_secs = renew_retry_secs * 2 > MAX_RENEW_RETRY_SECS ? MAX_RENEW_RETRY_SECS
+                                                                               : renew_retry_secs * 2;
+            }
+            continue;
+        }
+
+        unsigned long wait_ms = MAX_WAIT_MS;
+        if (current_expiry && !is_renew_requested) {
+            wait_ms = ms_until(next_token ? renew_at : prepare_at, now);
+        }
+        iotc_cond_timed_wait(&cond, &lock, wait_ms ? wait_ms : 1);
+    }
+    iotc_mutex_unlock(&lock);
+}
+
+void iotc_credentials_init_config(IotConnectCredentialsConfig *c) {
+    memset(c, 0, sizeof(IotConnectCredentialsConfig));
+    c->sas_lifetime_secs = IOTC_CREDENTIALS_DEFAULT_SAS_LIFETIME_SECS;
+    c->renew_margin_secs = IOTC_CREDENTIALS_DEFAULT_RENEW_MARGIN_SECS;
+}
+
+int iotc_credentials_init(
+        const IotConnectCredentialsConfig *c,
+        const char *host_name,
+        const char *device_client_id,
+        const char *key,
+        IotConnectCredentialsRenewCallback cb
+) {
+    if (is_enabled) {
+        iotc_credentials_deinit();
+    }
+    if (!host_name || !device_client_id || !key || !cb) {
+        IOTC_ERROR("iotc_credentials_init: host, client ID, key and callback are required.");
+        return IOTCL_ERR_MISSING_VALUE;
+    }
+    lifetime_secs = c->sas_lifetime_secs ? c->sas_lifetime_secs : IOTC_CREDENTIALS_DEFAULT_SAS_LIFETIME_SECS;
+    margin_secs = c->renew_margin_secs;
+    if (margin_secs >= lifetime_secs) {
+        margin_secs = lifetime_secs / 2;
+        IOTC_WARN("Credentials: Renew margin must be less than the token lifetime. Using %lu s.", margin_secs);
+    }
+    host = copy_string(host_name);
+    client_id = copy_string(device_client_id);
+    symmetric_key = copy_string(key);
+    if (!host || !client_id || !symmetric_key) {
+        IOTC_ERROR("iotc_credentials_init: Out of memory!");
+        free(host);
+        free(client_id);
+        free(symmetric_key);
+        host = client_id = symmetric_key = NULL;
+        return IOTCL_ERR_OUT_OF_MEMORY;
+    }
+    renew_cb = cb;
+
+    iotc_mutex_init(&lock);
+    iotc_cond_init(&cond);
+    is_stop_requested = false;
+    next_token = NULL;
+    next_expiry = 0;
+    current_expiry = 0;
+    is_renew_requested = false;
+    renew_retry_at = 0;
+    renew_retry_secs = IOTC_CREDENTIALS_RENEW_RETRY_SECS;
+    if (0 != iotc_thread_create(&manager_thread, manager_thread_fn, NULL)) {
+        IOTC_ERROR("iotc_credentials_init: Unable to start the credential manager thread");
+        iotc_cond_destroy(&cond);
+        iotc_mutex_destroy(&lock);
+        free(host);
+        free(client_id);
+        free(symmetric_key);
+        host = client_id = symmetric_key = NULL;
+        return IOTCL_ERR_FAILED;
+    }
+    is_enabled = true;
+    return IOTCL_SUCCESS;
+}
+
+void iotc_credentials_deinit(void) {
+    if (!is_enabled) {
+        return;
+    }
+    iotc_mutex_lock(&lock);
+    is_stop_requested = true;
+    iotc_cond_broadcast(&cond);
+    iotc_mutex_unlock(&lock);
+    iotc_thread_join(&manager_thread);
+
+    iotc_cond_destroy(&cond);
+    iotc_mutex_destroy(&lock);
+    free(next_token);
+    next_token = NULL;
+    free(host);
+    free(client_id);
+    free(symmetric_key);
+    host = client_id = symmetric_key = NULL;
+    renew_cb = NULL;
+    is_enabled = false;
+}
+
+bool iotc_credentials_is_enabled(void) {
+    return is_enabled;
+}
+
+char *iotc_credentials_take_sas_token(void) {
+    if (!is_enabled) {
+        return NULL;
+    }
+    iotc_mutex_lock(&lock);
+    char *token = next_token;
+    time_t expiry = next_expiry;
+    next_token = NULL;
+    iotc_mutex_unlock(&lock);
+
+    // A token that waited too long, for example while the device was offline, would need renewing right away
+    if (token && expiry - time(NULL) <= (time_t) margin_secs) {
+        free(token);
+        token = NULL;
+    }
+    if (!token) {
+        token = sign_token(&expiry);
+        if (!token) {
+            return NULL; // called function will print the error
+        }
+    }
+
+    iotc_mutex_lock(&lock);
+    current_expiry = expiry;
+    is_renew_requested = false;
+    renew_retry_at = 0;
+    renew_retry_secs = IOTC_CREDENTIALS_RENEW_RETRY_SECS;
+    iotc_cond_broadcast(&cond);
+    iotc_mutex_unlock(&lock);
+    return token;
+}
+
+time_t iotc_credentials_get_expiry(void) {
+    if (!is_enabled) {
+        return 0;
+    }
+    iotc_mutex_lock(&lock);
+    time_t expiry = current_expiry;
+    iotc_mutex_unlock(&lock);
+    return expiry;
+}
@@ -0,0 +1,525 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#if !defined(_POSIX_C_SOURCE)
+// for fseeko() with -std=c99
+#define _POSIX_C_SOURCE 200809L
+#endif
+// images over 2 GB on 32-bit systems
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/evp.h>
+#include "iotcl.h"
+#include "iotc_log.h"
+#include "iotc_delta.h"
+
+#ifdef IOTC_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef IOTC_WITH_BZIP2
+#include <bzlib.h>
+#endif
+
+#if defined(_WIN32) || defined(_WIN64)
+#define file_seek(f, offset) _fseeki64((f), (__int64) (offset), SEEK_SET)
+#else
+#define file_seek(f, offset) fseeko((f), (off_t) (offset), SEEK_SET)
+#endif
+
+#define SHA256_SIZE 32
+#define CONTROL_SIZE 24 // diff length, extra length and old position adjustment
+
+typedef enum {
+    CODEC_NONE = 0,
+    CODEC_GZIP,
+    CODEC_BZIP2
+} Codec;
+
+// Decompresses the records that follow the header
+typedef struct {
+    const IotConnectDeltaConfig *c;
+    Codec codec;
+    unsigned char in[IOTC_DELTA_BUFFER_SIZE];
+    size_t in_len; // compressed bytes in the buffer that were not consumed yet
+    size_t in_pos;
+    bool is_in_end; // patch_cb has nothing more
+    bool is_stream_end; // end of the compressed stream
+#ifdef IOTC_WITH_ZLIB
+    z_stream z;
+#endif
+#ifdef IOTC_WITH_BZIP2
+    bz_stream bz;
+#endif
+} PatchStream;
+
+typedef struct {
+    PatchStream patch;
+    unsigned char data[IOTC_DELTA_BUFFER_SIZE];
+    unsigned char old[IOTC_DELTA_BUFFER_SIZE];
+} Buffers;
+
+// Sign and magnitude, little endian, as written by bsdiff
+static int64_t offtin(const unsigned char *buf) {
+    int64_t y = buf[7] & 0x7F;
+    for (int i = 6; i >= 0; i--) {
+        y = y * 256 + buf[i];
+    }
+    return (buf[7] & 0x80) ? -y : y;
+}
+
+static int parse_hash(const char *hex, unsigned char *hash) {
+    if (strlen(hex) != SHA256_SIZE * 2) {
+        return IOTCL_ERR_BAD_VALUE;
+    }
+    for (int i = 0; i < SHA256_SIZE * 2; i++) {
+        int c = tolower((unsigned char) hex[i]);
+        int v;
+        if (c >= '0' && c <= '9') {
+            v = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            v = c - 'a' + 10;
+        } else {
+            return IOTCL_ERR_BAD_VALUE;
+        }
+        if (i % 2) {
+            hash[i / 2] = (unsigned char) (hash[i / 2] | v);
+        } else {
+            hash[i / 2] = (unsigned char) (v << 4);
+        }
+    }
+    return IOTCL_SUCCESS;
+}
+
+// Reads exactly len raw bytes of the patch
+static int read_raw(const IotConnectDeltaConfig *c, unsigned char *data, size_t len) {
+    while (len) {
+        long n = c->patch_cb(data, len, c->context);
+        if (n <= 0) {
+            return IOTCL_ERR_FAILED;
+        }
+        data += n;
+        len -= (size_t) n;
+    }
+    return IOTCL_SUCCESS;
+}
+
+static int fill_input(PatchStream *p) {
+    if (p->in_pos < p->in_len || p->is_in_end) {
+        return IOTCL_SUCCESS;
+    }
+    long n = p->c->patch_cb(p->in, sizeof(p->in), p->c->context);
+    if (n < 0) {
+        IOTC_ERROR("Delta: Failed to read the patch.");
+        return IOTCL_ERR_FAILED;
+    }
+    p->in_pos = 0;
+    p->in_len = (size_t) n;
+    p->is_in_end = (0 == n);
+    return IOTCL_SUCCESS;
+}
+
+// Picks the decompressor from the first bytes of the compressed stream
+static int stream_init(PatchStream *p) {
+    while (p->in_len < 3 && !p->is_in_end) {
+        long n = p->c->patch_cb(&p->in[p->in_len], sizeof(p->in) - p->in_len, p->c->context);
+        if (n < 0) {
+            IOTC_ERROR("Delta: Failed to read the patch.");
+            return IOTCL_ERR_FAILED;
+        }
+        p->in_len += (size_t) n;
+        p->is_in_end = (0 == n);
+    }
+    if (p->in_len >= 3 && 'B' == p->in[0] && 'Z' == p->in[1] && 'h' == p->in[2]) {
+#ifdef IOTC_WITH_BZIP2
+        if (BZ_OK != BZ2_bzDecompressInit(&p->bz, 0, IOTC_DELTA_BZIP2_SMALL)) {
+            IOTC_ERROR("Delta: Unable to initialize bzip2.");
+            return IOTCL_ERR_OUT_OF_MEMORY;
+        }
+        p->codec = CODEC_BZIP2;
+        return IOTCL_SUCCESS;
+#else
+        IOTC_ERROR("Delta: The patch is bzip2 compressed, but the SDK was built without bzip2.");
+        return IOTCL_ERR_CONFIG_ERROR;
+#endif
+    }
+    if (p->in_len >= 2 && 0x1f == p->in[0] && 0x8b == p->in[1]) {
+#ifdef IOTC_WITH_ZLIB
+        if (Z_OK != inflateInit2(&p->z, 15 + 16)) {
+            IOTC_ERROR("Delta: Unable to initialize zlib.");
+            return IOTCL_ERR_OUT_OF_MEMORY;
+        }
+        p->codec = CODEC_GZIP;
+        return IOTCL_SUCCESS;
+#else
+        IOTC_ERROR("Delta: The patch is gzip compressed, but the SDK was built without zlib.");
+        return IOTCL_ERR_CONFIG_ERROR;
+#endif
+    }
+    IOTC_ERROR("Delta: Unknown compression of the patch records.");
+    return IOTCL_ERR_PARSING_ERROR;
+}
+
+static void stream_deinit(PatchStream *p) {
+#ifdef IOTC_WITH_ZLIB
+    if (CODEC_GZIP == p->codec) {
+        inflateEnd(&p->z);
+    }
+#endif
+#ifdef IOTC_WITH_BZIP2
+    if (CODEC_BZIP2 == p->codec) {
+        BZ2_bzDecompressEnd(&p->bz);
+    }
+#endif
+    p->codec = CODEC_NONE;
+}
+
+// Decompresses exactly len bytes
+static int stream_read(PatchStream *p, unsigned char *out, size_t len) {
+    while (len) {
+        if (p->is_stream_end) {
+            IOTC_ERROR("Delta: The patch is truncated.");
+            return IOTCL_ERR_PARSING_ERROR;
+        }
+        int status = fill_input(p);
+        if (status) {
+            return status;
+        }
+        const size_t avail_in = p->in_len - p->in_pos;
+        size_t produced = 0;
+        size_t consumed = 0;
+        bool is_error = (CODEC_NONE == p->codec && avail_in > 0); // stream_init() did not find a decompressor
+#ifdef IOTC_WITH_ZLIB
+        if (CODEC_GZIP == p->codec) {
+            p->z.next_in = &p->in[p->in_pos];
+            p->z.avail_in = (uInt) avail_in;
+            p->z.next_out = out;
+            p->z.avail_out = (uInt) len;
+            int ret = inflate(&p->z, Z_NO_FLUSH);
+            consumed = avail_in - p->z.avail_in;
+            produced = len - p->z.avail_out;
+            p->is_stream_end = (Z_STREAM_END == ret);
+            is_error = (Z_OK != ret && Z_STREAM_END != ret && Z_BUF_ERROR != ret); // no progress is checked below
+        }
+#endif
+#ifdef IOTC_WITH_BZIP2
+        if (CODEC_BZIP2 == p->codec) {
+            p->bz.next_in = (char *) &p->in[p->in_pos];
+            p->bz.avail_in = (unsigned int) avail_in;
+            p->bz.next_out = (char *) out;
+            p->bz.avail_out = (unsigned int) len;
+            int ret = BZ2_bzDecompress(&p->bz);
+            consumed = avail_in - p->bz.avail_in;
+            produced = len - p->bz.avail_out;
+            p->is_stream_end = (BZ_STREAM_END == ret);
+            is_error = (BZ_OK != ret && BZ_STREAM_END != ret);
+        }
+#endif
+        p->in_pos += consumed;
+        out += produced;
+        len -= produced;
+        if (is_error) {
+            IOTC_ERROR("Delta: The patch is corrupted.");
+            return IOTCL_ERR_PARSING_ERROR;
+        }
+        if (0 == produced && 0 == consumed && p->is_in_end) {
+            IOTC_ERROR("Delta: The patch is truncated.");
+            return IOTCL_ERR_PARSING_ERROR;
+        }
+    }
+    return IOTCL_SUCCESS;
+}
+
+// Reads old image bytes at a position that can be partly outside of the image. Bytes outside read as zero.
+// The position comes from the patch, so pos + len is never computed, as it could overflow.
+static int read_old(const IotConnectDeltaConfig *c, int64_t pos, unsigned char *data, size_t len) {
+    const int64_t old_size = c->old_size > (uint64_t) INT64_MAX ? INT64_MAX : (int64_t) c->old_size;
+    if (pos >= old_size || (pos < 0 && pos <= -(int64_t) len)) {
+        memset(data, 0, len);
+        return IOTCL_SUCCESS;
+    }
+    const size_t before = pos < 0 ? (size_t) -pos : 0; // bytes before the start of the image
+    const int64_t lo = pos < 0 ? 0 : pos;
+    size_t count = len - before;
+    if ((uint64_t) count > (uint64_t) (old_size - lo)) {
+        count = (size_t) (old_size - lo);
+    }
+    memset(data, 0, before);
+    memset(&data[before + count], 0, len - before - count);
+    if (c->old_cb((uint64_t) lo, &data[before], count, c->context)) {
+        IOTC_ERROR("Delta: Failed to read the old image at %lld", (long long) lo);
+        return IOTCL_ERR_FAILED;
+    }
+    return IOTCL_SUCCESS;
+}
+
+static int write_new(const IotConnectDeltaConfig *c, EVP_MD_CTX *md, const unsigned char *data, size_t len) {
+    if (c->new_cb(data, len, c->context)) {
+        IOTC_ERROR("Delta: Failed to write the new image.");
+        return IOTCL_ERR_FAILED;
+    }
+    if (md) {
+        EVP_DigestUpdate(md, data, len);
+    }
+    return IOTCL_SUCCESS;
+}
+
+static int apply_records(const IotConnectDeltaConfig *c, Buffers *b, EVP_MD_CTX *md, uint64_t new_size,
+                         IotConnectDeltaStats *stats) {
+    uint64_t new_pos = 0;
+    int64_t old_pos = 0;
+    int status;
+
+    while (new_pos < new_size) {
+        unsigned char control[CONTROL_SIZE];
+        status = stream_read(&b->patch, control, sizeof(control));
+        if (status) {
+            return status;
+        }
+        const int64_t diff_len = offtin(control);
+        const int64_t extra_len = offtin(&control[8]);
+        const int64_t seek = offtin(&control[16]);
+        // checked before any arithmetic, as signed overflow is undefined
+        if (diff_len < 0 || extra_len < 0
+            || (uint64_t) diff_len > new_size - new_pos
+            || (uint64_t) extra_len > new_size - new_pos - (uint64_t) diff_len
+            || old_pos > INT64_MAX - diff_len
+            || (seek > 0 && old_pos + diff_len > INT64_MAX - seek)
+            || (seek < 0 && old_pos + diff_len < INT64_MIN - seek)) {
+            IOTC_ERROR("Delta: Invalid record at offset %llu.", (unsigned long long) new_pos);
+            return IOTCL_ERR_PARSING_ERROR;
+        }
+        stats->records++;
+
+        // difference bytes are added to the old image
+        for (int64_t left = diff_len; left > 0;) {
+            size_t n = left < IOTC_DELTA_BUFFER_SIZE ? (size_t) left : IOTC_DELTA_BUFFER_SIZE;
+            status = stream_read(&b->patch, b->data, n);
+            if (status) {
+                return status;
+            }
+            status = read_old(c, old_pos, b->old, n);
+            if (status) {
+                return status;
+            }
+            for (size_t i = 0; i < n; i++) {
+                b->data[i] = (unsigned char) (b->data[i] + b->old[i]);
+            }
+            status = write_new(c, md, b->data, n);
+            if (status) {
+                return status;
+            }
+            old_pos += (int64_t) n;
+            left -= (int64_t) n;
+        }
+
+        // extra bytes are new content
+        for (int64_t left = extra_len; left > 0;) {
+            size_t n = left < IOTC_DELTA_BUFFER_SIZE ? (size_t) left : IOTC_DELTA_BUFFER_SIZE;
+            status = stream_read(&b->patch, b->data, n);
+            if (status) {
+                return status;
+            }
+            status = write_new(c, md, b->data, n);
+            if (status) {
+                return status;
+            }
+            left -= (int64_t) n;
+        }
+
+        new_pos += (uint64_t) (diff_len + extra_len);
+        old_pos += seek;
+        stats->diff_bytes += (uint64_t) diff_len;
+        stats->extra_bytes += (uint64_t) extra_len;
+    }
+    return IOTCL_SUCCESS;
+}
+
+bool iotc_delta_is_patch(const void *data, size_t len) {
+    return len >= IOTC_DELTA_MAGIC_SIZE && 0 == memcmp(data, IOTC_DELTA_MAGIC, IOTC_DELTA_MAGIC_SIZE);
+}
+
+bool iotc_delta_is_patch_file(const char *path) {
+    unsigned char magic[IOTC_DELTA_MAGIC_SIZE];
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    size_t len = fread(magic, 1, sizeof(magic), f);
+    fclose(f);
+    return iotc_delta_is_patch(magic, len);
+}
+
+int iotc_delta_apply(const IotConnectDeltaConfig *c, IotConnectDeltaStats *stats) {
+    unsigned char header[IOTC_DELTA_HEADER_SIZE];
+    unsigned char expected_hash[SHA256_SIZE];
+    IotConnectDeltaStats local_stats;
+    EVP_MD_CTX *md = NULL;
+    Buffers *b = NULL;
+    int status;
+
+    if (!c->patch_cb || !c->old_cb || !c->new_cb) {
+        IOTC_ERROR("iotc_delta_apply: All callbacks are required.");
+        return IOTCL_ERR_MISSING_VALUE;
+    }
+    if (!stats) {
+        stats = &local_stats;
+    }
+    memset(stats, 0, sizeof(IotConnectDeltaStats));
+    if (c->new_sha256 && parse_hash(c->new_sha256, expected_hash)) {
+        IOTC_ERROR("iotc_delta_apply: The SHA-256 must be 64 hex characters.");
+        return IOTCL_ERR_BAD_VALUE;
+    }
+
+    if (read_raw(c, header, sizeof(header)) || !iotc_delta_is_patch(header, sizeof(header))) {
+        IOTC_ERROR("Delta: Not a delta update.");
+        return IOTCL_ERR_PARSING_ERROR;
+    }
+    const int64_t new_size = offtin(&header[IOTC_DELTA_MAGIC_SIZE]);
+    if (new_size < 0) {
+        IOTC_ERROR("Delta: Invalid image size in the patch header.");
+        return IOTCL_ERR_PARSING_ERROR;
+    }
+    stats->new_size = (uint64_t) new_size;
+
+    // calloc, because the buffers are too large for the stack of a callback
+    b = calloc(1, sizeof(Buffers));
+    if (!b) {
+        IOTC_ERROR("iotc_delta_apply: Out of memory!");
+        return IOTCL_ERR_OUT_OF_MEMORY;
+    }
+    b->patch.c = c;
+    if (c->new_sha256) {
+        md = EVP_MD_CTX_new();
+        if (!md || !EVP_DigestInit_ex(md, EVP_sha256(), NULL)) {
+            IOTC_ERROR("iotc_delta_apply: Unable to set up hashing.");
+            status = IOTCL_ERR_OUT_OF_MEMORY;
+            goto cleanup;
+        }
+    }
+
+    if (new_size > 0) {
+        status = stream_init(&b->patch);
+        if (status) goto cleanup; // called function will print the error
+    }
+    status = apply_records(c, b, md, (uint64_t) new_size, stats);
+    if (status) goto cleanup; // called function will print the error
+
+    if (md) {
+        unsigned char hash[SHA256_SIZE];
+        unsigned int hash_len = 0;
+        EVP_DigestFinal_ex(md, hash, &hash_len);
+        if (hash_len != SHA256_SIZE || 0 != memcmp(hash, expected_hash, SHA256_SIZE)) {
+            IOTC_ERROR("Delta: SHA-256 of the new image does not match. Was the patch made for a different image?");
+            status = IOTCL_ERR_BAD_VALUE;
+            goto cleanup;
+        }
+    }
+
+    cleanup:
+    stream_deinit(&b->patch);
+    if (md) {
+        EVP_MD_CTX_free(md);
+    }
+    free(b);
+    return status;
+}
+
+typedef struct {
+    FILE *old_file;
+    FILE *patch_file;
+    FILE *new_file;
+} DeltaFiles;
+
+static long file_patch_read(void *data, size_t len, void *context) {
+    DeltaFiles *f = (DeltaFiles *) context;
+    size_t n = fread(data, 1, len, f->patch_file);
+    if (n < len && ferror(f->patch_file)) {
+        return -1;
+    }
+    return (long) n;
+}
+
+static int file_old_read(uint64_t offset, void *data, size_t len, void *context) {
+    DeltaFiles *f = (DeltaFiles *) context;
+    if (0 != file_seek(f->old_file, offset) || len != fread(data, 1, len, f->old_file)) {
+        return IOTCL_ERR_FAILED;
+    }
+    return IOTCL_SUCCESS;
+}
+
+static int file_new_write(const void *data, size_t len, void *context) {
+    DeltaFiles *f = (DeltaFiles *) context;
+    return (len == fwrite(data, 1, len, f->new_file)) ? IOTCL_SUCCESS : IOTCL_ERR_FAILED;
+}
+
+int iotc_delta_apply_file(
+        const char *old_path,
+        const char *patch_path,
+        const char *new_path,
+        const char *new_sha256,
+        IotConnectDeltaStats *stats
+) {
+    DeltaFiles f = {NULL, NULL, NULL};
+    IotConnectDeltaConfig c;
+    bool is_new_created = false;
+    int status = IOTCL_ERR_FAILED;
+
+    f.old_file = fopen(old_path, "rb");
+    f.patch_file = fopen(patch_path, "rb");
+    if (!f.old_file || !f.patch_file) {
+        IOTC_ERROR("iotc_delta_apply_file: Unable to open %s", f.old_file ? patch_path : old_path);
+        goto cleanup;
+    }
+    f.new_file = fopen(new_path, "wb");
+    if (!f.new_file) {
+        IOTC_ERROR("iotc_delta_apply_file: Unable to create %s", new_path);
+        goto cleanup;
+    }
+    is_new_created = true;
+
+    memset(&c, 0, sizeof(c));
+    c.patch_cb = file_patch_read;
+    c.old_cb = file_old_read;
+    c.new_cb = file_new_write;
+    c.context = &f;
+    c.new_sha256 = new_sha256;
+    if (0 != fseek(f.old_file, 0, SEEK_END)) {
+        IOTC_ERROR("iotc_delta_apply_file: Unable to read %s", old_path);
+        goto cleanup;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    c.old_size = (uint64_t) _ftelli64(f.old_file);
+#else
+    c.old_size = (uint64_t) ftello(f.old_file);
+#endif
+
+    status = iotc_delta_apply(&c, stats);
+    if (0 != fclose(f.new_file) && !status) {
+        IOTC_ERROR("iotc_delta_apply_file: Unable to write %s", new_path);
+        status = IOTCL_ERR_FAILED;
+    }
+    f.new_file = NULL;
+
+    cleanup:
+    if (f.new_file) {
+        fclose(f.new_file);
+    }
+    if (status && is_new_created) {
+        remove(new_path); // never leave a partial or unverified image behind
+    }
+    if (f.old_file) {
+        fclose(f.old_file);
+    }
+    if (f.patch_file) {
+        fclose(f.patch_file);
+    }
+    return status;
+}
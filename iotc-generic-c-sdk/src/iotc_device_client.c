@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stddef.h>
+#include "iotc_log.h"
+#include "iotc_device_client.h"
+#ifdef IOTC_WITHOUT_PAHO
+#include "iotc_lite_mqtt.h"
+#endif
+
+// Dispatches the device client functions to the selected transport
+
+static const IotConnectTransport *transport = NULL;
+
+static const IotConnectTransport *get_default_transport(void) {
+#ifdef IOTC_WITHOUT_PAHO
+    return iotc_lite_mqtt_transport();
+#else
+    return iotc_paho_transport();
+#endif
+}
+
+static const IotConnectTransport *get_transport(void) {
+    if (!transport) {
+        transport = get_default_transport();
+    }
+    return transport;
+}
+
+void iotc_device_client_set_transport(const IotConnectTransport *t) {
+    if (!t) {
+        t = get_default_transport();
+    }
+    if (transport && t != transport && transport->is_connected()) {
+        IOTC_WARN("Changing the transport while connected. Disconnecting from %s.", transport->name);
+        transport->disconnect();
+    }
+    transport = t;
+}
+
+const IotConnectTransport *iotc_device_client_get_transport(void) {
+    return get_transport();
+}
+
+int iotc_device_client_connect(IotConnectDeviceClientConfig *c) {
+    return get_transport()->connect(c);
+}
+
+int iotc_device_client_disconnect(void) {
+    return get_transport()->disconnect();
+}
+
+int iotc_device_client_renew_credentials(void) {
+    return get_transport()->renew_credentials();
+}
+
+bool iotc_device_client_is_connected(void) {
+    return get_transport()->is_connected();
+}
+
+int iotc_device_client_send_message(const char *topic, const char *message) {
+    return get_transport()->send_message_qos(topic, message, 1);
+}
+
+int iotc_device_client_send_message_qos(const char *topic, const char *message, int qos) {
+    return get_transport()->send_message_qos(topic, message, qos);
+}
+
+void iotc_device_client_receive(void) {
+    const IotConnectTransport *t = get_transport();
+    if (t->receive) {
+        t->receive();
+    }
+}
@@ -0,0 +1,369 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#if !defined(_WIN32) && !defined(_WIN64) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L // getaddrinfo()
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(_WIN32) || defined(_WIN64)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#endif
+#include "iotcl.h"
+#include "iotc_log.h"
+#include "iotc_thread.h"
+#include "iotc_clock.h"
+#include "iotc_dns_cache.h"
+
+#define PERSIST_TMP_SUFFIX ".tmp"
+#define MAX_LINE_LENGTH (IOTC_DNS_CACHE_MAX_HOST_LENGTH + 24 + IOTC_DNS_CACHE_MAX_ADDRESSES * IOTC_DNS_CACHE_MAX_ADDRESS_LENGTH)
+
+typedef struct {
+    char host[IOTC_DNS_CACHE_MAX_HOST_LENGTH]; // empty if the entry is free
+    IotConnectDnsAddress addresses[IOTC_DNS_CACHE_MAX_ADDRESSES];
+    size_t address_count;
+    time_t expires_at; // wall clock, so that it stays meaningful in the persisted file
+    unsigned long last_used; // for evicting the least recently used entry
+} DnsEntry;
+
+static bool is_enabled = false;
+static unsigned long ttl_secs;
+static char *persist_path = NULL;
+
+// The lock protects everything below
+static IotcMutex lock;
+static IotcCond prefetch_cond; // signaled when a background lookup finishes
+static DnsEntry entries[IOTC_DNS_CACHE_MAX_ENTRIES];
+static unsigned long use_counter = 0;
+static char prefetch_host[IOTC_DNS_CACHE_MAX_HOST_LENGTH];
+static bool is_prefetching = false;
+static IotcThread prefetch_thread;
+static bool is_thread_started = false; // needs a join
+
+static DnsEntry *find_entry(const char *host) {
+    for (int i = 0; i < IOTC_DNS_CACHE_MAX_ENTRIES; i++) {
+        if (entries[i].host[0] && 0 == strcmp(entries[i].host, host)) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+// Returns a free entry, or the least recently used one
+static DnsEntry *find_free_entry(void) {
+    DnsEntry *oldest = &entries[0];
+    for (int i = 0; i < IOTC_DNS_CACHE_MAX_ENTRIES; i++) {
+        if (!entries[i].host[0]) {
+            return &entries[i];
+        }
+        if (entries[i].last_used < oldest->last_used) {
+            oldest = &entries[i];
+        }
+    }
+    return oldest;
+}
+
+// Called with the lock held
+static void save_entries(void) {
+    if (!persist_path) {
+        return;
+    }
+    size_t path_len = strlen(persist_path);
+    char *tmp_path = malloc(path_len + sizeof(PERSIST_TMP_SUFFIX));
+    if (!tmp_path) {
+        IOTC_ERROR("DNS cache: Out of memory!");
+        return;
+    }
+    memcpy(tmp_path, persist_path, path_len);
+    memcpy(&tmp_path[path_len], PERSIST_TMP_SUFFIX, sizeof(PERSIST_TMP_SUFFIX));
+
+    FILE *f = fopen(tmp_path, "w");
+    if (!f) {
+        IOTC_WARN("DNS cache: Unable to write %s", tmp_path);
+        free(tmp_path);
+        return;
+    }
+    for (int i = 0; i < IOTC_DNS_CACHE_MAX_ENTRIES; i++) {
+        const DnsEntry *e = &entries[i];
+        if (!e->host[0]) {
+            continue;
+        }
+        fprintf(f, "%s %lld", e->host, (long long) e->expires_at);
+        for (size_t j = 0; j < e->address_count; j++) {
+            fprintf(f, " %s", e->addresses[j]);
+        }
+        fprintf(f, "\n");
+    }
+    bool is_written = (0 == ferror(f));
+    if (0 != fclose(f)) {
+        is_written = false;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    remove(persist_path); // rename() does not replace files on Windows
+#endif
+    if (!is_written || 0 != rename(tmp_path, persist_path)) {
+        IOTC_WARN("DNS cache: Unable to save %s", persist_path);
+        remove(tmp_path);
+    }
+    free(tmp_path);
+}
+
+// Called from init only, as strtok() is not reentrant.
+// Format: one line per host with the host, the expiry time in seconds since the epoch and the addresses
+static void load_entries(void) {
+    FILE *f = fopen(persist_path, "r");
+    if (!f) {
+        return; // nothing saved yet
+    }
+    char line[MAX_LINE_LENGTH];
+    int count = 0;
+    while (count < IOTC_DNS_CACHE_MAX_ENTRIES && fgets(line, sizeof(line), f)) {
+        DnsEntry *e = &entries[count];
+        const char *host = strtok(line, " \r\n");
+        const char *expires = strtok(NULL, " \r\n");
+        if (!host || !expires || strlen(host) >= sizeof(e->host)) {
+            continue;
+        }
+        memset(e, 0, sizeof(DnsEntry));
+        const char *address;
+        while (e->address_count < IOTC_DNS_CACHE_MAX_ADDRESSES && (address = strtok(NULL, " \r\n"))) {
+            if (strlen(address) < IOTC_DNS_CACHE_MAX_ADDRESS_LENGTH) {
+                strcpy(e->addresses[e->address_count++], address);
+            }
+        }
+        if (0 == e->address_count) {
+            continue;
+        }
+        strcpy(e->host, host);
+        e->expires_at = (time_t) strtoll(expires, NULL, 10);
+        count++;
+    }
+    fclose(f);
+    if (count) {
+        IOTC_INFO("DNS cache: Loaded %d host(s) from %s", count, persist_path);
+    }
+}
+
+static size_t resolve(const char *host, IotConnectDnsAddress *addresses, size_t max) {
+    struct addrinfo hints;
+    struct addrinfo *result = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int status = getaddrinfo(host, NULL, &hints, &result);
+    if (0 != status) {
+        IOTC_WARN("DNS cache: Unable to resolve %s: %s", host, gai_strerror(status));
+        return 0;
+    }
+    size_t count = 0;
+    for (const struct addrinfo *ai = result; ai && count < max; ai = ai->ai_next) {
+        char address[IOTC_DNS_CACHE_MAX_ADDRESS_LENGTH];
+        if (0 != getnameinfo(ai->ai_addr, (socklen_t) ai->ai_addrlen, address, sizeof(address), NULL, 0,
+                             NI_NUMERICHOST)) {
+            continue;
+        }
+        bool is_duplicate = false;
+        for (size_t i = 0; i < count; i++) {
+            if (0 == strcmp(addresses[i], address)) {
+                is_duplicate = true;
+                break;
+            }
+        }
+        if (!is_duplicate) {
+            strcpy(addresses[count++], address);
+        }
+    }
+    freeaddrinfo(result);
+    return count;
+}
+
+static void prefetch_thread_fn(void *arg) {
+    (void) arg;
+    IotConnectDnsAddress addresses[IOTC_DNS_CACHE_MAX_ADDRESSES];
+    uint64_t start_ms = iotc_clock_now_ms();
+    size_t count = resolve(prefetch_host, addresses, IOTC_DNS_CACHE_MAX_ADDRESSES);
+    if (count) {
+        IOTC_INFO("DNS cache: Resolved %s to %s in %lu ms", prefetch_host, addresses[0],
+                  (unsigned long) (iotc_clock_now_ms() - start_ms));
+        iotc_dns_cache_put(prefetch_host, (const IotConnectDnsAddress *) addresses, count);
+    }
+    iotc_mutex_lock(&lock);
+    is_prefetching = false;
+    iotc_cond_broadcast(&prefetch_cond);
+    iotc_mutex_unlock(&lock);
+}
+
+void iotc_dns_cache_init_config(IotConnectDnsCacheConfig *c) {
+    memset(c, 0, sizeof(IotConnectDnsCacheConfig));
+    c->ttl_secs = IOTC_DNS_CACHE_DEFAULT_TTL_SECS;
+}
+
+int iotc_dns_cache_init(const IotConnectDnsCacheConfig *c) {
+    if (is_enabled) {
+        iotc_dns_cache_deinit();
+    }
+    if (0 == c->ttl_secs) {
+        return IOTCL_SUCCESS;
+    }
+    if (c->persist_path) {
+        size_t len = strlen(c->persist_path);
+        persist_path = malloc(len + 1);
+        if (!persist_path) {
+            IOTC_ERROR("iotc_dns_cache_init: Out of memory!");
+            return IOTCL_ERR_OUT_OF_MEMORY;
+        }
+        memcpy(persist_path, c->persist_path, len + 1);
+    }
+    ttl_secs = c->ttl_secs;
+    memset(entries, 0, sizeof(entries));
+    use_counter = 0;
+    is_prefetching = false;
+    is_thread_started = false;
+    if (persist_path) {
+        load_entries();
+    }
+    iotc_mutex_init(&lock);
+    iotc_cond_init(&prefetch_cond);
+    is_enabled = true;
+    return IOTCL_SUCCESS;
+}
+
+void iotc_dns_cache_deinit(void) {
+    if (!is_enabled) {
+        return;
+    }
+    // getaddrinfo() cannot be interrupted, so this waits for a running lookup to time out
+    if (is_thread_started) {
+        iotc_thread_join(&prefetch_thread);
+        is_thread_started = false;
+    }
+    iotc_cond_destroy(&prefetch_cond);
+    iotc_mutex_destroy(&lock);
+    free(persist_path);
+    persist_path = NULL;
+    is_enabled = false;
+}
+
+bool iotc_dns_cache_is_enabled(void) {
+    return is_enabled;
+}
+
+size_t iotc_dns_cache_get(const char *host, IotConnectDnsAddress *addresses, size_t max, bool allow_expired) {
+    if (!is_enabled || !host) {
+        return 0;
+    }
+    size_t count = 0;
+    iotc_mutex_lock(&lock);
+    DnsEntry *e = find_entry(host);
+    if (e && (allow_expired || e->expires_at > time(NULL))) {
+        e->last_used = ++use_counter;
+        for (; count < e->address_count && count < max; count++) {
+            strcpy(addresses[count], e->addresses[count]);
+        }
+    }
+    iotc_mutex_unlock(&lock);
+    return count;
+}
+
+void iotc_dns_cache_put(const char *host, const IotConnectDnsAddress *addresses, size_t count) {
+    if (!is_enabled || !host || 0 == count || strlen(host) >= IOTC_DNS_CACHE_MAX_HOST_LENGTH) {
+        return;
+    }
+    iotc_mutex_lock(&lock);
+    DnsEntry *e = find_entry(host);
+    if (!e) {
+        e = find_free_entry();
+        memset(e, 0, sizeof(DnsEntry));
+        strcpy(e->host, host);
+    }
+    e->address_count = 0;
+    for (size_t i = 0; i < count && e->address_count < IOTC_DNS_CACHE_MAX_ADDRESSES; i++) {
+        if (strlen(addresses[i]) < IOTC_DNS_CACHE_MAX_ADDRESS_LENGTH) {
+            strcpy(e->addresses[e->address_count++], addresses[i]);
+        }
+    }
+    e->expires_at = time(NULL) + (time_t) ttl_secs;
+    e->last_used = ++use_counter;
+    save_entries();
+    iotc_mutex_unlock(&lock);
+}
+
+void iotc_dns_cache_invalidate(const char *host) {
+    if (!is_enabled || !host) {
+        return;
+    }
+    iotc_mutex_lock(&lock);
+    DnsEntry *e = find_entry(host);
+    if (e) {
+        memset(e, 0, sizeof(DnsEntry));
+        save_entries();
+    }
+    iotc_mutex_unlock(&lock);
+}
+
+int iotc_dns_cache_prefetch(const char *host) {
+    if (!is_enabled) {
+        return IOTCL_SUCCESS;
+    }
+    if (!host || strlen(host) >= IOTC_DNS_CACHE_MAX_HOST_LENGTH) {
+        IOTC_ERROR("iotc_dns_cache_prefetch: Invalid host");
+        return IOTCL_ERR_BAD_VALUE;
+    }
+    IotConnectDnsAddress address;
+    if (iotc_dns_cache_get(host, &address, 1, false)) {
+        return IOTCL_SUCCESS; // already fresh
+    }
+    int ret = IOTCL_SUCCESS;
+    iotc_mutex_lock(&lock);
+    if (is_prefetching) {
+        if (0 != strcmp(prefetch_host, host)) {
+            IOTC_WARN("DNS cache: Unable to resolve %s while %s is being resolved", host, prefetch_host);
+            ret = IOTCL_ERR_FAILED;
+        }
+        iotc_mutex_unlock(&lock);
+        return ret;
+    }
+    if (is_thread_started) {
+        iotc_thread_join(&prefetch_thread); // already finished
+        is_thread_started = false;
+    }
+    strcpy(prefetch_host, host);
+    is_prefetching = true;
+    if (0 != iotc_thread_create(&prefetch_thread, prefetch_thread_fn, NULL)) {
+        IOTC_ERROR("DNS cache: Unable to start the lookup thread");
+        is_prefetching = false;
+        ret = IOTCL_ERR_FAILED;
+    } else {
+        is_thread_started = true;
+    }
+    iotc_mutex_unlock(&lock);
+    return ret;
+}
+
+bool iotc_dns_cache_wait(const char *host, unsigned long timeout_ms) {
+    if (!is_enabled) {
+        return true;
+    }
+    uint64_t deadline = iotc_clock_now_ms() + timeout_ms;
+    bool is_done = true;
+    iotc_mutex_lock(&lock);
+    while (is_prefetching && (!host || 0 == strcmp(prefetch_host, host))) {
+        uint64_t now = iotc_clock_now_ms();
+        if (now >= deadline || !iotc_cond_timed_wait(&prefetch_cond, &lock, (unsigned long) (deadline - now))) {
+            is_done = !is_prefetching;
+            break;
+        }
+    }
+    iotc_mutex_unlock(&lock);
+    return is_done;
+}
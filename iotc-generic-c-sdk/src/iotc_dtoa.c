@@ -0,0 +1,435 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "iotc_dtoa.h"
+
+/*
+ * Shortest round-trip double formatting with the Grisu2 algorithm from Florian Loitsch,
+ * "Printing Floating-Point Numbers Quickly and Accurately with Integers" (PLDI 2010),
+ * in the variant popularized by RapidJSON and nlohmann/json.
+ *
+ * Output always parses back to the same double. It is the shortest such representation for all but a tiny
+ * fraction of inputs (about 0.05% of random doubles), which get more digits than needed, like 1e23 printed as
+ * 9.999999999999999e+22. That keeps the cached power table at 79 entries, where Ryu would need several KB
+ * of tables on devices.
+ */
+
+typedef struct {
+    uint64_t f;
+    int e;
+} DiyFp;
+
+typedef struct {
+    uint64_t f;
+    int e;
+    int k;
+} CachedPower;
+
+// Normalized 10^k for k = -300, -292, ..., 324, rounded to 64 bits
+static const CachedPower cached_powers[] = {
+        {0xAB70FE17C79AC6CA, -1060, -300},
+        {0xFF77B1FCBEBCDC4F, -1034, -292},
+        {0xBE5691EF416BD60C, -1007, -284},
+        {0x8DD01FAD907FFC3C, -980, -276},
+        {0xD3515C2831559A83, -954, -268},
+        {0x9D71AC8FADA6C9B5, -927, -260},
+        {0xEA9C227723EE8BCB, -901, -252},
+        {0xAECC49914078536D, -874, -244},
+        {0x823C12795DB6CE57, -847, -236},
+        {0xC21094364DFB5637, -821, -228},
+        {0x9096EA6F3848984F, -794, -220},
+        {0xD77485CB25823AC7, -768, -212},
+        {0xA086CFCD97BF97F4, -741, -204},
+        {0xEF340A98172AACE5, -715, -196},
+        {0xB23867FB2A35B28E, -688, -188},
+        {0x84C8D4DFD2C63F3B, -661, -180},
+        {0xC5DD44271AD3CDBA, -635, -172},
+        {0x936B9FCEBB25C996, -608, -164},
+        {0xDBAC6C247D62A584, -582, -156},
+        {0xA3AB66580D5FDAF6, -555, -148},
+        {0xF3E2F893DEC3F126, -529, -140},
+        {0xB5B5ADA8AAFF80B8, -502, -132},
+        {0x87625F056C7C4A8B, -475, -124},
+        {0xC9BCFF6034C13053, -449, -116},
+        {0x964E858C91BA2655, -422, -108},
+        {0xDFF9772470297EBD, -396, -100},
+        {0xA6DFBD9FB8E5B88F, -369, -92},
+        {0xF8A95FCF88747D94, -343, -84},
+        {0xB94470938FA89BCF, -316, -76},
+        {0x8A08F0F8BF0F156B, -289, -68},
+        {0xCDB02555653131B6, -263, -60},
+        {0x993FE2C6D07B7FAC, -236, -52},
+        {0xE45C10C42A2B3B06, -210, -44},
+        {0xAA242499697392D3, -183, -36},
+        {0xFD87B5F28300CA0E, -157, -28},
+        {0xBCE5086492111AEB, -130, -20},
+        {0x8CBCCC096F5088CC, -103, -12},
+        {0xD1B71758E219652C, -77, -4},
+        {0x9C40000000000000, -50, 4},
+        {0xE8D4A51000000000, -24, 12},
+        {0xAD78EBC5AC620000, 3, 20},
+        {0x813F3978F8940984, 30, 28},
+        {0xC097CE7BC90715B3, 56, 36},
+        {0x8F7E32CE7BEA5C70, 83, 44},
+        {0xD5D238A4ABE98068, 109, 52},
+        {0x9F4F2726179A2245, 136, 60},
+        {0xED63A231D4C4FB27, 162, 68},
+        {0xB0DE65388CC8ADA8, 189, 76},
+        {0x83C7088E1AAB65DB, 216, 84},
+        {0xC45D1DF942711D9A, 242, 92},
+        {0x924D692CA61BE758, 269, 100},
+        {0xDA01EE641A708DEA, 295, 108},
+        {0xA26DA3999AEF774A, 322, 116},
+        {0xF209787BB47D6B85, 348, 124},
+        {0xB454E4A179DD1877, 375, 132},
+        {0x865B86925B9BC5C2, 402, 140},
+        {0xC83553C5C8965D3D, 428, 148},
+        {0x952AB45CFA97A0B3, 455, 156},
+        {0xDE469FBD99A05FE3, 481, 164},
+        {0xA59BC234DB398C25, 508, 172},
+        {0xF6C69A72A3989F5C, 534, 180},
+        {0xB7DCBF5354E9BECE, 561, 188},
+        {0x88FCF317F22241E2, 588, 196},
+        {0xCC20CE9BD35C78A5, 614, 204},
+        {0x98165AF37B2153DF, 641, 212},
+        {0xE2A0B5DC971F303A, 667, 220},
+        {0xA8D9D1535CE3B396, 694, 228},
+        {0xFB9B7CD9A4A7443C, 720, 236},
+        {0xBB764C4CA7A44410, 747, 244},
+        {0x8BAB8EEFB6409C1A, 774, 252},
+        {0xD01FEF10A657842C, 800, 260},
+        {0x9B10A4E5E9913129, 827, 268},
+        {0xE7109BFBA19C0C9D, 853, 276},
+        {0xAC2820D9623BF429, 880, 284},
+        {0x80444B5E7AA7CF85, 907, 292},
+        {0xBF21E44003ACDD2D, 933, 300},
+        {0x8E679C2F5E44FF8F, 960, 308},
+        {0xD433179D9C8CB841, 986, 316},
+        {0x9E19DB92B4E31BA9, 1013, 324},
+};
+
+#define CACHED_POWERS_MIN_DEC_EXP (-300)
+#define CACHED_POWERS_DEC_STEP 8
+
+// The cached power is chosen so that the binary exponent of the scaled upper boundary is in [-60, -32],
+// which lets digit generation split it into a 32 bit integral and a 64 bit fractional part
+#define GRISU_ALPHA (-60)
+
+static const char digit_pairs[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+static const uint32_t pow10_u32[] = {
+        1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+static DiyFp diyfp_make(uint64_t f, int e) {
+    DiyFp r;
+    r.f = f;
+    r.e = e;
+    return r;
+}
+
+// Upper 64 bits of the 128 bit product, rounded
+static DiyFp diyfp_mul(DiyFp x, DiyFp y) {
+    const uint64_t u_lo = x.f & 0xFFFFFFFFu;
+    const uint64_t u_hi = x.f >> 32u;
+    const uint64_t v_lo = y.f & 0xFFFFFFFFu;
+    const uint64_t v_hi = y.f >> 32u;
+
+    const uint64_t p0 = u_lo * v_lo;
+    const uint64_t p1 = u_lo * v_hi;
+    const uint64_t p2 = u_hi * v_lo;
+    const uint64_t p3 = u_hi * v_hi;
+
+    uint64_t q = (p0 >> 32u) + (p1 & 0xFFFFFFFFu) + (p2 & 0xFFFFFFFFu);
+    q += (uint64_t) 1u << 31u;
+
+    return diyfp_make(p3 + (p1 >> 32u) + (p2 >> 32u) + (q >> 32u), x.e + y.e + 64);
+}
+
+static DiyFp diyfp_normalize(DiyFp x) {
+    while (0 == (x.f >> 63u)) {
+        x.f <<= 1u;
+        x.e--;
+    }
+    return x;
+}
+
+// Computes the normalized value and its normalized rounding boundaries m- and m+, which share an exponent
+static void compute_boundaries(double value, DiyFp *w, DiyFp *m_minus, DiyFp *m_plus) {
+    const uint64_t hidden_bit = (uint64_t) 1u << 52u;
+    const int exponent_bias = 1023 + 52;
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    const uint64_t e = bits >> 52u; // sign is already removed by the caller
+    const uint64_t f = bits & (hidden_bit - 1u);
+    const DiyFp v = (0 == e) ? diyfp_make(f, 1 - exponent_bias) : diyfp_make(f + hidden_bit, (int) e - exponent_bias);
+
+    // the lower boundary is closer if the significand is a power of two, except for the smallest normal
+    const bool lower_boundary_is_closer = (0 == f && e > 1);
+    DiyFp plus = diyfp_normalize(diyfp_make((v.f << 1u) + 1u, v.e - 1));
+    DiyFp minus = lower_boundary_is_closer ? diyfp_make((v.f << 2u) - 1u, v.e - 2)
+                                           : diyfp_make((v.f << 1u) - 1u, v.e - 1);
+    minus.f <<= (unsigned) (minus.e - plus.e);
+    minus.e = plus.e;
+
+    *w = diyfp_normalize(v);
+    *m_minus = minus;
+    *m_plus = plus;
+}
+
+static CachedPower get_cached_power(int e) {
+    // k = ceil((alpha - e - 1) * log10(2)), with 78913 / 2^18 approximating log10(2)
+    const int f = GRISU_ALPHA - e - 1;
+    const int k = (f * 78913) / (1 << 18) + (f > 0);
+    const int index = (-CACHED_POWERS_MIN_DEC_EXP + k + (CACHED_POWERS_DEC_STEP - 1)) / CACHED_POWERS_DEC_STEP;
+    return cached_powers[index];
+}
+
+// Returns the number of decimal digits of n and the largest power of ten not greater than n
+static int find_largest_pow10(uint32_t n, uint32_t *pow10) {
+    int digits = 10;
+    while (digits > 1 && n < pow10_u32[digits - 1]) {
+        digits--;
+    }
+    *pow10 = pow10_u32[digits - 1];
+    return digits;
+}
+
+// Moves the last digit towards w while staying within the rounding interval
+static void grisu2_round(char *buffer, int length, uint64_t dist, uint64_t delta, uint64_t rest, uint64_t ten_k) {
+    while (rest < dist && delta - rest >= ten_k && (rest + ten_k < dist || dist - rest > rest + ten_k - dist)) {
+        buffer[length - 1]--;
+        rest += ten_k;
+    }
+}
+
+// Generates digits of M+ until the remainder falls inside the rounding interval [M-, M+]
+static int grisu2_digit_gen(char *buffer, int *decimal_exponent, DiyFp m_minus, DiyFp w, DiyFp m_plus) {
+    uint64_t delta = m_plus.f - m_minus.f;
+    uint64_t dist = m_plus.f - w.f;
+    const unsigned shift = (unsigned) -m_plus.e;
+    const uint64_t one = (uint64_t) 1u << shift;
+
+    uint32_t p1 = (uint32_t) (m_plus.f >> shift); // integral part
+    uint64_t p2 = m_plus.f & (one - 1u); // fractional part
+    int length = 0;
+
+    uint32_t pow10;
+    int n = find_largest_pow10(p1, &pow10);
+    while (n > 0) {
+        const uint32_t d = p1 / pow10;
+        p1 %= pow10;
+        buffer[length++] = (char) ('0' + d);
+        n--;
+        const uint64_t rest = ((uint64_t) p1 << shift) + p2;
+        if (rest <= delta) {
+            *decimal_exponent += n;
+            grisu2_round(buffer, length, dist, delta, rest, (uint64_t) pow10 << shift);
+            return length;
+        }
+        pow10 /= 10;
+    }
+
+    int m = 0;
+    for (;;) {
+        p2 *= 10;
+        const uint64_t d = p2 >> shift;
+        p2 &= one - 1u;
+        buffer[length++] = (char) ('0' + d);
+        m++;
+        delta *= 10;
+        dist *= 10;
+        if (p2 <= delta) {
+            break;
+        }
+    }
+    *decimal_exponent -= m;
+    grisu2_round(buffer, length, dist, delta, p2, one);
+    return length;
+}
+
+// Writes the digits of a positive finite value. The value is digits * 10^decimal_exponent.
+static int grisu2(char *buffer, int *decimal_exponent, double value) {
+    DiyFp w, m_minus, m_plus;
+    compute_boundaries(value, &w, &m_minus, &m_plus);
+
+    const CachedPower cached = get_cached_power(m_plus.e);
+    const DiyFp c_minus_k = diyfp_make(cached.f, cached.e);
+    const DiyFp w_scaled = diyfp_mul(w, c_minus_k);
+    const DiyFp w_minus = diyfp_mul(m_minus, c_minus_k);
+    const DiyFp w_plus = diyfp_mul(m_plus, c_minus_k);
+
+    // the products are off by at most one ulp, so shrink the interval to be safe
+    const DiyFp lower = diyfp_make(w_minus.f + 1u, w_minus.e);
+    const DiyFp upper = diyfp_make(w_plus.f - 1u, w_plus.e);
+
+    *decimal_exponent = -cached.k;
+    return grisu2_digit_gen(buffer, decimal_exponent, lower, w_scaled, upper);
+}
+
+static size_t write_exponent(char *buffer, int e) {
+    char *p = buffer;
+    if (e < 0) {
+        e = -e;
+        *p++ = '-';
+    } else {
+        *p++ = '+';
+    }
+    if (e >= 100) {
+        *p++ = (char) ('0' + e / 100);
+        e %= 100;
+        memcpy(p, &digit_pairs[e * 2], 2);
+        p += 2;
+    } else if (e >= 10) {
+        memcpy(p, &digit_pairs[e * 2], 2);
+        p += 2;
+    } else {
+        *p++ = (char) ('0' + e);
+    }
+    return (size_t) (p - buffer);
+}
+
+// Places the decimal point. Fixed notation is used for exponents that %.15g would also print in fixed notation.
+static size_t format_digits(char *buffer, int length, int decimal_exponent) {
+    const int k = length;
+    const int n = length + decimal_exponent; // position of the decimal point relative to the first digit
+
+    if (k <= n && n <= 15) {
+        // digits[000]
+        memset(buffer + k, '0', (size_t) (n - k));
+        return (size_t) n;
+    }
+    if (0 < n && n <= 15) {
+        // dig.its
+        memmove(buffer + n + 1, buffer + n, (size_t) (k - n));
+        buffer[n] = '.';
+        return (size_t) k + 1;
+    }
+    if (-4 < n && n <= 0) {
+        // 0.[000]digits
+        memmove(buffer + 2 - n, buffer, (size_t) k);
+        buffer[0] = '0';
+        buffer[1] = '.';
+        memset(buffer + 2, '0', (size_t) -n);
+        return (size_t) (2 - n + k);
+    }
+
+    size_t len;
+    if (1 == k) {
+        // de+123
+        len = 1;
+    } else {
+        // d.igitse+123
+        memmove(buffer + 2, buffer + 1, (size_t) k - 1);
+        buffer[1] = '.';
+        len = (size_t) k + 1;
+    }
+    buffer[len++] = 'e';
+    return len + write_exponent(buffer + len, n - 1);
+}
+
+static size_t write_u64(char *buffer, uint64_t value) {
+    char tmp[20];
+    char *p = tmp + sizeof(tmp);
+    while (value >= 100) {
+        p -= 2;
+        memcpy(p, &digit_pairs[(value % 100) * 2], 2);
+        value /= 100;
+    }
+    if (value >= 10) {
+        p -= 2;
+        memcpy(p, &digit_pairs[value * 2], 2);
+    } else {
+        *--p = (char) ('0' + value);
+    }
+    size_t len = (size_t) (tmp + sizeof(tmp) - p);
+    memcpy(buffer, p, len);
+    return len;
+}
+
+// Handles the sign, non-finite values and the integer fast path. Returns 0 if the value needs full formatting.
+static size_t format_special(double value, char *buffer, bool *is_negative, double *magnitude) {
+    if (value != value || value - value != 0) { // NaN or infinity
+        memcpy(buffer, "null", 4);
+        return 4;
+    }
+    *is_negative = value < 0;
+    *magnitude = *is_negative ? -value : value;
+    if (*magnitude < 9007199254740992.0 && *magnitude == (double) (uint64_t) *magnitude) { // below 2^53
+        uint64_t i = (uint64_t) *magnitude;
+        size_t len = 0;
+        if (*is_negative && 0 != i) {
+            buffer[len++] = '-';
+        }
+        return len + write_u64(buffer + len, i);
+    }
+    return 0;
+}
+
+size_t iotc_dtoa(double value, char *buffer) {
+    bool is_negative;
+    double magnitude;
+    size_t len = format_special(value, buffer, &is_negative, &magnitude);
+    if (len) {
+        return len;
+    }
+    if (is_negative) {
+        *buffer++ = '-';
+        len++;
+    }
+    int decimal_exponent;
+    int length = grisu2(buffer, &decimal_exponent, magnitude);
+    return len + format_digits(buffer, length, decimal_exponent);
+}
+
+size_t iotc_dtoa_fixed(double value, int precision, char *buffer) {
+    static const double scale[IOTC_DTOA_MAX_PRECISION + 1] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+    };
+    if (precision < 0 || precision > IOTC_DTOA_MAX_PRECISION) {
+        return iotc_dtoa(value, buffer);
+    }
+    if (value != value || value - value != 0) {
+        return iotc_dtoa(value, buffer); // will print null
+    }
+    const bool is_negative = value < 0;
+    const double scaled = (is_negative ? -value : value) * scale[precision];
+    if (scaled >= 9007199254740992.0) {
+        return iotc_dtoa(value, buffer); // integer part alone would not be exact
+    }
+
+    const uint64_t rounded = (uint64_t) (scaled + 0.5);
+    const uint64_t divisor = pow10_u32[precision];
+    size_t len = 0;
+    if (is_negative && 0 != rounded) {
+        buffer[len++] = '-';
+    }
+    len += write_u64(buffer + len, rounded / divisor);
+    if (precision > 0) {
+        char *p = buffer + len + 1 + precision;
+        uint64_t fraction = rounded % divisor;
+        for (int i = 0; i < precision; i++) {
+            *--p = (char) ('0' + fraction % 10);
+            fraction /= 10;
+        }
+        buffer[len] = '.';
+        len += 1 + (size_t) precision;
+    }
+    return len;
+}
@@ -0,0 +1,325 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#if !defined(_WIN32) && !defined(_WIN64) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L // getaddrinfo()
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32) || defined(_WIN64)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET RaceSocket;
+#define INVALID_RACE_SOCKET INVALID_SOCKET
+#define close_socket closesocket
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+typedef int RaceSocket;
+#define INVALID_RACE_SOCKET (-1)
+#define close_socket close
+#endif
+#include "iotcl.h"
+#include "iotc_log.h"
+#include "iotc_clock.h"
+#include "iotc_endpoint_race.h"
+
+#define MAX_ATTEMPTS (IOTC_ENDPOINT_RACE_MAX_ENDPOINTS * IOTC_DNS_CACHE_MAX_ADDRESSES)
+
+typedef struct {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    size_t endpoint; // index of the endpoint that the address belongs to
+    RaceSocket sock; // INVALID_RACE_SOCKET if not started or finished
+} RaceAttempt;
+
+void iotc_endpoint_race_init_config(IotConnectEndpointConfig *c) {
+    memset(c, 0, sizeof(IotConnectEndpointConfig));
+    c->attempt_delay_ms = IOTC_ENDPOINT_RACE_DEFAULT_ATTEMPT_DELAY_MS;
+    c->timeout_ms = IOTC_ENDPOINT_RACE_DEFAULT_TIMEOUT_MS;
+}
+
+int iotc_endpoint_parse(const char *str, unsigned int default_port, IotConnectEndpoint *endpoint) {
+    const char *host = str;
+    size_t host_len;
+    const char *port = NULL;
+    memset(endpoint, 0, sizeof(IotConnectEndpoint));
+    if (!str || !*str) {
+        return IOTCL_ERR_MISSING_VALUE;
+    }
+    if ('[' == str[0]) {
+        const char *end = strchr(str, ']');
+        if (!end || (end[1] && ':' != end[1])) {
+            IOTC_ERROR("Invalid endpoint %s", str);
+            return IOTCL_ERR_BAD_VALUE;
+        }
+        host = str + 1;
+        host_len = (size_t) (end - host);
+        port = end[1] ? &end[2] : NULL;
+    } else {
+        const char *colon = strchr(str, ':');
+        if (colon && !strchr(colon + 1, ':')) {
+            host_len = (size_t) (colon - str);
+            port = colon + 1;
+        } else {
+            host_len = strlen(str); // no port, or an IPv6 address without brackets
+        }
+    }
+    if (0 == host_len || host_len >= sizeof(endpoint->host)) {
+        IOTC_ERROR("Invalid endpoint host in %s", str);
+        return IOTCL_ERR_BAD_VALUE;
+    }
+    memcpy(endpoint->host, host, host_len);
+    endpoint->host[host_len] = 0;
+    endpoint->port = default_port;
+    if (port) {
+        char *port_end = NULL;
+        unsigned long value = strtoul(port, &port_end, 10);
+        if (port_end == port || *port_end || 0 == value || value > 65535) {
+            IOTC_ERROR("Invalid endpoint port in %s", str);
+            return IOTCL_ERR_BAD_VALUE;
+        }
+        endpoint->port = (unsigned int) value;
+    }
+    return IOTCL_SUCCESS;
+}
+
+static bool add_attempt(RaceAttempt *attempts, size_t *count, const struct addrinfo *ai, size_t endpoint) {
+    if (*count >= MAX_ATTEMPTS || ai->ai_addrlen > sizeof(attempts[0].addr)) {
+        return false;
+    }
+    RaceAttempt *a = &attempts[(*count)++];
+    memset(a, 0, sizeof(RaceAttempt));
+    memcpy(&a->addr, ai->ai_addr, ai->ai_addrlen);
+    a->addr_len = (socklen_t) ai->ai_addrlen;
+    a->endpoint = endpoint;
+    a->sock = INVALID_RACE_SOCKET;
+    return true;
+}
+
+// Adds the addresses of the endpoint with IPv6 and IPv4 interleaved, starting with the family that the
+// resolver listed first. Lookups that are not cached yet are cached for the MQTT client's own lookup.
+static void add_endpoint_attempts(const IotConnectEndpoint *e, size_t index, RaceAttempt *attempts, size_t *count) {
+    IotConnectDnsAddress addresses[IOTC_DNS_CACHE_MAX_ADDRESSES];
+    struct addrinfo *results[IOTC_DNS_CACHE_MAX_ADDRESSES] = {0};
+    struct addrinfo hints;
+    char port[8];
+    snprintf(port, sizeof(port), "%u", e->port);
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    size_t address_count = iotc_dns_cache_get(e->host, addresses, IOTC_DNS_CACHE_MAX_ADDRESSES, false);
+    size_t result_count = 0;
+    if (address_count) {
+        hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+        for (size_t i = 0; i < address_count; i++) {
+            if (0 == getaddrinfo(addresses[i], port, &hints, &results[result_count])) {
+                result_count++;
+            }
+        }
+    } else {
+        struct addrinfo *list = NULL;
+        hints.ai_flags = AI_NUMERICSERV;
+        int status = getaddrinfo(e->host, port, &hints, &list);
+        if (0 != status) {
+            IOTC_WARN("Endpoint race: Unable to resolve %s: %s", e->host, gai_strerror(status));
+            return;
+        }
+        // Split the list, so that every entry can be freed the same way as the ones above
+        while (list && result_count < IOTC_DNS_CACHE_MAX_ADDRESSES) {
+            struct addrinfo *next = list->ai_next;
+            list->ai_next = NULL;
+            if (0 == getnameinfo(list->ai_addr, (socklen_t) list->ai_addrlen, addresses[result_count],
+                                 sizeof(addresses[0]), NULL, 0, NI_NUMERICHOST)) {
+                results[result_count++] = list;
+            } else {
+                freeaddrinfo(list);
+            }
+            list = next;
+        }
+        if (list) {
+            freeaddrinfo(list);
+        }
+        if (result_count) {
+            iotc_dns_cache_put(e->host, (const IotConnectDnsAddress *) addresses, result_count);
+        }
+    }
+
+    bool is_taken[IOTC_DNS_CACHE_MAX_ADDRESSES] = {false};
+    int family = result_count ? results[0]->ai_family : AF_UNSPEC;
+    for (size_t added = 0; added < result_count; added++) {
+        size_t pick = result_count;
+        for (size_t i = 0; i < result_count; i++) {
+            if (!is_taken[i] && results[i]->ai_family == family) {
+                pick = i;
+                break;
+            }
+        }
+        if (pick == result_count) { // no address of this family left
+            for (pick = 0; is_taken[pick]; pick++) {
+            }
+        }
+        is_taken[pick] = true;
+        add_attempt(attempts, count, results[pick], index);
+        family = (AF_INET6 == results[pick]->ai_family) ? AF_INET : AF_INET6;
+    }
+    for (size_t i = 0; i < result_count; i++) {
+        freeaddrinfo(results[i]);
+    }
+}
+
+static bool start_attempt(RaceAttempt *a) {
+    a->sock = socket(a->addr.ss_family, SOCK_STREAM, 0);
+    if (INVALID_RACE_SOCKET == a->sock) {
+        return false;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    u_long non_blocking = 1;
+    bool is_set = (0 == ioctlsocket(a->sock, FIONBIO, &non_blocking));
+#else
+    int flags = fcntl(a->sock, F_GETFL, 0);
+    bool is_set = (flags >= 0 && 0 == fcntl(a->sock, F_SETFL, flags | O_NONBLOCK)) && a->sock < FD_SETSIZE;
+#endif
+    if (is_set && 0 == connect(a->sock, (struct sockaddr *) &a->addr, a->addr_len)) {
+        return true; // connected right away, which can happen with local addresses
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    bool is_pending = is_set && WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    bool is_pending = is_set && errno == EINPROGRESS;
+#endif
+    if (!is_pending) {
+        close_socket(a->sock);
+        a->sock = INVALID_RACE_SOCKET;
+        return false;
+    }
+    return true;
+}
+
+static bool is_connected(const RaceAttempt *a) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (0 != getsockopt(a->sock, SOL_SOCKET, SO_ERROR, (char *) &error, &len)) {
+        return false;
+    }
+    return 0 == error;
+}
+
+static void finish_attempt(RaceAttempt *a) {
+    close_socket(a->sock);
+    a->sock = INVALID_RACE_SOCKET;
+}
+
+// Returns the index of the attempt that connected first, or -1
+static int run_race(RaceAttempt *attempts, size_t count, const IotConnectEndpointConfig *c, uint64_t *connect_us) {
+    uint64_t start_us = iotc_clock_now_us();
+    uint64_t deadline_us = start_us + (uint64_t) c->timeout_ms * 1000;
+    uint64_t next_start_us = start_us;
+    size_t started = 0;
+    size_t active = 0;
+    int winner = -1;
+
+    while (winner < 0) {
+        uint64_t now_us = iotc_clock_now_us();
+        if (now_us >= deadline_us) {
+            break;
+        }
+        // The next attempt starts when its delay is up, or right away if all running attempts have failed
+        while (started < count && (now_us >= next_start_us || 0 == active)) {
+            if (start_attempt(&attempts[started])) {
+                active++;
+                next_start_us = now_us + (uint64_t) c->attempt_delay_ms * 1000;
+            }
+            started++;
+        }
+        if (0 == active) {
+            break; // every address failed
+        }
+
+        fd_set write_fds;
+        fd_set except_fds; // Windows reports failed connects here
+        FD_ZERO(&write_fds);
+        FD_ZERO(&except_fds);
+        RaceSocket max_sock = 0;
+        for (size_t i = 0; i < started; i++) {
+            if (INVALID_RACE_SOCKET != attempts[i].sock) {
+                FD_SET(attempts[i].sock, &write_fds);
+                FD_SET(attempts[i].sock, &except_fds);
+                if (attempts[i].sock > max_sock) {
+                    max_sock = attempts[i].sock;
+                }
+            }
+        }
+        uint64_t wait_until_us = (started < count && next_start_us < deadline_us) ? next_start_us : deadline_us;
+        uint64_t wait_us = wait_until_us > now_us ? wait_until_us - now_us : 0;
+        struct timeval tv;
+        tv.tv_sec = (long) (wait_us / 1000000);
+        tv.tv_usec = (long) (wait_us % 1000000);
+        int ready = select((int) max_sock + 1, NULL, &write_fds, &except_fds, &tv);
+        if (ready < 0) {
+            break;
+        }
+        for (size_t i = 0; i < started && ready > 0; i++) {
+            RaceAttempt *a = &attempts[i];
+            if (INVALID_RACE_SOCKET == a->sock || (!FD_ISSET(a->sock, &write_fds) && !FD_ISSET(a->sock, &except_fds))) {
+                continue;
+            }
+            if (winner < 0 && is_connected(a)) {
+                winner = (int) i;
+                *connect_us = iotc_clock_now_us() - start_us;
+            }
+            finish_attempt(a);
+            active--;
+        }
+    }
+
+    for (size_t i = 0; i < started; i++) {
+        if (INVALID_RACE_SOCKET != attempts[i].sock) {
+            finish_attempt(&attempts[i]);
+        }
+    }
+    return winner;
+}
+
+bool iotc_endpoint_race(IotConnectEndpoint *endpoints, size_t count, const IotConnectEndpointConfig *c) {
+    if (count < 2 || !c->timeout_ms) {
+        return false;
+    }
+    RaceAttempt *attempts = malloc(MAX_ATTEMPTS * sizeof(RaceAttempt));
+    if (!attempts) {
+        IOTC_ERROR("Endpoint race: Out of memory!");
+        return false;
+    }
+    size_t attempt_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        add_endpoint_attempts(&endpoints[i], i, attempts, &attempt_count);
+    }
+
+    uint64_t connect_us = 0;
+    int winner = run_race(attempts, attempt_count, c, &connect_us);
+    if (winner < 0) {
+        IOTC_WARN("Endpoint race: None of the endpoints answered.");
+        free(attempts);
+        return false;
+    }
+
+    size_t index = attempts[winner].endpoint;
+    free(attempts);
+    IotConnectEndpoint first = endpoints[index];
+    first.connect_us = connect_us ? (unsigned long) connect_us : 1;
+    memmove(&endpoints[1], &endpoints[0], index * sizeof(IotConnectEndpoint));
+    endpoints[0] = first;
+    IOTC_INFO("Endpoint race: %s port %u answered first in %lu ms.", first.host, first.port,
+              (unsigned long) ((connect_us + 500) / 1000));
+    return true;
+}
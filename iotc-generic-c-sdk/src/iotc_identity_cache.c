@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "iotcl.h"
+#include "iotc_log.h"
+#include "iotc_identity_cache.h"
+
+#define IDENTITY_TMP_SUFFIX ".tmp"
+
+// An identity response is a few KB. Anything much larger is not one.
+#ifndef IOTC_IDENTITY_CACHE_MAX_SIZE
+#define IOTC_IDENTITY_CACHE_MAX_SIZE 65536L
+#endif
+
+char *iotc_identity_cache_load(const char *path) {
+    char *data = NULL;
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL; // nothing cached yet
+    }
+    if (0 != fseek(f, 0, SEEK_END)) {
+        goto cleanup;
+    }
+    long size = ftell(f);
+    if (size <= 0 || size > IOTC_IDENTITY_CACHE_MAX_SIZE || 0 != fseek(f, 0, SEEK_SET)) {
+        IOTC_WARN("Identity cache: Ignoring %s", path);
+        goto cleanup;
+    }
+    data = malloc((size_t) size + 1);
+    if (!data) {
+        IOTC_ERROR("Identity cache: Out of memory!");
+        goto cleanup;
+    }
+    if (fread(data, 1, (size_t) size, f) != (size_t) size) {
+        IOTC_WARN("Identity cache: Unable to read %s", path);
+        free(data);
+        data = NULL;
+        goto cleanup;
+    }
+    data[size] = 0;
+
+    cleanup:
+    fclose(f);
+    return data;
+}
+
+int iotc_identity_cache_save(const char *path, const char *identity_response) {
+    size_t path_len = strlen(path);
+    char *tmp_path = malloc(path_len + sizeof(IDENTITY_TMP_SUFFIX));
+    if (!tmp_path) {
+        IOTC_ERROR("Identity cache: Out of memory!");
+        return IOTCL_ERR_OUT_OF_MEMORY;
+    }
+    memcpy(tmp_path, path, path_len);
+    memcpy(&tmp_path[path_len], IDENTITY_TMP_SUFFIX, sizeof(IDENTITY_TMP_SUFFIX));
+
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        IOTC_WARN("Identity cache: Unable to write %s", tmp_path);
+        free(tmp_path);
+        return IOTCL_ERR_FAILED;
+    }
+    size_t len = strlen(identity_response);
+    bool is_written = (fwrite(identity_response, 1, len, f) == len);
+    if (0 != fclose(f)) {
+        is_written = false;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    remove(path); // rename() does not replace files on Windows
+#endif
+    if (!is_written || 0 != rename(tmp_path, path)) {
+        IOTC_WARN("Identity cache: Unable to save %s", path);
+        remove(tmp_path);
+        free(tmp_path);
+        return IOTCL_ERR_FAILED;
+    }
+    free(tmp_path);
+    return IOTCL_SUCCESS;
+}
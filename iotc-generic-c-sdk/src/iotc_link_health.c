@@ -0,0 +1,155 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <string.h>
+#include "iotc_thread.h"
+#include "iotc_link_health.h"
+
+// Off by default. A value like 4 detects a dead link within a few RTTs on a stable link.
+#ifndef IOTC_LINK_HEALTH_DEAD_RTT_MULTIPLE
+#define IOTC_LINK_HEALTH_DEAD_RTT_MULTIPLE 0
+#endif
+
+#ifndef IOTC_LINK_HEALTH_DEAD_AFTER_MISSES
+#define IOTC_LINK_HEALTH_DEAD_AFTER_MISSES 3
+#endif
+
+#ifndef IOTC_LINK_HEALTH_MIN_ACK_TIMEOUT_MS
+#define IOTC_LINK_HEALTH_MIN_ACK_TIMEOUT_MS 1000L
+#endif
+
+// MQTT_PUBLISH_TIMEOUT_MS used to be the fixed publish timeout. Honor it if the user has overridden it.
+#ifndef IOTC_LINK_HEALTH_MAX_ACK_TIMEOUT_MS
+#ifdef MQTT_PUBLISH_TIMEOUT_MS
+#define IOTC_LINK_HEALTH_MAX_ACK_TIMEOUT_MS MQTT_PUBLISH_TIMEOUT_MS
+#else
+#define IOTC_LINK_HEALTH_MAX_ACK_TIMEOUT_MS 10000L
+#endif
+#endif
+
+static IotConnectLinkHealthConfig config = {
+        0,
+        IOTC_LINK_HEALTH_DEAD_RTT_MULTIPLE,
+        IOTC_LINK_HEALTH_DEAD_AFTER_MISSES,
+        IOTC_LINK_HEALTH_MIN_ACK_TIMEOUT_MS,
+        IOTC_LINK_HEALTH_MAX_ACK_TIMEOUT_MS
+};
+static IotConnectLinkHealthStats stats = {0};
+
+// Samples and timeouts come from the MQTT client callback and publishing threads, while stats can be read from any
+static IotcOnce lock_once = IOTC_ONCE_INIT;
+static IotcMutex lock;
+
+static void lock_init(void) {
+    iotc_mutex_init(&lock);
+}
+
+static void stats_lock(void) {
+    iotc_once(&lock_once, lock_init);
+    iotc_mutex_lock(&lock);
+}
+
+static unsigned long compute_ack_timeout_ms(void) {
+    if (0 == stats.samples || 0 == config.dead_rtt_multiple) {
+        return config.max_ack_timeout_ms;
+    }
+    // RFC 6298 retransmission timeout, scaled by the number of RTTs we are willing to wait
+    unsigned long rto_us = stats.srtt_us + 4 * stats.rttvar_us;
+    unsigned long timeout_ms = (rto_us / 1000 + 1) * config.dead_rtt_multiple;
+    if (timeout_ms < config.min_ack_timeout_ms) {
+        timeout_ms = config.min_ack_timeout_ms;
+    }
+    if (timeout_ms > config.max_ack_timeout_ms) {
+        timeout_ms = config.max_ack_timeout_ms;
+    }
+    return timeout_ms;
+}
+
+void iotc_link_health_init_config(IotConnectLinkHealthConfig *c) {
+    memset(c, 0, sizeof(IotConnectLinkHealthConfig));
+    c->dead_rtt_multiple = IOTC_LINK_HEALTH_DEAD_RTT_MULTIPLE;
+    c->dead_after_misses = IOTC_LINK_HEALTH_DEAD_AFTER_MISSES;
+    c->min_ack_timeout_ms = IOTC_LINK_HEALTH_MIN_ACK_TIMEOUT_MS;
+    c->max_ack_timeout_ms = IOTC_LINK_HEALTH_MAX_ACK_TIMEOUT_MS;
+}
+
+void iotc_link_health_reset(const IotConnectLinkHealthConfig *c) {
+    stats_lock();
+    if (c) {
+        config = *c;
+    }
+    if (0 == config.max_ack_timeout_ms) {
+        config.max_ack_timeout_ms = IOTC_LINK_HEALTH_MAX_ACK_TIMEOUT_MS;
+    }
+    if (config.min_ack_timeout_ms > config.max_ack_timeout_ms) {
+        config.min_ack_timeout_ms = config.max_ack_timeout_ms;
+    }
+    if (0 == config.dead_after_misses) {
+        config.dead_after_misses = 1;
+    }
+    memset(&stats, 0, sizeof(stats));
+    stats.ack_timeout_ms = compute_ack_timeout_ms();
+    iotc_mutex_unlock(&lock);
+}
+
+void iotc_link_health_on_rtt_sample(unsigned long rtt_us) {
+    stats_lock();
+    if (0 == stats.samples) {
+        stats.srtt_us = rtt_us;
+        stats.rttvar_us = rtt_us / 2;
+        stats.min_rtt_us = rtt_us;
+        stats.max_rtt_us = rtt_us;
+    } else {
+        // rttvar = 3/4 rttvar + 1/4 |srtt - rtt|, srtt = 7/8 srtt + 1/8 rtt
+        unsigned long delta = stats.srtt_us > rtt_us ? stats.srtt_us - rtt_us : rtt_us - stats.srtt_us;
+        stats.rttvar_us = stats.rttvar_us - stats.rttvar_us / 4 + delta / 4;
+        stats.srtt_us = stats.srtt_us - stats.srtt_us / 8 + rtt_us / 8;
+        if (rtt_us < stats.min_rtt_us) {
+            stats.min_rtt_us = rtt_us;
+        }
+        if (rtt_us > stats.max_rtt_us) {
+            stats.max_rtt_us = rtt_us;
+        }
+    }
+    stats.last_rtt_us = rtt_us;
+    stats.samples++;
+    stats.consecutive_timeouts = 0;
+    stats.is_dead = false;
+    stats.ack_timeout_ms = compute_ack_timeout_ms();
+    iotc_mutex_unlock(&lock);
+}
+
+static unsigned long get_ack_timeout_ms_locked(void) {
+    return stats.ack_timeout_ms ? stats.ack_timeout_ms : compute_ack_timeout_ms();
+}
+
+unsigned long iotc_link_health_get_ack_timeout_ms(void) {
+    stats_lock();
+    unsigned long timeout_ms = get_ack_timeout_ms_locked();
+    iotc_mutex_unlock(&lock);
+    return timeout_ms;
+}
+
+bool iotc_link_health_on_ack_timeout(void) {
+    stats_lock();
+    stats.timeouts++;
+    stats.consecutive_timeouts++;
+    // Before we have a sample, the timeout is the plain upper bound and tells us nothing about the RTT.
+    // Treat it the same way, as the publish is already as late as we are ever willing to wait for it.
+    // One late ack can be a broker hiccup, so only a run of them declares the link dead.
+    if (config.dead_rtt_multiple > 0 && stats.consecutive_timeouts >= config.dead_after_misses) {
+        stats.is_dead = true;
+    }
+    bool is_dead = stats.is_dead;
+    iotc_mutex_unlock(&lock);
+    return is_dead;
+}
+
+void iotc_link_health_get_stats(IotConnectLinkHealthStats *s) {
+    stats_lock();
+    *s = stats;
+    s->ack_timeout_ms = get_ack_timeout_ms_locked();
+    iotc_mutex_unlock(&lock);
+}
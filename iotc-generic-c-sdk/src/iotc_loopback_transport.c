@@ -0,0 +1,191 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <string.h>
+#include "iotcl.h"
+#include "iotc_log.h"
+#include "iotc_thread.h"
+#include "iotc_loopback_transport.h"
+
+static IotConnectC2dCallback c2d_msg_cb = NULL;
+static IotConnectMqttStatusCallback status_cb = NULL;
+static IotConnectLoopbackPublishCallback publish_cb = NULL;
+static volatile bool is_connected = false;
+static unsigned int connects_to_fail = 0;
+static unsigned int publishes_to_fail = 0;
+static IotConnectLoopbackStats stats;
+
+// Initialized on first use, as the transport has no init call of its own.
+// The test helpers below can be the first call and may come from any thread, so this goes through iotc_once().
+static IotcOnce lock_once = IOTC_ONCE_INIT;
+static IotcMutex lock;
+
+static void create_lock(void) {
+    iotc_mutex_init(&lock);
+}
+
+static void lock_init(void) {
+    iotc_once(&lock_once, create_lock);
+}
+
+static int loopback_connect(IotConnectDeviceClientConfig *c) {
+    lock_init();
+    iotc_mutex_lock(&lock);
+    if (connects_to_fail > 0) {
+        connects_to_fail--;
+        iotc_mutex_unlock(&lock);
+        IOTC_ERROR("Loopback: Injected connect failure");
+        return IOTCL_ERR_FAILED;
+    }
+    c2d_msg_cb = c->c2d_msg_cb;
+    status_cb = c->status_cb;
+    is_connected = true;
+    stats.connects++;
+    iotc_mutex_unlock(&lock);
+
+    if (status_cb) {
+        status_cb(IOTC_CS_MQTT_CONNECTED);
+    }
+    return 0;
+}
+
+static void close_connection(void) {
+    iotc_mutex_lock(&lock);
+    if (!is_connected) {
+        iotc_mutex_unlock(&lock);
+        return;
+    }
+    is_connected = false;
+    stats.disconnects++;
+    IotConnectMqttStatusCallback cb = status_cb;
+    iotc_mutex_unlock(&lock);
+
+    if (cb) {
+        cb(IOTC_CS_MQTT_DISCONNECTED);
+    }
+}
+
+static int loopback_disconnect(void) {
+    lock_init();
+    close_connection();
+    iotc_mutex_lock(&lock);
+    c2d_msg_cb = NULL;
+    status_cb = NULL;
+    iotc_mutex_unlock(&lock);
+    return 0;
+}
+
+static int loopback_renew_credentials(void) {
+    if (!is_connected) {
+        IOTC_ERROR("Loopback: Cannot renew credentials while not connected");
+        return IOTCL_ERR_FAILED;
+    }
+    return 0;
+}
+
+static bool loopback_is_connected(void) {
+    return is_connected;
+}
+
+static int loopback_send_message_qos(const char *topic, const char *message, int qos) {
+    lock_init();
+    iotc_mutex_lock(&lock);
+    if (!is_connected) {
+        iotc_mutex_unlock(&lock);
+        IOTC_ERROR("Loopback: Cannot publish while not connected");
+        return IOTCL_ERR_FAILED;
+    }
+    IotConnectMqttStatusCallback cb = status_cb;
+    if (publishes_to_fail > 0) {
+        publishes_to_fail--;
+        stats.publish_failures++;
+        iotc_mutex_unlock(&lock);
+        if (cb) {
+            cb(IOTC_CS_MQTT_SEND_FAILED);
+        }
+        return IOTCL_ERR_FAILED;
+    }
+    stats.publishes++;
+    stats.publish_bytes += strlen(message);
+    if (publish_cb) {
+        publish_cb(topic, message, qos);
+    }
+    iotc_mutex_unlock(&lock);
+
+    if (cb) {
+        cb(IOTC_CS_MQTT_DELIVERED);
+    }
+    return 0;
+}
+
+static const IotConnectTransport loopback_transport = {
+        "loopback",
+        loopback_connect,
+        loopback_disconnect,
+        loopback_renew_credentials,
+        loopback_is_connected,
+        loopback_send_message_qos,
+        NULL
+};
+
+const IotConnectTransport *iotc_loopback_transport(void) {
+    return &loopback_transport;
+}
+
+void iotc_loopback_set_publish_cb(IotConnectLoopbackPublishCallback cb) {
+    lock_init();
+    iotc_mutex_lock(&lock);
+    publish_cb = cb;
+    iotc_mutex_unlock(&lock);
+}
+
+int iotc_loopback_inject_c2d(const unsigned char *message, size_t message_len) {
+    lock_init();
+    iotc_mutex_lock(&lock);
+    IotConnectC2dCallback cb = is_connected ? c2d_msg_cb : NULL;
+    if (cb) {
+        stats.c2d_messages++;
+    }
+    iotc_mutex_unlock(&lock);
+
+    if (!cb) {
+        return IOTCL_ERR_FAILED;
+    }
+    cb(message, message_len);
+    return 0;
+}
+
+void iotc_loopback_fail_next_connects(unsigned int count) {
+    lock_init();
+    iotc_mutex_lock(&lock);
+    connects_to_fail = count;
+    iotc_mutex_unlock(&lock);
+}
+
+void iotc_loopback_fail_next_publishes(unsigned int count) {
+    lock_init();
+    iotc_mutex_lock(&lock);
+    publishes_to_fail = count;
+    iotc_mutex_unlock(&lock);
+}
+
+void iotc_loopback_drop_connection(void) {
+    lock_init();
+    close_connection();
+}
+
+void iotc_loopback_get_stats(IotConnectLoopbackStats *s) {
+    lock_init();
+    iotc_mutex_lock(&lock);
+    *s = stats;
+    iotc_mutex_unlock(&lock);
+}
+
+void iotc_loopback_reset_stats(void) {
+    lock_init();
+    iotc_mutex_lock(&lock);
+    memset(&stats, 0, sizeof(stats));
+    iotc_mutex_unlock(&lock);
+}
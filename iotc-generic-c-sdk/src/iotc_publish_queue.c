@@ -0,0 +1,358 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "iotcl.h"
+#include "iotc_log.h"
+#include "iotc_thread.h"
+#include "iotc_clock.h"
+#include "iotc_device_client.h"
+#include "iotc_publish_queue.h"
+
+// Intrusive MPSC queue node. Topic and message are stored in the same allocation, right after the node.
+typedef struct PublishNode {
+    struct PublishNode *next;
+    int qos;
+    size_t size; // of topic and message, for the watermarks
+    char *topic;
+    char *message;
+} PublishNode;
+
+// Producers swap themselves into head. The publisher thread is the only one that touches tail.
+static PublishNode *head = NULL;
+static PublishNode *tail = NULL;
+static PublishNode stub;
+
+static volatile long pending = 0; // pushed but not yet processed. Drives publisher thread wakeups.
+static volatile long pushed = 0;
+static volatile long processed = 0;
+static volatile long published = 0;
+static volatile long failed = 0;
+static volatile long flush_waiters = 0;
+static volatile long pending_bytes = 0;
+static volatile long would_block = 0;
+// Set by a producer that found the queue at the high watermark and cleared by the publisher at the low one,
+// both with the lock held. Producers read it without the lock.
+static volatile long is_blocked = 0;
+
+static IotConnectPublishQueueConfig config = {0};
+
+// Read with read-modify-write operations where it gates producers, so that it is ordered against the producer count
+static volatile long is_running = 0;
+// Threads inside push, is_writable or flush. Stop keeps the lock and conditions alive until this drops to zero.
+static volatile long producers = 0;
+static bool is_stop_requested = false;
+static IotcThread publisher_thread;
+static IotcMutex lock;
+static IotcCond wake_cond; // signaled when the queue goes from empty to non-empty, or on stop
+static IotcCond processed_cond; // signaled after each message while someone is flushing
+
+static void push_node(PublishNode *n) {
+    IOTC_ATOMIC_STORE_PTR(&n->next, NULL);
+    PublishNode *prev = IOTC_ATOMIC_EXCHANGE_PTR(&head, n);
+    // Between the exchange and this store the queue is briefly unlinked. The consumer will see next==NULL
+    // for the previous node and simply retry.
+    IOTC_ATOMIC_STORE_PTR(&prev->next, n);
+}
+
+// Returns false if the queue is not running. Otherwise leave_queue() must be called when done with the lock.
+static bool enter_queue(void) {
+    IOTC_ATOMIC_ADD(&producers, 1);
+    if (0 == IOTC_ATOMIC_ADD(&is_running, 0)) {
+        IOTC_ATOMIC_ADD(&producers, -1);
+        return false;
+    }
+    return true;
+}
+
+static void leave_queue(void) {
+    IOTC_ATOMIC_ADD(&producers, -1);
+}
+
+// Dmitry Vyukov's intrusive MPSC queue pop. Returns NULL if the queue is empty or a push is in progress.
+static PublishNode *pop_node(void) {
+    PublishNode *t = tail;
+    PublishNode *next = IOTC_ATOMIC_LOAD_PTR(&t->next);
+    if (t == &stub) {
+        if (NULL == next) {
+            return NULL;
+        }
+        tail = next;
+        t = next;
+        next = IOTC_ATOMIC_LOAD_PTR(&next->next);
+    }
+    if (next) {
+        tail = next;
+        return t;
+    }
+    if (t != IOTC_ATOMIC_LOAD_PTR(&head)) {
+        return NULL; // a producer is between the exchange and the link
+    }
+    push_node(&stub);
+    next = IOTC_ATOMIC_LOAD_PTR(&t->next);
+    if (next) {
+        tail = next;
+        return t;
+    }
+    return NULL;
+}
+
+static void publisher_loop(void *arg) {
+    (void) arg;
+    for (;;) {
+        if (0 == IOTC_ATOMIC_LOAD(&pending)) {
+            iotc_mutex_lock(&lock);
+            // Catches a producer that blocked the queue after the last message was counted below
+            if (is_blocked) {
+                is_blocked = 0;
+                if (config.writable_cb) {
+                    iotc_mutex_unlock(&lock);
+                    config.writable_cb();
+                    iotc_mutex_lock(&lock);
+                }
+            }
+            while (0 == IOTC_ATOMIC_LOAD(&pending) && !is_stop_requested) {
+                iotc_cond_wait(&wake_cond, &lock);
+            }
+            bool should_exit = (0 == IOTC_ATOMIC_LOAD(&pending) && is_stop_requested);
+            iotc_mutex_unlock(&lock);
+            if (should_exit) {
+                break;
+            }
+        }
+
+        PublishNode *n;
+        while (NULL == (n = pop_node())) {
+            // pending says there is a message, so a producer is just about to link it. Let it run.
+            iotc_thread_yield();
+        }
+
+        if (0 == iotc_device_client_send_message_qos(n->topic, n->message, n->qos)) {
+            IOTC_ATOMIC_ADD(&published, 1);
+        } else {
+            IOTC_ATOMIC_ADD(&failed, 1);
+        }
+        long bytes = IOTC_ATOMIC_ADD(&pending_bytes, -(long) n->size);
+        free(n);
+        IOTC_ATOMIC_ADD(&processed, 1);
+        IOTC_ATOMIC_ADD(&pending, -1);
+
+        if (IOTC_ATOMIC_LOAD(&is_blocked) && bytes <= (long) config.low_watermark) {
+            iotc_mutex_lock(&lock);
+            bool was_blocked = (0 != is_blocked);
+            is_blocked = 0;
+            iotc_mutex_unlock(&lock);
+            if (was_blocked && config.writable_cb) {
+                config.writable_cb();
+            }
+        }
+
+        if (IOTC_ATOMIC_LOAD(&flush_waiters) > 0) {
+            iotc_mutex_lock(&lock);
+            iotc_cond_broadcast(&processed_cond);
+            iotc_mutex_unlock(&lock);
+        }
+    }
+}
+
+void iotc_publish_queue_init_config(IotConnectPublishQueueConfig *c) {
+    memset(c, 0, sizeof(IotConnectPublishQueueConfig));
+}
+
+int iotc_publish_queue_start(const IotConnectPublishQueueConfig *c) {
+    if (IOTC_ATOMIC_LOAD(&is_running)) {
+        return IOTCL_SUCCESS;
+    }
+    if (c->high_watermark && c->low_watermark >= c->high_watermark) {
+        IOTC_ERROR("Publish queue: The low watermark must be lower than the high watermark.");
+        return IOTCL_ERR_CONFIG_ERROR;
+    }
+    memcpy(&config, c, sizeof(IotConnectPublishQueueConfig));
+    stub.next = NULL;
+    head = &stub;
+    tail = &stub;
+    pending = 0;
+    pushed = 0;
+    processed = 0;
+    published = 0;
+    failed = 0;
+    flush_waiters = 0;
+    pending_bytes = 0;
+    would_block = 0;
+    is_blocked = 0;
+    is_stop_requested = false;
+    iotc_mutex_init(&lock);
+    iotc_cond_init(&wake_cond);
+    iotc_cond_init(&processed_cond);
+    if (iotc_thread_create(&publisher_thread, publisher_loop, NULL)) {
+        IOTC_ERROR("Failed to start the publisher thread!");
+        iotc_cond_destroy(&processed_cond);
+        iotc_cond_destroy(&wake_cond);
+        iotc_mutex_destroy(&lock);
+        return IOTCL_ERR_FAILED;
+    }
+    IOTC_ATOMIC_ADD(&is_running, 1);
+    return IOTCL_SUCCESS;
+}
+
+void iotc_publish_queue_stop(void) {
+    if (0 == IOTC_ATOMIC_LOAD(&is_running)) {
+        return;
+    }
+    IOTC_ATOMIC_ADD(&is_running, -1); // new pushes are refused from here on
+    iotc_mutex_lock(&lock);
+    is_stop_requested = true;
+    iotc_cond_signal(&wake_cond);
+    iotc_mutex_unlock(&lock);
+    iotc_thread_join(&publisher_thread);
+
+    // Producers that raced with stop may have left something behind, or may still be linking a message
+    // or waiting in a flush. Nobody is publishing anymore, so fail what they pushed until the last one has left.
+    for (;;) {
+        PublishNode *n;
+        while (IOTC_ATOMIC_LOAD(&pending) > 0 && NULL != (n = pop_node())) {
+            IOTC_ATOMIC_ADD(&pending_bytes, -(long) n->size);
+            free(n);
+            IOTC_ATOMIC_ADD(&failed, 1);
+            IOTC_ATOMIC_ADD(&processed, 1);
+            IOTC_ATOMIC_ADD(&pending, -1);
+        }
+        if (0 == IOTC_ATOMIC_ADD(&producers, 0) && 0 == IOTC_ATOMIC_LOAD(&pending)) {
+            break;
+        }
+        iotc_mutex_lock(&lock);
+        iotc_cond_broadcast(&processed_cond);
+        iotc_mutex_unlock(&lock);
+        iotc_thread_yield();
+    }
+
+    iotc_cond_destroy(&processed_cond);
+    iotc_cond_destroy(&wake_cond);
+    iotc_mutex_destroy(&lock);
+}
+
+bool iotc_publish_queue_is_running(void) {
+    return 0 != IOTC_ATOMIC_LOAD(&is_running);
+}
+
+static int push_message(const char *topic, const char *message, int qos) {
+    size_t topic_size = strlen(topic) + 1;
+    size_t message_size = strlen(message) + 1;
+    PublishNode *n = malloc(sizeof(PublishNode) + topic_size + message_size);
+    if (!n) {
+        IOTC_ERROR("iotc_publish_queue_push: Out of memory!");
+        return IOTCL_ERR_OUT_OF_MEMORY;
+    }
+    n->qos = qos;
+    n->size = topic_size + message_size;
+    n->topic = (char *) (n + 1);
+    n->message = n->topic + topic_size;
+    memcpy(n->topic, topic, topic_size);
+    memcpy(n->message, message, message_size);
+
+    IOTC_ATOMIC_ADD(&pushed, 1);
+    IOTC_ATOMIC_ADD(&pending_bytes, (long) n->size);
+    push_node(n);
+    if (1 == IOTC_ATOMIC_ADD(&pending, 1)) {
+        // The queue was empty, so the publisher thread may be sleeping. Apart from the high watermark,
+        // this is the only locked path.
+        iotc_mutex_lock(&lock);
+        iotc_cond_signal(&wake_cond);
+        iotc_mutex_unlock(&lock);
+    }
+    return IOTCL_SUCCESS;
+}
+
+int iotc_publish_queue_push(const char *topic, const char *message, int qos) {
+    if (!enter_queue()) {
+        IOTC_ERROR("iotc_publish_queue_push: The publish queue is not running!");
+        return IOTCL_ERR_FAILED;
+    }
+    int ret = push_message(topic, message, qos);
+    leave_queue();
+    return ret;
+}
+
+static bool is_writable(void) {
+    if (0 == config.high_watermark) {
+        return true;
+    }
+    if (IOTC_ATOMIC_LOAD(&is_blocked)) {
+        return false; // until the queue drains to the low watermark
+    }
+    if (IOTC_ATOMIC_LOAD(&pending_bytes) < (long) config.high_watermark) {
+        return true;
+    }
+    // Only taken at the high watermark. The publisher checks is_blocked under the lock before it goes idle,
+    // so the callback cannot be missed if the queue drains in the meantime.
+    iotc_mutex_lock(&lock);
+    if (!is_blocked && IOTC_ATOMIC_LOAD(&pending_bytes) >= (long) config.high_watermark) {
+        is_blocked = 1;
+    }
+    bool ret = !is_blocked;
+    iotc_mutex_unlock(&lock);
+    return ret;
+}
+
+bool iotc_publish_queue_is_writable(void) {
+    if (!enter_queue()) {
+        return true;
+    }
+    bool ret = is_writable();
+    leave_queue();
+    return ret;
+}
+
+int iotc_publish_queue_try_push(const char *topic, const char *message, int qos) {
+    if (!enter_queue()) {
+        IOTC_ERROR("iotc_publish_queue_try_push: The publish queue is not running!");
+        return IOTCL_ERR_FAILED;
+    }
+    int ret = IOTC_ERR_WOULD_BLOCK;
+    if (is_writable()) {
+        ret = push_message(topic, message, qos);
+    } else {
+        IOTC_ATOMIC_ADD(&would_block, 1);
+    }
+    leave_queue();
+    return ret;
+}
+
+bool iotc_publish_queue_flush(unsigned long timeout_ms) {
+    if (!enter_queue()) {
+        return true;
+    }
+    long target = IOTC_ATOMIC_LOAD(&pushed);
+    uint64_t deadline_ms = iotc_clock_now_ms() + timeout_ms;
+    bool ret = true;
+    IOTC_ATOMIC_ADD(&flush_waiters, 1);
+    iotc_mutex_lock(&lock);
+    while (IOTC_ATOMIC_LOAD(&processed) < target) {
+        uint64_t now_ms = iotc_clock_now_ms();
+        if (now_ms >= deadline_ms) {
+            ret = false;
+            break;
+        }
+        // Wait in short slices. A broadcast can be missed if the publisher checked flush_waiters just before
+        // we incremented it, so do not rely on it alone.
+        uint64_t wait_ms = deadline_ms - now_ms;
+        iotc_cond_timed_wait(&processed_cond, &lock, (unsigned long) (wait_ms < 100 ? wait_ms : 100));
+    }
+    iotc_mutex_unlock(&lock);
+    IOTC_ATOMIC_ADD(&flush_waiters, -1);
+    leave_queue();
+    return ret;
+}
+
+void iotc_publish_queue_get_stats(IotConnectPublishQueueStats *stats) {
+    stats->pushed = (unsigned long) IOTC_ATOMIC_LOAD(&pushed);
+    stats->published = (unsigned long) IOTC_ATOMIC_LOAD(&published);
+    stats->failed = (unsigned long) IOTC_ATOMIC_LOAD(&failed);
+    stats->pending = (unsigned long) IOTC_ATOMIC_LOAD(&pending);
+    stats->pending_bytes = (unsigned long) IOTC_ATOMIC_LOAD(&pending_bytes);
+    stats->would_block = (unsigned long) IOTC_ATOMIC_LOAD(&would_block);
+}
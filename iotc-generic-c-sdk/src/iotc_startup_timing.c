@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "iotc_log.h"
+#include "iotc_clock.h"
+#include "iotc_startup_timing.h"
+
+#define FIRST_MQTT_PHASE IOTC_PHASE_ENDPOINT_RACE
+
+// Everything is recorded from the thread that calls iotconnect_sdk_init() and iotconnect_sdk_connect()
+static IotConnectStartupTimings timings;
+static uint64_t init_start_us = 0;
+static uint64_t connect_start_us = 0;
+
+static const char *phase_names[IOTC_PHASE_COUNT] = {
+        "iotcl init",
+        "discovery",
+        "identity",
+        "endpoint race",
+        "mqtt create",
+        "mqtt connect",
+        "mqtt subscribe"
+};
+
+static unsigned long to_ms(uint64_t us) {
+    return (unsigned long) ((us + 500) / 1000);
+}
+
+static void print_http(const char *name, const IotConnectHttpTimings *t) {
+    if (!t->total_us) {
+        return;
+    }
+    IOTC_INFO("  %-16s dns %lu, connect %lu, tls %lu, first byte %lu ms", name,
+              to_ms(t->dns_us), to_ms(t->connect_us), to_ms(t->tls_us), to_ms(t->first_byte_us));
+}
+
+const char *iotc_startup_timing_phase_name(IotConnectStartupPhase phase) {
+    return ((int) phase >= 0 && phase < IOTC_PHASE_COUNT) ? phase_names[phase] : "unknown";
+}
+
+void iotc_startup_timing_get(IotConnectStartupTimings *t) {
+    memcpy(t, &timings, sizeof(IotConnectStartupTimings));
+}
+
+void iotc_startup_timing_print(void) {
+    IOTC_INFO("Startup timing (ms from the start of init, duration):");
+    for (int i = 0; i < IOTC_PHASE_COUNT; i++) {
+        if (!timings.duration_us[i]) {
+            continue;
+        }
+        IOTC_INFO("  %-16s at %6lu, took %lu", phase_names[i], to_ms(timings.offset_us[i]), to_ms(timings.duration_us[i]));
+        if (IOTC_PHASE_DISCOVERY == i) {
+            print_http("  (discovery)", &timings.discovery);
+        } else if (IOTC_PHASE_IDENTITY == i) {
+            print_http("  (identity)", &timings.identity);
+        }
+    }
+    IOTC_INFO("  init took %lu ms, connect took %lu ms", to_ms(timings.init_us), to_ms(timings.connect_us));
+}
+
+void iotc_startup_timing_begin_init(void) {
+    memset(&timings, 0, sizeof(timings));
+    init_start_us = iotc_clock_now_us();
+}
+
+void iotc_startup_timing_end_init(void) {
+    timings.init_us = iotc_clock_now_us() - init_start_us;
+}
+
+void iotc_startup_timing_begin_connect(void) {
+    for (int i = FIRST_MQTT_PHASE; i < IOTC_PHASE_COUNT; i++) {
+        timings.duration_us[i] = 0;
+        timings.offset_us[i] = 0;
+    }
+    timings.connect_us = 0;
+    connect_start_us = iotc_clock_now_us();
+}
+
+void iotc_startup_timing_end_connect(void) {
+    timings.connect_us = iotc_clock_now_us() - connect_start_us;
+}
+
+void iotc_startup_timing_record(IotConnectStartupPhase phase, uint64_t start_us) {
+    if ((int) phase < 0 || phase >= IOTC_PHASE_COUNT) {
+        return;
+    }
+    uint64_t now = iotc_clock_now_us();
+    timings.duration_us[phase] = now > start_us ? now - start_us : 1; // 0 means that it did not run
+    timings.offset_us[phase] = start_us > init_start_us ? start_us - init_start_us : 0;
+}
+
+void iotc_startup_timing_record_http(IotConnectStartupPhase phase, const IotConnectHttpTimings *http) {
+    if (IOTC_PHASE_DISCOVERY == phase) {
+        timings.discovery = *http;
+    } else if (IOTC_PHASE_IDENTITY == phase) {
+        timings.identity = *http;
+    }
+}
@@ -0,0 +1,303 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "iotcl.h"
+#include "iotcl_util.h"
+#include "iotc_log.h"
+#include "iotc_telemetry_aggregator.h"
+
+// Independent accumulators per reduction step. Keeps the loop free of cross-iteration dependencies so that
+// the compiler can map it onto SIMD registers without -ffast-math, since no floating point sums are reordered.
+#define REDUCE_LANES 8
+
+typedef struct {
+    float min;
+    float max;
+    double sum; // of (value - shift)
+    double sum_sq; // of (value - shift)^2
+    size_t count;
+} Accumulator;
+
+struct IotConnectAggregator {
+    IotConnectAggregatorConfig config;
+    char **names; // copies of channel_names
+    char *path; // scratch buffer for "<channel>.<stat>"
+    float *data; // channel_count arrays of window_size samples, one after another
+    IotConnectAggregate *results;
+    size_t pos; // next write index in each channel array
+    size_t filled; // valid samples in the ring, up to window_size
+    size_t since_record; // samples added since the last record
+    unsigned long send_failures; // records that could not be sent
+};
+
+static void accumulator_init(Accumulator *acc) {
+    acc->min = FLT_MAX;
+    acc->max = -FLT_MAX;
+    acc->sum = 0;
+    acc->sum_sq = 0;
+    acc->count = 0;
+}
+
+// Values are shifted by a sample from the same window before summing. This keeps sum_sq - sum^2/n
+// from cancelling out when the spread is small compared to the values, like a 50 Hz signal around 230 V.
+static void accumulate(const float *x, size_t n, double shift, Accumulator *acc) {
+    float mn[REDUCE_LANES];
+    float mx[REDUCE_LANES];
+    double s[REDUCE_LANES];
+    double sq[REDUCE_LANES];
+    for (int j = 0; j < REDUCE_LANES; j++) {
+        mn[j] = acc->min;
+        mx[j] = acc->max;
+        s[j] = 0;
+        sq[j] = 0;
+    }
+
+    size_t i = 0;
+    for (; i + REDUCE_LANES <= n; i += REDUCE_LANES) {
+        for (int j = 0; j < REDUCE_LANES; j++) {
+            const float v = x[i + j];
+            const double d = (double) v - shift;
+            mn[j] = v < mn[j] ? v : mn[j];
+            mx[j] = v > mx[j] ? v : mx[j];
+            s[j] += d;
+            sq[j] += d * d;
+        }
+    }
+    for (; i < n; i++) {
+        const float v = x[i];
+        const double d = (double) v - shift;
+        mn[0] = v < mn[0] ? v : mn[0];
+        mx[0] = v > mx[0] ? v : mx[0];
+        s[0] += d;
+        sq[0] += d * d;
+    }
+
+    for (int j = 0; j < REDUCE_LANES; j++) {
+        acc->min = mn[j] < acc->min ? mn[j] : acc->min;
+        acc->max = mx[j] > acc->max ? mx[j] : acc->max;
+        acc->sum += s[j];
+        acc->sum_sq += sq[j];
+    }
+    acc->count += n;
+}
+
+static void accumulator_finish(const Accumulator *acc, double shift, IotConnectAggregate *result) {
+    result->count = acc->count;
+    if (0 == acc->count) {
+        memset(result, 0, sizeof(IotConnectAggregate));
+        return;
+    }
+    const double n = (double) acc->count;
+    const double mean_shifted = acc->sum / n;
+    double variance = acc->sum_sq / n - mean_shifted * mean_shifted;
+    if (variance < 0) {
+        variance = 0; // rounding
+    }
+    result->min = acc->min;
+    result->max = acc->max;
+    result->mean = shift + mean_shifted;
+    result->stddev = sqrt(variance);
+}
+
+void iotc_aggregator_reduce(const float *samples, size_t count, IotConnectAggregate *result) {
+    Accumulator acc;
+    accumulator_init(&acc);
+    const double shift = count ? samples[0] : 0;
+    accumulate(samples, count, shift, &acc);
+    accumulator_finish(&acc, shift, result);
+}
+
+static int send_record(IotConnectAggregator *a) {
+    static const struct {
+        unsigned int bit;
+        const char *suffix;
+    } stat_names[] = {
+            {IOTC_AGG_MIN,    "min"},
+            {IOTC_AGG_MAX,    "max"},
+            {IOTC_AGG_MEAN,   "mean"},
+            {IOTC_AGG_STDDEV, "stddev"},
+            {IOTC_AGG_COUNT,  "count"},
+    };
+
+    IotclMessageHandle msg = iotcl_telemetry_create();
+    if (!msg) {
+        return IOTCL_ERR_OUT_OF_MEMORY; // called function will print the error
+    }
+    for (size_t ch = 0; ch < a->config.channel_count; ch++) {
+        const IotConnectAggregate *r = &a->results[ch];
+        for (size_t i = 0; i < sizeof(stat_names) / sizeof(stat_names[0]); i++) {
+            double value;
+            if (!(a->config.stats & stat_names[i].bit)) {
+                continue;
+            }
+            switch (stat_names[i].bit) {
+                case IOTC_AGG_MIN:
+                    value = r->min;
+                    break;
+                case IOTC_AGG_MAX:
+                    value = r->max;
+                    break;
+                case IOTC_AGG_MEAN:
+                    value = r->mean;
+                    break;
+                case IOTC_AGG_STDDEV:
+                    value = r->stddev;
+                    break;
+                default:
+                    value = (double) r->count;
+                    break;
+            }
+            sprintf(a->path, "%s.%s", a->names[ch], stat_names[i].suffix);
+            iotcl_telemetry_set_number(msg, a->path, value);
+        }
+    }
+    int status = iotcl_mqtt_send_telemetry(msg, false);
+    iotcl_telemetry_destroy(msg);
+    return status;
+}
+
+// Reduces the last n samples of every channel and produces a record
+static void produce_record(IotConnectAggregator *a, size_t n) {
+    const size_t w = a->config.window_size;
+    const size_t start = (a->pos + w - n) % w;
+    const size_t first_len = (start + n <= w) ? n : w - start;
+
+    for (size_t ch = 0; ch < a->config.channel_count; ch++) {
+        const float *samples = &a->data[ch * w];
+        const double shift = samples[start];
+        Accumulator acc;
+        accumulator_init(&acc);
+        accumulate(&samples[start], first_len, shift, &acc);
+        if (first_len < n) {
+            accumulate(samples, n - first_len, shift, &acc); // wrapped around
+        }
+        accumulator_finish(&acc, shift, &a->results[ch]);
+    }
+
+    if (a->config.window_cb) {
+        a->config.window_cb(a->results, a->config.channel_count, a->config.cb_context);
+    } else if (IOTCL_SUCCESS != send_record(a)) {
+        a->send_failures++;
+        IOTC_WARN("Aggregator: Failed to send a record. %lu record(s) lost so far.", a->send_failures);
+    }
+    a->since_record = 0;
+}
+
+void iotc_aggregator_init_config(IotConnectAggregatorConfig *c) {
+    memset(c, 0, sizeof(IotConnectAggregatorConfig));
+    c->stats = IOTC_AGG_ALL;
+}
+
+void iotc_aggregator_destroy(IotConnectAggregator *a) {
+    if (!a) {
+        return;
+    }
+    if (a->names) {
+        for (size_t ch = 0; ch < a->config.channel_count; ch++) {
+            if (a->names[ch]) {
+                iotcl_free(a->names[ch]);
+            }
+        }
+    }
+    free(a->names);
+    free(a->path);
+    free(a->data);
+    free(a->results);
+    free(a);
+}
+
+IotConnectAggregator *iotc_aggregator_create(const IotConnectAggregatorConfig *c) {
+    if (!c->channel_names || 0 == c->channel_count || 0 == c->window_size) {
+        IOTC_ERROR("iotc_aggregator_create: Channel names, channel count and window size are required.");
+        return NULL;
+    }
+    if (c->hop > c->window_size) {
+        IOTC_ERROR("iotc_aggregator_create: Hop cannot be larger than the window size.");
+        return NULL;
+    }
+
+    IotConnectAggregator *a = calloc(1, sizeof(IotConnectAggregator));
+    if (!a) {
+        IOTC_ERROR("iotc_aggregator_create: Out of memory!");
+        return NULL;
+    }
+    a->config = *c;
+    a->config.channel_names = NULL; // use our copies
+    if (0 == a->config.hop) {
+        a->config.hop = a->config.window_size;
+    }
+    if (0 == a->config.stats) {
+        a->config.stats = IOTC_AGG_ALL;
+    }
+
+    a->names = calloc(c->channel_count, sizeof(char *));
+    a->data = calloc(c->channel_count * c->window_size, sizeof(float));
+    a->results = calloc(c->channel_count, sizeof(IotConnectAggregate));
+    if (!a->names || !a->data || !a->results) {
+        IOTC_ERROR("iotc_aggregator_create: Out of memory!");
+        iotc_aggregator_destroy(a);
+        return NULL;
+    }
+    size_t max_name_len = 0;
+    for (size_t ch = 0; ch < c->channel_count; ch++) {
+        a->names[ch] = iotcl_strdup(c->channel_names[ch]);
+        if (!a->names[ch]) {
+            IOTC_ERROR("iotc_aggregator_create: Out of memory!");
+            iotc_aggregator_destroy(a);
+            return NULL;
+        }
+        size_t len = strlen(a->names[ch]);
+        max_name_len = len > max_name_len ? len : max_name_len;
+    }
+    a->path = malloc(max_name_len + sizeof(".stddev"));
+    if (!a->path) {
+        IOTC_ERROR("iotc_aggregator_create: Out of memory!");
+        iotc_aggregator_destroy(a);
+        return NULL;
+    }
+    return a;
+}
+
+bool iotc_aggregator_add_sample(IotConnectAggregator *a, const float *values) {
+    const size_t w = a->config.window_size;
+    float *p = &a->data[a->pos];
+    for (size_t ch = 0; ch < a->config.channel_count; ch++) {
+        p[ch * w] = values[ch];
+    }
+    a->pos = (a->pos + 1 == w) ? 0 : a->pos + 1;
+    if (a->filled < w) {
+        a->filled++;
+    }
+    a->since_record++;
+
+    if (a->filled == w && a->since_record >= a->config.hop) {
+        produce_record(a, w);
+        return true;
+    }
+    return false;
+}
+
+bool iotc_aggregator_flush(IotConnectAggregator *a) {
+    if (0 == a->since_record) {
+        return false;
+    }
+    if (a->config.hop == a->config.window_size) {
+        // tumbling: the partial window, then start the next one from scratch
+        produce_record(a, a->since_record);
+        a->filled = 0;
+    } else {
+        produce_record(a, a->filled);
+    }
+    return true;
+}
+
+unsigned long iotc_aggregator_get_send_failures(const IotConnectAggregator *a) {
+    return a->send_failures;
+}
@@ -0,0 +1,95 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "iotcl.h"
+#include "iotc_log.h"
+#include "iotc_clock.h"
+#include "iotc_telemetry_filter.h"
+
+#define ENTRY_ENABLED 0x01 // configured with iotc_telemetry_filter_configure()
+#define ENTRY_HAS_VALUE 0x02 // last_value and last_report_ms are valid
+
+static IotConnectTelemetryFilterEntry *get_entry(IotConnectTelemetryFilter *f, int slot) {
+    if (slot < 0 || slot >= IOTC_TELEMETRY_FILTER_MAX_FIELDS) {
+        return NULL;
+    }
+    return &f->entries[slot];
+}
+
+void iotc_telemetry_filter_init(IotConnectTelemetryFilter *f) {
+    memset(f, 0, sizeof(IotConnectTelemetryFilter));
+    f->start_ms = iotc_clock_now_ms();
+}
+
+int iotc_telemetry_filter_configure(IotConnectTelemetryFilter *f, int slot, double abs_deadband,
+                                    double pct_deadband, unsigned long max_silence_ms) {
+    IotConnectTelemetryFilterEntry *e = get_entry(f, slot);
+    if (!e) {
+        IOTC_ERROR("iotc_telemetry_filter_configure: Slot %d is out of range. Increase IOTC_TELEMETRY_FILTER_MAX_FIELDS.",
+                   slot);
+        return IOTCL_ERR_BAD_VALUE;
+    }
+    if (abs_deadband < 0 || pct_deadband < 0) {
+        IOTC_ERROR("iotc_telemetry_filter_configure: Deadband cannot be negative.");
+        return IOTCL_ERR_BAD_VALUE;
+    }
+    e->abs_deadband = (float) abs_deadband;
+    e->pct_deadband = (float) pct_deadband;
+    e->max_silence_ms = (uint32_t) max_silence_ms;
+    e->flags = ENTRY_ENABLED; // also forces the next value to be reported
+    return IOTCL_SUCCESS;
+}
+
+bool iotc_telemetry_filter_update(IotConnectTelemetryFilter *f, int slot, double value) {
+    IotConnectTelemetryFilterEntry *e = get_entry(f, slot);
+    if (!e || !(e->flags & ENTRY_ENABLED)) {
+        f->reported++;
+        return true;
+    }
+    const uint32_t now_ms = (uint32_t) (iotc_clock_now_ms() - f->start_ms);
+
+    bool report;
+    if (!(e->flags & ENTRY_HAS_VALUE)) {
+        report = true;
+    } else if (e->max_silence_ms && (uint32_t) (now_ms - e->last_report_ms) >= e->max_silence_ms) {
+        report = true;
+    } else if (value != value || e->last_value != e->last_value) {
+        // NaN: report transitions to and from NaN, but not repeated NaNs
+        report = (value == value) || (e->last_value == e->last_value);
+    } else {
+        double delta = value - e->last_value;
+        double magnitude = e->last_value < 0 ? -e->last_value : e->last_value;
+        double deadband = e->pct_deadband * magnitude / 100.0;
+        if (deadband < e->abs_deadband) {
+            deadband = e->abs_deadband;
+        }
+        report = (delta > deadband || -delta > deadband);
+    }
+
+    if (report) {
+        e->last_value = value;
+        e->last_report_ms = now_ms;
+        e->flags |= ENTRY_HAS_VALUE;
+        f->reported++;
+    } else {
+        f->suppressed++;
+    }
+    return report;
+}
+
+void iotc_telemetry_filter_reset(IotConnectTelemetryFilter *f, int slot) {
+    IotConnectTelemetryFilterEntry *e = get_entry(f, slot);
+    if (e) {
+        e->flags &= (uint8_t) ~ENTRY_HAS_VALUE;
+    }
+}
+
+void iotc_telemetry_filter_reset_all(IotConnectTelemetryFilter *f) {
+    for (int i = 0; i < IOTC_TELEMETRY_FILTER_MAX_FIELDS; i++) {
+        f->entries[i].flags &= (uint8_t) ~ENTRY_HAS_VALUE;
+    }
+}
@@ -0,0 +1,476 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#if !defined(_WIN32) && !defined(_WIN64) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L // gmtime_r()
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "iotcl.h"
+#include "iotc_log.h"
+#include "iotc_dtoa.h"
+#include "iotc_telemetry_writer.h"
+
+// The envelope matches what iotcl_mqtt_send_telemetry() produces: {"d":[{"dt":"...","d":{...}}]}
+#define ENVELOPE_START "{\"d\":[{"
+#define ENVELOPE_DATA_START "\"d\":{"
+#define ENVELOPE_END "}}]}"
+
+typedef struct {
+    char *p;
+    char *end; // one past the last usable byte, leaving room for the NUL terminator
+    bool is_overflow;
+} OutputCursor;
+
+static void put_bytes(OutputCursor *c, const char *data, size_t len) {
+    if ((size_t) (c->end - c->p) < len) {
+        c->is_overflow = true;
+        return;
+    }
+    memcpy(c->p, data, len);
+    c->p += len;
+}
+
+static void put_char(OutputCursor *c, char ch) {
+    if (c->p >= c->end) {
+        c->is_overflow = true;
+        return;
+    }
+    *c->p++ = ch;
+}
+
+static void put_number(OutputCursor *c, double value, int precision) {
+    char tmp[IOTC_DTOA_BUFFER_SIZE];
+    size_t len = (precision < 0) ? iotc_dtoa(value, tmp) : iotc_dtoa_fixed(value, precision, tmp);
+    put_bytes(c, tmp, len);
+}
+
+static void put_string(OutputCursor *c, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    put_char(c, '"');
+    const char *run = s; // copy runs of characters that need no escaping in one go
+    for (; *s; s++) {
+        unsigned char ch = (unsigned char) *s;
+        if (ch >= 0x20 && ch != '"' && ch != '\\') {
+            continue;
+        }
+        put_bytes(c, run, (size_t) (s - run));
+        run = s + 1;
+        put_char(c, '\\');
+        switch (ch) {
+            case '"':
+                put_char(c, '"');
+                break;
+            case '\\':
+                put_char(c, '\\');
+                break;
+            case '\n':
+                put_char(c, 'n');
+                break;
+            case '\r':
+                put_char(c, 'r');
+                break;
+            case '\t':
+                put_char(c, 't');
+                break;
+            case '\b':
+                put_char(c, 'b');
+                break;
+            case '\f':
+                put_char(c, 'f');
+                break;
+            default:
+                put_bytes(c, "u00", 3);
+                put_char(c, hex[ch >> 4]);
+                put_char(c, hex[ch & 0xF]);
+                break;
+        }
+    }
+    put_bytes(c, run, (size_t) (s - run));
+    put_char(c, '"');
+}
+
+static void put_timestamp(OutputCursor *c) {
+    char tmp[48];
+    time_t now = time(NULL);
+    struct tm t;
+#if defined(_WIN32) || defined(_WIN64)
+    if (0 != gmtime_s(&t, &now)) {
+        return;
+    }
+#else
+    if (!gmtime_r(&now, &t)) {
+        return;
+    }
+#endif
+    size_t len = strftime(tmp, sizeof(tmp), "\"dt\":\"%Y-%m-%dT%H:%M:%S.000Z\",", &t);
+    put_bytes(c, tmp, len);
+}
+
+// Paths are copied into the JSON keys as they are, so anything that would need escaping is rejected
+static bool is_valid_path(const char *path) {
+    if (!path || !*path || path[0] == '.' || path[strlen(path) - 1] == '.' || strstr(path, "..")) {
+        return false;
+    }
+    for (const char *p = path; *p; p++) {
+        if (*p == '"' || *p == '\\' || (unsigned char) *p < 0x20) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Copies len bytes of data into the key pool, and NUL terminates it. Returns the offset or -1 if out of space.
+static int pool_add(IotConnectTelemetryWriter *w, const char *data, size_t len) {
+    if (w->key_pool_used + len + 1 > IOTC_TELEMETRY_WRITER_KEY_POOL_SIZE) {
+        IOTC_ERROR("Telemetry writer key pool is full. Increase IOTC_TELEMETRY_WRITER_KEY_POOL_SIZE.");
+        return -1;
+    }
+    int offset = (int) w->key_pool_used;
+    memcpy(&w->key_pool[offset], data, len);
+    w->key_pool[offset + len] = 0;
+    w->key_pool_used += len + 1;
+    return offset;
+}
+
+// Adds "name" followed by the suffix (":" or ":{") to the key pool
+static int pool_add_key(IotConnectTelemetryWriter *w, const char *name, size_t name_len, const char *suffix,
+                        uint16_t *key_len) {
+    size_t suffix_len = strlen(suffix);
+    size_t len = name_len + 2 + suffix_len;
+    if (w->key_pool_used + len + 1 > IOTC_TELEMETRY_WRITER_KEY_POOL_SIZE) {
+        IOTC_ERROR("Telemetry writer key pool is full. Increase IOTC_TELEMETRY_WRITER_KEY_POOL_SIZE.");
+        return -1;
+    }
+    int offset = (int) w->key_pool_used;
+    char *p = &w->key_pool[offset];
+    *p++ = '"';
+    memcpy(p, name, name_len);
+    p += name_len;
+    *p++ = '"';
+    memcpy(p, suffix, suffix_len);
+    p += suffix_len;
+    *p = 0;
+    w->key_pool_used += len + 1;
+    *key_len = (uint16_t) len;
+    return offset;
+}
+
+static int find_or_add_object(IotConnectTelemetryWriter *w, const char *path, size_t prefix_len, const char *name,
+                              size_t name_len) {
+    for (size_t i = 0; i < w->object_count; i++) {
+        IotConnectTelemetryObject *o = &w->objects[i];
+        if (o->prefix_len == prefix_len && 0 == memcmp(&w->key_pool[o->prefix_offset], path, prefix_len)) {
+            return (int) i;
+        }
+    }
+    if (w->object_count >= IOTC_TELEMETRY_WRITER_MAX_OBJECTS) {
+        IOTC_ERROR("Too many telemetry objects. Increase IOTC_TELEMETRY_WRITER_MAX_OBJECTS.");
+        return -1;
+    }
+    IotConnectTelemetryObject *o = &w->objects[w->object_count];
+    int prefix_offset = pool_add(w, path, prefix_len);
+    if (prefix_offset < 0) {
+        return -1;
+    }
+    int key_offset = pool_add_key(w, name, name_len, ":{", &o->key_len);
+    if (key_offset < 0) {
+        return -1;
+    }
+    o->prefix_offset = (uint16_t) prefix_offset;
+    o->prefix_len = (uint16_t) prefix_len;
+    o->key_offset = (uint16_t) key_offset;
+    return (int) w->object_count++;
+}
+
+// Orders paths so that fields sharing an object end up next to each other: a '.' sorts before anything else.
+static int compare_paths(const char *a, const char *b) {
+    for (;; a++, b++) {
+        unsigned char ca = (unsigned char) (*a == '.' ? 1 : *a);
+        unsigned char cb = (unsigned char) (*b == '.' ? 1 : *b);
+        if (ca != cb || 0 == ca) {
+            return (int) ca - (int) cb;
+        }
+    }
+}
+
+void iotc_telemetry_writer_init(IotConnectTelemetryWriter *w, char *buffer, size_t buffer_size) {
+    memset(w, 0, sizeof(IotConnectTelemetryWriter));
+    w->buffer = buffer;
+    w->buffer_size = buffer_size;
+}
+
+int iotc_telemetry_writer_add_field(IotConnectTelemetryWriter *w, const char *path,
+                                    IotConnectTelemetryFieldType type) {
+    if (w->is_compiled) {
+        IOTC_ERROR("iotc_telemetry_writer_add_field: Fields cannot be added after the writer is compiled.");
+        return -IOTCL_ERR_FAILED;
+    }
+    if (!is_valid_path(path)) {
+        IOTC_ERROR("iotc_telemetry_writer_add_field: Invalid field path \"%s\".", path ? path : "");
+        return -IOTCL_ERR_BAD_VALUE;
+    }
+    if (w->field_count >= IOTC_TELEMETRY_WRITER_MAX_FIELDS) {
+        IOTC_ERROR("Too many telemetry fields. Increase IOTC_TELEMETRY_WRITER_MAX_FIELDS.");
+        return -IOTCL_ERR_OUT_OF_MEMORY;
+    }
+    for (size_t i = 0; i < w->field_count; i++) {
+        if (0 == strcmp(&w->key_pool[w->fields[i].path_offset], path)) {
+            IOTC_ERROR("iotc_telemetry_writer_add_field: Duplicate field \"%s\".", path);
+            return -IOTCL_ERR_BAD_VALUE;
+        }
+    }
+    int path_offset = pool_add(w, path, strlen(path));
+    if (path_offset < 0) {
+        return -IOTCL_ERR_OUT_OF_MEMORY;
+    }
+    IotConnectTelemetryField *f = &w->fields[w->field_count];
+    memset(f, 0, sizeof(IotConnectTelemetryField));
+    f->type = type;
+    f->precision = -1;
+    f->path_offset = (uint16_t) path_offset;
+    return (int) w->field_count++;
+}
+
+int iotc_telemetry_writer_compile(IotConnectTelemetryWriter *w) {
+    if (w->is_compiled) {
+        return IOTCL_SUCCESS;
+    }
+    for (size_t i = 0; i < w->field_count; i++) {
+        IotConnectTelemetryField *f = &w->fields[i];
+        const char *path = &w->key_pool[f->path_offset];
+        const char *component = path;
+        const char *dot;
+        f->depth = 0;
+        while (NULL != (dot = strchr(component, '.'))) {
+            if (f->depth >= IOTC_TELEMETRY_WRITER_MAX_DEPTH) {
+                IOTC_ERROR("Telemetry field \"%s\" is nested too deep.", path);
+                return IOTCL_ERR_BAD_VALUE;
+            }
+            int object = find_or_add_object(w, path, (size_t) (dot - path), component, (size_t) (dot - component));
+            if (object < 0) {
+                return IOTCL_ERR_OUT_OF_MEMORY;
+            }
+            f->parents[f->depth++] = (uint8_t) object;
+            component = dot + 1;
+        }
+        int key_offset = pool_add_key(w, component, strlen(component), ":", &f->key_len);
+        if (key_offset < 0) {
+            return IOTCL_ERR_OUT_OF_MEMORY;
+        }
+        f->key_offset = (uint16_t) key_offset;
+    }
+
+    // a field cannot also be an object, like "coordinate" and "coordinate.x"
+    for (size_t i = 0; i < w->field_count; i++) {
+        const char *path = &w->key_pool[w->fields[i].path_offset];
+        for (size_t j = 0; j < w->object_count; j++) {
+            const IotConnectTelemetryObject *o = &w->objects[j];
+            if (strlen(path) == o->prefix_len && 0 == memcmp(path, &w->key_pool[o->prefix_offset], o->prefix_len)) {
+                IOTC_ERROR("Telemetry field \"%s\" is also used as an object.", path);
+                return IOTCL_ERR_BAD_VALUE;
+            }
+        }
+    }
+
+    // insertion sort. There are only a few dozen fields and this runs once.
+    for (size_t i = 0; i < w->field_count; i++) {
+        w->order[i] = (uint8_t) i;
+    }
+    for (size_t i = 1; i < w->field_count; i++) {
+        uint8_t current = w->order[i];
+        const char *current_path = &w->key_pool[w->fields[current].path_offset];
+        size_t j = i;
+        while (j > 0 && compare_paths(&w->key_pool[w->fields[w->order[j - 1]].path_offset], current_path) > 0) {
+            w->order[j] = w->order[j - 1];
+            j--;
+        }
+        w->order[j] = current;
+    }
+
+    w->is_compiled = true;
+    return IOTCL_SUCCESS;
+}
+
+static IotConnectTelemetryField *get_field(IotConnectTelemetryWriter *w, int slot, IotConnectTelemetryFieldType type) {
+    if (slot < 0 || (size_t) slot >= w->field_count) {
+        IOTC_ERROR("Invalid telemetry writer slot %d.", slot);
+        return NULL;
+    }
+    IotConnectTelemetryField *f = &w->fields[slot];
+    if (f->type != type) {
+        IOTC_ERROR("Telemetry field \"%s\" has a different type.", &w->key_pool[f->path_offset]);
+        return NULL;
+    }
+    return f;
+}
+
+int iotc_telemetry_writer_set_number(IotConnectTelemetryWriter *w, int slot, double value) {
+    IotConnectTelemetryField *f = get_field(w, slot, IOTC_TFT_NUMBER);
+    if (!f) {
+        return IOTCL_ERR_BAD_VALUE;
+    }
+    f->value.number = value;
+    f->is_set = true;
+    return IOTCL_SUCCESS;
+}
+
+int iotc_telemetry_writer_set_precision(IotConnectTelemetryWriter *w, int slot, int decimals) {
+    IotConnectTelemetryField *f = get_field(w, slot, IOTC_TFT_NUMBER);
+    if (!f) {
+        return IOTCL_ERR_BAD_VALUE;
+    }
+    if (decimals > IOTC_DTOA_MAX_PRECISION) {
+        IOTC_ERROR("Telemetry field \"%s\" precision can be at most %d decimals.", &w->key_pool[f->path_offset],
+                   IOTC_DTOA_MAX_PRECISION);
+        return IOTCL_ERR_BAD_VALUE;
+    }
+    f->precision = (int8_t) (decimals < 0 ? -1 : decimals);
+    return IOTCL_SUCCESS;
+}
+
+int iotc_telemetry_writer_set_bool(IotConnectTelemetryWriter *w, int slot, bool value) {
+    IotConnectTelemetryField *f = get_field(w, slot, IOTC_TFT_BOOLEAN);
+    if (!f) {
+        return IOTCL_ERR_BAD_VALUE;
+    }
+    f->value.boolean = value;
+    f->is_set = true;
+    return IOTCL_SUCCESS;
+}
+
+int iotc_telemetry_writer_set_string(IotConnectTelemetryWriter *w, int slot, const char *value) {
+    IotConnectTelemetryField *f = get_field(w, slot, IOTC_TFT_STRING);
+    if (!f) {
+        return IOTCL_ERR_BAD_VALUE;
+    }
+    f->value.string = value;
+    f->is_set = (NULL != value);
+    return IOTCL_SUCCESS;
+}
+
+void iotc_telemetry_writer_clear(IotConnectTelemetryWriter *w, int slot) {
+    if (slot >= 0 && (size_t) slot < w->field_count) {
+        w->fields[slot].is_set = false;
+    }
+}
+
+void iotc_telemetry_writer_clear_all(IotConnectTelemetryWriter *w) {
+    for (size_t i = 0; i < w->field_count; i++) {
+        w->fields[i].is_set = false;
+    }
+}
+
+size_t iotc_telemetry_writer_apply_filter(IotConnectTelemetryWriter *w, IotConnectTelemetryFilter *filter) {
+    size_t count = 0;
+    for (size_t i = 0; i < w->field_count; i++) {
+        IotConnectTelemetryField *f = &w->fields[i];
+        if (!f->is_set) {
+            continue;
+        }
+        if (IOTC_TFT_NUMBER == f->type && !iotc_telemetry_filter_update(filter, (int) i, f->value.number)) {
+            f->is_set = false;
+            continue;
+        }
+        count++;
+    }
+    return count;
+}
+
+const char *iotc_telemetry_writer_serialize(IotConnectTelemetryWriter *w) {
+    if (!w->is_compiled && iotc_telemetry_writer_compile(w)) {
+        return NULL; // called function will print the error
+    }
+    if (!w->buffer || 0 == w->buffer_size) {
+        IOTC_ERROR("iotc_telemetry_writer_serialize: No output buffer.");
+        return NULL;
+    }
+
+    OutputCursor c;
+    c.p = w->buffer;
+    c.end = w->buffer + w->buffer_size - 1; // leave room for the NUL
+    c.is_overflow = false;
+
+    uint8_t open_objects[IOTC_TELEMETRY_WRITER_MAX_DEPTH];
+    bool needs_comma[IOTC_TELEMETRY_WRITER_MAX_DEPTH + 1];
+    size_t open_depth = 0;
+    needs_comma[0] = false;
+
+    put_bytes(&c, ENVELOPE_START, sizeof(ENVELOPE_START) - 1);
+    if (w->include_timestamp) {
+        put_timestamp(&c);
+    }
+    put_bytes(&c, ENVELOPE_DATA_START, sizeof(ENVELOPE_DATA_START) - 1);
+
+    for (size_t i = 0; i < w->field_count; i++) {
+        const IotConnectTelemetryField *f = &w->fields[w->order[i]];
+        if (!f->is_set) {
+            continue;
+        }
+
+        // close the objects that this field is not part of and open the ones that it is in
+        size_t common = 0;
+        while (common < open_depth && common < f->depth && open_objects[common] == f->parents[common]) {
+            common++;
+        }
+        while (open_depth > common) {
+            put_char(&c, '}');
+            open_depth--;
+        }
+        while (open_depth < f->depth) {
+            const IotConnectTelemetryObject *o = &w->objects[f->parents[open_depth]];
+            if (needs_comma[open_depth]) {
+                put_char(&c, ',');
+            }
+            needs_comma[open_depth] = true;
+            put_bytes(&c, &w->key_pool[o->key_offset], o->key_len);
+            open_objects[open_depth] = f->parents[open_depth];
+            open_depth++;
+            needs_comma[open_depth] = false;
+        }
+
+        if (needs_comma[open_depth]) {
+            put_char(&c, ',');
+        }
+        needs_comma[open_depth] = true;
+        put_bytes(&c, &w->key_pool[f->key_offset], f->key_len);
+        switch (f->type) {
+            case IOTC_TFT_NUMBER:
+                put_number(&c, f->value.number, f->precision);
+                break;
+            case IOTC_TFT_BOOLEAN:
+                if (f->value.boolean) {
+                    put_bytes(&c, "true", 4);
+                } else {
+                    put_bytes(&c, "false", 5);
+                }
+                break;
+            case IOTC_TFT_STRING:
+                put_string(&c, f->value.string);
+                break;
+            default:
+                put_bytes(&c, "null", 4);
+                break;
+        }
+    }
+    while (open_depth > 0) {
+        put_char(&c, '}');
+        open_depth--;
+    }
+    put_bytes(&c, ENVELOPE_END, sizeof(ENVELOPE_END) - 1);
+
+    if (c.is_overflow) {
+        IOTC_ERROR("iotc_telemetry_writer_serialize: Buffer of %lu bytes is too small.",
+                   (unsigned long) w->buffer_size);
+        w->length = 0;
+        return NULL;
+    }
+    *c.p = 0;
+    w->length = (size_t) (c.p - w->buffer);
+    return w->buffer;
+}
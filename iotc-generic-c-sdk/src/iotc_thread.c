@@ -0,0 +1,190 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+#if !defined(_WIN32) && !defined(_WIN64) && !defined(_POSIX_C_SOURCE)
+// for clock_gettime() with -std=c99
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdlib.h>
+#include <time.h>
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <sched.h>
+#endif
+#include "iotc_thread.h"
+
+typedef struct {
+    IotcThreadFunction fn;
+    void *arg;
+} ThreadStart;
+
+#if defined(_WIN32) || defined(_WIN64)
+
+static DWORD WINAPI thread_entry(LPVOID param) {
+    ThreadStart start = *(ThreadStart *) param;
+    free(param);
+    start.fn(start.arg);
+    return 0;
+}
+
+int iotc_thread_create(IotcThread *thread, IotcThreadFunction fn, void *arg) {
+    ThreadStart *start = malloc(sizeof(ThreadStart));
+    if (!start) {
+        return -1;
+    }
+    start->fn = fn;
+    start->arg = arg;
+    *thread = CreateThread(NULL, 0, thread_entry, start, 0, NULL);
+    if (NULL == *thread) {
+        free(start);
+        return -1;
+    }
+    return 0;
+}
+
+void iotc_thread_join(IotcThread *thread) {
+    WaitForSingleObject(*thread, INFINITE);
+    CloseHandle(*thread);
+}
+
+void iotc_thread_yield(void) {
+    SwitchToThread();
+}
+
+void iotc_mutex_init(IotcMutex *mutex) {
+    InitializeCriticalSection(mutex);
+}
+
+void iotc_mutex_lock(IotcMutex *mutex) {
+    EnterCriticalSection(mutex);
+}
+
+void iotc_mutex_unlock(IotcMutex *mutex) {
+    LeaveCriticalSection(mutex);
+}
+
+void iotc_mutex_destroy(IotcMutex *mutex) {
+    DeleteCriticalSection(mutex);
+}
+
+void iotc_cond_init(IotcCond *cond) {
+    InitializeConditionVariable(cond);
+}
+
+void iotc_cond_wait(IotcCond *cond, IotcMutex *mutex) {
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+
+bool iotc_cond_timed_wait(IotcCond *cond, IotcMutex *mutex, unsigned long timeout_ms) {
+    return SleepConditionVariableCS(cond, mutex, (DWORD) timeout_ms) ? true : false;
+}
+
+void iotc_cond_signal(IotcCond *cond) {
+    WakeConditionVariable(cond);
+}
+
+void iotc_cond_broadcast(IotcCond *cond) {
+    WakeAllConditionVariable(cond);
+}
+
+void iotc_cond_destroy(IotcCond *cond) {
+    (void) cond; // nothing to do on Windows
+}
+
+static BOOL CALLBACK once_entry(PINIT_ONCE once, PVOID param, PVOID *context) {
+    (void) once;
+    (void) context;
+    ((IotcOnceFunction) param)();
+    return TRUE;
+}
+
+void iotc_once(IotcOnce *once, IotcOnceFunction fn) {
+    InitOnceExecuteOnce(once, once_entry, (PVOID) fn, NULL);
+}
+
+#else
+
+static void *thread_entry(void *param) {
+    ThreadStart start = *(ThreadStart *) param;
+    free(param);
+    start.fn(start.arg);
+    return NULL;
+}
+
+int iotc_thread_create(IotcThread *thread, IotcThreadFunction fn, void *arg) {
+    ThreadStart *start = malloc(sizeof(ThreadStart));
+    if (!start) {
+        return -1;
+    }
+    start->fn = fn;
+    start->arg = arg;
+    if (0 != pthread_create(thread, NULL, thread_entry, start)) {
+        free(start);
+        return -1;
+    }
+    return 0;
+}
+
+void iotc_thread_join(IotcThread *thread) {
+    pthread_join(*thread, NULL);
+}
+
+void iotc_thread_yield(void) {
+    sched_yield();
+}
+
+void iotc_mutex_init(IotcMutex *mutex) {
+    pthread_mutex_init(mutex, NULL);
+}
+
+void iotc_mutex_lock(IotcMutex *mutex) {
+    pthread_mutex_lock(mutex);
+}
+
+void iotc_mutex_unlock(IotcMutex *mutex) {
+    pthread_mutex_unlock(mutex);
+}
+
+void iotc_mutex_destroy(IotcMutex *mutex) {
+    pthread_mutex_destroy(mutex);
+}
+
+void iotc_cond_init(IotcCond *cond) {
+    pthread_cond_init(cond, NULL);
+}
+
+void iotc_cond_wait(IotcCond *cond, IotcMutex *mutex) {
+    pthread_cond_wait(cond, mutex);
+}
+
+bool iotc_cond_timed_wait(IotcCond *cond, IotcMutex *mutex, unsigned long timeout_ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += (time_t) (timeout_ms / 1000);
+    ts.tv_nsec += (long) (timeout_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return 0 == pthread_cond_timedwait(cond, mutex, &ts);
+}
+
+void iotc_cond_signal(IotcCond *cond) {
+    pthread_cond_signal(cond);
+}
+
+void iotc_cond_broadcast(IotcCond *cond) {
+    pthread_cond_broadcast(cond);
+}
+
+void iotc_cond_destroy(IotcCond *cond) {
+    pthread_cond_destroy(cond);
+}
+
+void iotc_once(IotcOnce *once, IotcOnceFunction fn) {
+    pthread_once(once, fn);
+}
+
+#endif
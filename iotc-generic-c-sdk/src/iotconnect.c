@@ -4,18 +4,49 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "iotcl_util.h"
 #include "iotcl_dra_url.h"
 #include "iotcl_dra_identity.h"
 #include "iotcl_dra_discovery.h"
 #include "iotc_log.h"
+#ifndef IOTC_WITHOUT_HTTP
 #include "iotc_http_request.h"
+#endif
 #include "iotc_device_client.h"
+#include "iotc_publish_queue.h"
+#include "iotc_backfill.h"
+#include "iotc_identity_cache.h"
+#include "iotc_dns_cache.h"
+#include "iotc_c2d_dedup.h"
+#include "iotc_clock.h"
+#include "iotc_startup_timing.h"
+#include "iotc_credentials.h"
+#include "iotc_command_executor.h"
+#include "iotc_thread.h"
 #include "iotconnect.h"
 
+#ifdef IOTC_WITHOUT_BACKFILL
+// Backfill is compiled out (IOTC_WITH_BACKFILL=OFF). The configuration keeps its settings, so that applications
+// build either way, but nothing is spooled.
+#define iotc_backfill_init_config(c) memset((c), 0, sizeof(IotConnectBackfillConfig))
+#define iotc_backfill_init(c) ((void) (c), IOTCL_SUCCESS)
+#define iotc_backfill_deinit() ((void) 0)
+#define iotc_backfill_is_enabled() false
+#define iotc_backfill_store(message) ((void) (message))
+#define iotc_backfill_start_upload() ((void) 0)
+#endif
+
+#ifndef IOTC_DISCONNECT_FLUSH_TIMEOUT_MS
+#define IOTC_DISCONNECT_FLUSH_TIMEOUT_MS 10000L
+#endif
+
 static IotConnectClientConfig config = {0};
 static bool is_config_valid = false;
+// Keeps credential renewals apart from connects and disconnects made by the application
+static IotcMutex connection_lock;
+static bool is_connection_lock_initialized = false;
 
 static int iotconnect_clone_client_config(IotConnectClientConfig* c) {
     bool oom_error = false;
@@ -54,11 +85,49 @@ static int iotconnect_clone_client_config(IotConnectClientConfig* c) {
     return 0;
 }
 
+// Configures MQTT from an identity response, whether it has just been received or was cached
+static int configure_identity(IotConnectConnectionType ct, char *identity_response) {
+    int status = iotcl_dra_identity_configure_library_mqtt(identity_response);
+    if (status) {
+        return status; // called function will print the error
+    }
+
+    // the broker lookup runs while we finish initializing and until iotconnect_sdk_connect() needs it
+    iotc_dns_cache_prefetch(iotcl_mqtt_get_config()->host);
+
+    if (ct == IOTC_CT_AWS && iotcl_mqtt_get_config()->username) {
+        // workaround for identity returning username for AWS.
+        // https://awspoc.iotconnect.io/support-info/2024036163515369
+        iotcl_free(iotcl_mqtt_get_config()->username);
+        iotcl_mqtt_get_config()->username = NULL;
+    }
+    return IOTCL_SUCCESS;
+}
+
+static int load_cached_identity(IotConnectConnectionType ct, const char *path) {
+    char *identity_response = iotc_identity_cache_load(path);
+    if (!identity_response) {
+        return IOTCL_ERR_CONFIG_MISSING;
+    }
+    int status = configure_identity(ct, identity_response);
+    free(identity_response);
+    if (status) {
+        IOTC_WARN("Unable to use the cached identity from %s", path);
+    } else {
+        IOTC_INFO("Using the cached identity from %s", path);
+    }
+    return status;
+}
+
+#ifndef IOTC_WITHOUT_HTTP
 static void dump_response(const char *message, IotConnectHttpResponse *response) {
     if (message) {
         IOTC_ERROR("%s", message);
     }
 
+    if (response->status_code) {
+        IOTC_INFO(" HTTP status was %ld", response->status_code);
+    }
     if (response->data) {
         IOTC_INFO(" Response was:\n----\n%s\n----", response->data);
     } else {
@@ -82,6 +151,18 @@ static int validate_response(IotConnectHttpResponse *response) {
     return IOTCL_SUCCESS;
 }
 
+static int http_get(IotConnectHttpResponse *response, const char *url, IotConnectStartupPhase phase) {
+    uint64_t start_us = iotc_clock_now_us();
+    int status = iotconnect_https_request(response, url, NULL);
+    iotc_startup_timing_record(phase, start_us);
+    iotc_startup_timing_record_http(phase, &response->timings);
+    if (status) {
+        dump_response(NULL, response); // called function will print the error
+        return IOTCL_ERR_FAILED;
+    }
+    return validate_response(response);
+}
+
 static int run_http_identity(IotConnectConnectionType ct, const char *cpid, const char *env, const char* duid) {
     IotclDraUrlContext discovery_url = {0};
     IotclDraUrlContext identity_url = {0};
@@ -105,11 +186,7 @@ static int run_http_identity(IotConnectConnectionType ct, const char *cpid, cons
     }
 
     IotConnectHttpResponse response;
-    iotconnect_https_request(&response,
-                             iotcl_dra_url_get_url(&discovery_url),
-                             NULL
-    );
-    status = validate_response(&response);
+    status = http_get(&response, iotcl_dra_url_get_url(&discovery_url), IOTC_PHASE_DISCOVERY);
     if (status) goto cleanup; // called function will print the error
 
 
@@ -125,26 +202,18 @@ static int run_http_identity(IotConnectConnectionType ct, const char *cpid, cons
     status = iotcl_dra_identity_build_url(&identity_url, duid);
     if (status) goto cleanup; // called function will print the error
 
-    iotconnect_https_request(&response,
-                             iotcl_dra_url_get_url(&identity_url),
-                             NULL
-    );
-
-    status = validate_response(&response);
+    status = http_get(&response, iotcl_dra_url_get_url(&identity_url), IOTC_PHASE_IDENTITY);
     if (status) goto cleanup; // called function will print the error
 
-    status = iotcl_dra_identity_configure_library_mqtt(response.data);
+    status = configure_identity(ct, response.data);
     if (status) {
         IOTC_ERROR("Error while parsing identity response from %s", iotcl_dra_url_get_url(&identity_url));
         dump_response(NULL, &response);
         goto cleanup;
     }
 
-    if (ct == IOTC_CT_AWS && iotcl_mqtt_get_config()->username) {
-        // workaround for identity returning username for AWS.
-        // https://awspoc.iotconnect.io/support-info/2024036163515369
-        iotcl_free(iotcl_mqtt_get_config()->username);
-        iotcl_mqtt_get_config()->username = NULL;
+    if (config.identity_cache_path) {
+        iotc_identity_cache_save(config.identity_cache_path, response.data); // failing to cache is not fatal
     }
 
     cleanup:
@@ -153,35 +222,116 @@ static int run_http_identity(IotConnectConnectionType ct, const char *cpid, cons
     iotconnect_free_https_response(&response);
     return status;
 }
+#endif // IOTC_WITHOUT_HTTP
 
 bool iotconnect_sdk_is_connected(void) {
     return iotc_device_client_is_connected();
 }
 
+void iotconnect_sdk_receive(void) {
+    iotc_device_client_receive();
+}
+
 void iotconnect_sdk_init_config(IotConnectClientConfig *c) {
     memset(c, 0, sizeof(IotConnectClientConfig));
     c->qos = 1;
+    iotc_link_health_init_config(&c->link_health);
+    iotc_publish_queue_init_config(&c->publish_queue);
+    iotc_backfill_init_config(&c->backfill);
+    iotc_dns_cache_init_config(&c->dns_cache);
+    iotc_credentials_init_config(&c->credentials);
+    iotc_endpoint_race_init_config(&c->mqtt_endpoints);
+    iotc_command_executor_init_config(&c->command_executor);
+    iotc_c2d_dedup_init_config(&c->c2d_dedup);
 }
 
 static void on_mqtt_c2d_message(const unsigned char *message, size_t message_len) {
     if (config.verbose) {
         IOTC_INFO("<: %.*s", (int) message_len, message);
     }
+    if (iotc_c2d_dedup_is_duplicate(message, message_len)) {
+        IOTC_INFO("Dropped a C2D message that was already received.");
+        return;
+    }
     iotcl_c2d_process_event_with_length(message, message_len);
 }
 
-void iotconnect_sdk_mqtt_send_cb(const char *topic, const char *json_str) {
+// Hands the command to the executor. The event data is freed when this returns, so the executor copies it.
+static void on_command(IotclC2dEventData data) {
+    const char *command = iotcl_c2d_get_command(data);
+    if (!command) {
+        IOTC_WARN("Received a command event without a command.");
+        return;
+    }
+    iotc_command_executor_submit(command, iotcl_c2d_get_ack_id(data)); // called function will print the error
+}
+
+static bool is_telemetry_topic(const char *topic) {
+    IotclMqttConfig *mc = iotcl_mqtt_get_config();
+    return mc && mc->pub_rpt && 0 == strcmp(topic, mc->pub_rpt);
+}
+
+// If can_refuse is set, the message is not queued at the high watermark of the publish queue
+static int send_message(const char *topic, const char *json_str, bool can_refuse) {
     if (config.verbose) {
         IOTC_INFO(">: %s",  json_str);
     }
-    iotc_device_client_send_message_qos(topic, json_str, config.qos);
+    bool can_backfill = iotc_backfill_is_enabled() && is_telemetry_topic(topic);
+    if (can_backfill && !iotc_device_client_is_connected()) {
+        iotc_backfill_store(json_str);
+        return IOTCL_SUCCESS;
+    }
+    // Acknowledgements from command workers are queued even if the application publishes inline
+    if (config.thread_safe_publish || iotc_command_executor_is_executor_thread()) {
+        if (can_refuse) {
+            return iotc_publish_queue_try_push(topic, json_str, config.qos);
+        }
+        return iotc_publish_queue_push(topic, json_str, config.qos);
+    }
+    int status = iotc_device_client_send_message_qos(topic, json_str, config.qos);
+    if (status && can_backfill) {
+        iotc_backfill_store(json_str);
+        return IOTCL_SUCCESS;
+    }
+    return status;
+}
+
+void iotconnect_sdk_mqtt_send_cb(const char *topic, const char *json_str) {
+    send_message(topic, json_str, false);
+}
+
+bool iotconnect_sdk_is_writable(void) {
+    return iotc_publish_queue_is_writable();
+}
+
+int iotconnect_sdk_send_telemetry_writer(IotConnectTelemetryWriter *w) {
+    IotclMqttConfig *mc = iotcl_mqtt_get_config();
+    if (!mc) {
+        return IOTCL_ERR_CONFIG_MISSING; // called function will print the error
+    }
+    const char *json_str = iotc_telemetry_writer_serialize(w);
+    if (!json_str) {
+        return IOTCL_ERR_OUT_OF_MEMORY; // called function will print the error
+    }
+    return send_message(mc->pub_rpt, json_str, true);
+}
+
+// Called from the credential manager thread
+static int on_credentials_renew(void) {
+    return iotconnect_sdk_renew_credentials(); // called function will print the error
 }
 
 int iotconnect_sdk_init(IotConnectClientConfig *c) {
     int status;
 
+    if (!is_connection_lock_initialized) {
+        iotc_mutex_init(&connection_lock);
+        is_connection_lock_initialized = true;
+    }
+
     // clear existing global config
     iotconnect_sdk_deinit();
+    iotc_startup_timing_begin_init();
 
     if (iotconnect_clone_client_config(c)) {
         iotconnect_sdk_deinit();
@@ -233,27 +383,94 @@ int iotconnect_sdk_init(IotConnectClientConfig *c) {
     iotcl_cfg.device.duid = config.duid;
     iotcl_cfg.device.instance_type = IOTCL_DCT_CUSTOM;
     iotcl_cfg.mqtt_send_cb = iotconnect_sdk_mqtt_send_cb;
-    iotcl_cfg.events.cmd_cb = config.cmd_cb;
+    iotcl_cfg.events.cmd_cb = config.command_executor.workers ? on_command : config.cmd_cb;
     iotcl_cfg.events.ota_cb = config.ota_cb;
 
+    uint64_t iotcl_start_us = iotc_clock_now_us();
     if (c->verbose) {
         status = iotcl_init_and_print_config(&iotcl_cfg);
     } else {
         status = iotcl_init(&iotcl_cfg);
     }
+    iotc_startup_timing_record(IOTC_PHASE_IOTCL_INIT, iotcl_start_us);
+    if (status) {
+        iotconnect_sdk_deinit();
+        return status; // called function will print errors
+    }
+
+    status = iotc_dns_cache_init(&config.dns_cache);
     if (status) {
         iotconnect_sdk_deinit();
         return status; // called function will print errors
     }
+    status = iotc_c2d_dedup_init(&config.c2d_dedup);
+    if (status) {
+        iotconnect_sdk_deinit();
+        return status; // called function will print errors
+    }
+
+    status = IOTCL_ERR_CONFIG_MISSING;
+    if (config.identity_cache_path) {
+        status = load_cached_identity(config.connection_type, config.identity_cache_path);
+    }
+#ifdef IOTC_WITHOUT_HTTP
+    if (status) {
+        IOTC_ERROR("Error: This build has no HTTP support and requires a cached identity.");
+        iotconnect_sdk_deinit();
+        return status;
+    }
+#else
+    // Backfill uploads use HTTP as well, so it is initialized even if the identity is cached
+    int https_status = iotconnect_https_init();
+    if (https_status) {
+        iotconnect_sdk_deinit();
+        return https_status; // called function will print errors
+    }
 
-    status = run_http_identity(config.connection_type, config.cpid, config.env, config.duid);
     if (status) {
-        iotcl_deinit();
+        status = run_http_identity(config.connection_type, config.cpid, config.env, config.duid);
+        if (status) {
+            iotconnect_sdk_deinit();
+            return status; // called function will print errors
+        }
+    }
+#endif
+
+    if (config.auth_info.type == IOTC_AT_SYMMETRIC_KEY) {
+        IotclMqttConfig *mc = iotcl_mqtt_get_config();
+        status = iotc_credentials_init(&config.credentials, mc->host, mc->client_id,
+                                       config.auth_info.data.symmetric_key, on_credentials_renew);
+        if (status) {
+            iotconnect_sdk_deinit();
+            return status; // called function will print errors
+        }
+    }
+
+    if (config.thread_safe_publish || config.command_executor.workers) {
+        status = iotc_publish_queue_start(&config.publish_queue);
+        if (status) {
+            iotconnect_sdk_deinit();
+            return status; // called function will print errors
+        }
+    }
+
+    if (config.command_executor.workers) {
+        status = iotc_command_executor_start(&config.command_executor);
+        if (status) {
+            iotconnect_sdk_deinit();
+            return status; // called function will print errors
+        }
+    }
+
+    status = iotc_backfill_init(&config.backfill);
+    if (status) {
+        iotconnect_sdk_deinit();
         return status; // called function will print errors
     }
 
     IOTC_INFO("Identity response parsing successful.");
     is_config_valid = true;
+    iotc_startup_timing_end_init();
     return status;
 }
 
@@ -267,24 +484,72 @@ int iotconnect_sdk_connect(void) {
     dc.status_cb = config.status_cb;
     dc.c2d_msg_cb = &on_mqtt_c2d_message;
     dc.auth = &config.auth_info;
-
+    dc.persistent_session = config.persistent_session;
+    dc.link_health = config.link_health;
+    dc.endpoints = config.mqtt_endpoints;
+
+    iotc_startup_timing_begin_connect();
+    iotc_mutex_lock(&connection_lock);
+    if (!iotc_device_client_is_connected()) {
+        iotc_device_client_set_transport(config.transport);
+    }
     int status = iotc_device_client_connect(&dc);
+    iotc_mutex_unlock(&connection_lock);
+    iotc_startup_timing_end_connect();
+    if (config.verbose) {
+        iotc_startup_timing_print();
+    }
     if (status) {
         IOTC_ERROR("Failed to connect!");
         return status;
     }
+    // send what was spooled while we were offline, alongside live telemetry
+    iotc_backfill_start_upload();
     return 0;
 }
 
+int iotconnect_sdk_renew_credentials(void) {
+    if (!is_connection_lock_initialized) {
+        return IOTCL_ERR_FAILED; // not initialized
+    }
+    // The publish queue keeps sending while the transport hands the connection over
+    iotc_mutex_lock(&connection_lock);
+    int status = IOTCL_ERR_FAILED;
+    if (iotc_device_client_is_connected()) {
+        status = iotc_device_client_renew_credentials(); // called function will print the error
+    }
+    iotc_mutex_unlock(&connection_lock);
+    return status;
+}
+
 void iotconnect_sdk_disconnect(void) {
     IOTC_INFO("Disconnecting...");
+    if (!iotc_publish_queue_flush(IOTC_DISCONNECT_FLUSH_TIMEOUT_MS)) {
+        IOTC_WARN("Timed out while sending queued messages before disconnecting.");
+    }
+    if (is_connection_lock_initialized) {
+        iotc_mutex_lock(&connection_lock);
+    }
     if (0 == iotc_device_client_disconnect()) {
         IOTC_INFO("Disconnected.");
     }
+    if (is_connection_lock_initialized) {
+        iotc_mutex_unlock(&connection_lock);
+    }
 }
 
 void iotconnect_sdk_deinit() {
 
+    iotc_credentials_deinit(); // first, so that no renewal runs from here on
+    iotc_command_executor_stop(); // before the publish queue, so that the last acknowledgements are sent
+    iotc_publish_queue_stop();
+    iotc_backfill_deinit();
+#ifndef IOTC_WITHOUT_HTTP
+    iotconnect_https_deinit();
+#endif
+    iotc_dns_cache_deinit();
+    iotc_c2d_dedup_deinit();
+
     iotcl_deinit();
 
     is_config_valid = false;
@@ -3,12 +3,15 @@
  * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
  */
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "iotcl.h"
 #include "iotconnect.h"
+#include "iotc_ota_download.h"
+#include "iotc_delta.h"
 
 #include "app_config.h"
 
@@ -25,6 +28,9 @@
 
 #define APP_VERSION "00.01.00"
 
+// the running image, which delta updates are applied to
+static const char *app_image_path = NULL;
+
 static void on_connection_status(IotConnectMqttStatus status) {
     // Add your own status handling
     switch (status) {
@@ -72,7 +78,86 @@ static bool app_needs_ota_update(const char *version) {
     return strcmp(APP_VERSION, version) < 0;
 }
 
-// This sample OTA handling only checks the version and verifies if the firmware needs an update but does not download.
+static void on_ota_progress(const IotConnectOtaProgress *progress, void *context) {
+    (void) context;
+    printf("OTA download: %llu of %llu bytes, %.0f KB/s\n",
+           (unsigned long long) progress->received, (unsigned long long) progress->total,
+           progress->bytes_per_second / 1024.0);
+}
+
+#ifndef IOTC_WITHOUT_HTTP
+// The version comes from the cloud and becomes part of the file names below, so only plain version strings
+// like "1.2.3-rc1" are accepted. Anything with a path separator or ".." could write outside the current directory.
+static bool is_safe_version(const char *version) {
+    size_t len = strlen(version);
+    if (0 == len || len > 64 || strstr(version, "..")) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        char c = version[i];
+        if (!isalnum((unsigned char) c) && '.' != c && '-' != c && '_' != c) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif // IOTC_WITHOUT_HTTP
+
+// Downloads the firmware to a file in the current directory, resuming an earlier attempt if there was one.
+// The URL can point to a full image or to a delta update made with bsdiff against the running image.
+// The download runs in the C2D callback to keep the sample simple.
+// A real application would download in its own thread and install the image afterwards.
+static bool download_ota(const char *url, const char *version) {
+#ifdef IOTC_WITHOUT_HTTP
+    (void) url;
+    (void) version;
+    printf("OTA downloads need an SDK built with IOTC_WITH_HTTP\n");
+    return false;
+#else
+    if (!is_safe_version(version)) {
+        printf("Refusing to download firmware with version \"%s\"\n", version);
+        return false;
+    }
+    char download_path[128];
+    char image_path[128];
+    snprintf(download_path, sizeof(download_path), "firmware-%s.download", version);
+    snprintf(image_path, sizeof(image_path), "firmware-%s.bin", version);
+
+    IotConnectOtaDownloadConfig c;
+    iotc_ota_download_init_config(&c);
+    c.url = url;
+    c.path = download_path;
+    c.progress_cb = on_ota_progress;
+    c.progress_interval_ms = 5000;
+    if (0 != iotc_ota_download(&c, NULL)) {
+        printf("Failed to download %s\n", url);
+        return false;
+    }
+
+    if (iotc_delta_is_patch_file(download_path)) {
+        // Pass the SHA-256 of the new image instead of NULL if your release process publishes it,
+        // so that a patch applied to the wrong image is caught before the image is installed.
+        IotConnectDeltaStats stats;
+        if (0 != iotc_delta_apply_file(app_image_path, download_path, image_path, NULL, &stats)) {
+            printf("Failed to apply the delta update to %s\n", app_image_path);
+            return false;
+        }
+        printf("Applied a delta update: %llu bytes, %llu of them new\n",
+               (unsigned long long) stats.new_size, (unsigned long long) stats.extra_bytes);
+        remove(download_path);
+    } else {
+        remove(image_path);
+        if (0 != rename(download_path, image_path)) {
+            printf("Failed to rename %s to %s\n", download_path, image_path);
+            return false;
+        }
+    }
+    printf("Firmware version %s is in %s\n", version, image_path);
+    return true;
+#endif // IOTC_WITHOUT_HTTP
+}
+
+// This sample OTA handling checks the version and downloads the firmware if it needs an update, but does not install it.
 static void on_ota(IotclC2dEventData data) {
     const char *message = NULL;
     const char *url = iotcl_c2d_get_ota_url(data, 0);
@@ -81,14 +166,17 @@ static void on_ota(IotclC2dEventData data) {
     if (NULL != url) {
         printf("Download URL is: %s\n", url);
         const char *version = iotcl_c2d_get_ota_sw_version(data);
-        if (is_app_version_same_as_ota(version)) {
+        if (!version) {
+            printf("OTA request without a version. Sending failure\n");
+            message = "Missing version";
+        } else if (is_app_version_same_as_ota(version)) {
             printf("OTA request for same version %s. Sending success\n", version);
             success = true;
             message = "Version is matching";
         } else if (app_needs_ota_update(version)) {
             printf("OTA update is required for version %s.\n", version);
-            success = false;
-            message = "Not implemented";
+            success = download_ota(url, version);
+            message = success ? "Downloaded" : "Download failed";
         } else {
             printf("Device firmware version %s is newer than OTA version %s. Sending failure\n", APP_VERSION, version);
             // Not sure what to do here. The app version is better than OTA version.
@@ -130,7 +218,7 @@ int main(int argc, char *argv[]) {
     char *trust_store;
 
     (void) argc;
-    (void) argv;
+    app_image_path = argv[0];
 
 #ifdef IOTCONNECT_MQTT_SERVER_CA_CERT
     trust_store = IOTCONNECT_CA_CERT_PATH
@@ -212,6 +300,8 @@ int main(int argc, char *argv[]) {
         // send 10 messages
         for (int i = 0; iotconnect_sdk_is_connected() && i < 10; i++) {
             publish_telemetry();
+            // needed by transports without a thread of their own, like the lite MQTT client
+            iotconnect_sdk_receive();
             // repeat evey ~5 seconds
             sleep(5);
         }
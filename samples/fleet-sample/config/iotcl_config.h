@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+#ifndef IOTCL_EXAMPLE_CONFIG_H
+#define IOTCL_EXAMPLE_CONFIG_H
+
+// See iotc_log.h for more information about configuring logging
+
+#define IOTCL_ENDLN "\n"
+/*
+
+#define IOTCL_FATAL(err_code, ...) \
+    do { \
+        printf("IOTCL FATAL (%d): ", err_code); printf(__VA_ARGS__); printf(IOTCL_ENDLN); \
+    } while(0)
+#endif
+
+#define IOTCL_ERROR(err_code, ...) \
+    do { \
+        (void)(err_code); \
+        printf("IOTCL ERROR (%d): ", err_code); printf(__VA_ARGS__); printf(IOTCL_ENDLN); \
+    } while(0)
+
+#define IOTCL_WARN(err_code, ...) \
+    do { \
+        (void)(err_code); \
+        printf("IOTCL WARN (%d): ", err_code); printf(__VA_ARGS__); printf(IOTCL_ENDLN); \
+    } while(0)
+*/
+
+#endif // IOTCL_EXAMPLE_CONFIG_H
@@ -0,0 +1,943 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (C) 2020-2024 Avnet
+ * Authors: Nikola Markovic <nikola.markovic@avnet.com> et al.
+ */
+
+// Simulates a fleet of devices against a local TLS MQTT broker, like mosquitto, for load testing.
+// Every device is a process of its own that runs the SDK, as the SDK holds a single connection per process.
+// Devices initialize from a cached identity that points to the local broker, send telemetry built with the
+// telemetry writer at their own rate and answer commands through the command executor according to their
+// C2D behavior. A controller client in the parent process stands in for the cloud: it sends commands to random
+// devices and counts the telemetry and the acknowledgements it receives.
+
+#define _DEFAULT_SOURCE // fork(), mkdtemp() and MAP_ANONYMOUS
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "MQTTClient.h"
+#include "iotcl.h"
+#include "iotconnect.h"
+#include "iotc_clock.h"
+#include "iotc_thread.h"
+#include "iotc_telemetry_writer.h"
+
+#define TELEMETRY_TOPIC_FORMAT "fleet/%s/telemetry"
+#define C2D_TOPIC_FORMAT "fleet/%s/c2d"
+#define ACK_TOPIC_FORMAT "fleet/%s/ack"
+#define OTHER_TOPIC_FORMAT "fleet/%s/other" // the identity topics that the simulation does not use
+#define CONTROLLER_TELEMETRY_TOPIC "fleet/+/telemetry"
+#define CONTROLLER_ACK_TOPIC "fleet/+/ack"
+
+#define MAX_TOPIC_LENGTH 96
+#define MAX_DEVICE_ID_LENGTH 48
+#define MAX_PATH_LENGTH 128
+#define MAX_TRACKED_COMMANDS 4096
+#define MAX_LATENCY_SAMPLES 100000
+#define RECONNECT_DELAY_US 2000000ULL
+#define SIMULATOR_TICK_US 5000
+#define DEVICE_EXIT_TIMEOUT_US 10000000ULL
+
+// C2D command statuses, as in IoTConnect acknowledgements
+#define ACK_STATUS_SUCCESS 7
+#define ACK_STATUS_FAILED 4
+
+typedef enum {
+    C2D_ACK = 0, // acknowledge right away
+    C2D_ACK_SLOW, // acknowledge after the configured delay
+    C2D_FAIL, // acknowledge with a failure
+    C2D_IGNORE, // never acknowledge
+    C2D_BEHAVIOR_COUNT
+} C2dBehavior;
+
+static const char *behavior_names[C2D_BEHAVIOR_COUNT] = {"ack", "slow", "fail", "ignore"};
+
+typedef struct {
+    const char *name;
+    size_t field_count;
+} PayloadProfile;
+
+// Field counts roughly match a sensor node, a gateway summary and a rich device template
+static const PayloadProfile payload_profiles[] = {
+        {"small",  3},
+        {"medium", 10},
+        {"large",  24},
+};
+
+#define PAYLOAD_PROFILE_COUNT (sizeof(payload_profiles) / sizeof(payload_profiles[0]))
+
+typedef struct {
+    const char *endpoint; // host:port of the broker
+    char *trust_store;
+    char *device_cert;
+    char *device_key;
+    const char *id_prefix;
+    unsigned int device_count;
+    double telemetry_rate; // messages per second per device
+    double command_rate; // commands per second across the fleet
+    double connect_rate; // new connections per second during ramp-up. 0 for no limit.
+    unsigned int duration_secs;
+    unsigned int report_secs;
+    unsigned int slow_ack_ms;
+    unsigned int behavior_mix[C2D_BEHAVIOR_COUNT]; // percentages
+    int qos;
+    const char *payload; // profile name, or NULL for a mix of all profiles
+    bool is_verbose; // keep the SDK output of the device processes
+} FleetOptions;
+
+// State of a device process that the parent reads
+typedef struct {
+    pid_t pid;
+    volatile long is_connected;
+} DeviceSlot;
+
+// Shared between the parent and all device processes. Counters are updated with atomics.
+typedef struct {
+    uint64_t run_start_us; // the monotonic clock is system wide, so the devices can pace their ramp-up with it
+    volatile long is_stop_requested;
+    volatile long is_draining; // no more telemetry, only the outstanding acknowledgements
+    volatile long connects;
+    volatile long connect_failures;
+    volatile long connections_lost;
+    volatile long telemetry_sent;
+    volatile long telemetry_bytes;
+    volatile long telemetry_failed; // refused by the SDK
+    volatile long publishes_acked; // delivered telemetry and acknowledgements, as reported by the SDK
+    volatile long publishes_failed;
+    volatile long commands_received; // by devices
+    volatile long connect_latency_count;
+    uint64_t connect_latencies[MAX_LATENCY_SAMPLES];
+    DeviceSlot devices[]; // options.device_count
+} FleetShared;
+
+typedef struct {
+    uint64_t sent_us;
+    unsigned long seq;
+    bool is_pending;
+} TrackedCommand;
+
+typedef struct {
+    uint64_t *samples;
+    size_t count;
+} LatencySamples;
+
+static FleetOptions options;
+static FleetShared *shared = NULL;
+static char identity_dir[MAX_PATH_LENGTH];
+
+// Controller counters, updated with atomics from the main and Paho threads of the parent
+static volatile long telemetry_received = 0;
+static volatile long commands_sent = 0;
+static volatile long command_send_failures = 0;
+static volatile long acks_ok = 0;
+static volatile long acks_failed = 0;
+
+// The controller and the command latency samples are protected by stats_lock
+static IotcMutex stats_lock;
+static MQTTClient controller = NULL;
+static TrackedCommand tracked_commands[MAX_TRACKED_COMMANDS];
+static unsigned long command_seq = 0;
+static LatencySamples command_latencies;
+
+static void print_usage(const char *name) {
+    printf("Usage: %s -r trust_store -C cert -K key [-e host:port] [-n devices] [-t msgs_per_sec]\n"
+           "          [-c cmds_per_sec] [-R connects_per_sec] [-d secs] [-i secs] [-p small|medium|large]\n"
+           "          [-m ack,slow,fail,ignore] [-s slow_ack_ms] [-q qos] [-I id_prefix] [-v]\n", name);
+    printf("  -r  trust store with the CA of the broker certificate\n");
+    printf("  -C  client certificate of the devices and the controller. The broker can ignore it.\n");
+    printf("  -K  private key of the client certificate\n");
+    printf("  -e  the broker (default localhost:8883). Its certificate must be valid for the host name.\n");
+    printf("  -n  number of simulated devices, one process each (default 10)\n");
+    printf("  -t  telemetry messages per second per device (default 1)\n");
+    printf("  -c  commands per second sent to random devices (default 1)\n");
+    printf("  -R  connection ramp-up rate. 0 connects all devices at once (default 50)\n");
+    printf("  -d  duration of the run in seconds (default 30)\n");
+    printf("  -i  seconds between progress reports (default 5)\n");
+    printf("  -p  payload profile for all devices. Devices cycle through all profiles if not set.\n");
+    printf("  -m  percentage of devices with each C2D behavior (default 85,5,5,5)\n");
+    printf("  -s  delay of the slow acknowledgements in milliseconds (default 500)\n");
+    printf("  -q  telemetry QoS (default 1)\n");
+    printf("  -I  prefix of the device IDs (default fleet)\n");
+    printf("  -v  show the SDK output of the device processes\n");
+}
+
+static bool parse_mix(const char *str, unsigned int *mix) {
+    unsigned int total = 0;
+    const char *p = str;
+    for (int i = 0; i < C2D_BEHAVIOR_COUNT; i++) {
+        char *end = NULL;
+        mix[i] = (unsigned int) strtoul(p, &end, 10);
+        if (end == p) {
+            return false;
+        }
+        total += mix[i];
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return 100 == total;
+}
+
+static int parse_options(int argc, char *argv[]) {
+    int opt;
+    memset(&options, 0, sizeof(options));
+    options.endpoint = "localhost:8883";
+    options.id_prefix = "fleet";
+    options.device_count = 10;
+    options.telemetry_rate = 1.0;
+    options.command_rate = 1.0;
+    options.connect_rate = 50.0;
+    options.duration_secs = 30;
+    options.report_secs = 5;
+    options.slow_ack_ms = 500;
+    options.qos = 1;
+    parse_mix("85,5,5,5", options.behavior_mix);
+    while ((opt = getopt(argc, argv, "r:C:K:e:n:t:c:R:d:i:p:m:s:q:I:vh")) != -1) {
+        switch (opt) {
+            case 'r':
+                options.trust_store = optarg;
+                break;
+            case 'C':
+                options.device_cert = optarg;
+                break;
+            case 'K':
+                options.device_key = optarg;
+                break;
+            case 'e':
+                options.endpoint = optarg;
+                break;
+            case 'n':
+                options.device_count = (unsigned int) strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                options.telemetry_rate = strtod(optarg, NULL);
+                break;
+            case 'c':
+                options.command_rate = strtod(optarg, NULL);
+                break;
+            case 'R':
+                options.connect_rate = strtod(optarg, NULL);
+                break;
+            case 'd':
+                options.duration_secs = (unsigned int) strtoul(optarg, NULL, 10);
+                break;
+            case 'i':
+                options.report_secs = (unsigned int) strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                options.payload = optarg;
+                break;
+            case 'm':
+                if (!parse_mix(optarg, options.behavior_mix)) {
+                    fprintf(stderr, "The behavior mix must be four percentages that add up to 100\n");
+                    return -1;
+                }
+                break;
+            case 's':
+                options.slow_ack_ms = (unsigned int) strtoul(optarg, NULL, 10);
+                break;
+            case 'q':
+                options.qos = atoi(optarg);
+                break;
+            case 'I':
+                options.id_prefix = optarg;
+                break;
+            case 'v':
+                options.is_verbose = true;
+                break;
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+    if (!options.trust_store || !options.device_cert || !options.device_key || 0 == options.device_count
+        || options.telemetry_rate <= 0.0 || options.qos < 0 || options.qos > 1 || 0 == options.report_secs
+        || !strchr(options.endpoint, ':')) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
+static void sleep_us(uint64_t us) {
+    struct timespec ts;
+    ts.tv_sec = (time_t) (us / 1000000);
+    ts.tv_nsec = (long) (us % 1000000) * 1000L;
+    nanosleep(&ts, NULL);
+}
+
+// xorshift32. Each device has its own state, so the simulation is repeatable and needs no locking.
+static uint32_t next_random(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static double random_unit(uint32_t *state) {
+    return (double) (next_random(state) & 0xFFFFFF) / (double) 0x1000000;
+}
+
+static void add_latency(LatencySamples *s, uint64_t us) {
+    iotc_mutex_lock(&stats_lock);
+    if (s->count < MAX_LATENCY_SAMPLES) {
+        s->samples[s->count++] = us;
+    }
+    iotc_mutex_unlock(&stats_lock);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static void print_latencies(const char *name, LatencySamples *s) {
+    if (0 == s->count) {
+        printf("  %-18s no samples\n", name);
+        return;
+    }
+    qsort(s->samples, s->count, sizeof(uint64_t), compare_u64);
+    printf("  %-18s n=%lu p50=%.1f p90=%.1f p99=%.1f max=%.1f ms\n", name, (unsigned long) s->count,
+           (double) s->samples[s->count / 2] / 1000.0,
+           (double) s->samples[(s->count * 9) / 10] / 1000.0,
+           (double) s->samples[(s->count * 99) / 100] / 1000.0,
+           (double) s->samples[s->count - 1] / 1000.0);
+}
+
+// Resident memory of a process in MB, 0 if it is gone
+static double get_rss_mb(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%ld/statm", (long) pid);
+    FILE *f = fopen(path, "r");
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    if (f) {
+        if (2 != fscanf(f, "%lu %lu", &size, &resident)) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return (double) resident * (double) sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+}
+
+static double get_fleet_rss_mb(void) {
+    double total = 0;
+    for (unsigned int i = 0; i < options.device_count; i++) {
+        if (shared->devices[i].pid > 0) {
+            total += get_rss_mb(shared->devices[i].pid);
+        }
+    }
+    return total;
+}
+
+static uint64_t get_cpu_us(int who) {
+    struct rusage usage;
+    getrusage(who, &usage);
+    return (uint64_t) usage.ru_utime.tv_sec * 1000000 + (uint64_t) usage.ru_utime.tv_usec
+           + (uint64_t) usage.ru_stime.tv_sec * 1000000 + (uint64_t) usage.ru_stime.tv_usec;
+}
+
+// Finds "key":"value" in a flat JSON message. Good enough for the messages that this sample produces.
+static bool get_json_string(const char *json, size_t json_len, const char *key, char *value, size_t value_size) {
+    char pattern[32];
+    snprintf(pattern, sizeof(pattern), "\"%s\":\"", key);
+    size_t pattern_len = strlen(pattern);
+    for (size_t i = 0; i + pattern_len <= json_len; i++) {
+        if (0 != memcmp(&json[i], pattern, pattern_len)) {
+            continue;
+        }
+        size_t start = i + pattern_len;
+        size_t len = 0;
+        while (start + len < json_len && json[start + len] != '"' && len + 1 < value_size) {
+            len++;
+        }
+        memcpy(value, &json[start], len);
+        value[len] = 0;
+        return true;
+    }
+    return false;
+}
+
+static bool get_json_int(const char *json, size_t json_len, const char *key, int *value) {
+    char pattern[32];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    size_t pattern_len = strlen(pattern);
+    for (size_t i = 0; i + pattern_len < json_len; i++) {
+        if (0 == memcmp(&json[i], pattern, pattern_len)) {
+            *value = atoi(&json[i + pattern_len]);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void get_duid(unsigned int index, char *duid, size_t duid_size) {
+    snprintf(duid, duid_size, "%s-%05u", options.id_prefix, index);
+}
+
+static void get_identity_path(unsigned int index, char *path, size_t path_size) {
+    snprintf(path, path_size, "%s/%05u.json", identity_dir, index);
+}
+
+// Spreads the behaviors evenly over the device indexes
+static C2dBehavior get_behavior(unsigned int index) {
+    unsigned int bucket = index % 100;
+    unsigned int cumulative = 0;
+    for (int i = 0; i < C2D_BEHAVIOR_COUNT; i++) {
+        cumulative += options.behavior_mix[i];
+        if (bucket < cumulative) {
+            return (C2dBehavior) i;
+        }
+    }
+    return C2D_IGNORE;
+}
+
+// ---------------- identities ----------------
+
+// An identity response like the one IoTConnect would send, but with the local broker and per-device topics
+static int write_identity(unsigned int index) {
+    char duid[MAX_DEVICE_ID_LENGTH];
+    char host[MAX_TOPIC_LENGTH];
+    char telemetry_topic[MAX_TOPIC_LENGTH];
+    char c2d_topic[MAX_TOPIC_LENGTH];
+    char ack_topic[MAX_TOPIC_LENGTH];
+    char other_topic[MAX_TOPIC_LENGTH];
+    char path[MAX_PATH_LENGTH];
+    get_duid(index, duid, sizeof(duid));
+    snprintf(host, sizeof(host), "%.*s", (int) (strrchr(options.endpoint, ':') - options.endpoint), options.endpoint);
+    snprintf(telemetry_topic, sizeof(telemetry_topic), TELEMETRY_TOPIC_FORMAT, duid);
+    snprintf(c2d_topic, sizeof(c2d_topic), C2D_TOPIC_FORMAT, duid);
+    snprintf(ack_topic, sizeof(ack_topic), ACK_TOPIC_FORMAT, duid);
+    snprintf(other_topic, sizeof(other_topic), OTHER_TOPIC_FORMAT, duid);
+    get_identity_path(index, path, sizeof(path));
+
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        return -1;
+    }
+    fprintf(f, "{\"d\":{\"ec\":0,\"ct\":200,\"meta\":{\"at\":7,\"df\":60,\"cd\":\"FLEET0\",\"gtw\":null,\"edge\":0,"
+               "\"pf\":0,\"hwv\":\"\",\"swv\":\"\",\"v\":2.1},\"has\":{\"d\":0,\"attr\":1,\"set\":0,\"r\":0,\"ota\":0},"
+               "\"p\":{\"n\":\"mqtt\",\"h\":\"%s\",\"p\":%s,\"id\":\"%s\",\"un\":null,\"topics\":{"
+               "\"rpt\":\"%s\",\"erpt\":\"%s\",\"erm\":\"%s\",\"flt\":\"%s\",\"od\":\"%s\",\"hb\":\"%s\","
+               "\"ack\":\"%s\",\"dl\":\"%s\",\"di\":\"%s\",\"c2d\":\"%s\","
+               "\"set\":{\"pub\":\"%s\",\"sub\":\"%s\",\"pubForAll\":\"%s\",\"subForAll\":\"%s\"}}},"
+               "\"dt\":\"2024-01-01T00:00:00.000Z\"},\"status\":200,\"message\":\"Identity Information\"}",
+            host, strrchr(options.endpoint, ':') + 1, duid,
+            telemetry_topic, telemetry_topic, telemetry_topic, other_topic, other_topic, other_topic,
+            ack_topic, other_topic, other_topic, c2d_topic,
+            other_topic, other_topic, other_topic, other_topic);
+    return 0 == fclose(f) ? 0 : -1;
+}
+
+static void remove_identities(void) {
+    char path[MAX_PATH_LENGTH];
+    for (unsigned int i = 0; i < options.device_count; i++) {
+        get_identity_path(i, path, sizeof(path));
+        remove(path);
+    }
+    rmdir(identity_dir);
+}
+
+// ---------------- device processes ----------------
+
+static C2dBehavior device_behavior;
+
+static void on_device_status(IotConnectMqttStatus status) {
+    if (IOTC_CS_MQTT_DELIVERED == status) {
+        IOTC_ATOMIC_ADD(&shared->publishes_acked, 1);
+    } else if (IOTC_CS_MQTT_SEND_FAILED == status) {
+        IOTC_ATOMIC_ADD(&shared->publishes_failed, 1);
+    }
+}
+
+// Runs on an executor worker, so a slow acknowledgement does not hold up the MQTT thread
+static int on_device_command(const char *command, char *ack_message, size_t ack_message_size) {
+    (void) command;
+    IOTC_ATOMIC_ADD(&shared->commands_received, 1);
+    if (C2D_ACK_SLOW == device_behavior) {
+        sleep_us((uint64_t) options.slow_ack_ms * 1000);
+    }
+    snprintf(ack_message, ack_message_size, "%s", behavior_names[device_behavior]);
+    return C2D_FAIL == device_behavior ? IOTCL_C2D_EVT_CMD_FAILED : IOTCL_C2D_EVT_CMD_SUCCESS_WITH_ACK;
+}
+
+// Used instead of the executor by devices that ignore commands
+static void on_ignored_command(IotclC2dEventData data) {
+    (void) data;
+    IOTC_ATOMIC_ADD(&shared->commands_received, 1);
+}
+
+static void setup_writer(unsigned int index, IotConnectTelemetryWriter *w, char *buffer, size_t buffer_size,
+                         int *slots, size_t *field_count) {
+    const PayloadProfile *profile = &payload_profiles[index % PAYLOAD_PROFILE_COUNT];
+    for (size_t i = 0; options.payload && i < PAYLOAD_PROFILE_COUNT; i++) {
+        if (0 == strcmp(options.payload, payload_profiles[i].name)) {
+            profile = &payload_profiles[i];
+        }
+    }
+    iotc_telemetry_writer_init(w, buffer, buffer_size);
+    for (size_t i = 0; i < profile->field_count; i++) {
+        char path[32];
+        // every fourth field is nested, to exercise the object handling of the writer
+        if (3 == i % 4) {
+            snprintf(path, sizeof(path), "group%u.value%u", (unsigned int) (i / 8), (unsigned int) i);
+        } else {
+            snprintf(path, sizeof(path), "sensor%u", (unsigned int) i);
+        }
+        slots[i] = iotc_telemetry_writer_add_field(w, path, IOTC_TFT_NUMBER);
+    }
+    iotc_telemetry_writer_compile(w);
+    *field_count = profile->field_count;
+}
+
+static int run_device(unsigned int index) {
+    DeviceSlot *slot = &shared->devices[index];
+    char duid[MAX_DEVICE_ID_LENGTH];
+    char identity_path[MAX_PATH_LENGTH];
+    static const char *endpoints[2];
+    get_duid(index, duid, sizeof(duid));
+    get_identity_path(index, identity_path, sizeof(identity_path));
+    endpoints[0] = options.endpoint;
+    endpoints[1] = NULL;
+    device_behavior = get_behavior(index);
+
+    IotConnectClientConfig config;
+    iotconnect_sdk_init_config(&config);
+    config.cpid = "FLEET";
+    config.env = "local";
+    config.duid = duid;
+    config.qos = options.qos;
+    config.connection_type = IOTC_CT_AWS;
+    config.auth_info.type = IOTC_AT_X509;
+    config.auth_info.trust_store = options.trust_store;
+    config.auth_info.data.cert_info.device_cert = options.device_cert;
+    config.auth_info.data.cert_info.device_key = options.device_key;
+    config.identity_cache_path = identity_path;
+    config.mqtt_endpoints.endpoints = endpoints;
+    config.status_cb = on_device_status;
+    if (C2D_IGNORE == device_behavior) {
+        config.cmd_cb = on_ignored_command;
+    } else {
+        config.command_executor.workers = 1;
+        config.command_executor.handler = on_device_command;
+    }
+    if (iotconnect_sdk_init(&config)) {
+        IOTC_ATOMIC_ADD(&shared->connect_failures, 1);
+        return 2;
+    }
+
+    static char buffer[1024];
+    static IotConnectTelemetryWriter writer;
+    int slots[IOTC_TELEMETRY_WRITER_MAX_FIELDS];
+    size_t field_count;
+    setup_writer(index, &writer, buffer, sizeof(buffer), slots, &field_count);
+
+    // +-20% around the configured rate, and a random phase, so that the devices do not send in lockstep
+    uint32_t random_state = 2463534242u ^ (index * 2654435761u);
+    if (0 == random_state) {
+        random_state = 1;
+    }
+    double nominal_interval_us = 1000000.0 / options.telemetry_rate;
+    uint64_t interval_us = (uint64_t) (nominal_interval_us * (0.8 + 0.4 * random_unit(&random_state)));
+    uint64_t phase_us = (uint64_t) (nominal_interval_us * random_unit(&random_state));
+    // This device's place in the ramp-up
+    uint64_t reconnect_at_us = shared->run_start_us;
+    if (options.connect_rate > 0.0) {
+        reconnect_at_us += (uint64_t) ((double) index * 1000000.0 / options.connect_rate);
+    }
+    uint64_t next_send_us = 0;
+
+    while (!IOTC_ATOMIC_LOAD(&shared->is_stop_requested)) {
+        uint64_t now_us = iotc_clock_now_us();
+        bool is_connected = iotconnect_sdk_is_connected();
+        if (IOTC_ATOMIC_LOAD(&slot->is_connected) && !is_connected) {
+            IOTC_ATOMIC_ADD(&shared->connections_lost, 1);
+            IOTC_ATOMIC_ADD(&slot->is_connected, -1);
+            reconnect_at_us = now_us + RECONNECT_DELAY_US;
+        }
+        if (!is_connected) {
+            if (!IOTC_ATOMIC_LOAD(&shared->is_draining) && now_us >= reconnect_at_us) {
+                if (0 == iotconnect_sdk_connect()) {
+                    uint64_t latency_us = iotc_clock_now_us() - now_us;
+                    long n = IOTC_ATOMIC_ADD(&shared->connect_latency_count, 1);
+                    if (n <= MAX_LATENCY_SAMPLES) {
+                        shared->connect_latencies[n - 1] = latency_us;
+                    }
+                    IOTC_ATOMIC_ADD(&shared->connects, 1);
+                    IOTC_ATOMIC_ADD(&slot->is_connected, 1);
+                    next_send_us = iotc_clock_now_us() + phase_us;
+                } else {
+                    IOTC_ATOMIC_ADD(&shared->connect_failures, 1);
+                    reconnect_at_us = now_us + RECONNECT_DELAY_US;
+                }
+            }
+            sleep_us(SIMULATOR_TICK_US);
+            continue;
+        }
+        if (now_us >= next_send_us && !IOTC_ATOMIC_LOAD(&shared->is_draining)) {
+            for (size_t i = 0; i < field_count; i++) {
+                iotc_telemetry_writer_set_number(&writer, slots[i], 100.0 * random_unit(&random_state));
+            }
+            if (0 == iotconnect_sdk_send_telemetry_writer(&writer)) {
+                IOTC_ATOMIC_ADD(&shared->telemetry_sent, 1);
+                IOTC_ATOMIC_ADD(&shared->telemetry_bytes, (long) writer.length);
+            } else {
+                IOTC_ATOMIC_ADD(&shared->telemetry_failed, 1);
+            }
+            next_send_us += interval_us;
+            if (next_send_us < now_us) {
+                next_send_us = now_us + interval_us; // fell behind, do not burst to catch up
+            }
+        }
+        iotconnect_sdk_receive();
+        sleep_us(SIMULATOR_TICK_US);
+    }
+
+    if (IOTC_ATOMIC_LOAD(&slot->is_connected)) {
+        iotconnect_sdk_disconnect();
+        IOTC_ATOMIC_ADD(&slot->is_connected, -1);
+    }
+    iotconnect_sdk_deinit();
+    return 0;
+}
+
+// Devices are forked before the controller starts any threads, so each one starts from a single threaded copy
+static int start_devices(void) {
+    fflush(stdout);
+    for (unsigned int i = 0; i < options.device_count; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return -1;
+        }
+        if (0 == pid) {
+            if (!options.is_verbose && !freopen("/dev/null", "w", stdout)) {
+                _exit(2);
+            }
+            int ret = run_device(i);
+            fflush(stdout);
+            _exit(ret);
+        }
+        shared->devices[i].pid = pid;
+    }
+    return 0;
+}
+
+// Returns the number of device processes that did not exit cleanly
+static unsigned int wait_for_devices(void) {
+    unsigned int failed_count = 0;
+    uint64_t deadline_us = iotc_clock_now_us() + DEVICE_EXIT_TIMEOUT_US;
+    for (unsigned int i = 0; i < options.device_count; i++) {
+        pid_t pid = shared->devices[i].pid;
+        if (pid <= 0) {
+            continue;
+        }
+        int status = 0;
+        pid_t ret;
+        while (0 == (ret = waitpid(pid, &status, WNOHANG)) && iotc_clock_now_us() < deadline_us) {
+            sleep_us(SIMULATOR_TICK_US);
+        }
+        if (0 == ret) {
+            kill(pid, SIGKILL); // stuck, likely in a handler or a disconnect
+            waitpid(pid, &status, 0);
+        }
+        if (!WIFEXITED(status) || 0 != WEXITSTATUS(status)) {
+            failed_count++;
+        }
+    }
+    return failed_count;
+}
+
+// ---------------- controller ----------------
+
+static int on_controller_message(void *context, char *topic_name, int topic_len, MQTTClient_message *message) {
+    (void) context;
+    size_t len = (size_t) (topic_len > 0 ? topic_len : (int) strlen(topic_name));
+    const char *suffix = "/ack";
+    size_t suffix_len = strlen(suffix);
+    bool is_ack = len > suffix_len && 0 == memcmp(&topic_name[len - suffix_len], suffix, suffix_len);
+    if (!is_ack) {
+        IOTC_ATOMIC_ADD(&telemetry_received, 1);
+    } else {
+        char ack_id[32];
+        int status = 0;
+        const char *payload = message->payload;
+        size_t payload_len = (size_t) message->payloadlen;
+        if (get_json_string(payload, payload_len, "ack", ack_id, sizeof(ack_id))
+            && get_json_int(payload, payload_len, "st", &status)) {
+            unsigned long seq = strtoul(ack_id, NULL, 10);
+            uint64_t now_us = iotc_clock_now_us();
+            uint64_t latency_us = 0;
+            iotc_mutex_lock(&stats_lock);
+            TrackedCommand *t = &tracked_commands[seq % MAX_TRACKED_COMMANDS];
+            if (t->is_pending && t->seq == seq) {
+                t->is_pending = false;
+                latency_us = now_us - t->sent_us;
+            }
+            iotc_mutex_unlock(&stats_lock);
+            if (latency_us) {
+                add_latency(&command_latencies, latency_us);
+            }
+            IOTC_ATOMIC_ADD(ACK_STATUS_SUCCESS == status ? &acks_ok : &acks_failed, 1);
+        }
+    }
+    MQTTClient_freeMessage(&message);
+    MQTTClient_free(topic_name);
+    return 1;
+}
+
+static int start_controller(void) {
+    MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
+    MQTTClient_SSLOptions ssl_opts = MQTTClient_SSLOptions_initializer;
+    char client_id[MAX_DEVICE_ID_LENGTH + 16];
+    char url[MAX_TOPIC_LENGTH];
+    snprintf(client_id, sizeof(client_id), "%s-controller", options.id_prefix);
+    snprintf(url, sizeof(url), "ssl://%s", options.endpoint);
+    int rc = MQTTClient_create(&controller, url, client_id, MQTTCLIENT_PERSISTENCE_NONE, NULL);
+    if (MQTTCLIENT_SUCCESS != rc) {
+        controller = NULL;
+        return rc;
+    }
+    MQTTClient_setCallbacks(controller, NULL, NULL, on_controller_message, NULL);
+    ssl_opts.trustStore = options.trust_store;
+    ssl_opts.keyStore = options.device_cert;
+    ssl_opts.privateKey = options.device_key;
+    conn_opts.ssl = &ssl_opts;
+    conn_opts.keepAliveInterval = 60;
+    conn_opts.cleansession = 1;
+    if (MQTTCLIENT_SUCCESS != (rc = MQTTClient_connect(controller, &conn_opts))) {
+        return rc;
+    }
+    if (MQTTCLIENT_SUCCESS != (rc = MQTTClient_subscribe(controller, CONTROLLER_ACK_TOPIC, 1))) {
+        return rc;
+    }
+    return MQTTClient_subscribe(controller, CONTROLLER_TELEMETRY_TOPIC, 0);
+}
+
+static void send_command(uint32_t *random_state) {
+    // Commands go to connected devices, so that the ramp-up does not show up as missing acknowledgements
+    int index = -1;
+    for (int attempt = 0; attempt < 16 && index < 0; attempt++) {
+        unsigned int candidate = next_random(random_state) % options.device_count;
+        if (IOTC_ATOMIC_LOAD(&shared->devices[candidate].is_connected) > 0) {
+            index = (int) candidate;
+        }
+    }
+    if (index < 0) {
+        return;
+    }
+    char duid[MAX_DEVICE_ID_LENGTH];
+    char topic[MAX_TOPIC_LENGTH];
+    char command[128];
+    get_duid((unsigned int) index, duid, sizeof(duid));
+    snprintf(topic, sizeof(topic), C2D_TOPIC_FORMAT, duid);
+
+    iotc_mutex_lock(&stats_lock);
+    unsigned long seq = ++command_seq;
+    TrackedCommand *t = &tracked_commands[seq % MAX_TRACKED_COMMANDS];
+    t->seq = seq;
+    t->sent_us = iotc_clock_now_us();
+    t->is_pending = true;
+    iotc_mutex_unlock(&stats_lock);
+
+    int len = snprintf(command, sizeof(command), "{\"v\":\"2.1\",\"ct\":0,\"cmd\":\"set-interval %u\",\"ack\":\"%lu\"}",
+                       (unsigned int) (next_random(random_state) % 60), seq);
+    if (MQTTCLIENT_SUCCESS == MQTTClient_publish(controller, topic, len, command, 1, 0, NULL)) {
+        IOTC_ATOMIC_ADD(&commands_sent, 1);
+    } else {
+        IOTC_ATOMIC_ADD(&command_send_failures, 1);
+        iotc_mutex_lock(&stats_lock);
+        t->is_pending = false;
+        iotc_mutex_unlock(&stats_lock);
+    }
+}
+
+// ---------------- reporting ----------------
+
+typedef struct {
+    uint64_t time_us;
+    long telemetry_sent;
+    long telemetry_received;
+    long connects;
+} ReportSnapshot;
+
+static void take_snapshot(ReportSnapshot *s) {
+    s->time_us = iotc_clock_now_us();
+    s->telemetry_sent = IOTC_ATOMIC_LOAD(&shared->telemetry_sent);
+    s->telemetry_received = IOTC_ATOMIC_LOAD(&telemetry_received);
+    s->connects = IOTC_ATOMIC_LOAD(&shared->connects);
+}
+
+static unsigned int count_connected(void) {
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < options.device_count; i++) {
+        if (IOTC_ATOMIC_LOAD(&shared->devices[i].is_connected) > 0) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static void print_progress(const ReportSnapshot *prev, const ReportSnapshot *now) {
+    double secs = (double) (now->time_us - prev->time_us) / 1000000.0;
+    double elapsed = (double) (now->time_us - shared->run_start_us) / 1000000.0;
+    printf("[%6.1fs] connected %u/%u, connects %.1f/s, telemetry sent %.0f/s received %.0f/s, "
+           "commands %ld acked %ld, device RSS %.1f MB\n",
+           elapsed, count_connected(), options.device_count,
+           (double) (now->connects - prev->connects) / secs,
+           (double) (now->telemetry_sent - prev->telemetry_sent) / secs,
+           (double) (now->telemetry_received - prev->telemetry_received) / secs,
+           IOTC_ATOMIC_LOAD(&commands_sent), IOTC_ATOMIC_LOAD(&acks_ok) + IOTC_ATOMIC_LOAD(&acks_failed),
+           get_fleet_rss_mb());
+    fflush(stdout);
+}
+
+static void print_summary(const ReportSnapshot *start, const ReportSnapshot *end, double fleet_rss_mb,
+                          unsigned int failed_devices) {
+    double secs = (double) (end->time_us - start->time_us) / 1000000.0;
+    long sent = IOTC_ATOMIC_LOAD(&shared->telemetry_sent);
+    long failed = IOTC_ATOMIC_LOAD(&shared->telemetry_failed);
+    long cmds = IOTC_ATOMIC_LOAD(&commands_sent);
+    long ok = IOTC_ATOMIC_LOAD(&acks_ok);
+    long nok = IOTC_ATOMIC_LOAD(&acks_failed);
+    unsigned int expected_silent = 0;
+    for (unsigned int i = 0; i < options.device_count; i++) {
+        if (C2D_IGNORE == get_behavior(i)) {
+            expected_silent++;
+        }
+    }
+    // The devices have exited and were waited for, so their CPU time is in RUSAGE_CHILDREN
+    double wall_us = (double) (end->time_us - start->time_us);
+    LatencySamples connect_latencies;
+    connect_latencies.samples = shared->connect_latencies;
+    connect_latencies.count = (size_t) IOTC_ATOMIC_LOAD(&shared->connect_latency_count);
+    if (connect_latencies.count > MAX_LATENCY_SAMPLES) {
+        connect_latencies.count = MAX_LATENCY_SAMPLES;
+    }
+
+    printf("\nFleet of %u devices against %s, %.1f s\n", options.device_count, options.endpoint, secs);
+    printf("  connections       %ld ok, %ld failed, %ld lost\n", IOTC_ATOMIC_LOAD(&shared->connects),
+           IOTC_ATOMIC_LOAD(&shared->connect_failures), IOTC_ATOMIC_LOAD(&shared->connections_lost));
+    printf("  telemetry         %ld sent (%.0f msg/s, %.1f KB/s), %ld refused (%.2f%%)\n",
+           sent, (double) sent / secs, (double) IOTC_ATOMIC_LOAD(&shared->telemetry_bytes) / 1024.0 / secs,
+           failed, sent + failed ? 100.0 * (double) failed / (double) (sent + failed) : 0.0);
+    printf("  publishes         %ld delivered, %ld failed (telemetry and acknowledgements)\n",
+           IOTC_ATOMIC_LOAD(&shared->publishes_acked), IOTC_ATOMIC_LOAD(&shared->publishes_failed));
+    printf("  telemetry routed  %ld received by the controller\n", IOTC_ATOMIC_LOAD(&telemetry_received));
+    printf("  commands          %ld sent, %ld failed to send, %ld received by devices\n",
+           cmds, IOTC_ATOMIC_LOAD(&command_send_failures), IOTC_ATOMIC_LOAD(&shared->commands_received));
+    printf("  acknowledgements  %ld success, %ld failure, %ld missing (%u of %u devices ignore commands)\n",
+           ok, nok, cmds - ok - nok, expected_silent, options.device_count);
+    printf("  device processes  RSS %.1f MB total, %.2f MB per device, CPU %.1f%% of one core, %u failed\n",
+           fleet_rss_mb, fleet_rss_mb / options.device_count, 100.0 * (double) get_cpu_us(RUSAGE_CHILDREN) / wall_us,
+           failed_devices);
+    printf("  controller        CPU %.1f%% of one core\n", 100.0 * (double) get_cpu_us(RUSAGE_SELF) / wall_us);
+    print_latencies("connect", &connect_latencies);
+    print_latencies("command round trip", &command_latencies);
+}
+
+int main(int argc, char *argv[]) {
+    if (parse_options(argc, argv)) {
+        return 1;
+    }
+
+    size_t shared_size = sizeof(FleetShared) + options.device_count * sizeof(DeviceSlot);
+    shared = mmap(NULL, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    command_latencies.samples = malloc(MAX_LATENCY_SAMPLES * sizeof(uint64_t));
+    if (MAP_FAILED == shared || !command_latencies.samples) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    memset(shared, 0, shared_size);
+    snprintf(identity_dir, sizeof(identity_dir), "/tmp/fleet-sample-XXXXXX");
+    if (!mkdtemp(identity_dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    for (unsigned int i = 0; i < options.device_count; i++) {
+        if (write_identity(i)) {
+            fprintf(stderr, "Unable to write the identity of device %u to %s\n", i, identity_dir);
+            remove_identities();
+            return 1;
+        }
+    }
+
+    printf("Simulating %u device processes against %s for %u s\n", options.device_count, options.endpoint,
+           options.duration_secs);
+    ReportSnapshot start;
+    take_snapshot(&start);
+    shared->run_start_us = start.time_us;
+    if (start_devices()) {
+        IOTC_ATOMIC_ADD(&shared->is_stop_requested, 1);
+        wait_for_devices();
+        remove_identities();
+        return 1;
+    }
+
+    iotc_mutex_init(&stats_lock);
+    int rc = start_controller();
+    if (MQTTCLIENT_SUCCESS != rc) {
+        fprintf(stderr, "Unable to connect the controller to %s, return code %d. Is the broker running?\n",
+                options.endpoint, rc);
+        IOTC_ATOMIC_ADD(&shared->is_stop_requested, 1);
+        wait_for_devices();
+        remove_identities();
+        return 2;
+    }
+
+    // The main thread paces the commands and prints the progress
+    uint32_t random_state = 0x9E3779B9u;
+    uint64_t end_us = shared->run_start_us + (uint64_t) options.duration_secs * 1000000;
+    uint64_t command_interval_us = options.command_rate > 0.0 ? (uint64_t) (1000000.0 / options.command_rate) : 0;
+    uint64_t next_command_us = shared->run_start_us + command_interval_us;
+    ReportSnapshot last;
+    last = start;
+    uint64_t next_report_us = shared->run_start_us + (uint64_t) options.report_secs * 1000000;
+    for (;;) {
+        uint64_t now_us = iotc_clock_now_us();
+        if (now_us >= end_us) {
+            break;
+        }
+        while (command_interval_us && now_us >= next_command_us) {
+            send_command(&random_state);
+            next_command_us += command_interval_us;
+        }
+        if (now_us >= next_report_us) {
+            ReportSnapshot now;
+            take_snapshot(&now);
+            print_progress(&last, &now);
+            last = now;
+            next_report_us += (uint64_t) options.report_secs * 1000000;
+        }
+        sleep_us(SIMULATOR_TICK_US);
+    }
+
+    ReportSnapshot end;
+    take_snapshot(&end);
+    // Let the last slow acknowledgements and routed messages arrive before counting
+    IOTC_ATOMIC_ADD(&shared->is_draining, 1);
+    sleep_us((uint64_t) options.slow_ack_ms * 1000 + 500000);
+    double fleet_rss_mb = get_fleet_rss_mb();
+    IOTC_ATOMIC_ADD(&shared->is_stop_requested, 1);
+    unsigned int failed_devices = wait_for_devices();
+    print_summary(&start, &end, fleet_rss_mb, failed_devices);
+
+    MQTTClient_disconnect(controller, 1000);
+    MQTTClient_destroy(&controller);
+    iotc_mutex_destroy(&stats_lock);
+    remove_identities();
+    free(command_latencies.samples);
+    bool is_failed = IOTC_ATOMIC_LOAD(&shared->connect_failures) || IOTC_ATOMIC_LOAD(&shared->telemetry_failed)
+                     || failed_devices;
+    munmap(shared, shared_size);
+    return is_failed ? 3 : 0;
+}